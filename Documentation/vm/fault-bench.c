@@ -0,0 +1,136 @@
+/*
+ * fault-bench.c - time anonymous page faults from many threads of one mm
+ *
+ * For each thread count, from 1 doubling up to the count given (default
+ * the number of online cpus), the process maps a region of that many
+ * times the per-thread size (default 256MB) and its threads all fault in
+ * their share of it at once, writing every page.  Two layouts are timed:
+ *
+ *   apart	each thread has its own contiguous share, so the threads
+ *		fault in different page tables
+ *   mixed	the threads take every nth page in turn, so they all fault
+ *		in the same page tables at the same time
+ *
+ * With a single page_table_lock per mm the fault rate hardly grows with
+ * the threads in either layout; with split page table locks "apart"
+ * should scale with the cpus, while "mixed" still contends on the lock
+ * of each page table page.
+ *
+ * Transparent huge pages would fault in 2MB at a time and hide the pte
+ * locking: set vm.transparent_hugepage to 0 while running this.
+ *
+ * Build with "cc -O2 -o fault-bench fault-bench.c -lpthread" and run as
+ * "./fault-bench [max threads] [MB per thread]".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#define MB		(1024UL * 1024)
+#define MAX_THREADS	1024
+
+static long page_size;
+
+static char *region;
+static unsigned long region_pages;
+static int nr_threads;
+static int mixed;
+static volatile int go;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static void *fault_thread(void *arg)
+{
+	long id = (long)arg;
+	unsigned long i, first, step, end;
+
+	if (mixed) {
+		first = id;
+		step = nr_threads;
+		end = region_pages;
+	} else {
+		first = region_pages / nr_threads * id;
+		step = 1;
+		end = first + region_pages / nr_threads;
+	}
+
+	while (!go)
+		;
+	for (i = first; i < end; i += step)
+		region[i * page_size] = 1;
+	return NULL;
+}
+
+/* Thousands of faults per second with every thread faulting at once */
+static double time_faults(unsigned long size, int layout)
+{
+	pthread_t threads[MAX_THREADS];
+	double start, elapsed;
+	long i;
+
+	region = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	region_pages = size / page_size;
+	mixed = layout;
+	go = 0;
+
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&threads[i], NULL, fault_thread,
+				   (void *)i)) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	start = now();
+	go = 1;
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	elapsed = now() - start;
+
+	munmap(region, size);
+	return region_pages * 1000 / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	int max = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long mb = 256;
+	double apart, mixed_rate, apart1 = 0;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (argc > 1)
+		max = atoi(argv[1]);
+	if (argc > 2)
+		mb = strtoul(argv[2], NULL, 0);
+	if (max < 1 || max > MAX_THREADS || mb < 2) {
+		fprintf(stderr, "usage: %s [max threads, 1 to %d] "
+			"[MB per thread, at least 2]\n", argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	printf("%8s %14s %8s %14s\n", "threads", "apart(kf/s)", "scale",
+	       "mixed(kf/s)");
+	for (nr_threads = 1; nr_threads <= max; nr_threads *= 2) {
+		apart = time_faults(nr_threads * mb * MB, 0);
+		mixed_rate = time_faults(nr_threads * mb * MB, 1);
+		if (nr_threads == 1)
+			apart1 = apart;
+		printf("%8d %14.0f %8.2f %14.0f\n", nr_threads, apart,
+		       apart / apart1, mixed_rate);
+	}
+	return 0;
+}
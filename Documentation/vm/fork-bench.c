@@ -0,0 +1,163 @@
+/*
+ * fork-bench.c - time fork() of processes of increasing RSS
+ *
+ * For each size, from 16MB doubling up to the size given (default 1GB),
+ * the process maps and touches that much memory and times fork() in the
+ * parent, the child exiting at once.  Three kinds of memory are timed:
+ *
+ *   anon	private anonymous memory, every page written
+ *   file	a private mapping of a file, every page read
+ *   cow	the same file mapping, one page in 512 written
+ *
+ * Fork copies the page tables of anonymous memory; a file mapping
+ * which has had nothing written to it is left for the child to fault
+ * in, and so are the page tables of one which map none of the pages
+ * written.  Compare the fork_* lines of /proc/vmstat before and after.
+ *
+ * Build with "cc -O2 -o fork-bench fork-bench.c" and run as
+ * "./fork-bench [max MB] [file]"; the file, default ./fork-bench.data,
+ * is created at the largest size and removed at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define MB		(1024UL * 1024)
+#define NR_FORKS	16
+
+static long page_size;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Median microseconds taken by fork() to return in the parent */
+static double time_fork(void)
+{
+	double t[NR_FORKS];
+	int i;
+
+	for (i = 0; i < NR_FORKS; i++) {
+		double start = now();
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (pid == 0)
+			_exit(0);
+		t[i] = now() - start;
+		waitpid(pid, NULL, 0);
+	}
+	qsort(t, NR_FORKS, sizeof(t[0]), cmp_double);
+	return t[NR_FORKS / 2];
+}
+
+static double bench_anon(unsigned long size)
+{
+	char *p;
+	unsigned long off;
+	double t;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	for (off = 0; off < size; off += page_size)
+		p[off] = 1;
+	t = time_fork();
+	munmap(p, size);
+	return t;
+}
+
+static double bench_file(int fd, unsigned long size, unsigned long stride)
+{
+	volatile char *p;
+	unsigned long off;
+	char sum = 0;
+	double t;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	for (off = 0; off < size; off += page_size)
+		sum += p[off];
+	if (stride)
+		for (off = 0; off < size; off += stride * page_size)
+			p[off] = sum;
+	t = time_fork();
+	munmap((char *)p, size);
+	return t;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long max = 1024 * MB;
+	unsigned long size;
+	const char *name = "fork-bench.data";
+	char buf[65536];
+	int fd;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (argc > 1)
+		max = strtoul(argv[1], NULL, 0) * MB;
+	if (argc > 2)
+		name = argv[2];
+	if (max < 16 * MB) {
+		fprintf(stderr, "usage: %s [max MB, at least 16] [file]\n",
+			argv[0]);
+		return 1;
+	}
+
+	fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		perror(name);
+		return 1;
+	}
+	memset(buf, 0x5a, sizeof(buf));
+	for (size = 0; size < max; size += sizeof(buf)) {
+		if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			perror("write");
+			unlink(name);
+			return 1;
+		}
+	}
+
+	printf("%8s %12s %12s %12s\n", "RSS(MB)", "anon(us)", "file(us)",
+	       "cow(us)");
+	for (size = 16 * MB; size <= max; size *= 2) {
+		double anon = bench_anon(size);
+		double file = bench_file(fd, size, 0);
+		double cow = bench_file(fd, size, 512);
+
+		printf("%8lu %12.0f %12.0f %12.0f\n", size / MB,
+		       anon, file, cow);
+	}
+
+	close(fd);
+	unlink(name);
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * mmap-bench.c - time mmap() and munmap() in address spaces of many vmas
+ *
+ * For each count, from 1000 vmas multiplying by ten up to the count
+ * given (default 100000), the process fills its address space with that
+ * many one page mappings, alternately readable and writable so that
+ * they cannot merge, and then unmaps every other one, leaving one page
+ * holes between the rest.  In that address space it times:
+ *
+ *   mmap	mapping two pages, which fit in none of the holes, and
+ *		unmapping them again
+ *   fault	faulting in a page of each of four vmas far apart, round
+ *		and round, giving each back with MADV_DONTNEED
+ *
+ * Finding a free range used to walk the vma list past every hole too
+ * small, so mmap grew with the number of vmas; now it should stay
+ * nearly flat.  Compare the vmacache_find_* lines of /proc/vmstat before
+ * and after for how often the page faults found their vma in the cache.
+ *
+ * Build with "cc -O2 -o mmap-bench mmap-bench.c" and run as
+ * "./mmap-bench [max vmas]"; vm.max_map_count may need raising to go
+ * past 65530.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#define NR_RUNS		64
+#define NR_FAULTS	(256 * 1024)
+
+static long page_size;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Median microseconds taken to map and unmap two pages */
+static double time_mmap(void)
+{
+	double t[NR_RUNS];
+	int i;
+
+	for (i = 0; i < NR_RUNS; i++) {
+		double start = now();
+		char *p;
+
+		p = mmap(NULL, 2 * page_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			exit(1);
+		}
+		munmap(p, 2 * page_size);
+		t[i] = now() - start;
+	}
+	qsort(t, NR_RUNS, sizeof(t[0]), cmp_double);
+	return t[NR_RUNS / 2];
+}
+
+/* Nanoseconds per fault, and madvise, on four vmas in turn */
+static double time_fault(char **vmas, unsigned long nr)
+{
+	volatile char *p;
+	double start;
+	long i;
+
+	start = now();
+	for (i = 0; i < NR_FAULTS; i++) {
+		p = vmas[(nr / 4) * (i & 3)];
+		(void)*p;
+		/* Give the page back, so the next touch faults again */
+		madvise((char *)p, page_size, MADV_DONTNEED);
+	}
+	return (now() - start) * 1000 / NR_FAULTS;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long max = 100000;
+	unsigned long nr, i;
+	char **vmas;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (argc > 1)
+		max = strtoul(argv[1], NULL, 0);
+	if (max < 1000) {
+		fprintf(stderr, "usage: %s [max vmas, at least 1000]\n",
+			argv[0]);
+		return 1;
+	}
+	vmas = malloc(2 * max * sizeof(*vmas));
+	if (!vmas) {
+		perror("malloc");
+		return 1;
+	}
+
+	printf("%10s %12s %12s\n", "vmas", "mmap(us)", "fault(ns)");
+	for (nr = 1000; nr <= max; nr *= 10) {
+		double mmap_us, fault_ns;
+
+		for (i = 0; i < 2 * nr; i++) {
+			vmas[i] = mmap(NULL, page_size, i & 1 ?
+				       PROT_READ : PROT_READ | PROT_WRITE,
+				       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (vmas[i] == MAP_FAILED) {
+				perror("mmap");
+				return 1;
+			}
+		}
+		/* Punch holes of one page: too small for time_mmap */
+		for (i = 0; i < 2 * nr; i += 2)
+			munmap(vmas[i], page_size);
+		for (i = 0; i < nr; i++)
+			vmas[i] = vmas[2 * i + 1];
+
+		mmap_us = time_mmap();
+		fault_ns = time_fault(vmas, nr);
+		printf("%10lu %12.1f %12.0f\n", nr, mmap_us, fault_ns);
+
+		for (i = 0; i < nr; i++)
+			munmap(vmas[i], page_size);
+	}
+	free(vmas);
+	return 0;
+}
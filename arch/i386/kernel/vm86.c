@@ -140,6 +140,7 @@ static void mark_screen_rdonly(struct task_struct * tsk)
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *pte, *mapped;
+	spinlock_t *ptl;
 	int i;
 
 	preempt_disable();
@@ -153,6 +154,7 @@ static void mark_screen_rdonly(struct task_struct * tsk)
 	pmd = pmd_offset(pud, 0xA0000);
 	if (pmd_none_or_clear_bad(pmd))
 		goto out;
+	ptl = pte_ptl_lock(tsk->mm, pmd);
 	pte = mapped = pte_offset_map(pmd, 0xA0000);
 	for (i = 0; i < 32; i++) {
 		if (pte_present(*pte))
@@ -160,6 +162,7 @@ static void mark_screen_rdonly(struct task_struct * tsk)
 		pte++;
 	}
 	pte_unmap(mapped);
+	pte_ptl_unlock(ptl);
 out:
 	spin_unlock(&tsk->mm->page_table_lock);
 	preempt_enable();
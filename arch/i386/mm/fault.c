@@ -267,6 +267,18 @@ fastcall void do_page_fault(struct pt_regs *regs, unsigned long error_code)
 	if (in_atomic() || !mm)
 		goto bad_area_nosemaphore;
 
+	/*
+	 * Try a not-present fault without mmap_sem first: it is most
+	 * likely on fresh anonymous memory.  vm86 mode wants to see its
+	 * faults below.
+	 */
+	if (!(error_code & 1) && !(regs->eflags & VM_MASK) &&
+	    handle_speculative_fault(mm, address,
+				     error_code & 2) == VM_FAULT_MINOR) {
+		tsk->min_flt++;
+		return;
+	}
+
 	/* When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in the
 	 * kernel and should generate an OOPS.  Unfortunatly, in the case of an
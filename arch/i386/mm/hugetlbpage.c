@@ -268,7 +268,9 @@ int hugetlb_prefault(struct address_space *mapping, struct vm_area_struct *vma)
 				ret = -ENOMEM;
 				goto out;
 			}
-			page = alloc_huge_page();
+			spin_unlock(&mm->page_table_lock);
+			page = alloc_huge_page(vma, addr);
+			spin_lock(&mm->page_table_lock);
 			if (!page) {
 				hugetlb_put_quota(mapping);
 				ret = -ENOMEM;
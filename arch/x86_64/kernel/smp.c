@@ -100,6 +100,7 @@ static inline void leave_mm (unsigned long cpu)
  *
  * 1) Flush the tlb entries if the cpu uses the mm that's being flushed.
  * 2) Leave the mm if we are in the lazy tlb mode.
+ * 3) Without an mm (flush_tlb_cpus), flush whatever the cpu has.
  */
 
 asmlinkage void smp_invalidate_interrupt (void)
@@ -119,7 +120,9 @@ asmlinkage void smp_invalidate_interrupt (void)
 		 * BUG();
 		 */
 		 
-	if (flush_mm == read_pda(active_mm)) {
+	if (!flush_mm)
+		local_flush_tlb();
+	else if (flush_mm == read_pda(active_mm)) {
 		if (read_pda(mmu_state) == TLBSTATE_OK) {
 			if (flush_va == FLUSH_ALL)
 				local_flush_tlb();
@@ -150,8 +153,6 @@ static void flush_tlb_others(cpumask_t cpumask, struct mm_struct *mm,
 	cpus_and(tmp, cpumask, cpu_online_map);
 	BUG_ON(!cpus_equal(tmp, cpumask));
 	BUG_ON(cpu_isset(smp_processor_id(), cpumask));
-	if (!mm)
-		BUG();
 
 	/*
 	 * I'm not happy about this global shared spinlock in the
@@ -236,6 +237,25 @@ void flush_tlb_page(struct vm_area_struct * vma, unsigned long va)
 	preempt_enable();
 }
 
+/*
+ * Flush the user entries of every cpu in @cpumask, whichever mm they are
+ * on now: for reclaim's batched unmaps, which cover pages of many mms.
+ * One of those cpus which has since switched mm has nothing stale left
+ * and flushes needlessly, but the IPI goes out once for them all.
+ */
+void flush_tlb_cpus(cpumask_t cpumask)
+{
+	preempt_disable();
+	if (cpu_isset(smp_processor_id(), cpumask)) {
+		cpu_clear(smp_processor_id(), cpumask);
+		local_flush_tlb();
+	}
+	cpus_and(cpumask, cpumask, cpu_online_map);
+	if (!cpus_empty(cpumask))
+		flush_tlb_others(cpumask, NULL, FLUSH_ALL);
+	preempt_enable();
+}
+
 static void do_flush_tlb_all(void* info)
 {
 	unsigned long cpu = smp_processor_id();
@@ -370,6 +370,17 @@ asmlinkage void do_page_fault(struct pt_regs *regs, unsigned long error_code)
 	if (unlikely(in_atomic() || !mm))
 		goto bad_area_nosemaphore;
 
+	/*
+	 * Try a not-present fault without mmap_sem first: it is most
+	 * likely on fresh anonymous memory.
+	 */
+	if (!(error_code & 1) &&
+	    handle_speculative_fault(mm, address,
+				     error_code & 2) == VM_FAULT_MINOR) {
+		tsk->min_flt++;
+		return;
+	}
+
  again:
 	/* When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in the
@@ -21,6 +21,7 @@
 #include <linux/hash.h>
 #include <linux/rbtree.h>
 #include <linux/mempool.h>
+#include <linux/ioprio.h>
 
 static unsigned long max_elapsed_crq;
 static unsigned long max_elapsed_dispatch;
@@ -30,12 +31,31 @@ static unsigned long max_elapsed_dispatch;
  */
 static int cfq_quantum = 4;		/* max queue in one round of service */
 static int cfq_queued = 8;		/* minimum rq allocate limit per-queue*/
-static int cfq_service = HZ;		/* period over which service is avg */
 static int cfq_fifo_expire_r = HZ / 2;	/* fifo timeout for sync requests */
 static int cfq_fifo_expire_w = 5 * HZ;	/* fifo timeout for async requests */
 static int cfq_fifo_rate = HZ / 8;	/* fifo expiry rate */
 static int cfq_back_max = 16 * 1024;	/* maximum backwards seek, in KiB */
 static int cfq_back_penalty = 2;	/* penalty of a backwards seek */
+static int cfq_slice_sync = HZ / 10;	/* base time slice of sync queue */
+static int cfq_slice_async = HZ / 25;	/* base time slice of async queue */
+static int cfq_slice_idle = HZ / 100;	/* idle window for a sync queue */
+
+/*
+ * a slice is scaled by this fraction of the base slice for each level of
+ * priority above or below IOPRIO_NORM
+ */
+#define CFQ_SLICE_SCALE		(5)
+
+/*
+ * the idle class is only served once the disk has been left alone by
+ * everyone else for this long
+ */
+#define CFQ_IDLE_GRACE		(HZ / 10)
+
+/*
+ * one round-robin list per priority class, RT first
+ */
+#define CFQ_PRIO_LISTS		(3)
 
 /*
  * for the hash of cfqq inside the cfqd
@@ -75,11 +95,6 @@ static int cfq_back_penalty = 2;	/* penalty of a backwards seek */
 #define rb_entry_crq(node)	rb_entry((node), struct cfq_rq, rb_node)
 #define rq_rb_key(rq)		(rq)->sector
 
-/*
- * threshold for switching off non-tag accounting
- */
-#define CFQ_MAX_TAG		(4)
-
 /*
  * sort key types and names
  */
@@ -98,7 +113,7 @@ static kmem_cache_t *cfq_pool;
 static kmem_cache_t *cfq_ioc_pool;
 
 struct cfq_data {
-	struct list_head rr_list;
+	struct list_head rr_list[CFQ_PRIO_LISTS];
 	struct list_head empty_list;
 
 	struct hlist_head *cfq_hash;
@@ -121,6 +136,17 @@ struct cfq_data {
 
 	int rq_in_driver;
 
+	/*
+	 * queue currently owning the time slice, and the timer used to idle
+	 * for it (or for the idle class grace period)
+	 */
+	struct cfq_queue *active_queue;
+	struct timer_list idle_slice_timer;
+	struct work_struct unplug_work;
+
+	/* last completion of a non-idle class request */
+	unsigned long last_end_request;
+
 	/*
 	 * tunables, see top of file
 	 */
@@ -132,8 +158,9 @@ struct cfq_data {
 	unsigned int cfq_back_penalty;
 	unsigned int cfq_back_max;
 	unsigned int find_best_crq;
-
-	unsigned int cfq_tagged;
+	unsigned int cfq_slice_sync;
+	unsigned int cfq_slice_async;
+	unsigned int cfq_slice_idle;
 };
 
 struct cfq_queue {
@@ -164,10 +191,22 @@ struct cfq_queue {
 
 	int key_type;
 
-	unsigned long service_start;
-	unsigned long service_used;
+	/* io priority class and level within the class */
+	unsigned short ioprio_class;
+	unsigned short ioprio;
+
+	/* end of the current time slice, 0 until the first dispatch */
+	unsigned long slice_end;
+	/* slice timer is running, waiting for this queue to issue io */
+	int wait_request;
+	/* think time is short enough to be worth idling for */
+	int idle_window;
 
-	unsigned int max_rate;
+	/* think time tracking, see cfq_update_idle_window() */
+	unsigned long last_end_request;
+	unsigned long ttime_total;
+	unsigned long ttime_samples;
+	unsigned long ttime_mean;
 
 	/* number of requests that have been handed to the driver */
 	int in_flight;
@@ -401,75 +440,28 @@ static void cfq_update_next_crq(struct cfq_rq *crq)
 		cfqq->next_crq = cfq_find_next_crq(cfqq->cfqd, cfqq, crq);
 }
 
-static int cfq_check_sort_rr_list(struct cfq_queue *cfqq)
+static inline struct list_head *
+cfq_class_rr_list(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 {
-	struct list_head *head = &cfqq->cfqd->rr_list;
-	struct list_head *next, *prev;
-
-	/*
-	 * list might still be ordered
-	 */
-	next = cfqq->cfq_list.next;
-	if (next != head) {
-		struct cfq_queue *cnext = list_entry_cfqq(next);
-
-		if (cfqq->service_used > cnext->service_used)
-			return 1;
-	}
-
-	prev = cfqq->cfq_list.prev;
-	if (prev != head) {
-		struct cfq_queue *cprev = list_entry_cfqq(prev);
-
-		if (cfqq->service_used < cprev->service_used)
-			return 1;
-	}
-
-	return 0;
+	return &cfqd->rr_list[cfqq->ioprio_class - IOPRIO_CLASS_RT];
 }
 
-static void cfq_sort_rr_list(struct cfq_queue *cfqq, int new_queue)
+/*
+ * slice length for this queue, larger for the higher priority levels
+ */
+static inline int
+cfq_prio_to_slice(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 {
-	struct list_head *entry = &cfqq->cfqd->rr_list;
-
-	if (!cfqq->on_rr)
-		return;
-	if (!new_queue && !cfq_check_sort_rr_list(cfqq))
-		return;
-
-	list_del(&cfqq->cfq_list);
+	const int base_slice = cfqq->queued[1] ? cfqd->cfq_slice_sync :
+						 cfqd->cfq_slice_async;
 
-	/*
-	 * sort by our mean service_used, sub-sort by in-flight requests
-	 */
-	while ((entry = entry->prev) != &cfqq->cfqd->rr_list) {
-		struct cfq_queue *__cfqq = list_entry_cfqq(entry);
-
-		if (cfqq->service_used > __cfqq->service_used)
-			break;
-		else if (cfqq->service_used == __cfqq->service_used) {
-			struct list_head *prv;
-
-			while ((prv = entry->prev) != &cfqq->cfqd->rr_list) {
-				__cfqq = list_entry_cfqq(prv);
-
-				WARN_ON(__cfqq->service_used > cfqq->service_used);
-				if (cfqq->service_used != __cfqq->service_used)
-					break;
-				if (cfqq->in_flight > __cfqq->in_flight)
-					break;
-
-				entry = prv;
-			}
-		}
-	}
-
-	list_add(&cfqq->cfq_list, entry);
+	return base_slice + (base_slice / CFQ_SLICE_SCALE *
+			     (IOPRIO_NORM - (int) cfqq->ioprio));
 }
 
 /*
- * add to busy list of queues for service, trying to be fair in ordering
- * the pending list according to requests serviced
+ * add to busy list of queues for service. queues are served round robin
+ * within their class, the slice length takes care of the priority level
  */
 static inline void
 cfq_add_cfqq_rr(struct cfq_data *cfqd, struct cfq_queue *cfqq)
@@ -480,10 +472,7 @@ cfq_add_cfqq_rr(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	cfqq->on_rr = 1;
 	cfqd->busy_queues++;
 
-	if (time_after(jiffies, cfqq->service_start + cfq_service))
-		cfqq->service_used >>= 3;
-
-	cfq_sort_rr_list(cfqq, 1);
+	list_move_tail(&cfqq->cfq_list, cfq_class_rr_list(cfqd, cfqq));
 }
 
 static inline void
@@ -614,11 +603,6 @@ static void cfq_deactivate_request(request_queue_t *q, struct request *rq)
 	if (crq) {
 		struct cfq_queue *cfqq = crq->cfq_queue;
 
-		if (cfqq->cfqd->cfq_tagged) {
-			cfqq->service_used--;
-			cfq_sort_rr_list(cfqq, 0);
-		}
-
 		if (crq->accounted) {
 			crq->accounted = 0;
 			cfqq->cfqd->rq_in_driver--;
@@ -821,53 +805,192 @@ cfq_dispatch_request(request_queue_t *q, struct cfq_data *cfqd,
 	cfq_dispatch_sort(q, crq);
 }
 
-static int cfq_dispatch_requests(request_queue_t *q, int max_dispatch)
+/*
+ * current slice is over: put the queue back at the end of its class list,
+ * so the next one in line gets a go
+ */
+static void cfq_slice_expired(struct cfq_data *cfqd)
 {
-	struct cfq_data *cfqd = q->elevator->elevator_data;
-	struct cfq_queue *cfqq;
-	struct list_head *entry, *tmp;
-	int queued, busy_queues, first_round;
+	struct cfq_queue *cfqq = cfqd->active_queue;
 
-	if (list_empty(&cfqd->rr_list))
-		return 0;
+	if (!cfqq)
+		return;
 
-	queued = 0;
-	first_round = 1;
-restart:
-	busy_queues = 0;
-	list_for_each_safe(entry, tmp, &cfqd->rr_list) {
-		cfqq = list_entry_cfqq(entry);
+	if (cfqq->wait_request)
+		del_timer(&cfqd->idle_slice_timer);
 
-		BUG_ON(RB_EMPTY(&cfqq->sort_list));
+	cfqq->wait_request = 0;
+	cfqq->slice_end = 0;
 
-		/*
-		 * first round of queueing, only select from queues that
-		 * don't already have io in-flight
-		 */
-		if (first_round && cfqq->in_flight)
+	if (cfqq->on_rr)
+		list_move_tail(&cfqq->cfq_list, cfq_class_rr_list(cfqd, cfqq));
+
+	cfqd->active_queue = NULL;
+}
+
+/*
+ * pick the next queue to own a slice. RT is always served before BE, the
+ * idle class only once nobody else has used the disk for a grace period
+ */
+static struct cfq_queue *cfq_set_active_queue(struct cfq_data *cfqd)
+{
+	struct cfq_queue *cfqq = NULL;
+	unsigned long end;
+	int i;
+
+	for (i = 0; i < CFQ_PRIO_LISTS; i++) {
+		if (list_empty(&cfqd->rr_list[i]))
 			continue;
 
-		cfq_dispatch_request(q, cfqd, cfqq);
+		if (i == IOPRIO_CLASS_IDLE - IOPRIO_CLASS_RT) {
+			end = cfqd->last_end_request + CFQ_IDLE_GRACE;
+			if (time_before(jiffies, end)) {
+				mod_timer(&cfqd->idle_slice_timer, end);
+				break;
+			}
+		}
+
+		cfqq = list_entry_cfqq(cfqd->rr_list[i].next);
+		cfqq->slice_end = 0;
+		cfqq->wait_request = 0;
+		break;
+	}
+
+	cfqd->active_queue = cfqq;
+	return cfqq;
+}
+
+/*
+ * the active queue has run out of requests. if it has been issuing
+ * dependent sync io with a short think time, give it a little while to
+ * send more before moving on, like AS does for reads
+ */
+static int cfq_arm_slice_timer(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	unsigned long timeout = jiffies + cfqd->cfq_slice_idle;
+
+	if (!cfqd->cfq_slice_idle || !cfqq->idle_window)
+		return 0;
+	if (cfqq->ioprio_class == IOPRIO_CLASS_IDLE)
+		return 0;
+
+	/*
+	 * not worth it if the slice would end while we wait
+	 */
+	if (cfqq->slice_end && time_after(timeout, cfqq->slice_end))
+		return 0;
+
+	cfqq->wait_request = 1;
+	mod_timer(&cfqd->idle_slice_timer, timeout);
+	return 1;
+}
+
+static struct cfq_queue *cfq_select_queue(struct cfq_data *cfqd)
+{
+	struct cfq_queue *cfqq = cfqd->active_queue;
+	int i;
+
+	if (!cfqq)
+		goto new_queue;
+
+	if (cfqq->slice_end && time_after(jiffies, cfqq->slice_end))
+		goto expire;
+
+	/*
+	 * a queue of a better class has become busy, it preempts us
+	 */
+	for (i = 0; i < cfqq->ioprio_class - IOPRIO_CLASS_RT; i++)
+		if (!list_empty(&cfqd->rr_list[i]))
+			goto expire;
+
+	if (!RB_EMPTY(&cfqq->sort_list))
+		return cfqq;
+
+	/*
+	 * queue is empty. if we are already waiting for it, or it still has
+	 * io in the driver that its next request will likely depend on, keep
+	 * the disk reserved for it
+	 */
+	if (cfqq->wait_request)
+		return NULL;
+	if (cfqq->in_flight && cfqq->idle_window)
+		return NULL;
+	if (cfq_arm_slice_timer(cfqd, cfqq))
+		return NULL;
+
+expire:
+	cfq_slice_expired(cfqd);
+new_queue:
+	return cfq_set_active_queue(cfqd);
+}
+
+/*
+ * drain everything regardless of slices and idling, used before inserting
+ * at the back of the dispatch list
+ */
+static int cfq_forced_dispatch(request_queue_t *q, struct cfq_data *cfqd)
+{
+	struct list_head *entry, *tmp;
+	struct cfq_queue *cfqq;
+	int i, dispatched = 0;
+
+	cfq_slice_expired(cfqd);
 
-		if (!RB_EMPTY(&cfqq->sort_list))
-			busy_queues++;
+	for (i = 0; i < CFQ_PRIO_LISTS; i++) {
+		list_for_each_safe(entry, tmp, &cfqd->rr_list[i]) {
+			cfqq = list_entry_cfqq(entry);
 
-		queued++;
+			while (!RB_EMPTY(&cfqq->sort_list)) {
+				cfq_dispatch_request(q, cfqd, cfqq);
+				dispatched++;
+			}
+		}
 	}
 
-	if ((queued < max_dispatch) && (busy_queues || first_round)) {
-		first_round = 0;
-		goto restart;
+	return dispatched;
+}
+
+static int
+cfq_dispatch_requests(request_queue_t *q, int max_dispatch, int force)
+{
+	struct cfq_data *cfqd = q->elevator->elevator_data;
+	struct cfq_queue *cfqq;
+	int dispatched = 0;
+
+	if (!cfqd->busy_queues)
+		return 0;
+
+	if (unlikely(force))
+		return cfq_forced_dispatch(q, cfqd);
+
+	cfqq = cfq_select_queue(cfqd);
+	if (!cfqq)
+		return 0;
+
+	if (cfqq->wait_request) {
+		cfqq->wait_request = 0;
+		del_timer(&cfqd->idle_slice_timer);
 	}
 
-	return queued;
+	/*
+	 * slice starts ticking when the queue first gets to the disk
+	 */
+	if (!cfqq->slice_end)
+		cfqq->slice_end = jiffies + cfq_prio_to_slice(cfqd, cfqq);
+
+	do {
+		cfq_dispatch_request(q, cfqd, cfqq);
+		dispatched++;
+	} while (dispatched < max_dispatch && !RB_EMPTY(&cfqq->sort_list));
+
+	return dispatched;
 }
 
 static inline void cfq_account_dispatch(struct cfq_rq *crq)
 {
 	struct cfq_queue *cfqq = crq->cfq_queue;
 	struct cfq_data *cfqd = cfqq->cfqd;
-	unsigned long now, elapsed;
+	unsigned long elapsed;
 
 	if (!blk_fs_request(crq->request))
 		return;
@@ -879,43 +1002,20 @@ static inline void cfq_account_dispatch(struct cfq_rq *crq)
 	if (crq->accounted)
 		return;
 
-	now = jiffies;
-	if (cfqq->service_start == ~0UL)
-		cfqq->service_start = now;
-
-	/*
-	 * on drives with tagged command queueing, command turn-around time
-	 * doesn't necessarily reflect the time spent processing this very
-	 * command inside the drive. so do the accounting differently there,
-	 * by just sorting on the number of requests
-	 */
-	if (cfqd->cfq_tagged) {
-		if (time_after(now, cfqq->service_start + cfq_service)) {
-			cfqq->service_start = now;
-			cfqq->service_used /= 10;
-		}
-
-		cfqq->service_used++;
-		cfq_sort_rr_list(cfqq, 0);
-	}
-
-	elapsed = now - crq->queue_start;
+	elapsed = jiffies - crq->queue_start;
 	if (elapsed > max_elapsed_dispatch)
 		max_elapsed_dispatch = elapsed;
 
 	crq->accounted = 1;
-	crq->service_start = now;
-
-	if (++cfqd->rq_in_driver >= CFQ_MAX_TAG && !cfqd->cfq_tagged) {
-		cfqq->cfqd->cfq_tagged = 1;
-		printk("cfq: depth %d reached, tagging now on\n", CFQ_MAX_TAG);
-	}
+	crq->service_start = jiffies;
+	cfqd->rq_in_driver++;
 }
 
 static inline void
 cfq_account_completion(struct cfq_queue *cfqq, struct cfq_rq *crq)
 {
 	struct cfq_data *cfqd = cfqq->cfqd;
+	unsigned long now, duration;
 
 	if (!crq->accounted)
 		return;
@@ -923,21 +1023,15 @@ cfq_account_completion(struct cfq_queue *cfqq, struct cfq_rq *crq)
 	WARN_ON(!cfqd->rq_in_driver);
 	cfqd->rq_in_driver--;
 
-	if (!cfqd->cfq_tagged) {
-		unsigned long now = jiffies;
-		unsigned long duration = now - crq->service_start;
-
-		if (time_after(now, cfqq->service_start + cfq_service)) {
-			cfqq->service_start = now;
-			cfqq->service_used >>= 3;
-		}
-
-		cfqq->service_used += duration;
-		cfq_sort_rr_list(cfqq, 0);
+	now = jiffies;
+	duration = now - crq->service_start;
+	if (duration > max_elapsed_crq)
+		max_elapsed_crq = duration;
 
-		if (duration > max_elapsed_crq)
-			max_elapsed_crq = duration;
-	}
+	if (crq->is_sync)
+		cfqq->last_end_request = now;
+	if (cfqq->ioprio_class != IOPRIO_CLASS_IDLE)
+		cfqd->last_end_request = now;
 }
 
 static struct request *cfq_next_request(request_queue_t *q)
@@ -958,7 +1052,7 @@ dispatch:
 		return rq;
 	}
 
-	if (cfq_dispatch_requests(q, cfqd->cfq_quantum))
+	if (cfq_dispatch_requests(q, cfqd->cfq_quantum, 0))
 		goto dispatch;
 
 	return NULL;
@@ -980,6 +1074,9 @@ static void cfq_put_queue(struct cfq_queue *cfqq)
 	BUG_ON(rb_first(&cfqq->sort_list));
 	BUG_ON(cfqq->on_rr);
 
+	if (unlikely(cfqq->cfqd->active_queue == cfqq))
+		cfq_slice_expired(cfqq->cfqd);
+
 	cfq_put_cfqd(cfqq->cfqd);
 
 	/*
@@ -1224,7 +1321,10 @@ retry:
 		cfqq->cfqd = cfqd;
 		atomic_inc(&cfqd->ref);
 		cfqq->key_type = cfqd->key_type;
-		cfqq->service_start = ~0UL;
+		cfqq->ioprio_class = IOPRIO_CLASS_BE;
+		cfqq->ioprio = IOPRIO_NORM;
+		/* no idling until it issues sync io, see cfq_enqueue() */
+		cfqq->idle_window = 0;
 	}
 
 	if (new_cfqq)
@@ -1236,16 +1336,94 @@ out:
 	return cfqq;
 }
 
+/*
+ * pick up the io priority of the task allocating a request on this queue,
+ * moving the queue to its new class list if that changed
+ */
+static void
+cfq_update_ioprio(struct cfq_data *cfqd, struct cfq_queue *cfqq,
+		  struct task_struct *tsk)
+{
+	int ioprio_class = IOPRIO_PRIO_CLASS(tsk->ioprio);
+	int ioprio = IOPRIO_PRIO_DATA(tsk->ioprio);
+
+	switch (ioprio_class) {
+		case IOPRIO_CLASS_RT:
+		case IOPRIO_CLASS_BE:
+			break;
+		case IOPRIO_CLASS_IDLE:
+			ioprio = IOPRIO_BE_NR - 1;
+			break;
+		default:
+			printk(KERN_ERR "%s: bad prio %x\n", __FUNCTION__, tsk->ioprio);
+		case IOPRIO_CLASS_NONE:
+			ioprio_class = IOPRIO_CLASS_BE;
+			ioprio = task_nice_ioprio(tsk);
+			break;
+	}
+
+	cfqq->ioprio = ioprio;
+	if (cfqq->ioprio_class == ioprio_class)
+		return;
+
+	cfqq->ioprio_class = ioprio_class;
+	if (cfqq->on_rr && cfqq != cfqd->active_queue)
+		list_move_tail(&cfqq->cfq_list, cfq_class_rr_list(cfqd, cfqq));
+}
+
+/*
+ * keep a decaying average of the time between a sync completion of this
+ * queue and its next sync request. idling only pays off if the process
+ * comes back within the idle window
+ */
+static void
+cfq_update_idle_window(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	unsigned long elapsed, ttime;
+
+	/* first sync request: idle until its think time says otherwise */
+	if (!cfqq->last_end_request) {
+		cfqq->idle_window = cfqd->cfq_slice_idle != 0;
+		return;
+	}
+
+	elapsed = jiffies - cfqq->last_end_request;
+	ttime = min(elapsed, 2UL * cfqd->cfq_slice_idle);
+
+	cfqq->ttime_samples = (7 * cfqq->ttime_samples + 256) / 8;
+	cfqq->ttime_total = (7 * cfqq->ttime_total + 256 * ttime) / 8;
+	cfqq->ttime_mean = (cfqq->ttime_total + 128) / cfqq->ttime_samples;
+
+	cfqq->idle_window = cfqd->cfq_slice_idle &&
+			    cfqq->ttime_mean <= cfqd->cfq_slice_idle;
+}
+
 static void cfq_enqueue(struct cfq_data *cfqd, struct cfq_rq *crq)
 {
+	struct cfq_queue *cfqq = crq->cfq_queue;
+	struct cfq_queue *active = cfqd->active_queue;
+
 	crq->is_sync = 0;
 	if (rq_data_dir(crq->request) == READ || current->flags & PF_SYNCWRITE)
 		crq->is_sync = 1;
 
+	if (crq->is_sync)
+		cfq_update_idle_window(cfqd, cfqq);
+
 	cfq_add_crq_rb(crq);
 	crq->queue_start = jiffies;
 
-	list_add_tail(&crq->request->queuelist, &crq->cfq_queue->fifo[crq->is_sync]);
+	list_add_tail(&crq->request->queuelist, &cfqq->fifo[crq->is_sync]);
+
+	/*
+	 * if we are idling for the active queue and either it or a queue of
+	 * a better class now has io, stop waiting and get the disk going
+	 */
+	if (active && active->wait_request &&
+	    (cfqq == active || cfqq->ioprio_class < active->ioprio_class)) {
+		del_timer(&cfqd->idle_slice_timer);
+		kblockd_schedule_work(&cfqd->unplug_work);
+	}
 }
 
 static void
@@ -1256,7 +1434,7 @@ cfq_insert_request(request_queue_t *q, struct request *rq, int where)
 
 	switch (where) {
 		case ELEVATOR_INSERT_BACK:
-			while (cfq_dispatch_requests(q, cfqd->cfq_quantum))
+			while (cfq_dispatch_requests(q, cfqd->cfq_quantum, 1))
 				;
 			list_add_tail(&rq->queuelist, &q->queue_head);
 			break;
@@ -1284,11 +1462,12 @@ static int cfq_queue_empty(request_queue_t *q)
 {
 	struct cfq_data *cfqd = q->elevator->elevator_data;
 
-	return list_empty(&q->queue_head) && list_empty(&cfqd->rr_list);
+	return list_empty(&q->queue_head) && !cfqd->busy_queues;
 }
 
 static void cfq_completed_request(request_queue_t *q, struct request *rq)
 {
+	struct cfq_data *cfqd = q->elevator->elevator_data;
 	struct cfq_rq *crq = RQ_DATA(rq);
 	struct cfq_queue *cfqq;
 
@@ -1303,6 +1482,19 @@ static void cfq_completed_request(request_queue_t *q, struct request *rq)
 	}
 
 	cfq_account_completion(cfqq, crq);
+
+	/*
+	 * last io of the active queue finished and it has nothing queued,
+	 * either idle for its next request or hand the disk to someone else
+	 */
+	if (cfqd->active_queue == cfqq && !cfqq->in_flight &&
+	    RB_EMPTY(&cfqq->sort_list)) {
+		if (!crq->is_sync || !cfq_arm_slice_timer(cfqd, cfqq))
+			cfq_slice_expired(cfqd);
+	}
+
+	if (cfqd->busy_queues && !cfqd->rq_in_driver)
+		kblockd_schedule_work(&cfqd->unplug_work);
 }
 
 static struct request *
@@ -1342,6 +1534,13 @@ static int cfq_may_queue(request_queue_t *q, int rw)
 	if (cfqq) {
 		int limit = cfqd->max_queued;
 
+		/*
+		 * we are idling for this queue, don't make it wait for a
+		 * request as well
+		 */
+		if (cfqq == cfqd->active_queue && cfqq->wait_request)
+			return ELV_MQUEUE_MUST;
+
 		if (cfqq->allocated[rw] < cfqd->cfq_queued)
 			return ELV_MQUEUE_MUST;
 
@@ -1425,6 +1624,8 @@ static int cfq_set_request(request_queue_t *q, struct request *rq, int gfp_mask)
 	if (!cfqq)
 		goto out_lock;
 
+	cfq_update_ioprio(cfqd, cfqq, current);
+
 repeat:
 	if (cfqq->allocated[rw] >= cfqd->max_queued)
 		goto out_lock;
@@ -1490,9 +1691,62 @@ static void cfq_put_cfqd(struct cfq_data *cfqd)
 	kfree(cfqd);
 }
 
+/*
+ * timer fired: either the active queue didn't issue io within its idle
+ * window, or the idle class grace period is over. kick the queue so the
+ * next one gets served
+ */
+static void cfq_idle_slice_timer(unsigned long data)
+{
+	struct cfq_data *cfqd = (struct cfq_data *) data;
+	struct cfq_queue *cfqq;
+	unsigned long flags;
+
+	spin_lock_irqsave(cfqd->queue->queue_lock, flags);
+
+	if ((cfqq = cfqd->active_queue) != NULL) {
+		/*
+		 * a request came in just as we timed out, let it run
+		 */
+		if (RB_EMPTY(&cfqq->sort_list))
+			cfq_slice_expired(cfqd);
+		else
+			cfqq->wait_request = 0;
+	}
+
+	if (cfqd->busy_queues)
+		kblockd_schedule_work(&cfqd->unplug_work);
+
+	spin_unlock_irqrestore(cfqd->queue->queue_lock, flags);
+}
+
+/*
+ * executed by kblockd, calls the driver's request_fn so a queue that was
+ * held back for idling gets dispatched
+ */
+static void cfq_kick_queue(void *data)
+{
+	request_queue_t *q = data;
+	unsigned long flags;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+	blk_remove_plug(q);
+	q->request_fn(q);
+	spin_unlock_irqrestore(q->queue_lock, flags);
+}
+
 static void cfq_exit_queue(elevator_t *e)
 {
-	cfq_put_cfqd(e->elevator_data);
+	struct cfq_data *cfqd = e->elevator_data;
+
+	del_timer_sync(&cfqd->idle_slice_timer);
+	kblockd_flush();
+
+	spin_lock_irq(cfqd->queue->queue_lock);
+	cfq_slice_expired(cfqd);
+	spin_unlock_irq(cfqd->queue->queue_lock);
+
+	cfq_put_cfqd(cfqd);
 }
 
 static int cfq_init_queue(request_queue_t *q, elevator_t *e)
@@ -1505,7 +1759,8 @@ static int cfq_init_queue(request_queue_t *q, elevator_t *e)
 		return -ENOMEM;
 
 	memset(cfqd, 0, sizeof(*cfqd));
-	INIT_LIST_HEAD(&cfqd->rr_list);
+	for (i = 0; i < CFQ_PRIO_LISTS; i++)
+		INIT_LIST_HEAD(&cfqd->rr_list[i]);
 	INIT_LIST_HEAD(&cfqd->empty_list);
 
 	cfqd->crq_hash = kmalloc(sizeof(struct hlist_head) * CFQ_MHASH_ENTRIES, GFP_KERNEL);
@@ -1530,6 +1785,11 @@ static int cfq_init_queue(request_queue_t *q, elevator_t *e)
 	cfqd->queue = q;
 	atomic_inc(&q->refcnt);
 
+	init_timer(&cfqd->idle_slice_timer);
+	cfqd->idle_slice_timer.function = cfq_idle_slice_timer;
+	cfqd->idle_slice_timer.data = (unsigned long) cfqd;
+	INIT_WORK(&cfqd->unplug_work, cfq_kick_queue, q);
+
 	/*
 	 * just set it to some high value, we want anyone to be able to queue
 	 * some requests. fairness is handled differently
@@ -1548,6 +1808,9 @@ static int cfq_init_queue(request_queue_t *q, elevator_t *e)
 	cfqd->cfq_fifo_batch_expire = cfq_fifo_rate;
 	cfqd->cfq_back_max = cfq_back_max;
 	cfqd->cfq_back_penalty = cfq_back_penalty;
+	cfqd->cfq_slice_sync = cfq_slice_sync;
+	cfqd->cfq_slice_async = cfq_slice_async;
+	cfqd->cfq_slice_idle = cfq_slice_idle;
 
 	return 0;
 out_crqpool:
@@ -1672,6 +1935,9 @@ SHOW_FUNCTION(cfq_fifo_batch_expire_show, cfqd->cfq_fifo_batch_expire, 1);
 SHOW_FUNCTION(cfq_find_best_show, cfqd->find_best_crq, 0);
 SHOW_FUNCTION(cfq_back_max_show, cfqd->cfq_back_max, 0);
 SHOW_FUNCTION(cfq_back_penalty_show, cfqd->cfq_back_penalty, 0);
+SHOW_FUNCTION(cfq_slice_sync_show, cfqd->cfq_slice_sync, 1);
+SHOW_FUNCTION(cfq_slice_async_show, cfqd->cfq_slice_async, 1);
+SHOW_FUNCTION(cfq_slice_idle_show, cfqd->cfq_slice_idle, 1);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -1697,6 +1963,9 @@ STORE_FUNCTION(cfq_fifo_batch_expire_store, &cfqd->cfq_fifo_batch_expire, 0, UIN
 STORE_FUNCTION(cfq_find_best_store, &cfqd->find_best_crq, 0, 1, 0);
 STORE_FUNCTION(cfq_back_max_store, &cfqd->cfq_back_max, 0, UINT_MAX, 0);
 STORE_FUNCTION(cfq_back_penalty_store, &cfqd->cfq_back_penalty, 1, UINT_MAX, 0);
+STORE_FUNCTION(cfq_slice_sync_store, &cfqd->cfq_slice_sync, 1, UINT_MAX, 1);
+STORE_FUNCTION(cfq_slice_async_store, &cfqd->cfq_slice_async, 1, UINT_MAX, 1);
+STORE_FUNCTION(cfq_slice_idle_store, &cfqd->cfq_slice_idle, 0, UINT_MAX, 1);
 #undef STORE_FUNCTION
 
 static struct cfq_fs_entry cfq_quantum_entry = {
@@ -1739,6 +2008,21 @@ static struct cfq_fs_entry cfq_back_penalty_entry = {
 	.show = cfq_back_penalty_show,
 	.store = cfq_back_penalty_store,
 };
+static struct cfq_fs_entry cfq_slice_sync_entry = {
+	.attr = {.name = "slice_sync", .mode = S_IRUGO | S_IWUSR },
+	.show = cfq_slice_sync_show,
+	.store = cfq_slice_sync_store,
+};
+static struct cfq_fs_entry cfq_slice_async_entry = {
+	.attr = {.name = "slice_async", .mode = S_IRUGO | S_IWUSR },
+	.show = cfq_slice_async_show,
+	.store = cfq_slice_async_store,
+};
+static struct cfq_fs_entry cfq_slice_idle_entry = {
+	.attr = {.name = "slice_idle", .mode = S_IRUGO | S_IWUSR },
+	.show = cfq_slice_idle_show,
+	.store = cfq_slice_idle_store,
+};
 static struct cfq_fs_entry cfq_clear_elapsed_entry = {
 	.attr = {.name = "clear_elapsed", .mode = S_IWUSR },
 	.store = cfq_clear_elapsed,
@@ -1759,6 +2043,9 @@ static struct attribute *default_attrs[] = {
 	&cfq_find_best_entry.attr,
 	&cfq_back_max_entry.attr,
 	&cfq_back_penalty_entry.attr,
+	&cfq_slice_sync_entry.attr,
+	&cfq_slice_async_entry.attr,
+	&cfq_slice_idle_entry.attr,
 	&cfq_clear_elapsed_entry.attr,
 	NULL,
 };
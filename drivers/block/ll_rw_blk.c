@@ -28,6 +28,8 @@
 #include <linux/slab.h>
 #include <linux/swap.h>
 #include <linux/writeback.h>
+#include <linux/interrupt.h>
+#include <linux/cpu.h>
 
 /*
  * for max sense size
@@ -37,6 +39,76 @@
 static void blk_unplug_work(void *data);
 static void blk_unplug_timeout(unsigned long data);
 
+#ifdef CONFIG_BLK_DEV_LOCK_STATS
+/*
+ * queue_lock acquisitions made by the block layer itself are counted, along
+ * with how often they had to spin and for how many cycles the lock was held.
+ * The counters are protected by the queue_lock itself.
+ */
+static inline void blk_lock_stats_acquired(request_queue_t *q, int contended)
+{
+	struct blk_lock_stats *ls = &q->lock_stats;
+
+	ls->acquired++;
+	if (contended)
+		ls->contended++;
+	ls->hold_start = get_cycles();
+}
+
+static inline void blk_lock_stats_release(request_queue_t *q)
+{
+	struct blk_lock_stats *ls = &q->lock_stats;
+	cycles_t held = get_cycles() - ls->hold_start;
+
+	ls->hold_total += held;
+	if (held > ls->hold_max)
+		ls->hold_max = held;
+}
+
+static inline void __blk_queue_lock(request_queue_t *q)
+{
+	int contended = 0;
+
+	if (!spin_trylock(q->queue_lock)) {
+		spin_lock(q->queue_lock);
+		contended = 1;
+	}
+
+	blk_lock_stats_acquired(q, contended);
+}
+
+#define blk_queue_lock_irq(q)			\
+do {						\
+	local_irq_disable();			\
+	__blk_queue_lock((q));			\
+} while (0)
+
+#define blk_queue_unlock_irq(q)			\
+do {						\
+	blk_lock_stats_release((q));		\
+	spin_unlock_irq((q)->queue_lock);	\
+} while (0)
+
+#define blk_queue_lock_irqsave(q, flags)	\
+do {						\
+	local_irq_save((flags));		\
+	__blk_queue_lock((q));			\
+} while (0)
+
+#define blk_queue_unlock_irqrestore(q, flags)	\
+do {						\
+	blk_lock_stats_release((q));		\
+	spin_unlock_irqrestore((q)->queue_lock, (flags)); \
+} while (0)
+#else
+#define blk_queue_lock_irq(q)		spin_lock_irq((q)->queue_lock)
+#define blk_queue_unlock_irq(q)		spin_unlock_irq((q)->queue_lock)
+#define blk_queue_lock_irqsave(q, flags)	\
+	spin_lock_irqsave((q)->queue_lock, (flags))
+#define blk_queue_unlock_irqrestore(q, flags)	\
+	spin_unlock_irqrestore((q)->queue_lock, (flags))
+#endif
+
 /*
  * For the allocated request tables
  */
@@ -270,6 +342,7 @@ EXPORT_SYMBOL(blk_queue_make_request);
 static inline void rq_init(request_queue_t *q, struct request *rq)
 {
 	INIT_LIST_HEAD(&rq->queuelist);
+	INIT_LIST_HEAD(&rq->donelist);
 
 	rq->errors = 0;
 	rq->rq_status = RQ_ACTIVE;
@@ -1477,9 +1550,9 @@ EXPORT_SYMBOL(__generic_unplug_device);
  **/
 void generic_unplug_device(request_queue_t *q)
 {
-	spin_lock_irq(q->queue_lock);
+	blk_queue_lock_irq(q);
 	__generic_unplug_device(q);
-	spin_unlock_irq(q->queue_lock);
+	blk_queue_unlock_irq(q);
 }
 EXPORT_SYMBOL(generic_unplug_device);
 
@@ -1587,10 +1660,10 @@ void blk_run_queue(struct request_queue *q)
 {
 	unsigned long flags;
 
-	spin_lock_irqsave(q->queue_lock, flags);
+	blk_queue_lock_irqsave(q, flags);
 	blk_remove_plug(q);
 	q->request_fn(q);
-	spin_unlock_irqrestore(q->queue_lock, flags);
+	blk_queue_unlock_irqrestore(q, flags);
 }
 EXPORT_SYMBOL(blk_run_queue);
 
@@ -1612,6 +1685,7 @@ EXPORT_SYMBOL(blk_run_queue);
 void blk_cleanup_queue(request_queue_t * q)
 {
 	struct request_list *rl = &q->rq;
+	int cpu;
 
 	if (!atomic_dec_and_test(&q->refcnt))
 		return;
@@ -1621,6 +1695,15 @@ void blk_cleanup_queue(request_queue_t * q)
 
 	blk_sync_queue(q);
 
+	if (rl->rq_cache) {
+		for_each_cpu(cpu) {
+			struct request_cache *rc = per_cpu_ptr(rl->rq_cache, cpu);
+
+			while (rc->nr)
+				mempool_free(rc->rqs[--rc->nr], rl->rq_pool);
+		}
+		free_percpu(rl->rq_cache);
+	}
 	if (rl->rq_pool)
 		mempool_destroy(rl->rq_pool);
 
@@ -1649,6 +1732,9 @@ static int blk_init_free_list(request_queue_t *q)
 	if (!rl->rq_pool)
 		return -ENOMEM;
 
+	/* without it, requests just come from the mempool every time */
+	rl->rq_cache = alloc_percpu(struct request_cache);
+
 	return 0;
 }
 
@@ -1759,17 +1845,61 @@ int blk_get_queue(request_queue_t *q)
 
 EXPORT_SYMBOL(blk_get_queue);
 
+/*
+ * Freed requests are kept in a small per-cpu cache and handed out again on
+ * the same cpu, so that submission and completion running there allocate
+ * without going to the mempool and slab, and get a request which is still
+ * cache hot.  Requests are only cached while the mempool's reserve is full:
+ * it must stay available to every cpu for writeout under memory pressure.
+ */
+static struct request *blk_rq_cache_get(struct request_list *rl)
+{
+	struct request_cache *rc;
+	struct request *rq = NULL;
+	unsigned long flags;
+
+	if (!rl->rq_cache)
+		return NULL;
+
+	local_irq_save(flags);
+	rc = per_cpu_ptr(rl->rq_cache, smp_processor_id());
+	if (rc->nr)
+		rq = rc->rqs[--rc->nr];
+	local_irq_restore(flags);
+	return rq;
+}
+
+static void blk_rq_cache_put(struct request_list *rl, struct request *rq)
+{
+	struct request_cache *rc;
+	unsigned long flags;
+
+	if (rl->rq_cache && rl->rq_pool->curr_nr >= rl->rq_pool->min_nr) {
+		local_irq_save(flags);
+		rc = per_cpu_ptr(rl->rq_cache, smp_processor_id());
+		if (rc->nr < BLK_RQ_CACHE) {
+			rc->rqs[rc->nr++] = rq;
+			rq = NULL;
+		}
+		local_irq_restore(flags);
+	}
+	if (rq)
+		mempool_free(rq, rl->rq_pool);
+}
+
 static inline void blk_free_request(request_queue_t *q, struct request *rq)
 {
 	elv_put_request(q, rq);
-	mempool_free(rq, q->rq.rq_pool);
+	blk_rq_cache_put(&q->rq, rq);
 }
 
 static inline struct request *blk_alloc_request(request_queue_t *q, int rw,
 						int gfp_mask)
 {
-	struct request *rq = mempool_alloc(q->rq.rq_pool, gfp_mask);
+	struct request *rq = blk_rq_cache_get(&q->rq);
 
+	if (!rq)
+		rq = mempool_alloc(q->rq.rq_pool, gfp_mask);
 	if (!rq)
 		return NULL;
 
@@ -1782,7 +1912,7 @@ static inline struct request *blk_alloc_request(request_queue_t *q, int rw,
 	if (!elv_set_request(q, rq, gfp_mask))
 		return rq;
 
-	mempool_free(rq, q->rq.rq_pool);
+	blk_rq_cache_put(&q->rq, rq);
 	return NULL;
 }
 
@@ -1860,18 +1990,19 @@ static void freed_request(request_queue_t *q, int rw)
 
 #define blkdev_free_rq(list) list_entry((list)->next, struct request, queuelist)
 /*
- * Get a free request, queue_lock must not be held
+ * Reserve a request slot for the allocating process, taking the queue full
+ * and batching state and the io scheduler into account. queue_lock must be
+ * held. If this returns 1, the request itself must then be allocated with
+ * get_reserved_request() once the lock has been dropped.
  */
-static struct request *get_request(request_queue_t *q, int rw, int gfp_mask)
+static int __get_request_slot(request_queue_t *q, int rw,
+			      struct io_context *ioc)
 {
-	struct request *rq = NULL;
 	struct request_list *rl = &q->rq;
-	struct io_context *ioc = get_io_context(gfp_mask);
 
 	if (unlikely(test_bit(QUEUE_FLAG_DRAIN, &q->queue_flags)))
-		goto out;
+		return 0;
 
-	spin_lock_irq(q->queue_lock);
 	if (rl->count[rw]+1 >= q->nr_requests) {
 		/*
 		 * The queue will fill after this allocation, so set it as
@@ -1899,8 +2030,7 @@ static struct request *get_request(request_queue_t *q, int rw, int gfp_mask)
 		 * The queue is full and the allocating process is not a
 		 * "batcher", and not exempted by the IO scheduler
 		 */
-		spin_unlock_irq(q->queue_lock);
-		goto out;
+		return 0;
 	}
 
 get_rq:
@@ -1908,7 +2038,30 @@ get_rq:
 	rl->starved[rw] = 0;
 	if (rl->count[rw] >= queue_congestion_on_threshold(q))
 		set_queue_congested(q, rw);
-	spin_unlock_irq(q->queue_lock);
+	return 1;
+
+rq_starved:
+	/*
+	 * if no requests for this direction are pending, mark us starved
+	 * so that freeing of a request in the other direction will notice
+	 * us. another possible fix would be to split the rq mempool into
+	 * READ and WRITE
+	 */
+	if (unlikely(rl->count[rw] == 0))
+		rl->starved[rw] = 1;
+	return 0;
+}
+
+/*
+ * Allocate the request for a slot reserved by __get_request_slot(),
+ * queue_lock must not be held
+ */
+static struct request *get_reserved_request(request_queue_t *q, int rw,
+					    int gfp_mask,
+					    struct io_context *ioc)
+{
+	struct request_list *rl = &q->rq;
+	struct request *rq;
 
 	rq = blk_alloc_request(q, rw, gfp_mask);
 	if (!rq) {
@@ -1919,22 +2072,18 @@ get_rq:
 		 * Allocating task should really be put onto the front of the
 		 * wait queue, but this is pretty rare.
 		 */
-		spin_lock_irq(q->queue_lock);
+		blk_queue_lock_irq(q);
 		freed_request(q, rw);
 
 		/*
 		 * in the very unlikely event that allocation failed and no
 		 * requests for this direction was pending, mark us starved
-		 * so that freeing of a request in the other direction will
-		 * notice us. another possible fix would be to split the
-		 * rq mempool into READ and WRITE
 		 */
-rq_starved:
 		if (unlikely(rl->count[rw] == 0))
 			rl->starved[rw] = 1;
 
-		spin_unlock_irq(q->queue_lock);
-		goto out;
+		blk_queue_unlock_irq(q);
+		return NULL;
 	}
 
 	if (ioc_batching(q, ioc))
@@ -1942,6 +2091,27 @@ rq_starved:
 	
 	rq_init(q, rq);
 	rq->rl = rl;
+	return rq;
+}
+
+/*
+ * Get a free request, queue_lock must not be held
+ */
+static struct request *get_request(request_queue_t *q, int rw, int gfp_mask)
+{
+	struct request *rq = NULL;
+	struct io_context *ioc = get_io_context(gfp_mask);
+	int reserved;
+
+	if (unlikely(test_bit(QUEUE_FLAG_DRAIN, &q->queue_flags)))
+		goto out;
+
+	blk_queue_lock_irq(q);
+	reserved = __get_request_slot(q, rw, ioc);
+	blk_queue_unlock_irq(q);
+
+	if (reserved)
+		rq = get_reserved_request(q, rw, gfp_mask, ioc);
 out:
 	put_io_context(ioc);
 	return rq;
@@ -2398,9 +2568,9 @@ void blk_put_request(struct request *req)
 		unsigned long flags;
 		request_queue_t *q = req->q;
 
-		spin_lock_irqsave(q->queue_lock, flags);
+		blk_queue_lock_irqsave(q, flags);
 		__blk_put_request(q, req);
-		spin_unlock_irqrestore(q->queue_lock, flags);
+		blk_queue_unlock_irqrestore(q, flags);
 	}
 }
 
@@ -2559,7 +2729,8 @@ EXPORT_SYMBOL(__blk_attempt_remerge);
 static int __make_request(request_queue_t *q, struct bio *bio)
 {
 	struct request *req, *freereq = NULL;
-	int el_ret, rw, nr_sectors, cur_nr_sectors, barrier, err;
+	int el_ret, rw, nr_sectors, cur_nr_sectors, barrier, err, reserved;
+	struct io_context *ioc;
 	sector_t sector;
 
 	sector = bio->bi_sector;
@@ -2584,7 +2755,7 @@ static int __make_request(request_queue_t *q, struct bio *bio)
 	}
 
 again:
-	spin_lock_irq(q->queue_lock);
+	blk_queue_lock_irq(q);
 
 	if (elv_queue_empty(q)) {
 		blk_plug_device(q);
@@ -2654,8 +2825,19 @@ get_rq:
 		req = freereq;
 		freereq = NULL;
 	} else {
-		spin_unlock_irq(q->queue_lock);
-		if ((freereq = get_request(q, rw, GFP_ATOMIC)) == NULL) {
+		/*
+		 * reserve the request slot while we hold the lock anyway,
+		 * only the allocation itself has to be done unlocked
+		 */
+		ioc = get_io_context(GFP_ATOMIC);
+		reserved = __get_request_slot(q, rw, ioc);
+		blk_queue_unlock_irq(q);
+
+		if (reserved)
+			freereq = get_reserved_request(q, rw, GFP_ATOMIC, ioc);
+		put_io_context(ioc);
+
+		if (!freereq) {
 			/*
 			 * READA bit set
 			 */
@@ -2701,7 +2883,7 @@ out:
 	if (bio_sync(bio))
 		__generic_unplug_device(q);
 
-	spin_unlock_irq(q->queue_lock);
+	blk_queue_unlock_irq(q);
 	return 0;
 
 end_io:
@@ -3223,6 +3405,110 @@ void end_request(struct request *req, int uptodate)
 
 EXPORT_SYMBOL(end_request);
 
+static DEFINE_PER_CPU(struct list_head, blk_cpu_done);
+
+/**
+ * blk_queue_softirq_done - set the batched completion handler of a queue
+ * @q:    the request queue
+ * @fn:   the completion function
+ *
+ * Description:
+ *   Drivers that complete requests through blk_complete_request() must
+ *   provide @fn. It is called from softirq context with the queue lock
+ *   held, and must finish the request (typically end_that_request_first()
+ *   followed by end_that_request_last()).
+ **/
+void blk_queue_softirq_done(request_queue_t *q, softirq_done_fn *fn)
+{
+	q->softirq_done_fn = fn;
+}
+
+EXPORT_SYMBOL(blk_queue_softirq_done);
+
+/**
+ * blk_complete_request - end I/O on a request from hard irq context
+ * @req:      the request being processed
+ *
+ * Description:
+ *   Queues @req on a per-cpu list and defers the rest of the completion
+ *   to BLOCK_SOFTIRQ, so the driver interrupt handler doesn't need the
+ *   queue lock at all. The softirq completes everything queued on that
+ *   cpu in one go, taking the queue lock once per run of requests that
+ *   belong to the same queue instead of once per request.
+ **/
+void blk_complete_request(struct request *req)
+{
+	unsigned long flags;
+
+	BUG_ON(!req->q->softirq_done_fn);
+
+	local_irq_save(flags);
+	list_add_tail(&req->donelist, &__get_cpu_var(blk_cpu_done));
+	raise_softirq_irqoff(BLOCK_SOFTIRQ);
+	local_irq_restore(flags);
+}
+
+EXPORT_SYMBOL(blk_complete_request);
+
+static void blk_done_softirq(struct softirq_action *h)
+{
+	struct list_head local_list;
+	request_queue_t *q;
+	struct request *rq;
+
+	INIT_LIST_HEAD(&local_list);
+
+	local_irq_disable();
+	list_splice_init(&__get_cpu_var(blk_cpu_done), &local_list);
+	local_irq_enable();
+
+	while (!list_empty(&local_list)) {
+		rq = list_entry(local_list.next, struct request, donelist);
+		q = rq->q;
+
+		blk_queue_lock_irq(q);
+		do {
+			/*
+			 * the request may be freed by the completion, so
+			 * unlink it first
+			 */
+			list_del_init(&rq->donelist);
+			q->softirq_done_fn(rq);
+
+			if (list_empty(&local_list))
+				break;
+			rq = list_entry(local_list.next, struct request,
+					donelist);
+		} while (rq->q == q);
+		blk_queue_unlock_irq(q);
+	}
+}
+
+#ifdef CONFIG_HOTPLUG_CPU
+static int blk_cpu_notify(struct notifier_block *self, unsigned long action,
+			  void *hcpu)
+{
+	int cpu = (unsigned long) hcpu;
+
+	/*
+	 * move the completions of a dead cpu over to this one
+	 */
+	if (action == CPU_DEAD) {
+		local_irq_disable();
+		list_splice_init(&per_cpu(blk_cpu_done, cpu),
+				 &__get_cpu_var(blk_cpu_done));
+		raise_softirq_irqoff(BLOCK_SOFTIRQ);
+		local_irq_enable();
+	}
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block __devinitdata blk_cpu_notifier = {
+	.notifier_call	= blk_cpu_notify,
+};
+#endif /* CONFIG_HOTPLUG_CPU */
+
 void blk_rq_bio_prep(request_queue_t *q, struct request *rq, struct bio *bio)
 {
 	/* first three bits are identical in rq->flags and bio->bi_rw */
@@ -3255,6 +3541,8 @@ EXPORT_SYMBOL(kblockd_flush);
 
 int __init blk_dev_init(void)
 {
+	int i;
+
 	kblockd_workqueue = create_workqueue("kblockd");
 	if (!kblockd_workqueue)
 		panic("Failed to create kblockd\n");
@@ -3268,6 +3556,14 @@ int __init blk_dev_init(void)
 	iocontext_cachep = kmem_cache_create("blkdev_ioc",
 			sizeof(struct io_context), 0, SLAB_PANIC, NULL, NULL);
 
+	for (i = 0; i < NR_CPUS; i++)
+		INIT_LIST_HEAD(&per_cpu(blk_cpu_done, i));
+
+	open_softirq(BLOCK_SOFTIRQ, blk_done_softirq, NULL);
+#ifdef CONFIG_HOTPLUG_CPU
+	register_cpu_notifier(&blk_cpu_notifier);
+#endif
+
 	blk_max_low_pfn = max_low_pfn;
 	blk_max_pfn = max_pfn;
 
@@ -3523,6 +3819,33 @@ static ssize_t queue_max_hw_sectors_show(struct request_queue *q, char *page)
 }
 
 
+#ifdef CONFIG_BLK_DEV_LOCK_STATS
+/*
+ * acquired, contended, total and max hold time in cycles, writing
+ * anything resets them
+ */
+static ssize_t queue_lock_stats_show(struct request_queue *q, char *page)
+{
+	struct blk_lock_stats *ls = &q->lock_stats;
+
+	return sprintf(page, "%lu %lu %llu %llu\n", ls->acquired,
+			ls->contended, ls->hold_total,
+			(unsigned long long) ls->hold_max);
+}
+
+static ssize_t
+queue_lock_stats_store(struct request_queue *q, const char *page, size_t count)
+{
+	struct blk_lock_stats *ls = &q->lock_stats;
+
+	spin_lock_irq(q->queue_lock);
+	ls->acquired = ls->contended = 0;
+	ls->hold_total = ls->hold_max = 0;
+	spin_unlock_irq(q->queue_lock);
+	return count;
+}
+#endif
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -3552,12 +3875,23 @@ static struct queue_sysfs_entry queue_iosched_entry = {
 	.store = elv_iosched_store,
 };
 
+#ifdef CONFIG_BLK_DEV_LOCK_STATS
+static struct queue_sysfs_entry queue_lock_stats_entry = {
+	.attr = {.name = "lock_stats", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_lock_stats_show,
+	.store = queue_lock_stats_store,
+};
+#endif
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
 	&queue_max_hw_sectors_entry.attr,
 	&queue_max_sectors_entry.attr,
 	&queue_iosched_entry.attr,
+#ifdef CONFIG_BLK_DEV_LOCK_STATS
+	&queue_lock_stats_entry.attr,
+#endif
 	NULL,
 };
 
@@ -10,6 +10,7 @@
 
 #include <linux/config.h>
 #include <linux/mm.h>
+#include <linux/huge_mm.h>
 #include <linux/miscdevice.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
@@ -558,6 +559,9 @@ static inline size_t read_zero_pagealigned(char __user * buf, size_t size)
 			goto out_up;
 		if (vma->vm_flags & (VM_SHARED | VM_HUGETLB))
 			break;
+		/* Don't break up huge pages for zero pages */
+		if (vma_huge_anon(vma))
+			break;
 		count = vma->vm_end - addr;
 		if (count > size)
 			count = size;
@@ -81,6 +81,23 @@ int __ide_end_request(ide_drive_t *drive, struct request *rq, int uptodate,
 		HWGROUP(drive)->hwif->ide_dma_on(drive);
 	}
 
+	/*
+	 * a file system request finishing in one go is taken off the drive
+	 * here, so the next one can be started, and finished in the block
+	 * softirq with the others that completed on this cpu
+	 */
+	if (blk_fs_request(rq) && !blk_barrier_rq(rq) &&
+	    nr_sectors >= rq->hard_nr_sectors) {
+		if (blk_rq_tagged(rq))
+			blk_queue_end_tag(drive->queue, rq);
+
+		blkdev_dequeue_request(rq);
+		HWGROUP(drive)->rq = NULL;
+		rq->errors = uptodate;
+		blk_complete_request(rq);
+		return 0;
+	}
+
 	if (!end_that_request_first(rq, uptodate, nr_sectors)) {
 		add_disk_randomness(rq->rq_disk);
 
@@ -96,6 +113,24 @@ int __ide_end_request(ide_drive_t *drive, struct request *rq, int uptodate,
 }
 EXPORT_SYMBOL(__ide_end_request);
 
+/**
+ *	ide_softirq_done	-	finish a request completed in one go
+ *	@rq: request handed to blk_complete_request() by __ide_end_request()
+ *
+ *	Called from the block softirq with ide_lock held. rq->errors holds
+ *	the uptodate value the request was completed with.
+ */
+
+void ide_softirq_done(struct request *rq)
+{
+	int uptodate = rq->errors;
+
+	rq->errors = 0;
+	add_disk_randomness(rq->rq_disk);
+	end_that_request_first(rq, uptodate, rq->hard_nr_sectors);
+	end_that_request_last(rq);
+}
+
 /**
  *	ide_end_request		-	complete an IDE I/O
  *	@drive: IDE device for the I/O
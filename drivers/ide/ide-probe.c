@@ -983,6 +983,7 @@ static int ide_init_queue(ide_drive_t *drive)
 
 	q->queuedata = drive;
 	blk_queue_segment_boundary(q, 0xffff);
+	blk_queue_softirq_done(q, ide_softirq_done);
 
 	if (!hwif->rqsize) {
 		if (hwif->no_lba48 || hwif->no_lba48_dma)
@@ -67,6 +67,8 @@ void cache_readahead(struct address_space *mapping, int index)
 			break;
 		}
 		page = radix_tree_lookup(&mapping->page_tree, pagei);
+		if (page && radix_tree_exceptional_entry(page))
+			page = NULL;
 		if (page && (!i))
 			break;
 		if (page)
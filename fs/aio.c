@@ -29,6 +29,7 @@
 #include <linux/highmem.h>
 #include <linux/workqueue.h>
 #include <linux/security.h>
+#include <linux/vmacache.h>
 
 #include <asm/kmap_types.h>
 #include <asm/uaccess.h>
@@ -577,6 +578,7 @@ static void use_mm(struct mm_struct *mm)
 	tsk->active_mm = mm;
 	activate_mm(active_mm, mm);
 	task_unlock(tsk);
+	vmacache_flush(tsk);
 
 	mmdrop(active_mm);
 }
@@ -1680,7 +1680,8 @@ static void __init dcache_init(unsigned long mempages)
 					 SLAB_RECLAIM_ACCOUNT|SLAB_PANIC,
 					 NULL, NULL);
 	
-	set_shrinker(DEFAULT_SEEKS, shrink_dcache_memory);
+	/* Small batches: prune_dcache() works under the global dcache_lock */
+	set_shrinker(DEFAULT_SEEKS, 32, shrink_dcache_memory);
 
 	/* Hash may have been set up in dcache_init_early */
 	if (!hashdist)
@@ -97,6 +97,98 @@ read_block_bitmap(struct super_block *sb, unsigned int block_group)
 error_out:
 	return bh;
 }
+
+/*
+ * Free space summaries
+ * --------------------
+ * To avoid reading and searching the bitmaps of groups which cannot satisfy
+ * a multi-block request, we remember the length of the longest run of free
+ * blocks seen in each group's bitmap.  The figure is computed the first time
+ * the allocator searches the bitmap and is an upper bound from then on:
+ * allocations can only shorten the free runs, while ext3_free_blocks_sb()
+ * raises it to the length of the run the freed blocks have joined, or makes
+ * it unknown again if that run is too long to measure there.  It is a
+ * hint only; a request which no group
+ * appears able to satisfy in full is still served from fragmented space.
+ */
+#define EXT3_MAX_RUN_UNKNOWN	(~0U)
+
+static unsigned int ext3_group_max_run(struct super_block *sb,
+				       unsigned int group)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+
+	if (!sbi->s_group_max_run || group >= sbi->s_group_summaries)
+		return EXT3_MAX_RUN_UNKNOWN;
+	return sbi->s_group_max_run[group];
+}
+
+/* Free blocks looked at on each side of a freed extent */
+#define EXT3_MAX_RUN_SCAN	256
+
+/*
+ * Blocks @start to @start + @len - 1 of the group have just been freed in
+ * @bitmap_bh: measure the free run they are now part of.  Called under the
+ * group's sb_bgl_lock, which the bitmap's bit operations also take, so the
+ * scan is bounded: a run reaching further than EXT3_MAX_RUN_SCAN on either
+ * side leaves the group's figure unknown, for the allocator to recompute
+ * when it next reads the bitmap.
+ */
+static void ext3_raise_max_run(struct super_block *sb, unsigned int group,
+			struct buffer_head *bitmap_bh, unsigned int start,
+			unsigned int len)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+	unsigned int nbits = EXT3_BLOCKS_PER_GROUP(sb);
+	unsigned int end = start + len;
+	unsigned int low, high;
+
+	if (ext3_group_max_run(sb, group) == EXT3_MAX_RUN_UNKNOWN)
+		return;
+	low = start > EXT3_MAX_RUN_SCAN ? start - EXT3_MAX_RUN_SCAN : 0;
+	high = min(end + EXT3_MAX_RUN_SCAN, nbits);
+	while (start > low && !ext3_test_bit(start - 1, bitmap_bh->b_data))
+		start--;
+	while (end < high && !ext3_test_bit(end, bitmap_bh->b_data))
+		end++;
+	if ((start == low && low > 0 &&
+	     !ext3_test_bit(start - 1, bitmap_bh->b_data)) ||
+	    (end == high && high < nbits &&
+	     !ext3_test_bit(end, bitmap_bh->b_data)))
+		sbi->s_group_max_run[group] = EXT3_MAX_RUN_UNKNOWN;
+	else if (end - start > sbi->s_group_max_run[group])
+		sbi->s_group_max_run[group] = end - start;
+}
+
+static void ext3_update_max_run(struct super_block *sb, unsigned int group,
+				struct buffer_head *bitmap_bh)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+	unsigned char *bitmap = (unsigned char *)bitmap_bh->b_data;
+	unsigned int nbits = EXT3_BLOCKS_PER_GROUP(sb);
+	unsigned int i = 0, start, best = 0;
+
+	if (ext3_group_max_run(sb, group) != EXT3_MAX_RUN_UNKNOWN ||
+	    !sbi->s_group_max_run || group >= sbi->s_group_summaries)
+		return;
+
+	while (i < nbits) {
+		i = ext3_find_next_zero_bit(bitmap, nbits, i);
+		if (i >= nbits)
+			break;
+		start = i;
+		while (i < nbits && !ext3_test_bit(i, bitmap)) {
+			if (!(i & 7) && i + 8 <= nbits && !bitmap[i >> 3])
+				i += 8;
+			else
+				i++;
+		}
+		if (i - start > best)
+			best = i - start;
+	}
+	sbi->s_group_max_run[group] = best;
+}
+
 /*
  * The reservation window structure operations
  * --------------------------------------------
@@ -465,6 +557,7 @@ do_more:
 	desc->bg_free_blocks_count =
 		cpu_to_le16(le16_to_cpu(desc->bg_free_blocks_count) +
 			group_freed);
+	ext3_raise_max_run(sb, block_group, bitmap_bh, bit, count);
 	spin_unlock(sb_bgl_lock(sbi, block_group));
 	percpu_counter_mod(&sbi->s_freeblocks_counter, count);
 
@@ -649,12 +742,18 @@ claim_block(spinlock_t *lock, int block, struct buffer_head *bh)
  * If we failed to allocate the desired block then we may end up crossing to a
  * new bitmap.  In that case we must release write access to the old one via
  * ext3_journal_release_buffer(), else we'll run out of credits.
+ *
+ * Once the first block is claimed we keep claiming the blocks which follow
+ * it, up to *count of them or the end of the window.  On return *count holds
+ * the number of contiguous blocks actually claimed.
  */
 static int
 ext3_try_to_allocate(struct super_block *sb, handle_t *handle, int group,
-	struct buffer_head *bitmap_bh, int goal, struct ext3_reserve_window *my_rsv)
+	struct buffer_head *bitmap_bh, int goal, unsigned long *count,
+	struct ext3_reserve_window *my_rsv)
 {
 	int group_first_block, start, end;
+	unsigned long num = 0;
 
 	/* we do allocation within the reservation window if we have a window */
 	if (my_rsv) {
@@ -712,8 +811,18 @@ repeat:
 			goto fail_access;
 		goto repeat;
 	}
-	return goal;
+	num++;
+	goal++;
+	while (num < *count && goal < end
+		&& ext3_test_allocatable(goal, bitmap_bh)
+		&& claim_block(sb_bgl_lock(EXT3_SB(sb), group), goal, bitmap_bh)) {
+		num++;
+		goal++;
+	}
+	*count = num;
+	return goal - num;
 fail_access:
+	*count = num;
 	return -1;
 }
 
@@ -996,6 +1105,49 @@ failed:
 	return -1;		/* failed */
 }
 
+/**
+ *	try_to_extend_reservation()
+ *	@my_rsv:		given reservation window
+ *	@sb:			super block
+ *	@size:			the delta to extend
+ *
+ *	Attempt to expand the reservation window large enough to have
+ *	required number of free blocks
+ *
+ *	Since ext3_try_to_allocate() will always allocate blocks within
+ *	the reservation window range, if the window size is too small,
+ *	multiple blocks allocation has to stop at the end of the reservation
+ *	window. To make this more efficient, given the total number of
+ *	blocks needed and the current size of the window, we try to
+ *	expand the reservation window size if necessary on a best-effort
+ *	basis before ext3_new_blocks() tries to allocate blocks,
+ */
+static void try_to_extend_reservation(struct ext3_reserve_window_node *my_rsv,
+			struct super_block *sb, int size)
+{
+	struct ext3_reserve_window_node *next_rsv;
+	struct rb_node *next;
+	spinlock_t *rsv_lock = &EXT3_SB(sb)->s_rsv_window_lock;
+
+	if (!spin_trylock(rsv_lock))
+		return;
+
+	next = rb_next(&my_rsv->rsv_node);
+
+	if (!next)
+		my_rsv->rsv_end += size;
+	else {
+		next_rsv = list_entry(next, struct ext3_reserve_window_node,
+					rsv_node);
+
+		if ((next_rsv->rsv_start - my_rsv->rsv_end - 1) >= size)
+			my_rsv->rsv_end += size;
+		else
+			my_rsv->rsv_end = next_rsv->rsv_start - 1;
+	}
+	spin_unlock(rsv_lock);
+}
+
 /*
  * This is the main function used to allocate a new block and its reservation
  * window.
@@ -1016,17 +1168,20 @@ failed:
  * The insert, remove and find a free space(non-reserved) operations for the
  * sorted double linked list should be fast.
  *
+ * *count is the number of blocks wanted; on success it is updated to the
+ * number of contiguous blocks allocated starting at the returned block.
  */
 static int
 ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 			unsigned int group, struct buffer_head *bitmap_bh,
 			int goal, struct ext3_reserve_window_node * my_rsv,
-			int *errp)
+			unsigned long *count, int *errp)
 {
 	spinlock_t *rsv_lock;
 	unsigned long group_first_block;
 	int ret = 0;
 	int fatal;
+	unsigned long num = *count;
 
 	*errp = 0;
 
@@ -1049,7 +1204,8 @@ ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 	 * or last attempt to allocate a block with reservation turned on failed
 	 */
 	if (my_rsv == NULL ) {
-		ret = ext3_try_to_allocate(sb, handle, group, bitmap_bh, goal, NULL);
+		ret = ext3_try_to_allocate(sb, handle, group, bitmap_bh, goal,
+					   count, NULL);
 		goto out;
 	}
 	rsv_lock = &EXT3_SB(sb)->s_rsv_window_lock;
@@ -1085,6 +1241,8 @@ ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 
 		if (rsv_is_empty(&rsv_copy) || (ret < 0) ||
 			!goal_in_my_reservation(&rsv_copy, goal, group, sb)) {
+			if (my_rsv->rsv_goal_size < *count)
+				my_rsv->rsv_goal_size = *count;
 			spin_lock(rsv_lock);
 			ret = alloc_new_reservation(my_rsv, goal, sb,
 							group, bitmap_bh);
@@ -1096,16 +1254,23 @@ ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 
 			if (!goal_in_my_reservation(&rsv_copy, goal, group, sb))
 				goal = -1;
+		} else if (goal >= 0 && (rsv_copy._rsv_end -
+				(group_first_block + goal) + 1) < *count) {
+			try_to_extend_reservation(my_rsv, sb, *count -
+				(rsv_copy._rsv_end - (group_first_block + goal) + 1));
+			rsv_copy._rsv_end = my_rsv->rsv_end;
 		}
 		if ((rsv_copy._rsv_start >= group_first_block + EXT3_BLOCKS_PER_GROUP(sb))
 		    || (rsv_copy._rsv_end < group_first_block))
 			BUG();
 		ret = ext3_try_to_allocate(sb, handle, group, bitmap_bh, goal,
-					   &rsv_copy);
+					   &num, &rsv_copy);
 		if (ret >= 0) {
-			my_rsv->rsv_alloc_hit++;
+			my_rsv->rsv_alloc_hit += num;
+			*count = num;
 			break;				/* succeed */
 		}
+		num = *count;
 	}
 out:
 	if (ret >= 0) {
@@ -1124,13 +1289,22 @@ out:
 	return ret;
 }
 
-static int ext3_has_free_blocks(struct ext3_sb_info *sbi)
+/*
+ * Blocks promised to delayed-allocation writers (s_dirtyblocks_counter)
+ * are not really free: they will be allocated at writeback time.
+ */
+static int ext3_has_free_blocks(struct ext3_sb_info *sbi,
+				unsigned long nblocks)
 {
-	int free_blocks, root_blocks;
+	long free_blocks, root_blocks;
 
-	free_blocks = percpu_counter_read_positive(&sbi->s_freeblocks_counter);
+	free_blocks = percpu_counter_read_positive(&sbi->s_freeblocks_counter) -
+		percpu_counter_read_positive(&sbi->s_dirtyblocks_counter);
 	root_blocks = le32_to_cpu(sbi->s_es->s_r_blocks_count);
-	if (free_blocks < root_blocks + 1 && !capable(CAP_SYS_RESOURCE) &&
+	if (free_blocks < (long)nblocks)
+		return 0;
+	if (free_blocks < root_blocks + (long)nblocks &&
+		!capable(CAP_SYS_RESOURCE) &&
 		sbi->s_resuid != current->fsuid &&
 		(sbi->s_resgid == 0 || !in_group_p (sbi->s_resgid))) {
 		return 0;
@@ -1138,6 +1312,27 @@ static int ext3_has_free_blocks(struct ext3_sb_info *sbi)
 	return 1;
 }
 
+/**
+ * ext3_claim_free_blocks() -- set blocks aside for delayed allocation
+ * @sb:			superblock
+ * @nblocks:		number of blocks wanted
+ *
+ * Account @nblocks as promised to a delayed-allocation writer, so that
+ * nobody else can allocate them before writeback does.  Returns 0 on
+ * success or -ENOSPC.  The caller gives them back by decrementing
+ * s_dirtyblocks_counter, which ext3_new_blocks() also does as it
+ * allocates reserved blocks.
+ */
+int ext3_claim_free_blocks(struct super_block *sb, unsigned long nblocks)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+
+	if (!ext3_has_free_blocks(sbi, nblocks))
+		return -ENOSPC;
+	percpu_counter_mod(&sbi->s_dirtyblocks_counter, nblocks);
+	return 0;
+}
+
 /*
  * ext3_should_retry_alloc() is called when ENOSPC is returned, and if
  * it is profitable to retry the operation, this function will wait
@@ -1146,7 +1341,7 @@ static int ext3_has_free_blocks(struct ext3_sb_info *sbi)
  */
 int ext3_should_retry_alloc(struct super_block *sb, int *retries)
 {
-	if (!ext3_has_free_blocks(EXT3_SB(sb)) || (*retries)++ > 3)
+	if (!ext3_has_free_blocks(EXT3_SB(sb), 1) || (*retries)++ > 3)
 		return 0;
 
 	jbd_debug(1, "%s: retrying operation after ENOSPC\n", sb->s_id);
@@ -1155,15 +1350,25 @@ int ext3_should_retry_alloc(struct super_block *sb, int *retries)
 }
 
 /*
- * ext3_new_block uses a goal block to assist allocation.  If the goal is
+ * ext3_new_blocks uses a goal block to assist allocation.  If the goal is
  * free, or there is a free block within 32 blocks of the goal, that block
  * is allocated.  Otherwise a forward search is made for a free block; within 
  * each block group the search first looks for an entire free byte in the block
  * bitmap, and then for any free bit if that fails.
+ *
+ * Up to *count blocks are allocated as one contiguous run starting at the
+ * returned block; *count is updated to the number actually allocated, which
+ * may be fewer than asked for but is never zero on success.
  * This function also updates quota and i_blocks field.
+ *
+ * The first @reserved of the blocks asked for were already charged to quota
+ * and set aside by ext3_claim_free_blocks() at write() time (delayed
+ * allocation), so they are neither charged again nor refused for lack of
+ * free space.
  */
-int ext3_new_block(handle_t *handle, struct inode *inode,
-			unsigned long goal, int *errp)
+int ext3_new_blocks(handle_t *handle, struct inode *inode,
+			unsigned long goal, unsigned long *count,
+			unsigned long reserved, int *errp)
 {
 	struct buffer_head *bitmap_bh = NULL;
 	struct buffer_head *gdp_bh;
@@ -1186,6 +1391,8 @@ int ext3_new_block(handle_t *handle, struct inode *inode,
 	static int goal_hits, goal_attempts;
 #endif
 	unsigned long ngroups;
+	unsigned long num = *count;
+	int whole_run;
 
 	*errp = -ENOSPC;
 	sb = inode->i_sb;
@@ -1194,16 +1401,30 @@ int ext3_new_block(handle_t *handle, struct inode *inode,
 		return 0;
 	}
 
+	sbi = EXT3_SB(sb);
+	es = EXT3_SB(sb)->s_es;
+
+	if (reserved > num)
+		reserved = num;
+	if (num > reserved && !ext3_has_free_blocks(sbi, num - reserved)) {
+		/* Only the first block is required, the rest is best effort */
+		if (reserved)
+			/* Make do with what was set aside at write() time */
+			*count = num = reserved;
+		else if (ext3_has_free_blocks(sbi, 1))
+			*count = num = 1;
+		else
+			return 0;
+	}
+
 	/*
-	 * Check quota for allocation of this block.
+	 * Check quota for allocation of these blocks.
 	 */
-	if (DQUOT_ALLOC_BLOCK(inode, 1)) {
+	if (num > reserved && DQUOT_ALLOC_BLOCK(inode, num - reserved)) {
 		*errp = -EDQUOT;
 		return 0;
 	}
 
-	sbi = EXT3_SB(sb);
-	es = EXT3_SB(sb)->s_es;
 	ext3_debug("goal=%lu.\n", goal);
 	/*
 	 * Allocate a block from reservation only when
@@ -1217,11 +1438,6 @@ int ext3_new_block(handle_t *handle, struct inode *inode,
 	if (block_i && ((windowsz = block_i->rsv_window_node.rsv_goal_size) > 0))
 		my_rsv = &block_i->rsv_window_node;
 
-	if (!ext3_has_free_blocks(sbi)) {
-		*errp = -ENOSPC;
-		goto out;
-	}
-
 	/*
 	 * First, test whether the goal block is free.
 	 */
@@ -1236,6 +1452,7 @@ int ext3_new_block(handle_t *handle, struct inode *inode,
 
 	goal_group = group_no;
 retry:
+	whole_run = (*count > 1);
 	free_blocks = le16_to_cpu(gdp->bg_free_blocks_count);
 	/*
 	 * if there is not enough free blocks to make a new resevation
@@ -1251,8 +1468,10 @@ retry:
 		bitmap_bh = read_block_bitmap(sb, group_no);
 		if (!bitmap_bh)
 			goto io_error;
+		ext3_update_max_run(sb, group_no, bitmap_bh);
 		ret_block = ext3_try_to_allocate_with_rsv(sb, handle, group_no,
-					bitmap_bh, ret_block, my_rsv, &fatal);
+					bitmap_bh, ret_block, my_rsv,
+					&num, &fatal);
 		if (fatal)
 			goto out;
 		if (ret_block >= 0)
@@ -1266,6 +1485,7 @@ retry:
 	 * Now search the rest of the groups.  We assume that 
 	 * i and gdp correctly point to the last group visited.
 	 */
+search_groups:
 	for (bgi = 0; bgi < ngroups; bgi++) {
 		group_no++;
 		if (group_no >= ngroups)
@@ -1283,18 +1503,33 @@ retry:
 		 */
 		if (free_blocks <= (windowsz/2))
 			continue;
+		/*
+		 * On the first pass, only look at groups which may hold
+		 * the whole request in one run.
+		 */
+		if (whole_run && (free_blocks < *count ||
+				ext3_group_max_run(sb, group_no) < *count))
+			continue;
 
 		brelse(bitmap_bh);
 		bitmap_bh = read_block_bitmap(sb, group_no);
 		if (!bitmap_bh)
 			goto io_error;
+		ext3_update_max_run(sb, group_no, bitmap_bh);
+		if (whole_run && ext3_group_max_run(sb, group_no) < *count)
+			continue;
+		num = *count;
 		ret_block = ext3_try_to_allocate_with_rsv(sb, handle, group_no,
-					bitmap_bh, -1, my_rsv, &fatal);
+					bitmap_bh, -1, my_rsv, &num, &fatal);
 		if (fatal)
 			goto out;
 		if (ret_block >= 0) 
 			goto allocated;
 	}
+	if (whole_run) {
+		whole_run = 0;
+		goto search_groups;
+	}
 	/*
 	 * We may end up a bogus ealier ENOSPC error due to
 	 * filesystem is "full" of reservations, but
@@ -1305,6 +1540,7 @@ retry:
 	if (my_rsv) {
 		my_rsv = NULL;
 		group_no = goal_group;
+		num = *count;
 		goto retry;
 	}
 	/* No space left on the device */
@@ -1324,13 +1560,15 @@ allocated:
 	target_block = ret_block + group_no * EXT3_BLOCKS_PER_GROUP(sb)
 				+ le32_to_cpu(es->s_first_data_block);
 
-	if (target_block == le32_to_cpu(gdp->bg_block_bitmap) ||
-	    target_block == le32_to_cpu(gdp->bg_inode_bitmap) ||
+	if (in_range(le32_to_cpu(gdp->bg_block_bitmap), target_block, num) ||
+	    in_range(le32_to_cpu(gdp->bg_inode_bitmap), target_block, num) ||
 	    in_range(target_block, le32_to_cpu(gdp->bg_inode_table),
+		      EXT3_SB(sb)->s_itb_per_group) ||
+	    in_range(target_block + num - 1, le32_to_cpu(gdp->bg_inode_table),
 		      EXT3_SB(sb)->s_itb_per_group))
 		ext3_error(sb, "ext3_new_block",
 			    "Allocating block in system zone - "
-			    "block = %u", target_block);
+			    "blocks from %u, length %lu", target_block, num);
 
 	performed_allocation = 1;
 
@@ -1349,10 +1587,14 @@ allocated:
 	jbd_lock_bh_state(bitmap_bh);
 	spin_lock(sb_bgl_lock(sbi, group_no));
 	if (buffer_jbd(bitmap_bh) && bh2jh(bitmap_bh)->b_committed_data) {
-		if (ext3_test_bit(ret_block,
-				bh2jh(bitmap_bh)->b_committed_data)) {
-			printk("%s: block was unexpectedly set in "
-				"b_committed_data\n", __FUNCTION__);
+		int i;
+
+		for (i = 0; i < num; i++) {
+			if (ext3_test_bit(ret_block + i,
+					bh2jh(bitmap_bh)->b_committed_data)) {
+				printk("%s: block was unexpectedly set in "
+					"b_committed_data\n", __FUNCTION__);
+			}
 		}
 	}
 	ext3_debug("found bit %d\n", ret_block);
@@ -1363,7 +1605,7 @@ allocated:
 	/* ret_block was blockgroup-relative.  Now it becomes fs-relative */
 	ret_block = target_block;
 
-	if (ret_block >= le32_to_cpu(es->s_blocks_count)) {
+	if (ret_block + num - 1 >= le32_to_cpu(es->s_blocks_count)) {
 		ext3_error(sb, "ext3_new_block",
 			    "block(%d) >= blocks count(%d) - "
 			    "block_group = %d, es == %p ", ret_block,
@@ -1381,9 +1623,12 @@ allocated:
 
 	spin_lock(sb_bgl_lock(sbi, group_no));
 	gdp->bg_free_blocks_count =
-			cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) - 1);
+			cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) - num);
 	spin_unlock(sb_bgl_lock(sbi, group_no));
-	percpu_counter_mod(&sbi->s_freeblocks_counter, -1);
+	percpu_counter_mod(&sbi->s_freeblocks_counter, -num);
+	if (reserved)
+		percpu_counter_mod(&sbi->s_dirtyblocks_counter,
+				   -(long)min(num, reserved));
 
 	BUFFER_TRACE(gdp_bh, "journal_dirty_metadata for group descriptor");
 	err = ext3_journal_dirty_metadata(handle, gdp_bh);
@@ -1396,6 +1641,10 @@ allocated:
 
 	*errp = 0;
 	brelse(bitmap_bh);
+	/* Give back the quota we charged for blocks we did not get */
+	if (max(num, reserved) < *count)
+		DQUOT_FREE_BLOCK(inode, *count - max(num, reserved));
+	*count = num;
 	return ret_block;
 
 io_error:
@@ -1408,12 +1657,20 @@ out:
 	/*
 	 * Undo the block allocation
 	 */
-	if (!performed_allocation)
-		DQUOT_FREE_BLOCK(inode, 1);
+	if (!performed_allocation && *count > reserved)
+		DQUOT_FREE_BLOCK(inode, *count - reserved);
 	brelse(bitmap_bh);
 	return 0;
 }
 
+int ext3_new_block(handle_t *handle, struct inode *inode,
+			unsigned long goal, int *errp)
+{
+	unsigned long count = 1;
+
+	return ext3_new_blocks(handle, inode, goal, &count, 0, errp);
+}
+
 unsigned long ext3_count_free_blocks(struct super_block *sb)
 {
 	unsigned long desc_count;
@@ -233,16 +233,6 @@ no_delete:
 	clear_inode(inode);	/* We must guarantee clearing of inode... */
 }
 
-static int ext3_alloc_block (handle_t *handle,
-			struct inode * inode, unsigned long goal, int *err)
-{
-	unsigned long result;
-
-	result = ext3_new_block(handle, inode, goal, err);
-	return result;
-}
-
-
 typedef struct {
 	__le32	*p;
 	__le32	key;
@@ -267,8 +257,10 @@ static inline int verify_chain(Indirect *from, Indirect *to)
  *	@inode: inode in question (we are only interested in its superblock)
  *	@i_block: block number to be parsed
  *	@offsets: array to store the offsets in
- *      @boundary: set this non-zero if the referred-to block is likely to be
- *             followed (on disk) by an indirect block.
+ *      @boundary: set this to the number of blocks which follow the
+ *             referred-to block within the same indirect block (or the
+ *             inode), i.e. how many more can be mapped before the next
+ *             mapping needs another indirect block.
  *
  *	To store the locations of file's data ext3 uses a data structure common
  *	for UNIX filesystems - tree of pointers anchored in the inode, with
@@ -328,7 +320,7 @@ static int ext3_block_to_path(struct inode *inode,
 		ext3_warning (inode->i_sb, "ext3_block_to_path", "block > big");
 	}
 	if (boundary)
-		*boundary = (i_block & (ptrs - 1)) == (final - 1);
+		*boundary = final - 1 - (i_block & (ptrs - 1));
 	return n;
 }
 
@@ -481,95 +473,340 @@ static int ext3_find_goal(struct inode *inode, long block, Indirect chain[4],
 	return -EAGAIN;
 }
 
+/**
+ *	ext3_blks_to_allocate - count the direct blocks to allocate for a branch
+ *	@branch: chain of indirect blocks
+ *	@k: number of blocks needed for indirect blocks
+ *	@blks: number of data blocks to be mapped
+ *	@blocks_to_boundary: the offset in the indirect block
+ *
+ *	Return the number of direct blocks which can be allocated in one go
+ *	for the given branch.  We never go past the end of the indirect
+ *	block (or of the inode's direct blocks), and where the indirect block
+ *	already exists we stop at the first slot which is already mapped.
+ */
+static int ext3_blks_to_allocate(Indirect *branch, int k, unsigned long blks,
+		int blocks_to_boundary)
+{
+	unsigned long count = 0;
+
+	/*
+	 * Simple case, [t,d]Indirect block(s) has not allocated yet
+	 * then it's clear blocks on that path have not allocated
+	 */
+	if (k > 0) {
+		/* right now we don't handle cross boundary allocation */
+		if (blks < blocks_to_boundary + 1)
+			count += blks;
+		else
+			count += blocks_to_boundary + 1;
+		return count;
+	}
+
+	count++;
+	while (count < blks && count <= blocks_to_boundary &&
+		le32_to_cpu(*(branch[0].p + count)) == 0) {
+		count++;
+	}
+	return count;
+}
+
+/*
+ * Delayed allocation accounting.  For each buffer it leaves delayed,
+ * ext3_da_get_block_prep() sets aside one data block, plus whatever it
+ * takes to keep a worst-case estimate of the indirect blocks needed to map
+ * all of the inode's delayed data.  Everything set aside is charged to
+ * quota (without dirtying the inode: ext3_do_update_inode() leaves it out
+ * of the on-disk i_blocks) and counted in s_dirtyblocks_counter.  The
+ * allocator consumes the reservation at writeback time; truncate gives back
+ * what was never allocated.
+ */
+static unsigned long ext3_da_meta_estimate(struct inode *inode,
+					   unsigned long data)
+{
+	unsigned long ptrs = EXT3_ADDR_PER_BLOCK(inode->i_sb);
+	unsigned long ind, dind;
+
+	if (!data)
+		return 0;
+	ind = data / ptrs + 1;
+	dind = ind / ptrs + 1;
+	return ind + dind + 1;
+}
+
+static int ext3_da_reserve_space(struct inode *inode)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	unsigned long md_wanted, md_needed = 0;
+	int err;
+
+	spin_lock(&ei->i_da_lock);
+	md_wanted = ext3_da_meta_estimate(inode, ei->i_da_data_blocks + 1);
+	if (md_wanted > ei->i_da_meta_blocks)
+		md_needed = md_wanted - ei->i_da_meta_blocks;
+	spin_unlock(&ei->i_da_lock);
+
+	if (DQUOT_ALLOC_BLOCK_NODIRTY(inode, md_needed + 1))
+		return -EDQUOT;
+	err = ext3_claim_free_blocks(inode->i_sb, md_needed + 1);
+	if (err) {
+		DQUOT_FREE_BLOCK_NODIRTY(inode, md_needed + 1);
+		return err;
+	}
+
+	spin_lock(&ei->i_da_lock);
+	ei->i_da_data_blocks++;
+	ei->i_da_meta_blocks += md_needed;
+	spin_unlock(&ei->i_da_lock);
+	return 0;
+}
+
+/*
+ * Give back the reservation for @to_free delayed data blocks which will
+ * never be allocated, along with any indirect blocks no longer needed.
+ */
+static void ext3_da_release_space(struct inode *inode, unsigned long to_free)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	unsigned long md_wanted;
+
+	spin_lock(&ei->i_da_lock);
+	/*
+	 * Allocations for buffers which were not delayed (mmap writes
+	 * into holes) may have eaten into the reservation already.
+	 */
+	if (to_free > ei->i_da_data_blocks)
+		to_free = ei->i_da_data_blocks;
+	ei->i_da_data_blocks -= to_free;
+	md_wanted = ext3_da_meta_estimate(inode, ei->i_da_data_blocks);
+	if (ei->i_da_meta_blocks > md_wanted) {
+		to_free += ei->i_da_meta_blocks - md_wanted;
+		ei->i_da_meta_blocks = md_wanted;
+	}
+	spin_unlock(&ei->i_da_lock);
+
+	if (!to_free)
+		return;
+	percpu_counter_mod(&EXT3_SB(inode->i_sb)->s_dirtyblocks_counter,
+			   -(long)to_free);
+	DQUOT_FREE_BLOCK_NODIRTY(inode, to_free);
+}
+
+/*
+ * Take up to @meta indirect and @data direct blocks out of the inode's
+ * reservation for an allocation which is about to happen.
+ */
+static void ext3_da_claim_space(struct inode *inode,
+			unsigned long *meta, unsigned long *data)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+
+	spin_lock(&ei->i_da_lock);
+	*meta = min(*meta, ei->i_da_meta_blocks);
+	*data = min(*data, ei->i_da_data_blocks);
+	ei->i_da_meta_blocks -= *meta;
+	ei->i_da_data_blocks -= *data;
+	spin_unlock(&ei->i_da_lock);
+}
+
+/* Put back the part of a claim which the allocation did not use */
+static void ext3_da_unclaim_space(struct inode *inode,
+			unsigned long meta, unsigned long data)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+
+	spin_lock(&ei->i_da_lock);
+	ei->i_da_meta_blocks += meta;
+	ei->i_da_data_blocks += data;
+	spin_unlock(&ei->i_da_lock);
+	ext3_da_release_space(inode, 0);
+}
+
+/**
+ *	ext3_alloc_blocks - allocate the blocks needed for a branch
+ *	@indirect_blks: the number of blocks needed for indirect blocks
+ *	@blks: the number of direct blocks wanted
+ *	@delayed: the blocks are for delayed data being written out
+ *	@new_blocks: on return holds the new block numbers for the indirect
+ *		blocks (if needed) and the first direct block
+ *	@err: here we store the error value
+ *
+ *	The indirect blocks and the first direct block are required; the
+ *	remaining direct blocks are allocated on a best-effort basis, as one
+ *	contiguous run following the first.  Returns the number of direct
+ *	blocks allocated.
+ *
+ *	When writing out delayed data, the blocks set aside for it are used
+ *	first, so that writeback does not fail for lack of quota or space.
+ *	Nothing else (direct I/O, mmap writes, directories) may touch them.
+ */
+static int ext3_alloc_blocks(handle_t *handle, struct inode *inode,
+			unsigned long goal, int indirect_blks, int blks,
+			int delayed, unsigned long new_blocks[4], int *err)
+{
+	int target, i;
+	unsigned long count = 0;
+	int index = 0;
+	unsigned long current_block = 0;
+	unsigned long meta = 0, data = 0, claimed, used;
+	int ret = 0;
+
+	target = blks + indirect_blks;
+	if (delayed) {
+		meta = indirect_blks;
+		data = blks;
+		ext3_da_claim_space(inode, &meta, &data);
+	}
+	claimed = meta + data;
+
+	while (1) {
+		count = target;
+		/* allocating blocks for indirect blocks and direct blocks */
+		current_block = ext3_new_blocks(handle, inode, goal,
+						&count, meta + data, err);
+		if (*err)
+			goto failed_out;
+
+		used = min(count, meta + data);
+		if (used > meta) {
+			data -= used - meta;
+			meta = 0;
+		} else
+			meta -= used;
+		target -= count;
+		/* allocate blocks for indirect blocks */
+		while (index < indirect_blks && count) {
+			new_blocks[index++] = current_block++;
+			count--;
+		}
+
+		if (count > 0)
+			break;
+	}
+
+	/* save the new block number for the first direct block */
+	new_blocks[index] = current_block;
+
+	/* total number of blocks allocated for direct blocks */
+	ret = count;
+	*err = 0;
+	if (claimed)
+		ext3_da_unclaim_space(inode, meta, data);
+	return ret;
+failed_out:
+	if (claimed)
+		ext3_da_unclaim_space(inode, meta, data);
+	for (i = 0; i < index; i++)
+		ext3_free_blocks(handle, inode, new_blocks[i], 1);
+	return ret;
+}
+
 /**
  *	ext3_alloc_branch - allocate and set up a chain of blocks.
  *	@inode: owner
- *	@num: depth of the chain (number of blocks to allocate)
+ *	@indirect_blks: number of allocated indirect blocks
+ *	@blks: number of allocated direct blocks
+ *	@delayed: the blocks are for delayed data being written out
  *	@offsets: offsets (in the blocks) to store the pointers to next.
  *	@branch: place to store the chain in.
  *
- *	This function allocates @num blocks, zeroes out all but the last one,
+ *	This function allocates blocks, zeroes out all but the last one,
  *	links them into chain and (if we are synchronous) writes them to disk.
  *	In other words, it prepares a branch that can be spliced onto the
  *	inode. It stores the information about that chain in the branch[], in
  *	the same format as ext3_get_branch() would do. We are calling it after
  *	we had read the existing part of chain and partial points to the last
  *	triple of that (one with zero ->key). Upon the exit we have the same
- *	picture as after the successful ext3_get_block(), excpet that in one
+ *	picture as after the successful ext3_get_block(), except that in one
  *	place chain is disconnected - *branch->p is still zero (we did not
  *	set the last link), but branch->key contains the number that should
  *	be placed into *branch->p to fill that gap.
  *
+ *	Where more than one direct block was allocated, the extra ones follow
+ *	the first on disk and are recorded in the slots following the last
+ *	link of the branch; *@blks is updated to their total number.
+ *
  *	If allocation fails we free all blocks we've allocated (and forget
  *	their buffer_heads) and return the error value the from failed
- *	ext3_alloc_block() (normally -ENOSPC). Otherwise we set the chain
+ *	ext3_new_blocks() (normally -ENOSPC). Otherwise we set the chain
  *	as described above and return 0.
  */
-
 static int ext3_alloc_branch(handle_t *handle, struct inode *inode,
-			     int num,
-			     unsigned long goal,
-			     int *offsets,
-			     Indirect *branch)
+			int indirect_blks, int *blks, int delayed,
+			unsigned long goal, int *offsets, Indirect *branch)
 {
 	int blocksize = inode->i_sb->s_blocksize;
-	int n = 0, keys = 0;
+	int i, n = 0;
 	int err = 0;
-	int i;
-	int parent = ext3_alloc_block(handle, inode, goal, &err);
-
-	branch[0].key = cpu_to_le32(parent);
-	if (parent) {
-		for (n = 1; n < num; n++) {
-			struct buffer_head *bh;
-			/* Allocate the next block */
-			int nr = ext3_alloc_block(handle, inode, parent, &err);
-			if (!nr)
-				break;
-			branch[n].key = cpu_to_le32(nr);
-			keys = n+1;
+	struct buffer_head *bh;
+	int num;
+	unsigned long new_blocks[4];
+	unsigned long current_block;
 
-			/*
-			 * Get buffer_head for parent block, zero it out
-			 * and set the pointer to new one, then send
-			 * parent to disk.  
-			 */
-			bh = sb_getblk(inode->i_sb, parent);
-			branch[n].bh = bh;
-			lock_buffer(bh);
-			BUFFER_TRACE(bh, "call get_create_access");
-			err = ext3_journal_get_create_access(handle, bh);
-			if (err) {
-				unlock_buffer(bh);
-				brelse(bh);
-				break;
-			}
+	num = ext3_alloc_blocks(handle, inode, goal, indirect_blks,
+				*blks, delayed, new_blocks, &err);
+	if (err)
+		return err;
 
-			memset(bh->b_data, 0, blocksize);
-			branch[n].p = (__le32*) bh->b_data + offsets[n];
-			*branch[n].p = branch[n].key;
-			BUFFER_TRACE(bh, "marking uptodate");
-			set_buffer_uptodate(bh);
+	branch[0].key = cpu_to_le32(new_blocks[0]);
+	/*
+	 * metadata blocks and data blocks are allocated.
+	 */
+	for (n = 1; n <= indirect_blks;  n++) {
+		/*
+		 * Get buffer_head for parent block, zero it out
+		 * and set the pointer to new one, then send
+		 * parent to disk.
+		 */
+		bh = sb_getblk(inode->i_sb, new_blocks[n-1]);
+		branch[n].bh = bh;
+		lock_buffer(bh);
+		BUFFER_TRACE(bh, "call get_create_access");
+		err = ext3_journal_get_create_access(handle, bh);
+		if (err) {
 			unlock_buffer(bh);
+			brelse(bh);
+			goto failed;
+		}
 
-			BUFFER_TRACE(bh, "call ext3_journal_dirty_metadata");
-			err = ext3_journal_dirty_metadata(handle, bh);
-			if (err)
-				break;
+		memset(bh->b_data, 0, blocksize);
+		branch[n].p = (__le32*) bh->b_data + offsets[n];
+		branch[n].key = cpu_to_le32(new_blocks[n]);
+		*branch[n].p = branch[n].key;
+		if (n == indirect_blks) {
+			current_block = new_blocks[n];
+			/*
+			 * End of chain, update the last new metablock of
+			 * the chain to point to the new allocated
+			 * data blocks numbers
+			 */
+			for (i = 1; i < num; i++)
+				*(branch[n].p + i) = cpu_to_le32(++current_block);
+		}
+		BUFFER_TRACE(bh, "marking uptodate");
+		set_buffer_uptodate(bh);
+		unlock_buffer(bh);
 
-			parent = nr;
+		BUFFER_TRACE(bh, "call ext3_journal_dirty_metadata");
+		err = ext3_journal_dirty_metadata(handle, bh);
+		if (err) {
+			n++;
+			goto failed;
 		}
 	}
-	if (n == num)
-		return 0;
-
+	*blks = num;
+	return err;
+failed:
 	/* Allocation failed, free what we already allocated */
-	for (i = 1; i < keys; i++) {
+	for (i = 1; i < n; i++) {
 		BUFFER_TRACE(branch[i].bh, "call journal_forget");
 		ext3_journal_forget(handle, branch[i].bh);
 	}
-	for (i = 0; i < keys; i++)
-		ext3_free_blocks(handle, inode, le32_to_cpu(branch[i].key), 1);
+	for (i = 0; i < indirect_blks; i++)
+		ext3_free_blocks(handle, inode, new_blocks[i], 1);
+
+	ext3_free_blocks(handle, inode, new_blocks[i], num);
+
 	return err;
 }
 
@@ -580,7 +817,8 @@ static int ext3_alloc_branch(handle_t *handle, struct inode *inode,
  *	@chain: chain of indirect blocks (with a missing link - see
  *		ext3_alloc_branch)
  *	@where: location of missing link
- *	@num:   number of blocks we are adding
+ *	@num:   number of indirect blocks we are adding
+ *	@blks:  number of direct blocks we are adding
  *
  *	This function verifies that chain (up to the missing link) had not
  *	changed, fills the missing link and does all housekeeping needed in
@@ -591,11 +829,13 @@ static int ext3_alloc_branch(handle_t *handle, struct inode *inode,
  */
 
 static int ext3_splice_branch(handle_t *handle, struct inode *inode, long block,
-			      Indirect chain[4], Indirect *where, int num)
+			      Indirect chain[4], Indirect *where, int num,
+			      int blks)
 {
 	int i;
 	int err = 0;
 	struct ext3_block_alloc_info *block_i = EXT3_I(inode)->i_block_alloc_info;
+	unsigned long current_block;
 
 	/*
 	 * If we're splicing into a [td]indirect block (as opposed to the
@@ -614,18 +854,39 @@ static int ext3_splice_branch(handle_t *handle, struct inode *inode, long block,
 		/* Writer: end */
 		goto changed;
 
+	/*
+	 * The direct blocks after the first one go straight into the
+	 * existing indirect block (or the inode): make sure nobody has
+	 * mapped those slots since ext3_blks_to_allocate() looked.
+	 */
+	if (num == 0)
+		for (i = 1; i < blks; i++)
+			if (*(where->p + i))
+				goto changed;
+
 	/* That's it */
 
 	*where->p = where->key;
 
+	/*
+	 * Update the host buffer_head or inode to point to more just allocated
+	 * direct blocks blocks
+	 */
+	if (num == 0 && blks > 1) {
+		current_block = le32_to_cpu(where->key) + 1;
+		for (i = 1; i < blks; i++)
+			*(where->p + i) = cpu_to_le32(current_block++);
+	}
+
 	/*
 	 * update the most recently allocated logical & physical block
 	 * in i_block_alloc_info, to assist find the proper goal block for next
 	 * allocation
 	 */
 	if (block_i) {
-		block_i->last_alloc_logical_block = block;
-		block_i->last_alloc_physical_block = le32_to_cpu(where[num-1].key);
+		block_i->last_alloc_logical_block = block + blks - 1;
+		block_i->last_alloc_physical_block =
+				le32_to_cpu(where[num].key) + blks - 1;
 	}
 
 	/* We are done with atomic stuff, now do the rest of housekeeping */
@@ -666,17 +927,20 @@ changed:
 	err = -EAGAIN;
 
 err_out:
-	for (i = 1; i < num; i++) {
+	for (i = 1; i <= num; i++) {
 		BUFFER_TRACE(where[i].bh, "call journal_forget");
 		ext3_journal_forget(handle, where[i].bh);
 	}
 	/* For the normal collision cleanup case, we free up the blocks.
 	 * On genuine filesystem errors we don't even think about doing
 	 * that. */
-	if (err == -EAGAIN)
+	if (err == -EAGAIN) {
 		for (i = 0; i < num; i++)
-			ext3_free_blocks(handle, inode, 
+			ext3_free_blocks(handle, inode,
 					 le32_to_cpu(where[i].key), 1);
+		ext3_free_blocks(handle, inode, le32_to_cpu(where[num].key),
+				 blks);
+	}
 	return err;
 }
 
@@ -692,24 +956,38 @@ err_out:
  * allocations is needed - we simply release blocks and do not touch anything
  * reachable from inode.
  *
+ * Up to @maxblocks blocks are mapped in one call: either a run of blocks
+ * which are already allocated and contiguous on disk, or a run of newly
+ * allocated ones, never a mix of the two.  The run stops at the end of the
+ * indirect block holding the first pointer.  On success the number of
+ * blocks mapped is returned, and bh_result describes the first of them; a
+ * hole (when create == 0) returns 0 with bh_result unmapped.
+ *
+ * Space set aside by ext3_da_get_block_prep() is only used when bh_result
+ * comes in with BH_Delay set, i.e. for delayed data being written out.
+ *
  * akpm: `handle' can be NULL if create == 0.
  *
  * The BKL may not be held on entry here.  Be sure to take it early.
  */
 
 static int
-ext3_get_block_handle(handle_t *handle, struct inode *inode, sector_t iblock,
-		struct buffer_head *bh_result, int create, int extend_disksize)
+ext3_get_blocks_handle(handle_t *handle, struct inode *inode, sector_t iblock,
+		unsigned long maxblocks, struct buffer_head *bh_result,
+		int create, int extend_disksize)
 {
 	int err = -EIO;
 	int offsets[4];
 	Indirect chain[4];
 	Indirect *partial;
 	unsigned long goal;
-	int left;
-	int boundary = 0;
-	int depth = ext3_block_to_path(inode, iblock, offsets, &boundary);
+	int indirect_blks;
+	int blocks_to_boundary = 0;
+	int depth = ext3_block_to_path(inode, iblock, offsets,
+					&blocks_to_boundary);
 	struct ext3_inode_info *ei = EXT3_I(inode);
+	int count = 0;
+	unsigned long first_block = 0;
 
 	J_ASSERT(handle != NULL || create == 0);
 
@@ -721,11 +999,34 @@ reread:
 
 	/* Simplest case - block found, no allocation needed */
 	if (!partial) {
+		first_block = le32_to_cpu(chain[depth - 1].key);
 		clear_buffer_new(bh_result);
+		count++;
+		/* map more blocks */
+		while (count < maxblocks && count <= blocks_to_boundary) {
+			unsigned long blk;
+
+			if (!verify_chain(chain, chain + depth - 1)) {
+				/*
+				 * Indirect block might be removed by
+				 * truncate while we were reading it.
+				 * Forget what we've got and reread.
+				 */
+				partial = chain + depth - 1;
+				goto changed;
+			}
+			blk = le32_to_cpu(*(chain[depth-1].p + count));
+
+			if (blk == first_block + count)
+				count++;
+			else
+				break;
+		}
 got_it:
 		map_bh(bh_result, inode->i_sb, le32_to_cpu(chain[depth-1].key));
-		if (boundary)
+		if (count > blocks_to_boundary)
 			set_buffer_boundary(bh_result);
+		err = count;
 		/* Clean up and exit */
 		partial = chain+depth-1; /* the whole chain */
 		goto cleanup;
@@ -765,13 +1066,22 @@ out:
 		goto changed;
 	}
 
-	left = (chain + depth) - partial;
+	/* the number of blocks need to allocate for [d,t]indirect blocks */
+	indirect_blks = (chain + depth) - partial - 1;
+
+	/*
+	 * Next look up the indirect map to count the totoal number of
+	 * direct blocks to allocate for this branch.
+	 */
+	count = ext3_blks_to_allocate(partial, indirect_blks,
+					maxblocks, blocks_to_boundary);
 
 	/*
 	 * Block out ext3_truncate while we alter the tree
 	 */
-	err = ext3_alloc_branch(handle, inode, left, goal,
-					offsets+(partial-chain), partial);
+	err = ext3_alloc_branch(handle, inode, indirect_blks, &count,
+				buffer_delay(bh_result), goal,
+				offsets+(partial-chain), partial);
 
 	/* The ext3_splice_branch call will free and forget any buffers
 	 * on the new chain if there is a failure, but that risks using
@@ -780,7 +1090,7 @@ out:
 	 * may need to return -EAGAIN upwards in the worst case.  --sct */
 	if (!err)
 		err = ext3_splice_branch(handle, inode, iblock, chain,
-					 partial, left);
+					 partial, indirect_blks, count);
 	/* i_disksize growing is protected by truncate_sem
 	 * don't forget to protect it if you're about to implement
 	 * concurrent ext3_get_block() -bzzz */
@@ -802,6 +1112,7 @@ changed:
 		brelse(partial->bh);
 		partial--;
 	}
+	count = 0;
 	goto reread;
 }
 
@@ -815,8 +1126,14 @@ static int ext3_get_block(struct inode *inode, sector_t iblock,
 		handle = ext3_journal_current_handle();
 		J_ASSERT(handle != 0);
 	}
-	ret = ext3_get_block_handle(handle, inode, iblock,
+	ret = ext3_get_blocks_handle(handle, inode, iblock, 1,
 				bh_result, create, 1);
+	if (ret > 0) {
+		/* a delayed buffer being written out has its block now */
+		if (create)
+			clear_buffer_delay(bh_result);
+		ret = 0;
+	}
 	return ret;
 }
 
@@ -859,19 +1176,18 @@ ext3_direct_io_get_blocks(struct inode *inode, sector_t iblock,
 	}
 
 get_block:
-	if (ret == 0)
-		ret = ext3_get_block_handle(handle, inode, iblock,
+	if (ret == 0) {
+		ret = ext3_get_blocks_handle(handle, inode, iblock, max_blocks,
 					bh_result, create, 0);
-	bh_result->b_size = (1 << inode->i_blkbits);
+		if (ret > 0) {
+			bh_result->b_size = (ret << inode->i_blkbits);
+			ret = 0;
+		} else if (ret == 0)
+			bh_result->b_size = (1 << inode->i_blkbits);
+	}
 	return ret;
 }
 
-static int ext3_writepages_get_block(struct inode *inode, sector_t iblock,
-			struct buffer_head *bh, int create)
-{
-	return ext3_direct_io_get_blocks(inode, iblock, 1, bh, create);
-}
-
 /*
  * `handle' can be NULL if create is zero
  */
@@ -886,8 +1202,12 @@ struct buffer_head *ext3_getblk(handle_t *handle, struct inode * inode,
 	dummy.b_state = 0;
 	dummy.b_blocknr = -1000;
 	buffer_trace_init(&dummy.b_history);
-	*errp = ext3_get_block_handle(handle, inode, block, &dummy, create, 1);
-	if (!*errp && buffer_mapped(&dummy)) {
+	err = ext3_get_blocks_handle(handle, inode, block, 1,
+					&dummy, create, 1);
+	if (err > 0)
+		err = 0;
+	*errp = err;
+	if (!err && buffer_mapped(&dummy)) {
 		struct buffer_head *bh;
 		bh = sb_getblk(inode->i_sb, dummy.b_blocknr);
 		if (buffer_new(&dummy)) {
@@ -1044,6 +1364,59 @@ out:
 	return ret;
 }
 
+/*
+ * get_block for delayed allocation: map the block if it is already on
+ * disk, otherwise reserve space for it and leave the buffer unmapped with
+ * BH_Delay set.  The block is allocated when the page is written back.
+ * No transaction is needed as nothing is changed on disk.
+ */
+static int ext3_da_get_block_prep(struct inode *inode, sector_t iblock,
+			struct buffer_head *bh_result, int create)
+{
+	struct page *page = bh_result->b_page;
+	int ret;
+
+	BUG_ON(create == 0);
+	if (buffer_delay(bh_result))
+		return 0;
+
+	ret = ext3_get_blocks_handle(NULL, inode, iblock, 1, bh_result, 0, 0);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
+	ret = ext3_da_reserve_space(inode);
+	if (ret)
+		return ret;
+
+	/*
+	 * It is a hole, so zeroes are its contents until the caller
+	 * copies in the new data.
+	 */
+	if (!PageUptodate(page) && !buffer_uptodate(bh_result)) {
+		void *kaddr = kmap_atomic(page, KM_USER0);
+
+		memset(kaddr + bh_offset(bh_result), 0, bh_result->b_size);
+		flush_dcache_page(page);
+		kunmap_atomic(kaddr, KM_USER0);
+		set_buffer_uptodate(bh_result);
+	}
+	set_buffer_delay(bh_result);
+	return 0;
+}
+
+static int ext3_da_prepare_write(struct file *file, struct page *page,
+			      unsigned from, unsigned to)
+{
+	struct inode *inode = page->mapping->host;
+	int ret, retries = 0;
+
+retry:
+	ret = block_prepare_write(page, from, to, ext3_da_get_block_prep);
+	if (ret == -ENOSPC && ext3_should_retry_alloc(inode->i_sb, &retries))
+		goto retry;
+	return ret;
+}
+
 int
 ext3_journal_dirty_data(handle_t *handle, struct buffer_head *bh)
 {
@@ -1123,6 +1496,24 @@ static int ext3_writeback_commit_write(struct file *file, struct page *page,
 	return ret;
 }
 
+/*
+ * Nothing was allocated by ext3_da_prepare_write(), so there is no handle
+ * to stop; generic_commit_write() journals the inode size change through
+ * ext3_dirty_inode().
+ */
+static int ext3_da_commit_write(struct file *file, struct page *page,
+			     unsigned from, unsigned to)
+{
+	struct inode *inode = page->mapping->host;
+	loff_t new_i_size;
+
+	new_i_size = ((loff_t)page->index << PAGE_CACHE_SHIFT) + to;
+	if (new_i_size > EXT3_I(inode)->i_disksize)
+		EXT3_I(inode)->i_disksize = new_i_size;
+
+	return generic_commit_write(file, page, from, to);
+}
+
 static int ext3_journalled_commit_write(struct file *file,
 			struct page *page, unsigned from, unsigned to)
 {
@@ -1176,6 +1567,10 @@ static sector_t ext3_bmap(struct address_space *mapping, sector_t block)
 	journal_t *journal;
 	int err;
 
+	/* Delayed blocks have no disk address until they are written */
+	if (EXT3_I(inode)->i_da_data_blocks)
+		filemap_write_and_wait(mapping);
+
 	if (EXT3_I(inode)->i_state & EXT3_STATE_JDATA) {
 		/* 
 		 * This is a REALLY heavyweight approach, but the use of
@@ -1369,11 +1764,16 @@ ext3_writeback_writepages(struct address_space *mapping,
 		return ret;
 	}
 
-        ret = __mpage_writepages(mapping, wbc, ext3_writepages_get_block,
+	/*
+	 * ext3_direct_io_get_blocks() maps or allocates a whole run of
+	 * blocks at a time, so a sequential writeout costs one trip
+	 * through the allocator per extent rather than per block.
+	 */
+	ret = mpage_writepages_blocks(mapping, wbc, ext3_direct_io_get_blocks,
 					ext3_writeback_writepage_helper);
 
 	/*
-	 * Need to reaquire the handle since ext3_writepages_get_block()
+	 * Need to reaquire the handle since ext3_direct_io_get_blocks()
 	 * can restart the handle
 	 */
 	handle = journal_current_handle();
@@ -1486,9 +1886,38 @@ ext3_readpages(struct file *file, struct address_space *mapping,
 	return mpage_readpages(mapping, pages, nr_pages, ext3_get_block);
 }
 
+/*
+ * Count the delayed buffers of @page from byte @offset on, whose
+ * reservations are to be given back, clearing BH_Delay if @clear.
+ */
+static int ext3_da_page_delayed(struct page *page, unsigned long offset,
+				int clear)
+{
+	struct buffer_head *head, *bh;
+	unsigned long curr_off = 0;
+	int nr = 0;
+
+	if (!page_has_buffers(page))
+		return 0;
+	head = bh = page_buffers(page);
+	do {
+		if (curr_off >= offset && buffer_delay(bh) &&
+		    !buffer_mapped(bh)) {
+			nr++;
+			if (clear)
+				clear_buffer_delay(bh);
+		}
+		curr_off += bh->b_size;
+		bh = bh->b_this_page;
+	} while (bh != head);
+	return nr;
+}
+
 static int ext3_invalidatepage(struct page *page, unsigned long offset)
 {
-	journal_t *journal = EXT3_JOURNAL(page->mapping->host);
+	struct inode *inode = page->mapping->host;
+	journal_t *journal = EXT3_JOURNAL(inode);
+	int delayed;
 
 	/*
 	 * If it's a full truncate we just forget about the pending dirtying
@@ -1496,17 +1925,27 @@ static int ext3_invalidatepage(struct page *page, unsigned long offset)
 	if (offset == 0)
 		ClearPageChecked(page);
 
+	delayed = ext3_da_page_delayed(page, offset, 1);
+	if (delayed)
+		ext3_da_release_space(inode, delayed);
+
 	return journal_invalidatepage(journal, page, offset);
 }
 
 static int ext3_releasepage(struct page *page, int wait)
 {
-	journal_t *journal = EXT3_JOURNAL(page->mapping->host);
+	struct inode *inode = page->mapping->host;
+	journal_t *journal = EXT3_JOURNAL(inode);
+	int delayed, ret;
 
 	WARN_ON(PageChecked(page));
 	if (!page_has_buffers(page))
 		return 0;
-	return journal_try_to_free_buffers(journal, page, wait);
+	delayed = ext3_da_page_delayed(page, 0, 0);
+	ret = journal_try_to_free_buffers(journal, page, wait);
+	if (ret && delayed)
+		ext3_da_release_space(inode, delayed);
+	return ret;
 }
 
 /*
@@ -1631,6 +2070,20 @@ static struct address_space_operations ext3_writeback_aops = {
 	.direct_IO	= ext3_direct_IO,
 };
 
+static struct address_space_operations ext3_da_aops = {
+	.readpage	= ext3_readpage,
+	.readpages	= ext3_readpages,
+	.writepage	= ext3_writeback_writepage,
+	.writepages	= ext3_writeback_writepages,
+	.sync_page	= block_sync_page,
+	.prepare_write	= ext3_da_prepare_write,
+	.commit_write	= ext3_da_commit_write,
+	.bmap		= ext3_bmap,
+	.invalidatepage	= ext3_invalidatepage,
+	.releasepage	= ext3_releasepage,
+	.direct_IO	= ext3_direct_IO,
+};
+
 static struct address_space_operations ext3_journalled_aops = {
 	.readpage	= ext3_readpage,
 	.readpages	= ext3_readpages,
@@ -1648,6 +2101,9 @@ void ext3_set_aops(struct inode *inode)
 {
 	if (ext3_should_order_data(inode))
 		inode->i_mapping->a_ops = &ext3_ordered_aops;
+	else if (ext3_should_writeback_data(inode) &&
+		 test_opt(inode->i_sb, DELALLOC))
+		inode->i_mapping->a_ops = &ext3_da_aops;
 	else if (ext3_should_writeback_data(inode))
 		inode->i_mapping->a_ops = &ext3_writeback_aops;
 	else
@@ -1708,7 +2164,8 @@ static int ext3_block_truncate_page(handle_t *handle, struct page *page,
 		goto unlock;
 	}
 
-	if (!buffer_mapped(bh)) {
+	/* A delayed buffer has no block yet, but its data must be zeroed */
+	if (!buffer_mapped(bh) && !buffer_delay(bh)) {
 		BUFFER_TRACE(bh, "unmapped");
 		ext3_get_block(inode, iblock, bh, 0);
 		/* unmapped? It's a hole - nothing to do */
@@ -2679,7 +3136,12 @@ static int ext3_do_update_inode(handle_t *handle,
 	raw_inode->i_atime = cpu_to_le32(inode->i_atime.tv_sec);
 	raw_inode->i_ctime = cpu_to_le32(inode->i_ctime.tv_sec);
 	raw_inode->i_mtime = cpu_to_le32(inode->i_mtime.tv_sec);
-	raw_inode->i_blocks = cpu_to_le32(inode->i_blocks);
+	/* blocks reserved for delayed allocation are not on disk yet */
+	spin_lock(&ei->i_da_lock);
+	raw_inode->i_blocks = cpu_to_le32(inode->i_blocks -
+		((ei->i_da_data_blocks + ei->i_da_meta_blocks) <<
+		 (inode->i_sb->s_blocksize_bits - 9)));
+	spin_unlock(&ei->i_da_lock);
 	raw_inode->i_dtime = cpu_to_le32(ei->i_dtime);
 	raw_inode->i_flags = cpu_to_le32(ei->i_flags);
 #ifdef EXT3_FRAGMENTS
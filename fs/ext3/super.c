@@ -390,9 +390,11 @@ static void ext3_put_super (struct super_block * sb)
 	for (i = 0; i < sbi->s_gdb_count; i++)
 		brelse(sbi->s_group_desc[i]);
 	kfree(sbi->s_group_desc);
+	kfree(sbi->s_group_max_run);
 	percpu_counter_destroy(&sbi->s_freeblocks_counter);
 	percpu_counter_destroy(&sbi->s_freeinodes_counter);
 	percpu_counter_destroy(&sbi->s_dirs_counter);
+	percpu_counter_destroy(&sbi->s_dirtyblocks_counter);
 	brelse(sbi->s_sbh);
 #ifdef CONFIG_QUOTA
 	for (i = 0; i < MAXQUOTAS; i++)
@@ -440,6 +442,8 @@ static struct inode *ext3_alloc_inode(struct super_block *sb)
 	ei->i_default_acl = EXT3_ACL_NOT_CACHED;
 #endif
 	ei->i_block_alloc_info = NULL;
+	ei->i_da_data_blocks = 0;
+	ei->i_da_meta_blocks = 0;
 	ei->vfs_inode.i_version = 1;
 	return &ei->vfs_inode;
 }
@@ -460,6 +464,7 @@ static void init_once(void * foo, kmem_cache_t * cachep, unsigned long flags)
 		init_rwsem(&ei->xattr_sem);
 #endif
 		init_MUTEX(&ei->truncate_sem);
+		spin_lock_init(&ei->i_da_lock);
 		inode_init_once(&ei->vfs_inode);
 	}
 }
@@ -578,6 +583,7 @@ enum {
 	Opt_nouid32, Opt_check, Opt_nocheck, Opt_debug, Opt_oldalloc, Opt_orlov,
 	Opt_user_xattr, Opt_nouser_xattr, Opt_acl, Opt_noacl,
 	Opt_reservation, Opt_noreservation, Opt_noload, Opt_nobh,
+	Opt_delalloc, Opt_nodelalloc,
 	Opt_commit, Opt_journal_update, Opt_journal_inum,
 	Opt_abort, Opt_data_journal, Opt_data_ordered, Opt_data_writeback,
 	Opt_usrjquota, Opt_grpjquota, Opt_offusrjquota, Opt_offgrpjquota,
@@ -613,6 +619,8 @@ static match_table_t tokens = {
 	{Opt_noreservation, "noreservation"},
 	{Opt_noload, "noload"},
 	{Opt_nobh, "nobh"},
+	{Opt_delalloc, "delalloc"},
+	{Opt_nodelalloc, "nodelalloc"},
 	{Opt_commit, "commit=%u"},
 	{Opt_journal_update, "journal=update"},
 	{Opt_journal_inum, "journal=%u"},
@@ -927,6 +935,12 @@ clear_qf_name:
 		case Opt_nobh:
 			set_opt(sbi->s_mount_opt, NOBH);
 			break;
+		case Opt_delalloc:
+			set_opt(sbi->s_mount_opt, DELALLOC);
+			break;
+		case Opt_nodelalloc:
+			clear_opt(sbi->s_mount_opt, DELALLOC);
+			break;
 		default:
 			printk (KERN_ERR
 				"EXT3-fs: Unrecognized mount option \"%s\" "
@@ -1477,8 +1491,18 @@ static int ext3_fill_super (struct super_block *sb, void *data, int silent)
 	percpu_counter_init(&sbi->s_freeblocks_counter);
 	percpu_counter_init(&sbi->s_freeinodes_counter);
 	percpu_counter_init(&sbi->s_dirs_counter);
+	percpu_counter_init(&sbi->s_dirtyblocks_counter);
 	bgl_lock_init(&sbi->s_blockgroup_lock);
 
+	/* Free space summaries are only a hint: do without if short of memory */
+	sbi->s_group_max_run = kmalloc(sbi->s_groups_count *
+				       sizeof(unsigned int), GFP_KERNEL);
+	if (sbi->s_group_max_run) {
+		memset(sbi->s_group_max_run, 0xff,
+		       sbi->s_groups_count * sizeof(unsigned int));
+		sbi->s_group_summaries = sbi->s_groups_count;
+	}
+
 	for (i = 0; i < db_count; i++) {
 		block = descriptor_loc(sb, logic_sb_block, i);
 		sbi->s_group_desc[i] = sb_bread(sb, block);
@@ -1581,10 +1605,16 @@ static int ext3_fill_super (struct super_block *sb, void *data, int silent)
 		}
 		if (!(test_opt(sb, DATA_FLAGS) == EXT3_MOUNT_WRITEBACK_DATA)) {
 			printk(KERN_WARNING "EXT3-fs: Ignoring nobh option - "
-				"its supported only with writeback mode\n");
+				"it's supported only with writeback mode\n");
 			clear_opt(sbi->s_mount_opt, NOBH);
 		}
 	}
+	if (test_opt(sb, DELALLOC) &&
+	    test_opt(sb, DATA_FLAGS) != EXT3_MOUNT_WRITEBACK_DATA) {
+		printk(KERN_WARNING "EXT3-fs: Ignoring delalloc option - "
+			"it's supported only with writeback mode\n");
+		clear_opt(sbi->s_mount_opt, DELALLOC);
+	}
 	/*
 	 * The journal_load will have done any necessary log recovery,
 	 * so we can safely mount the rest of the filesystem now.
@@ -1646,6 +1676,7 @@ failed_mount2:
 	for (i = 0; i < db_count; i++)
 		brelse(sbi->s_group_desc[i]);
 	kfree(sbi->s_group_desc);
+	kfree(sbi->s_group_max_run);
 failed_mount:
 #ifdef CONFIG_QUOTA
 	for (i = 0; i < MAXQUOTAS; i++)
@@ -2156,7 +2187,7 @@ static int ext3_remount (struct super_block * sb, int * flags, char * data)
 static int ext3_statfs (struct super_block * sb, struct kstatfs * buf)
 {
 	struct ext3_super_block *es = EXT3_SB(sb)->s_es;
-	unsigned long overhead;
+	unsigned long overhead, dirty;
 	int i;
 
 	if (test_opt (sb, MINIX_DF))
@@ -2198,6 +2229,10 @@ static int ext3_statfs (struct super_block * sb, struct kstatfs * buf)
 	buf->f_bsize = sb->s_blocksize;
 	buf->f_blocks = le32_to_cpu(es->s_blocks_count) - overhead;
 	buf->f_bfree = ext3_count_free_blocks (sb);
+	/* blocks promised to delayed allocation are as good as used */
+	dirty = percpu_counter_read_positive(
+			&EXT3_SB(sb)->s_dirtyblocks_counter);
+	buf->f_bfree = buf->f_bfree > dirty ? buf->f_bfree - dirty : 0;
 	buf->f_bavail = buf->f_bfree - le32_to_cpu(es->s_r_blocks_count);
 	if (buf->f_bfree < le32_to_cpu(es->s_r_blocks_count))
 		buf->f_bavail = 0;
@@ -244,6 +244,9 @@ void clear_inode(struct inode *inode)
 	might_sleep();
 	invalidate_inode_buffers(inode);
        
+	/* Evicted pages leave shadow entries behind them */
+	if (inode->i_data.nrshadows)
+		clear_shadow_entries(&inode->i_data, 0);
 	if (inode->i_data.nrpages)
 		BUG();
 	if (!(inode->i_state & I_FREEING))
@@ -431,6 +434,9 @@ static void prune_icache(int nr_to_scan)
 	for (nr_scanned = 0; nr_scanned < nr_to_scan; nr_scanned++) {
 		struct inode *inode;
 
+		/* The inodes on freeable are ours: inode_lock can go */
+		cond_resched_lock(&inode_lock);
+
 		if (list_empty(&inode_unused))
 			break;
 
@@ -1337,7 +1343,8 @@ void __init inode_init(unsigned long mempages)
 	/* inode slab cache */
 	inode_cachep = kmem_cache_create("inode_cache", sizeof(struct inode),
 				0, SLAB_PANIC, init_once, NULL);
-	set_shrinker(DEFAULT_SEEKS, shrink_icache_memory);
+	/* Small batches: prune_icache() works under the global inode_lock */
+	set_shrinker(DEFAULT_SEEKS, 32, shrink_icache_memory);
 
 	/* Hash may have been set up in inode_init_early */
 	if (!hashdist)
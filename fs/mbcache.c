@@ -663,7 +663,7 @@ mb_cache_entry_find_next(struct mb_cache_entry *prev, int index,
 
 static int __init init_mbcache(void)
 {
-	mb_shrinker = set_shrinker(DEFAULT_SEEKS, mb_cache_shrink_fn);
+	mb_shrinker = set_shrinker(DEFAULT_SEEKS, 0, mb_cache_shrink_fn);
 	return 0;
 }
 
@@ -370,6 +370,126 @@ int mpage_readpage(struct page *page, get_block_t get_block)
 }
 EXPORT_SYMBOL(mpage_readpage);
 
+/*
+ * A filesystem which can map or allocate a whole run of blocks in one go
+ * hands mpage_writepages a get_blocks() function instead of a get_block().
+ * The extent it returns is remembered here and handed out block by block
+ * while the following pages are written, so one call covers as much of a
+ * run of consecutive dirty pages as the filesystem can manage.
+ *
+ * Only blocks under the pages of the run are ever asked for (up to
+ * ->wanted_end), and every page of the run is locked before the first
+ * get_blocks() call for it: truncate cannot free the blocks of a page still
+ * to be written, and nothing gets instantiated under pages which are not
+ * going to be written.  The extent is dropped between pagevecs, so it never
+ * outlives the pages it was mapped for.
+ */
+struct mpage_extent {
+	get_blocks_t *get_blocks;
+	sector_t first_block;		/* file block at map_bh.b_blocknr */
+	unsigned long nr_blocks;	/* blocks mapped, 0 if none cached */
+	sector_t wanted_end;		/* end of the dirty run, in blocks */
+	struct buffer_head map_bh;
+};
+
+/* Whether the page holds delayed-allocation data, see mpage_map_delayed() */
+static inline int mpage_page_delayed(struct page *page)
+{
+	return page_has_buffers(page) && buffer_delay(page_buffers(page));
+}
+
+/*
+ * Lock the dirty pages of @pvec consecutive with the locked page in slot
+ * @i, as far as they can be locked without waiting, and set ->wanted_end
+ * to the end of the run, in units of filesystem blocks.  Delayed and
+ * ordinary pages are not mixed in one run, since the filesystem may only
+ * spend what it set aside at write() time on the former.  Returns the slot
+ * after the last page of the run: the pages up to it are left locked, and
+ * will all be written.  Locking in index order is safe against truncate,
+ * which only ever holds one page lock at a time.
+ */
+static unsigned mpage_lock_run(struct pagevec *pvec, unsigned i,
+		struct address_space *mapping, pgoff_t end,
+		struct mpage_extent *ext)
+{
+	const unsigned blkbits = mapping->host->i_blkbits;
+	pgoff_t index = pvec->pages[i]->index;
+	int delayed = mpage_page_delayed(pvec->pages[i]);
+
+	while (++i < pagevec_count(pvec)) {
+		struct page *page = pvec->pages[i];
+
+		if (page->index != index + 1 || TestSetPageLocked(page))
+			break;
+		/*
+		 * With several blocks per page, a page with buffers may be
+		 * only partly dirty, with holes which must stay holes.
+		 */
+		if (page->mapping != mapping || page->index > end ||
+		    PageWriteback(page) || !PageDirty(page) ||
+		    mpage_page_delayed(page) != delayed ||
+		    (blkbits < PAGE_CACHE_SHIFT && page_has_buffers(page))) {
+			unlock_page(page);
+			break;
+		}
+		index++;
+	}
+	ext->wanted_end = (sector_t)(index + 1) << (PAGE_CACHE_SHIFT - blkbits);
+	return i;
+}
+
+/*
+ * Map file block @block for writing, either through the plain get_block()
+ * or, if an extent is being used, from the cached extent, refilling it when
+ * @block falls outside.  @last_block is the final block inside i_size.
+ * BH_Delay on @bh is passed down to tell the filesystem that the blocks are
+ * for delayed data, which has space set aside for it.
+ */
+static int mpage_map_block(struct inode *inode, sector_t block,
+		sector_t last_block, struct buffer_head *bh,
+		get_block_t get_block, struct mpage_extent *ext)
+{
+	struct buffer_head *map_bh;
+	unsigned long offset;
+
+	if (!ext)
+		return get_block(inode, block, bh, 1);
+
+	map_bh = &ext->map_bh;
+	if (block < ext->first_block ||
+			block >= ext->first_block + ext->nr_blocks) {
+		unsigned long max_blocks = 1;
+		int ret;
+
+		if (ext->wanted_end > block) {
+			max_blocks = ext->wanted_end - block;
+			if (max_blocks > last_block - block + 1)
+				max_blocks = last_block - block + 1;
+		}
+		ext->nr_blocks = 0;
+		map_bh->b_state = bh->b_state & (1 << BH_Delay);
+		map_bh->b_size = 0;
+		map_bh->b_page = bh->b_page;
+		ret = ext->get_blocks(inode, block, max_blocks, map_bh, 1);
+		if (ret)
+			return ret;
+		clear_buffer_delay(map_bh);
+		ext->first_block = block;
+		ext->nr_blocks = map_bh->b_size >> inode->i_blkbits;
+		if (ext->nr_blocks == 0)
+			ext->nr_blocks = 1;
+	}
+
+	offset = block - ext->first_block;
+	bh->b_state = map_bh->b_state;
+	bh->b_bdev = map_bh->b_bdev;
+	bh->b_blocknr = map_bh->b_blocknr + offset;
+	/* Only the last block of the extent can sit on a boundary */
+	if (offset != ext->nr_blocks - 1)
+		clear_buffer_boundary(bh);
+	return 0;
+}
+
 /*
  * Writing is not so simple.
  *
@@ -386,10 +506,63 @@ EXPORT_SYMBOL(mpage_readpage);
  * written, so it can intelligently allocate a suitably-sized BIO.  For now,
  * just allocate full-size (16-page) BIOs.
  */
+/*
+ * Give a dirty delayed-allocation buffer (BH_Delay: data in the page, but no
+ * block on disk yet) its block from the extent being written out.
+ */
+static int mpage_map_delayed(struct page *page, struct buffer_head *bh,
+		unsigned page_block, struct mpage_extent *ext)
+{
+	struct inode *inode = page->mapping->host;
+	const unsigned blkbits = inode->i_blkbits;
+	const unsigned blocks_per_page = PAGE_CACHE_SIZE >> blkbits;
+	sector_t block, last_block, run_end;
+	struct buffer_head *next;
+	struct buffer_head map_bh;
+	int ret;
+
+	block = ((sector_t)page->index << (PAGE_CACHE_SHIFT - blkbits)) +
+			page_block;
+	last_block = (i_size_read(inode) - 1) >> blkbits;
+	if (block > last_block)
+		return -EINVAL;
+
+	/* Don't let the extent cover the holes of a partly written page */
+	if (blocks_per_page > 1) {
+		run_end = block + 1;
+		for (next = bh->b_this_page; next != page_buffers(page) &&
+				buffer_delay(next) && buffer_dirty(next) &&
+				!buffer_mapped(next); next = next->b_this_page)
+			run_end++;
+		if (ext->wanted_end > run_end)
+			ext->wanted_end = run_end;
+	}
+
+	map_bh.b_state = 1 << BH_Delay;
+	map_bh.b_page = page;
+	ret = mpage_map_block(inode, block, last_block, &map_bh, NULL, ext);
+	if (ret)
+		return ret;
+	if (!buffer_mapped(&map_bh))
+		return -EIO;
+	if (buffer_new(&map_bh))
+		unmap_underlying_metadata(map_bh.b_bdev, map_bh.b_blocknr);
+
+	bh->b_bdev = map_bh.b_bdev;
+	bh->b_blocknr = map_bh.b_blocknr;
+	set_buffer_mapped(bh);
+	clear_buffer_delay(bh);
+	if (buffer_boundary(&map_bh))
+		set_buffer_boundary(bh);
+	else
+		clear_buffer_boundary(bh);
+	return 0;
+}
+
 static struct bio *
 __mpage_writepage(struct bio *bio, struct page *page, get_block_t get_block,
-	sector_t *last_block_in_bio, int *ret, struct writeback_control *wbc,
-	writepage_t writepage_fn)
+	struct mpage_extent *ext, sector_t *last_block_in_bio, int *ret,
+	struct writeback_control *wbc, writepage_t writepage_fn)
 {
 	struct address_space *mapping = page->mapping;
 	struct inode *inode = page->mapping->host;
@@ -417,6 +590,12 @@ __mpage_writepage(struct bio *bio, struct page *page, get_block_t get_block,
 		page_block = 0;
 		do {
 			BUG_ON(buffer_locked(bh));
+			if (!buffer_mapped(bh) && buffer_delay(bh) &&
+			    buffer_dirty(bh) && ext &&
+			    first_unmapped == blocks_per_page) {
+				if (mpage_map_delayed(page, bh, page_block, ext))
+					goto confused;
+			}
 			if (!buffer_mapped(bh)) {
 				/*
 				 * unmapped dirty buffers are created by
@@ -469,7 +648,8 @@ __mpage_writepage(struct bio *bio, struct page *page, get_block_t get_block,
 	for (page_block = 0; page_block < blocks_per_page; ) {
 
 		map_bh.b_state = 0;
-		if (get_block(inode, block_in_file, &map_bh, 1))
+		if (mpage_map_block(inode, block_in_file, last_block,
+					&map_bh, get_block, ext))
 			goto confused;
 		if (buffer_new(&map_bh))
 			unmap_underlying_metadata(map_bh.b_bdev,
@@ -631,10 +811,10 @@ mpage_writepages(struct address_space *mapping,
 		mapping->a_ops->writepage);
 }
 
-int
-__mpage_writepages(struct address_space *mapping,
+static int
+do_mpage_writepages(struct address_space *mapping,
 		struct writeback_control *wbc, get_block_t get_block,
-		writepage_t writepage_fn)
+		struct mpage_extent *ext, writepage_t writepage_fn)
 {
 	struct backing_dev_info *bdi = mapping->backing_dev_info;
 	struct bio *bio = NULL;
@@ -648,6 +828,7 @@ __mpage_writepages(struct address_space *mapping,
 	pgoff_t end = -1;		/* Inclusive */
 	int scanned = 0;
 	int is_range = 0;
+	unsigned run_end = 0;		/* slots before it are locked already */
 
 	if (wbc->nonblocking && bdi_write_congested(bdi)) {
 		wbc->encountered_congestion = 1;
@@ -655,7 +836,7 @@ __mpage_writepages(struct address_space *mapping,
 	}
 
 	writepage = NULL;
-	if (get_block == NULL)
+	if (get_block == NULL && ext == NULL)
 		writepage = mapping->a_ops->writepage;
 
 	pagevec_init(&pvec, 0);
@@ -690,7 +871,8 @@ retry:
 			 * mapping
 			 */
 
-			lock_page(page);
+			if (i >= run_end)
+				lock_page(page);
 
 			if (unlikely(page->mapping != mapping)) {
 				unlock_page(page);
@@ -723,9 +905,12 @@ retry:
 							&mapping->flags);
 				}
 			} else {
+				if (ext && i >= run_end)
+					run_end = mpage_lock_run(&pvec, i,
+						mapping, end, ext);
 				bio = __mpage_writepage(bio, page, get_block,
-						&last_block_in_bio, &ret, wbc,
-						writepage_fn);
+						ext, &last_block_in_bio, &ret,
+						wbc, writepage_fn);
 			}
 			if (ret || (--(wbc->nr_to_write) <= 0))
 				done = 1;
@@ -733,7 +918,16 @@ retry:
 				wbc->encountered_congestion = 1;
 				done = 1;
 			}
+			if (done)
+				break;
 		}
+		/* The rest of a run cut short is still locked, and dirty */
+		while (++i < run_end)
+			unlock_page(pvec.pages[i]);
+		/* Blocks of pages we no longer hold may be freed any time */
+		if (ext)
+			ext->nr_blocks = 0;
+		run_end = 0;
 		pagevec_release(&pvec);
 		cond_resched();
 	}
@@ -752,8 +946,44 @@ retry:
 		mpage_bio_submit(WRITE, bio);
 	return ret;
 }
+
+int
+__mpage_writepages(struct address_space *mapping,
+		struct writeback_control *wbc, get_block_t get_block,
+		writepage_t writepage_fn)
+{
+	return do_mpage_writepages(mapping, wbc, get_block, NULL,
+					writepage_fn);
+}
+
+/**
+ * mpage_writepages_blocks - mpage_writepages() for multi-block mappers
+ *
+ * @mapping: address space structure to write
+ * @wbc: subtract the number of written pages from *@wbc->nr_to_write
+ * @get_blocks: the filesystem's multi-block mapper function.
+ * @writepage_fn: used for pages which cannot go direct-to-BIO.
+ *
+ * As __mpage_writepages(), but the blocks under each run of consecutive
+ * dirty pages are mapped (or allocated) with as few @get_blocks calls as
+ * the filesystem allows, rather than with one get_block call per block.
+ * @get_blocks reports how many contiguous blocks it mapped in b_size, in
+ * the same way as for direct-io.
+ */
+int
+mpage_writepages_blocks(struct address_space *mapping,
+		struct writeback_control *wbc, get_blocks_t get_blocks,
+		writepage_t writepage_fn)
+{
+	struct mpage_extent ext;
+
+	memset(&ext, 0, sizeof(ext));
+	ext.get_blocks = get_blocks;
+	return do_mpage_writepages(mapping, wbc, NULL, &ext, writepage_fn);
+}
 EXPORT_SYMBOL(mpage_writepages);
 EXPORT_SYMBOL(__mpage_writepages);
+EXPORT_SYMBOL(mpage_writepages_blocks);
 
 int mpage_writepage(struct page *page, get_block_t get_block,
 	struct writeback_control *wbc)
@@ -762,7 +992,7 @@ int mpage_writepage(struct page *page, get_block_t get_block,
 	struct bio *bio;
 	sector_t last_block_in_bio = 0;
 
-	bio = __mpage_writepage(NULL, page, get_block,
+	bio = __mpage_writepage(NULL, page, get_block, NULL,
 			&last_block_in_bio, &ret, wbc, NULL);
 	if (bio)
 		mpage_bio_submit(WRITE, bio);
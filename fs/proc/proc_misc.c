@@ -163,6 +163,7 @@ static int meminfo_read_proc(char *page, char **start, off_t off,
 		"Writeback:    %8lu kB\n"
 		"Mapped:       %8lu kB\n"
 		"Slab:         %8lu kB\n"
+		"AnonHugePages:%8lu kB\n"
 		"CommitLimit:  %8lu kB\n"
 		"Committed_AS: %8lu kB\n"
 		"PageTables:   %8lu kB\n"
@@ -186,6 +187,7 @@ static int meminfo_read_proc(char *page, char **start, off_t off,
 		K(ps.nr_writeback),
 		K(ps.nr_mapped),
 		K(ps.nr_slab),
+		K(ps.nr_anon_huge_pages),
 		K(allowed),
 		K(committed),
 		K(ps.nr_page_table_pages),
@@ -214,6 +216,47 @@ static struct file_operations fragmentation_file_operations = {
 	.release	= seq_release,
 };
 
+extern struct seq_operations kswapdinfo_op;
+static int kswapdinfo_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &kswapdinfo_op);
+}
+
+static struct file_operations kswapdinfo_file_operations = {
+	.open		= kswapdinfo_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
+extern struct seq_operations shrinkers_op;
+static int shrinkers_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &shrinkers_op);
+}
+
+static struct file_operations shrinkers_file_operations = {
+	.open		= shrinkers_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
+#ifdef CONFIG_KSM
+extern struct seq_operations ksminfo_op;
+static int ksminfo_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &ksminfo_op);
+}
+
+static struct file_operations ksminfo_file_operations = {
+	.open		= ksminfo_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+#endif
+
 static int version_read_proc(char *page, char **start, off_t off,
 				 int count, int *eof, void *data)
 {
@@ -583,6 +626,11 @@ void __init proc_misc_init(void)
 	create_seq_entry("interrupts", 0, &proc_interrupts_operations);
 	create_seq_entry("slabinfo",S_IWUSR|S_IRUGO,&proc_slabinfo_operations);
 	create_seq_entry("buddyinfo",S_IRUGO, &fragmentation_file_operations);
+	create_seq_entry("kswapdinfo",S_IRUGO, &kswapdinfo_file_operations);
+	create_seq_entry("shrinkers",S_IRUGO, &shrinkers_file_operations);
+#ifdef CONFIG_KSM
+	create_seq_entry("ksminfo",S_IRUGO, &ksminfo_file_operations);
+#endif
 	create_seq_entry("vmstat",S_IRUGO, &proc_vmstat_file_operations);
 	create_seq_entry("diskstats", 0, &proc_diskstats_operations);
 #ifdef CONFIG_MODULES
@@ -156,7 +156,7 @@ static void *m_start(struct seq_file *m, loff_t *pos)
 
 	/*
 	 * We remember last_addr rather than next_addr to hit with
-	 * mmap_cache most of the time. We have zero last_addr at
+	 * the vmacache most of the time. We have zero last_addr at
 	 * the begining and also after lseek. We will have -1 last_addr
 	 * after the end of the maps.
 	 */
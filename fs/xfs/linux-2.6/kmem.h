@@ -139,7 +139,7 @@ typedef int (*kmem_shake_func_t)(int, unsigned int);
 static __inline kmem_shaker_t
 kmem_shake_register(kmem_shake_func_t sfunc)
 {
-	return set_shrinker(DEFAULT_SEEKS, sfunc);
+	return set_shrinker(DEFAULT_SEEKS, 0, sfunc);
 }
 
 static __inline void
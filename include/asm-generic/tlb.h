@@ -157,4 +157,48 @@ static inline void tlb_remove_page(struct mmu_gather *tlb, struct page *page)
 
 #define tlb_migrate_finish(mm) do {} while (0)
 
+#ifdef CONFIG_BATCHED_UNMAP_TLB_FLUSH
+/* struct mmu_unmap_batch gathers TLB flushes for reclaim, which unmaps
+ * single pages of many mms and sleeps in between, so cannot keep an
+ * mmu_gather.  try_to_unmap() clears the ptes without flushing and adds
+ * the CPUs each mm has run on: one IPI to all of them, before any of
+ * the pages can be written out or freed, then does for the whole batch.
+ * It lives on the reclaimer's stack, found through current->unmap_batch.
+ */
+struct mmu_unmap_batch {
+	cpumask_t		cpus;	/* may have stale entries cached */
+	unsigned int		need_flush;
+	unsigned int		dirty;	/* a dirty pte was cleared */
+};
+
+static inline void tlb_unmap_batch_init(struct mmu_unmap_batch *batch)
+{
+	cpus_clear(batch->cpus);
+	batch->need_flush = 0;
+	batch->dirty = 0;
+}
+
+/* tlb_unmap_batch_add
+ *	Called with the pte cleared: a cpu which takes up @mm after reading
+ *	cpu_vm_mask here loads its page tables afresh.
+ */
+static inline void tlb_unmap_batch_add(struct mmu_unmap_batch *batch,
+				       struct mm_struct *mm, pte_t pteval)
+{
+	cpus_or(batch->cpus, batch->cpus, mm->cpu_vm_mask);
+	batch->need_flush = 1;
+	if (pte_dirty(pteval))
+		batch->dirty = 1;
+}
+
+static inline void tlb_unmap_batch_flush(struct mmu_unmap_batch *batch)
+{
+	if (!batch->need_flush)
+		return;
+	flush_tlb_cpus(batch->cpus);
+	tlb_unmap_batch_init(batch);
+}
+#endif
+
+
 #endif /* _ASM_GENERIC__TLB_H */
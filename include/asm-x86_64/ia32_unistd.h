@@ -294,7 +294,11 @@
 #define __NR_ia32_add_key		286
 #define __NR_ia32_request_key	287
 #define __NR_ia32_keyctl		288
+#define __NR_ia32_ioprio_set	289
+#define __NR_ia32_ioprio_get	290
+#define __NR_ia32_migrate_pages	291
+#define __NR_ia32_move_pages	292
 
-#define IA32_NR_syscalls 290	/* must be > than biggest syscall! */
+#define IA32_NR_syscalls 293	/* must be > than biggest syscall! */
 
 #endif /* _ASM_X86_64_IA32_UNISTD_H_ */
@@ -295,6 +295,44 @@ static inline int pmd_large(pmd_t pte) {
 	return (pmd_val(pte) & __LARGE_PTE) == __LARGE_PTE; 
 } 	
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Huge pmds mapping anonymous memory, see mm/huge_memory.c.  The pmd is
+ * a pte with _PAGE_PSE added: don't use pmd_page() on it, bit 63 may be NX.
+ */
+static inline int pmd_trans_huge(pmd_t pmd)
+{
+	return pmd_val(pmd) & _PAGE_PSE;
+}
+
+static inline pte_t pmd_huge_pte(pmd_t pmd)
+{
+	return __pte(pmd_val(pmd) & ~_PAGE_PSE);
+}
+
+static inline pmd_t pte_mkhuge_pmd(pte_t pte)
+{
+	return __pmd(pte_val(pte) | _PAGE_PSE);
+}
+
+static inline pmd_t pmdp_get_and_clear(pmd_t *pmdp)
+{
+	return __pmd(xchg(&pmdp->pmd, 0));
+}
+
+static inline void pmdp_set_wrprotect(pmd_t *pmdp)
+{
+	clear_bit(_PAGE_BIT_RW, pmdp);
+}
+
+static inline int pmdp_test_and_clear_young(pmd_t *pmdp)
+{
+	if (!(pmd_val(*pmdp) & _PAGE_ACCESSED))
+		return 0;
+	return test_and_clear_bit(_PAGE_BIT_ACCESSED, pmdp);
+}
+#endif
+
 
 /*
  * Conversion functions: convert a page and protection to a page entry,
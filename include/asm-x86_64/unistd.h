@@ -563,8 +563,16 @@ __SYSCALL(__NR_add_key, sys_add_key)
 __SYSCALL(__NR_request_key, sys_request_key)
 #define __NR_keyctl		250
 __SYSCALL(__NR_keyctl, sys_keyctl)
-
-#define __NR_syscall_max __NR_keyctl
+#define __NR_ioprio_set		251
+__SYSCALL(__NR_ioprio_set, sys_ioprio_set)
+#define __NR_ioprio_get		252
+__SYSCALL(__NR_ioprio_get, sys_ioprio_get)
+#define __NR_migrate_pages	253
+__SYSCALL(__NR_migrate_pages, sys_migrate_pages)
+#define __NR_move_pages		254
+__SYSCALL(__NR_move_pages, sys_move_pages)
+
+#define __NR_syscall_max __NR_move_pages
 #ifndef __NO_STUBS
 
 /* user-visible error numbers are in the range -1 - -4095 */
@@ -16,6 +16,7 @@
 #include <linux/stringify.h>
 
 #include <asm/scatterlist.h>
+#include <asm/timex.h>
 
 struct request_queue;
 typedef struct request_queue request_queue_t;
@@ -96,10 +97,21 @@ void swap_io_context(struct io_context **ioc1, struct io_context **ioc2);
 struct request;
 typedef void (rq_end_io_fn)(struct request *);
 
+/*
+ * Requests freed on a cpu, kept there to be allocated again
+ */
+#define BLK_RQ_CACHE	16
+
+struct request_cache {
+	int nr;
+	struct request *rqs[BLK_RQ_CACHE];
+};
+
 struct request_list {
 	int count[2];
 	int starved[2];
 	mempool_t *rq_pool;
+	struct request_cache *rq_cache;	/* per-cpu, may be NULL */
 	wait_queue_head_t wait[2];
 	wait_queue_head_t drain;
 };
@@ -113,6 +125,7 @@ struct request {
 	struct list_head queuelist; /* looking for ->queue? you must _not_
 				     * access it directly, use
 				     * blkdev_dequeue_request! */
+	struct list_head donelist;	/* blk_complete_request() list */
 	unsigned long flags;		/* see REQ_ bits below */
 
 	/* Maintain bio traversal state for part by part I/O submission.
@@ -279,6 +292,7 @@ typedef void (activity_fn) (void *data, int rw);
 typedef int (issue_flush_fn) (request_queue_t *, struct gendisk *, sector_t *);
 typedef int (prepare_flush_fn) (request_queue_t *, struct request *);
 typedef void (end_flush_fn) (request_queue_t *, struct request *);
+typedef void (softirq_done_fn)(struct request *);
 
 enum blk_queue_state {
 	Queue_down,
@@ -298,6 +312,16 @@ struct blk_queue_tag {
 	atomic_t refcnt;		/* map can be shared */
 };
 
+#ifdef CONFIG_BLK_DEV_LOCK_STATS
+struct blk_lock_stats {
+	unsigned long		acquired;	/* by the block layer */
+	unsigned long		contended;	/* had to spin */
+	unsigned long long	hold_total;	/* cycles */
+	cycles_t		hold_max;
+	cycles_t		hold_start;
+};
+#endif
+
 struct request_queue
 {
 	/*
@@ -324,6 +348,7 @@ struct request_queue
 	issue_flush_fn		*issue_flush_fn;
 	prepare_flush_fn	*prepare_flush_fn;
 	end_flush_fn		*end_flush_fn;
+	softirq_done_fn		*softirq_done_fn;
 
 	/*
 	 * Auto-unplugging state
@@ -358,6 +383,9 @@ struct request_queue
 	 * protects queue structures from reentrancy
 	 */
 	spinlock_t		*queue_lock;
+#ifdef CONFIG_BLK_DEV_LOCK_STATS
+	struct blk_lock_stats	lock_stats;
+#endif
 
 	/*
 	 * queue kobject
@@ -591,6 +619,12 @@ extern int end_that_request_chunk(struct request *, int, int);
 extern void end_that_request_last(struct request *);
 extern void end_request(struct request *req, int uptodate);
 
+/*
+ * blk_complete_request() is called without the queue lock, from hard irq
+ * context. The completion is finished by the queue's softirq_done_fn.
+ */
+extern void blk_complete_request(struct request *);
+
 /*
  * end_that_request_first/chunk() takes an uptodate argument. we account
  * any value <= as an io error. 0 means -EIO for compatability reasons,
@@ -624,6 +658,7 @@ extern void blk_queue_hardsect_size(request_queue_t *, unsigned short);
 extern void blk_queue_stack_limits(request_queue_t *t, request_queue_t *b);
 extern void blk_queue_segment_boundary(request_queue_t *, unsigned long);
 extern void blk_queue_prep_rq(request_queue_t *, prep_rq_fn *pfn);
+extern void blk_queue_softirq_done(request_queue_t *, softirq_done_fn *);
 extern void blk_queue_merge_bvec(request_queue_t *, merge_bvec_fn *);
 extern void blk_queue_dma_alignment(request_queue_t *, int);
 extern struct backing_dev_info *blk_get_backing_dev_info(struct block_device *bdev);
@@ -83,6 +83,16 @@ struct ext3_inode_info {
 	/* block reservation info */
 	struct ext3_block_alloc_info *i_block_alloc_info;
 
+	/*
+	 * Delayed allocation: blocks charged to quota and set aside in
+	 * s_dirtyblocks_counter for dirty pages not yet allocated on disk,
+	 * data blocks and a worst-case estimate of the indirect blocks
+	 * needed to map them.  Protected by i_da_lock.
+	 */
+	spinlock_t i_da_lock;
+	unsigned long i_da_data_blocks;
+	unsigned long i_da_meta_blocks;
+
 	__u32	i_dir_start_lookup;
 #ifdef CONFIG_EXT3_FS_XATTR
 	/*
@@ -57,7 +57,10 @@ struct ext3_sb_info {
 	struct percpu_counter s_freeblocks_counter;
 	struct percpu_counter s_freeinodes_counter;
 	struct percpu_counter s_dirs_counter;
+	struct percpu_counter s_dirtyblocks_counter;	/* delalloc reservations */
 	struct blockgroup_lock s_blockgroup_lock;
+	unsigned int *s_group_max_run;	/* longest free run, per group */
+	unsigned long s_group_summaries; /* groups in s_group_max_run */
 
 	/* root of the per fs reservation window tree */
 	spinlock_t s_rsv_window_lock;
@@ -0,0 +1,130 @@
+#ifndef _LINUX_HUGE_MM_H
+#define _LINUX_HUGE_MM_H
+
+/*
+ * Transparent huge pages: anonymous memory mapped by huge pmds.
+ * See mm/huge_memory.c.
+ */
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+
+struct mmu_gather;
+
+#define HPAGE_PMD_SHIFT		PMD_SHIFT
+#define HPAGE_PMD_SIZE		(1UL << HPAGE_PMD_SHIFT)
+#define HPAGE_PMD_MASK		(~(HPAGE_PMD_SIZE - 1))
+#define HPAGE_PMD_ORDER		(HPAGE_PMD_SHIFT - PAGE_SHIFT)
+#define HPAGE_PMD_NR		(1 << HPAGE_PMD_ORDER)
+
+extern int sysctl_transparent_hugepage;
+extern int sysctl_khugepaged_pages_to_scan;
+extern int sysctl_khugepaged_scan_sleep_millisecs;
+
+/*
+ * Only private anonymous memory is mapped with huge pmds, and not where
+ * KSM has been asked to merge pages.
+ */
+static inline int vma_huge_anon(struct vm_area_struct *vma)
+{
+	return !vma->vm_file && !vma->vm_ops &&
+		!(vma->vm_flags & (VM_SHARED|VM_IO|VM_RESERVED|VM_HUGETLB|
+				   VM_MERGEABLE));
+}
+
+static inline struct page *huge_pmd_page(pmd_t pmd)
+{
+	return pte_page(pmd_huge_pte(pmd));
+}
+
+/*
+ * Does the huge pmd map @page?  For the rmap walks.
+ */
+static inline int huge_pmd_maps_page(pmd_t pmd, struct page *page)
+{
+	return page_to_pfn(page) - pte_pfn(pmd_huge_pte(pmd)) < HPAGE_PMD_NR;
+}
+
+/*
+ * unmap_vmas works in blocks: never end one in the middle of a huge pmd.
+ */
+static inline unsigned long huge_pmd_block_end(struct vm_area_struct *vma,
+				unsigned long addr, unsigned long end)
+{
+	unsigned long next;
+
+	if (!vma_huge_anon(vma))
+		return addr;
+	next = (addr + HPAGE_PMD_SIZE - 1) & HPAGE_PMD_MASK;
+	if (next && next < end)
+		return next;
+	return end;
+}
+
+int do_huge_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			unsigned long address, pmd_t *pmd, int write_access);
+int do_huge_pmd_fault(struct mm_struct *mm, struct vm_area_struct *vma,
+			unsigned long address, pmd_t *pmd, int write_access);
+struct page *follow_huge_anon_pmd(struct mm_struct *mm, unsigned long address,
+			pmd_t *pmd, int write);
+int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+			pmd_t *dst_pmd, pmd_t *src_pmd);
+void zap_huge_pmd(struct mmu_gather *tlb, pmd_t *pmd);
+int __split_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+			unsigned long address, struct page *new);
+int split_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+			unsigned long address);
+int split_huge_pmd_address(struct vm_area_struct *vma, unsigned long address);
+int split_huge_pmd_range(struct vm_area_struct *vma, unsigned long start,
+			unsigned long end);
+void khugepaged_enter(struct vm_area_struct *vma);
+void khugepaged_exit(struct mm_struct *mm);
+void khugepaged_forget(struct mm_struct *mm);
+
+#else /* !CONFIG_TRANSPARENT_HUGEPAGE */
+
+#define pmd_trans_huge(pmd)	0
+
+static inline int vma_huge_anon(struct vm_area_struct *vma)
+{
+	return 0;
+}
+
+static inline struct page *huge_pmd_page(pmd_t pmd)
+{
+	return NULL;
+}
+
+static inline int huge_pmd_maps_page(pmd_t pmd, struct page *page)
+{
+	return 0;
+}
+
+static inline unsigned long huge_pmd_block_end(struct vm_area_struct *vma,
+				unsigned long addr, unsigned long end)
+{
+	return addr;
+}
+
+static inline int split_huge_pmd_address(struct vm_area_struct *vma,
+				unsigned long address)
+{
+	return 0;
+}
+
+static inline int split_huge_pmd_range(struct vm_area_struct *vma,
+				unsigned long start, unsigned long end)
+{
+	return 0;
+}
+
+#define do_huge_anonymous_page(mm, vma, address, pmd, write) VM_FAULT_FALLBACK
+#define do_huge_pmd_fault(mm, vma, address, pmd, write)	VM_FAULT_FALLBACK
+#define follow_huge_anon_pmd(mm, address, pmd, write)	NULL
+#define copy_huge_pmd(dst_mm, src_mm, dst_pmd, src_pmd)	(-EAGAIN)
+#define zap_huge_pmd(tlb, pmd)				do { } while (0)
+#define khugepaged_exit(mm)				do { } while (0)
+#define khugepaged_forget(mm)				do { } while (0)
+
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+#endif /* _LINUX_HUGE_MM_H */
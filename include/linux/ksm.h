@@ -0,0 +1,46 @@
+#ifndef _LINUX_KSM_H
+#define _LINUX_KSM_H
+
+/*
+ * Merging of identical anonymous pages in madvised areas.
+ * See mm/ksm.c.
+ */
+
+#include <linux/mm.h>
+
+#ifdef CONFIG_KSM
+
+extern int sysctl_ksm_run;
+extern int sysctl_ksm_pages_to_scan;
+extern int sysctl_ksm_sleep_millisecs;
+
+struct ctl_table;
+struct file;
+int ksm_run_sysctl_handler(struct ctl_table *table, int write,
+		struct file *file, void __user *buffer, size_t *length,
+		loff_t *ppos);
+
+/*
+ * A KSM page is an anonymous page without an anon_vma: its ptes belong
+ * to whichever mms had a page of the same contents.  It is kept off the
+ * LRU, and copied on the first write to it through any of them.
+ */
+static inline int PageKsm(struct page *page)
+{
+	return page->mapping == (void *)PAGE_MAPPING_ANON;
+}
+
+int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
+		unsigned long end, int advice, unsigned long *vm_flags);
+void ksm_fork(struct mm_struct *mm, struct mm_struct *oldmm);
+void ksm_exit(struct mm_struct *mm);
+
+#else /* !CONFIG_KSM */
+
+#define PageKsm(page)			0
+#define ksm_fork(mm, oldmm)		do { } while (0)
+#define ksm_exit(mm)			do { } while (0)
+
+#endif /* CONFIG_KSM */
+
+#endif /* _LINUX_KSM_H */
@@ -0,0 +1,58 @@
+#ifndef _LINUX_MEMCTL_H
+#define _LINUX_MEMCTL_H
+/*
+ * Memory controller: page accounting and limits for cpusets.
+ * See mm/memctl.c.
+ */
+
+#include <linux/config.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/spinlock.h>
+#include <asm/atomic.h>
+
+#ifdef CONFIG_CPUSET_MEMCTL
+
+#define MEM_GROUP_UNLIMITED	(~0UL)
+
+/*
+ * The pages charged to a cpuset.  Its cpuset holds a reference, and so
+ * does each charged page: a group outlives its cpuset until the last
+ * page charged to it is freed.
+ */
+struct mem_group {
+	spinlock_t lock;		/* Protects the rest; taken irqsave */
+	unsigned long usage;		/* Pages charged */
+	unsigned long limit;		/* Most pages which may be charged */
+	unsigned long failcnt;		/* Charges refused at the limit */
+	struct list_head pages;		/* Charged pages, coldest last */
+	atomic_t count;
+};
+
+extern struct mem_group *mem_group_alloc(void);
+extern void mem_group_put(struct mem_group *mg);
+extern void mem_group_set_limit(struct mem_group *mg, unsigned long limit);
+extern int memctl_charge(struct page *page, unsigned int gfp_mask);
+extern void __memctl_uncharge(struct page *page);
+extern void memctl_migrate(struct page *page, struct page *newpage);
+
+/* kernel/cpuset.c */
+extern struct mem_group *cpuset_get_mem_group(void);
+extern int cpuset_charges_memory(void);
+
+static inline void memctl_uncharge(struct page *page)
+{
+	if (unlikely(page->mem_group != NULL))
+		__memctl_uncharge(page);
+}
+
+#else /* !CONFIG_CPUSET_MEMCTL */
+
+#define memctl_charge(page, gfp_mask)	0
+#define memctl_uncharge(page)		do { } while (0)
+#define memctl_migrate(page, newpage)	do { } while (0)
+#define cpuset_charges_memory()		0
+
+#endif /* CONFIG_CPUSET_MEMCTL */
+
+#endif /* _LINUX_MEMCTL_H */
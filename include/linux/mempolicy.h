@@ -22,6 +22,10 @@
 
 /* Flags for mbind */
 #define MPOL_MF_STRICT	(1<<0)	/* Verify existing pages in the mapping */
+#define MPOL_MF_MOVE	(1<<1)	/* Move pages owned by this process to conform
+				   to the policy; also for move_pages */
+#define MPOL_MF_MOVE_ALL (1<<2)	/* Move every page to conform to the policy */
+#define MPOL_MF_INTERNAL (1<<3)	/* Internal flags start here */
 
 #ifdef __KERNEL__
 
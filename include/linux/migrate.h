@@ -0,0 +1,42 @@
+#ifndef _LINUX_MIGRATE_H
+#define _LINUX_MIGRATE_H
+
+#include <linux/config.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+
+/*
+ * Page migration between NUMA nodes, see mm/migrate.c.
+ */
+
+typedef struct page *new_page_t(struct page *, unsigned long private);
+
+/*
+ * Allocation flags for the page that @page is to be migrated to.
+ */
+static inline unsigned int migrate_gfp_mask(struct page *page)
+{
+	if (PageAnon(page) || !page->mapping)
+		return GFP_HIGHUSER;
+	return mapping_gfp_mask(page->mapping);
+}
+
+#ifdef CONFIG_NUMA
+extern int isolate_lru_page(struct page *p, struct list_head *pagelist);
+extern void putback_lru_pages(struct list_head *l);
+extern int migrate_pages(struct list_head *l, new_page_t x,
+			unsigned long private);
+#else
+static inline int isolate_lru_page(struct page *p, struct list_head *list)
+{
+	return -ENOSYS;
+}
+static inline void putback_lru_pages(struct list_head *l) {}
+static inline int migrate_pages(struct list_head *l, new_page_t x,
+			unsigned long private)
+{
+	return -ENOSYS;
+}
+#endif /* CONFIG_NUMA */
+
+#endif /* _LINUX_MIGRATE_H */
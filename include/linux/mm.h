@@ -13,6 +13,7 @@
 #include <linux/rbtree.h>
 #include <linux/prio_tree.h>
 #include <linux/fs.h>
+#include <linux/rcupdate.h>
 
 struct mempolicy;
 struct anon_vma;
@@ -71,6 +72,11 @@ struct vm_area_struct {
 	unsigned long vm_flags;		/* Flags, listed below. */
 
 	struct rb_node vm_rb;
+	/*
+	 * Largest free gap after any vma in this rbtree subtree, up to the
+	 * next vma: get_unmapped_area() skips subtrees with too little.
+	 */
+	unsigned long rb_subtree_gap;
 
 	/*
 	 * For areas with an address space and backing store,
@@ -113,6 +119,10 @@ struct vm_area_struct {
 #ifdef CONFIG_NUMA
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	seqcount_t vm_sequence;		/* Odd while the fields above change */
+	struct rcu_head vm_rcu_head;	/* VMAs are freed by RCU */
+#endif
 };
 
 /*
@@ -165,6 +175,7 @@ extern unsigned int kobjsize(const void *objp);
 #define VM_HUGETLB	0x00400000	/* Huge TLB Page VM */
 #define VM_NONLINEAR	0x00800000	/* Is non-linear (remap_file_pages) */
 #define VM_MAPPED_COPY	0x01000000	/* T if mapped copy of data (nommu mmap) */
+#define VM_MERGEABLE	0x02000000	/* KSM may merge identical pages */
 
 #ifndef VM_STACK_DEFAULT_FLAGS		/* arch can override this */
 #define VM_STACK_DEFAULT_FLAGS VM_DATA_DEFAULT_FLAGS
@@ -208,6 +219,7 @@ struct vm_operations_struct {
 
 struct mmu_gather;
 struct inode;
+struct mem_group;
 
 #ifdef ARCH_HAS_ATOMIC_UNSIGNED
 typedef unsigned page_flags_t;
@@ -229,13 +241,20 @@ struct page {
 					 * to show when page is mapped
 					 * & limit reverse map searches.
 					 */
-	unsigned long private;		/* Mapping-private opaque data:
+	union {
+		unsigned long private;	/* Mapping-private opaque data:
 					 * usually used for buffer_heads
 					 * if PagePrivate set; used for
 					 * swp_entry_t if PageSwapCache
 					 * When page is free, this indicates
 					 * order in the buddy system.
 					 */
+#if NR_CPUS >= CONFIG_SPLIT_PTLOCK_CPUS
+		spinlock_t ptl;		/* Page table page: protects its
+					 * ptes, see pte_lockptr() below.
+					 */
+#endif
+	} u;
 	struct address_space *mapping;	/* If low bit clear, points to
 					 * inode address_space, or NULL.
 					 * If page mapped as anonymous
@@ -247,6 +266,12 @@ struct page {
 	struct list_head lru;		/* Pageout list, eg. active_list
 					 * protected by zone->lru_lock !
 					 */
+#ifdef CONFIG_CPUSET_MEMCTL
+	struct mem_group *mem_group;	/* Charged to, see mm/memctl.c */
+	struct list_head mem_lru;	/* On mem_group->pages, under
+					 * mem_group->lock
+					 */
+#endif
 	/*
 	 * On machines where all RAM is mapped into kernel address space,
 	 * we can simply calculate the virtual address. On machines with
@@ -263,6 +288,9 @@ struct page {
 #endif /* WANT_PAGE_VIRTUAL */
 };
 
+#define page_private(page)		((page)->u.private)
+#define set_page_private(page, v)	((page)->u.private = (v))
+
 /*
  * FIXME: take this include out, include page-flags.h in
  * files which need it (119 of them)
@@ -317,14 +345,14 @@ extern void FASTCALL(__page_cache_release(struct page *));
 static inline int page_count(struct page *p)
 {
 	if (PageCompound(p))
-		p = (struct page *)p->private;
+		p = (struct page *)page_private(p);
 	return atomic_read(&(p)->_count) + 1;
 }
 
 static inline void get_page(struct page *page)
 {
 	if (unlikely(PageCompound(page)))
-		page = (struct page *)page->private;
+		page = (struct page *)page_private(page);
 	atomic_inc(&page->_count);
 }
 
@@ -498,7 +526,7 @@ static inline int PageAnon(struct page *page)
 static inline pgoff_t page_index(struct page *page)
 {
 	if (unlikely(PageSwapCache(page)))
-		return page->private;
+		return page_private(page);
 	return page->index;
 }
 
@@ -541,6 +569,12 @@ static inline int page_mapped(struct page *page)
 #define VM_FAULT_MINOR	1
 #define VM_FAULT_MAJOR	2
 
+/*
+ * Returned when a fault has to be handled some other way after all: a
+ * huge pmd fault at pte level, a speculative fault under mmap_sem.
+ */
+#define VM_FAULT_FALLBACK	(-2)
+
 #define offset_in_page(p)	((unsigned long)(p) & ~PAGE_MASK)
 
 extern void show_free_areas(void);
@@ -646,14 +680,36 @@ extern unsigned long do_mremap(unsigned long addr,
  */
 typedef int (*shrinker_t)(int nr_to_scan, unsigned int gfp_mask);
 
+/*
+ * A cache which keeps its objects per node can register a node shrinker
+ * instead.  It is passed the node reclaim is working for (-1 for all of
+ * them), and the zone when reclaim is for a single zone, and should count
+ * and scan only the objects which free memory there.  Its pending scan
+ * count is kept per node.
+ */
+struct shrink_control {
+	int nr_to_scan;			/* 0 to query the cache size */
+	unsigned int gfp_mask;
+	int nid;			/* node to shrink, or -1 */
+	struct zone *zone;		/* zone to shrink, or NULL */
+};
+
+typedef int (*node_shrinker_t)(struct shrink_control *sc);
+
 /*
  * Add an aging callback.  The int is the number of 'seeks' it takes
- * to recreate one of the objects that these functions age.
+ * to recreate one of the objects that these functions age.  The batch
+ * is the most objects it should be asked to scan in one call (0 for the
+ * default): callbacks holding a global lock while they scan should keep
+ * that small.
  */
 
 #define DEFAULT_SEEKS 2
 struct shrinker;
-extern struct shrinker *set_shrinker(int, shrinker_t);
+extern struct shrinker *set_shrinker(int seeks, int batch,
+					shrinker_t theshrinker);
+extern struct shrinker *set_node_shrinker(int seeks, int batch,
+					node_shrinker_t theshrinker);
 extern void remove_shrinker(struct shrinker *shrinker);
 
 /*
@@ -683,6 +739,124 @@ static inline pmd_t *pmd_alloc(struct mm_struct *mm, pud_t *pud, unsigned long a
 #endif
 #endif /* CONFIG_MMU */
 
+#if NR_CPUS >= CONFIG_SPLIT_PTLOCK_CPUS
+/*
+ * With many cpus, each page table page carries its own spinlock, kept in
+ * its struct page, guarding the ptes it holds: faults on different parts
+ * of a large address space then no longer contend on page_table_lock.
+ * The page_table_lock still guards allocating and freeing page tables;
+ * it nests outside the pte locks.  Walks which change ptes must take
+ * the pte lock too, unless they hold mmap_sem for writing, excluding
+ * faults, as well as the page_table_lock, excluding everything else.
+ * Speculative faults (below) hold neither: such walks must also hold
+ * them off, or take the pte lock after all.
+ * A spinlock larger than ->u.private runs over ->mapping, which
+ * pte_lock_deinit() resets before the page table page is freed.
+ */
+#define __pte_lockptr(page)	(&(page)->u.ptl)
+#define pte_lock_init(page)	spin_lock_init(__pte_lockptr(page))
+#define pte_lock_deinit(page)	((page)->mapping = NULL)
+#define pte_lockptr(mm, pmd)	({(void)(mm); __pte_lockptr(pmd_page(*(pmd)));})
+
+/*
+ * Take the pte lock for a walk already holding the page_table_lock.
+ */
+#define pte_ptl_lock(mm, pmd)	({				\
+	spinlock_t *__ptl = pte_lockptr(mm, pmd);		\
+	spin_lock(__ptl);					\
+	__ptl;							\
+})
+#define pte_ptl_unlock(ptl)	spin_unlock(ptl)
+#else
+/*
+ * We use mm->page_table_lock to guard all pagetable pages of the mm.
+ */
+#define pte_lock_init(page)	do {} while (0)
+#define pte_lock_deinit(page)	do {} while (0)
+#define pte_lockptr(mm, pmd)	({(void)(pmd); &(mm)->page_table_lock;})
+
+#define pte_ptl_lock(mm, pmd)	({(void)(mm); (void)(pmd); (spinlock_t *)NULL;})
+#define pte_ptl_unlock(ptl)	do { (void)(ptl); } while (0)
+#endif
+
+/*
+ * Map the pte for address and take the lock guarding it, without
+ * holding the page_table_lock: the page fault path.
+ */
+#define pte_offset_map_lock(mm, pmd, address, ptlp)	\
+({							\
+	spinlock_t *__ptl = pte_lockptr(mm, pmd);	\
+	pte_t *__pte = pte_offset_map(pmd, address);	\
+	*(ptlp) = __ptl;				\
+	spin_lock(__ptl);				\
+	__pte;						\
+})
+
+#define pte_unmap_unlock(pte, ptl)	do {		\
+	spin_unlock(ptl);				\
+	pte_unmap(pte);					\
+} while (0)
+
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Speculative page faults look up the vma and walk the page tables
+ * without mmap_sem, so those who change what they rely on have to tell
+ * them, even when holding mmap_sem for writing:
+ *
+ * vma_write_begin/end bracket changes to a vma's bounds, flags and
+ *	protections, which a speculative fault has copied, and changes to
+ *	its ptes which do not take the pte lock;
+ * mm_rb_write_begin/end bracket changes to the mm_rb tree, which a
+ *	speculative fault walks under RCU;
+ * mm_exclude_faults_begin/end hold off speculative faults altogether,
+ *	around moving or freeing page tables.
+ *
+ * All of them are called with mmap_sem held for writing.
+ */
+static inline void vma_write_begin(struct vm_area_struct *vma)
+{
+	write_seqcount_begin(&vma->vm_sequence);
+}
+
+static inline void vma_write_end(struct vm_area_struct *vma)
+{
+	write_seqcount_end(&vma->vm_sequence);
+}
+
+static inline void mm_rb_write_begin(struct mm_struct *mm)
+{
+	write_seqcount_begin(&mm->mm_rb_seq);
+}
+
+static inline void mm_rb_write_end(struct mm_struct *mm)
+{
+	write_seqcount_end(&mm->mm_rb_seq);
+}
+
+static inline void mm_exclude_faults_begin(struct mm_struct *mm)
+{
+	write_seqcount_begin(&mm->fault_seq);
+}
+
+static inline void mm_exclude_faults_end(struct mm_struct *mm)
+{
+	write_seqcount_end(&mm->fault_seq);
+}
+
+extern struct vm_area_struct *find_vma_speculative(struct mm_struct *mm,
+		unsigned long addr, struct vm_area_struct *copy, unsigned *seq);
+extern int handle_speculative_fault(struct mm_struct *mm,
+		unsigned long address, int write_access);
+#else
+#define vma_write_begin(vma)			do { } while (0)
+#define vma_write_end(vma)			do { } while (0)
+#define mm_rb_write_begin(mm)			do { } while (0)
+#define mm_rb_write_end(mm)			do { } while (0)
+#define mm_exclude_faults_begin(mm)		do { } while (0)
+#define mm_exclude_faults_end(mm)		do { } while (0)
+#define handle_speculative_fault(mm, address, write)	VM_FAULT_FALLBACK
+#endif
+
 extern void free_area_init(unsigned long * zones_size);
 extern void free_area_init_node(int nid, pg_data_t *pgdat,
 	unsigned long * zones_size, unsigned long zone_start_pfn, 
@@ -730,6 +904,10 @@ extern struct vm_area_struct *copy_vma(struct vm_area_struct **,
 extern void exit_mmap(struct mm_struct *);
 
 extern unsigned long get_unmapped_area(struct file *, unsigned long, unsigned long, unsigned long, unsigned long);
+extern unsigned long unmapped_area(unsigned long len, unsigned long low,
+				   unsigned long high);
+extern unsigned long unmapped_area_topdown(unsigned long len,
+				unsigned long low, unsigned long high);
 
 extern unsigned long do_mmap_pgoff(struct file *file, unsigned long addr,
 	unsigned long len, unsigned long prot,
@@ -813,6 +991,8 @@ extern struct page * vmalloc_to_page(void *addr);
 extern unsigned long vmalloc_to_pfn(void *addr);
 extern struct page * follow_page(struct mm_struct *mm, unsigned long address,
 		int write);
+extern struct page * follow_page_get(struct mm_struct *mm,
+		unsigned long address);
 extern int check_user_page_readable(struct mm_struct *mm, unsigned long address);
 int remap_pfn_range(struct vm_area_struct *, unsigned long,
 		unsigned long, unsigned long, pgprot_t);
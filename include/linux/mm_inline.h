@@ -1,40 +1,72 @@
 
+/*
+ * Which LRU lists a page goes on is decided when it is first added to
+ * the LRU, and kept in PG_swapbacked: the anon lists for pages which
+ * only swap can back, the file lists for the rest.  ->mapping is not
+ * stable enough to decide it on the way off (truncation clears it).
+ */
+static inline int page_is_file_cache(struct page *page)
+{
+	return !PageSwapBacked(page);
+}
+
+static inline enum lru_list page_lru_base_type(struct page *page)
+{
+	return page_is_file_cache(page) ? LRU_INACTIVE_FILE : LRU_INACTIVE_ANON;
+}
+
+static inline enum lru_list page_lru(struct page *page)
+{
+	return page_lru_base_type(page) + (PageActive(page) ? LRU_ACTIVE : 0);
+}
+
+static inline unsigned long zone_lru_pages(struct zone *zone)
+{
+	return zone->nr_lru[LRU_ACTIVE_ANON] + zone->nr_lru[LRU_INACTIVE_ANON] +
+		zone->nr_lru[LRU_ACTIVE_FILE] + zone->nr_lru[LRU_INACTIVE_FILE];
+}
+
+static inline void
+add_page_to_lru_list(struct zone *zone, struct page *page, enum lru_list l)
+{
+	list_add(&page->lru, &zone->lru[l]);
+	zone->nr_lru[l]++;
+}
+
+static inline void
+del_page_from_lru_list(struct zone *zone, struct page *page, enum lru_list l)
+{
+	list_del(&page->lru);
+	zone->nr_lru[l]--;
+}
+
 static inline void
 add_page_to_active_list(struct zone *zone, struct page *page)
 {
-	list_add(&page->lru, &zone->active_list);
-	zone->nr_active++;
+	add_page_to_lru_list(zone, page, page_lru_base_type(page) + LRU_ACTIVE);
 }
 
 static inline void
 add_page_to_inactive_list(struct zone *zone, struct page *page)
 {
-	list_add(&page->lru, &zone->inactive_list);
-	zone->nr_inactive++;
+	add_page_to_lru_list(zone, page, page_lru_base_type(page));
 }
 
 static inline void
 del_page_from_active_list(struct zone *zone, struct page *page)
 {
-	list_del(&page->lru);
-	zone->nr_active--;
+	del_page_from_lru_list(zone, page, page_lru_base_type(page) + LRU_ACTIVE);
 }
 
 static inline void
 del_page_from_inactive_list(struct zone *zone, struct page *page)
 {
-	list_del(&page->lru);
-	zone->nr_inactive--;
+	del_page_from_lru_list(zone, page, page_lru_base_type(page));
 }
 
 static inline void
 del_page_from_lru(struct zone *zone, struct page *page)
 {
-	list_del(&page->lru);
-	if (PageActive(page)) {
-		ClearPageActive(page);
-		zone->nr_active--;
-	} else {
-		zone->nr_inactive--;
-	}
+	del_page_from_lru_list(zone, page, page_lru(page));
+	ClearPageActive(page);
 }
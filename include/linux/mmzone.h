@@ -28,6 +28,35 @@ struct free_area {
 
 struct pglist_data;
 
+/*
+ * The LRU lists of a zone.  Pages which only swap can back (anonymous,
+ * swap cache, tmpfs) and file pages age on separate lists, so that
+ * reclaim can choose between them without scanning through the other.
+ * Adding LRU_ACTIVE to an inactive list gives its active list.
+ */
+enum lru_list {
+	LRU_INACTIVE_ANON,
+	LRU_ACTIVE_ANON,
+	LRU_INACTIVE_FILE,
+	LRU_ACTIVE_FILE,
+	NR_LRU_LISTS
+};
+
+#define LRU_ACTIVE	1
+#define LRU_FILE	2
+
+#define for_each_lru(l) for (l = 0; l < NR_LRU_LISTS; l++)
+
+static inline int is_active_lru(enum lru_list l)
+{
+	return l & LRU_ACTIVE;
+}
+
+static inline int is_file_lru(enum lru_list l)
+{
+	return !!(l & LRU_FILE);
+}
+
 /*
  * zone->lock and zone->lru_lock are two of the hottest locks in the kernel.
  * So add a wild amount of padding here to ensure that they fall into separate
@@ -135,15 +164,38 @@ struct zone {
 
 	/* Fields commonly accessed by the page reclaim scanner */
 	spinlock_t		lru_lock;	
-	struct list_head	active_list;
-	struct list_head	inactive_list;
-	unsigned long		nr_scan_active;
-	unsigned long		nr_scan_inactive;
-	unsigned long		nr_active;
-	unsigned long		nr_inactive;
+	struct list_head	lru[NR_LRU_LISTS];
+	unsigned long		nr_scan[NR_LRU_LISTS];
+	unsigned long		nr_lru[NR_LRU_LISTS];
+
+	/*
+	 * How many anon [0] and file [1] pages reclaim recently took off
+	 * the LRU, and how many of them it had to put back on the active
+	 * list because they were in use.  The ratio is the cost of
+	 * scanning each type, and sets how hard each is scanned.  Halved
+	 * as they grow, so they follow the recent behaviour.
+	 */
+	unsigned long		recent_rotated[2];
+	unsigned long		recent_scanned[2];
+
+	/*
+	 * The active anon list is only aged while it is more than this
+	 * many times the size of the inactive one.
+	 */
+	unsigned int		inactive_ratio;
+
+	/*
+	 * Counts evictions and activations, the events which move the
+	 * inactive file list on: see mm/workingset.c.  Under lru_lock.
+	 */
+	unsigned long		inactive_age;
+
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	int			all_unreclaimable; /* All pages pinned */
 
+	/* jiffies of the last zone_reclaim() which freed too little */
+	unsigned long		last_unsuccessful_zone_reclaim;
+
 	/*
 	 * prev_priority holds the scanning priority for this zone.  It is
 	 * defined as the scanning priority at which we achieved our reclaim
@@ -151,8 +203,7 @@ struct zone {
 	 * invokation.
 	 *
 	 * We use prev_priority as a measure of how much stress page reclaim is
-	 * under - it drives the swappiness decision: whether to unmap mapped
-	 * pages.
+	 * under.
 	 *
 	 * temp_priority is used to remember the scanning priority at which
 	 * this zone was successfully refilled to free_pages == pages_high.
@@ -247,6 +298,12 @@ struct zonelist {
  * Memory statistics and page replacement data structures are maintained on a
  * per-zone basis.
  */
+/*
+ * A node can have up to this many kswapd threads: see kswapd_threads= in
+ * mm/vmscan.c.
+ */
+#define MAX_KSWAPD_THREADS	8
+
 struct bootmem_data;
 typedef struct pglist_data {
 	struct zone node_zones[MAX_NR_ZONES];
@@ -261,8 +318,15 @@ typedef struct pglist_data {
 	int node_id;
 	struct pglist_data *pgdat_next;
 	wait_queue_head_t kswapd_wait;
-	struct task_struct *kswapd;
+	struct task_struct *kswapd[MAX_KSWAPD_THREADS];
+	int nr_kswapd;			/* started so far */
 	int kswapd_max_order;
+	/*
+	 * kswapd runs for each order, and how many of them got the node's
+	 * zones above their watermarks for that order (/proc/kswapdinfo)
+	 */
+	unsigned long kswapd_order_runs[MAX_ORDER];
+	unsigned long kswapd_order_ok[MAX_ORDER];
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
@@ -23,6 +23,9 @@ int mpage_writepage(struct page *page, get_block_t *get_block,
 int __mpage_writepages(struct address_space *mapping,
 		struct writeback_control *wbc, get_block_t get_block,
 		writepage_t writepage);
+int mpage_writepages_blocks(struct address_space *mapping,
+		struct writeback_control *wbc, get_blocks_t get_blocks,
+		writepage_t writepage);
 
 static inline int
 generic_writepages(struct address_space *mapping, struct writeback_control *wbc)
@@ -76,6 +76,7 @@
 #define PG_reclaim		18	/* To be reclaimed asap */
 #define PG_nosave_free		19	/* Free, should not be written */
 #define PG_uncached		20	/* Page has been mapped as uncached */
+#define PG_swapbacked		21	/* On the anon LRU lists: see mm_inline.h */
 
 /*
  * Global page accounting.  One instance per CPU.  Only unsigned longs are
@@ -88,7 +89,8 @@ struct page_state {
 	unsigned long nr_page_table_pages;/* Pages used for pagetables */
 	unsigned long nr_mapped;	/* mapped into pagetables */
 	unsigned long nr_slab;		/* In slab */
-#define GET_PAGE_STATE_LAST nr_slab
+	unsigned long nr_anon_huge_pages;/* mapped by huge pmds */
+#define GET_PAGE_STATE_LAST nr_anon_huge_pages
 
 	/*
 	 * The below are zeroed by get_page_state().  Use get_full_page_state()
@@ -98,6 +100,8 @@ struct page_state {
 	unsigned long pgpgout;		/* Disk writes */
 	unsigned long pswpin;		/* swap reads */
 	unsigned long pswpout;		/* swap writes */
+	unsigned long pswpin_contig;	/* swap reads following the last one */
+	unsigned long pswpout_contig;	/* swap writes following the last one */
 	unsigned long pgalloc_high;	/* page allocations */
 
 	unsigned long pgalloc_normal;
@@ -108,6 +112,7 @@ struct page_state {
 
 	unsigned long pgfault;		/* faults (major+minor) */
 	unsigned long pgmajfault;	/* faults (major only) */
+	unsigned long pgspecfault;	/* faults handled without mmap_sem */
 	unsigned long pgrefill_high;	/* inspected in refill_inactive_zone */
 	unsigned long pgrefill_normal;
 	unsigned long pgrefill_dma;
@@ -122,6 +127,7 @@ struct page_state {
 	unsigned long pgscan_direct_high;/* total highmem pages scanned */
 	unsigned long pgscan_direct_normal;
 	unsigned long pgscan_direct_dma;
+	unsigned long pglumpy;		/* taken by lumpy reclaim */
 	unsigned long pginodesteal;	/* pages reclaimed via inode freeing */
 
 	unsigned long slabs_scanned;	/* slab objects scanned */
@@ -131,6 +137,27 @@ struct page_state {
 	unsigned long allocstall;	/* direct reclaim calls */
 
 	unsigned long pgrotated;	/* pages rotated to tail of the LRU */
+
+	unsigned long workingset_refault;/* evicted file pages read again */
+	unsigned long workingset_activate;/* ...soon enough to be activated */
+
+	unsigned long zone_reclaim_success;/* local reclaims before fallback */
+	unsigned long zone_reclaim_failed;/* ...which freed too little */
+
+	unsigned long thp_fault_alloc;	/* huge pages faulted in */
+	unsigned long thp_fault_fallback;/* huge faults fallen back to ptes */
+	unsigned long thp_collapse_alloc;/* huge pages allocated by khugepaged */
+	unsigned long thp_split;	/* huge pmds split into ptes */
+
+	unsigned long fork_vma_skip;	/* vmas left for the child to fault */
+	unsigned long fork_ptable_copy;	/* page tables copied by fork */
+	unsigned long fork_ptable_skip;	/* ...and left for the child to fault */
+
+	unsigned long vmacache_find_calls;/* find_vma lookups */
+	unsigned long vmacache_find_hits;/* ...found in the task's vmacache */
+
+	unsigned long unmap_tlb_deferred;/* ptes reclaim cleared unflushed */
+	unsigned long unmap_tlb_flush;	/* ...and the batch flushes of them */
 };
 
 extern void get_page_state(struct page_state *ret);
@@ -305,6 +332,9 @@ extern void __mod_page_state(unsigned offset, unsigned long delta);
 #define SetPageUncached(page)	set_bit(PG_uncached, &(page)->flags)
 #define ClearPageUncached(page)	clear_bit(PG_uncached, &(page)->flags)
 
+#define PageSwapBacked(page)	test_bit(PG_swapbacked, &(page)->flags)
+#define SetPageSwapBacked(page)	set_bit(PG_swapbacked, &(page)->flags)
+
 struct page;	/* forward declaration */
 
 int test_clear_page_dirty(struct page *page);
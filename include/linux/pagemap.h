@@ -50,6 +50,70 @@ static inline void mapping_set_gfp_mask(struct address_space *m, int mask)
 #define page_cache_release(page)	put_page(page)
 void release_pages(struct page **pages, int nr, int cold);
 
+/*
+ * find_get_page() and find_get_pages() look pages up under
+ * rcu_read_lock() alone (the radix tree is RCU-safe), and take their
+ * reference with page_cache_get_speculative(): it fails on a page which
+ * is free or frozen, and the caller must check that the page is still in
+ * its slot afterwards, since it may have been freed and reused meanwhile.
+ *
+ * Whoever removes or replaces a page in the page cache under tree_lock
+ * first freezes its count with page_freeze_refs(), which only succeeds
+ * if nobody else holds a reference, and keeps speculative references
+ * off until page_unfreeze_refs().
+ *
+ * This needs cmpxchg: elsewhere lookups keep taking tree_lock, under
+ * which they cannot see a page whose count is being checked.
+ */
+#ifdef __HAVE_ARCH_CMPXCHG
+
+#define pagecache_lookup_lock(mapping)		rcu_read_lock()
+#define pagecache_lookup_unlock(mapping)	rcu_read_unlock()
+
+static inline int page_cache_get_speculative(struct page *page)
+{
+	int count;
+
+	/* _count is biased by one: -1 is a free (or frozen) page */
+	do {
+		count = atomic_read(&page->_count);
+		if (unlikely(count == -1))
+			return 0;
+	} while (unlikely(cmpxchg(&page->_count.counter,
+				count, count + 1) != count));
+	return 1;
+}
+
+static inline int page_freeze_refs(struct page *page, int count)
+{
+	return likely(cmpxchg(&page->_count.counter, count - 1, -1) ==
+			count - 1);
+}
+
+#else /* !__HAVE_ARCH_CMPXCHG */
+
+#define pagecache_lookup_lock(mapping)	read_lock_irq(&(mapping)->tree_lock)
+#define pagecache_lookup_unlock(mapping) read_unlock_irq(&(mapping)->tree_lock)
+
+static inline int page_cache_get_speculative(struct page *page)
+{
+	page_cache_get(page);
+	return 1;
+}
+
+static inline int page_freeze_refs(struct page *page, int count)
+{
+	return page_count(page) == count;
+}
+
+#endif /* __HAVE_ARCH_CMPXCHG */
+
+static inline void page_unfreeze_refs(struct page *page, int count)
+{
+	smp_wmb();
+	set_page_count(page, count);
+}
+
 static inline struct page *page_cache_alloc(struct address_space *x)
 {
 	return alloc_pages(mapping_gfp_mask(x), 0);
@@ -97,6 +161,10 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				unsigned long index, int gfp_mask);
 extern void remove_from_page_cache(struct page *page);
 extern void __remove_from_page_cache(struct page *page);
+extern void __remove_from_page_cache_shadow(struct page *page, void *shadow);
+extern void clear_shadow_entries(struct address_space *mapping, pgoff_t start);
+extern void remove_from_page_cache_batch(struct address_space *mapping,
+				struct page **pages, int nr);
 
 extern atomic_t nr_pagecache;
 
@@ -21,6 +21,7 @@
 
 #include <linux/preempt.h>
 #include <linux/types.h>
+#include <linux/rcupdate.h>
 
 struct radix_tree_root {
 	unsigned int		height;
@@ -37,6 +38,14 @@ struct radix_tree_root {
 #define RADIX_TREE(name, mask) \
 	struct radix_tree_root name = RADIX_TREE_INIT(mask)
 
+/*
+ * Items are at least word aligned, so bit 1 of a pointer to one is clear.
+ * Users may keep other values in a slot with it set, shifted up past it:
+ * these "exceptional entries" are skipped by the gang lookups.
+ */
+#define RADIX_TREE_EXCEPTIONAL_ENTRY	2
+#define RADIX_TREE_EXCEPTIONAL_SHIFT	2
+
 #define INIT_RADIX_TREE(root, mask)					\
 do {									\
 	(root)->height = 0;						\
@@ -46,10 +55,18 @@ do {									\
 
 int radix_tree_insert(struct radix_tree_root *, unsigned long, void *);
 void *radix_tree_lookup(struct radix_tree_root *, unsigned long);
+void **radix_tree_lookup_slot(struct radix_tree_root *, unsigned long);
 void *radix_tree_delete(struct radix_tree_root *, unsigned long);
+unsigned long radix_tree_delete_range(struct radix_tree_root *root,
+			unsigned long first, unsigned long last);
+unsigned long radix_tree_delete_exceptional(struct radix_tree_root *root,
+			unsigned long first, unsigned long last);
 unsigned int
 radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 			unsigned long first_index, unsigned int max_items);
+unsigned int
+radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
+			unsigned long first_index, unsigned int max_items);
 int radix_tree_preload(int gfp_mask);
 void radix_tree_init(void);
 void *radix_tree_tag_set(struct radix_tree_root *root,
@@ -63,6 +80,20 @@ radix_tree_gang_lookup_tag(struct radix_tree_root *root, void **results,
 		unsigned long first_index, unsigned int max_items, int tag);
 int radix_tree_tagged(struct radix_tree_root *root, int tag);
 
+/*
+ * Read an item through a slot found by radix_tree_lookup_slot() or
+ * radix_tree_gang_lookup_slot() under rcu_read_lock().
+ */
+static inline void *radix_tree_deref_slot(void **slot)
+{
+	return rcu_dereference(*slot);
+}
+
+static inline int radix_tree_exceptional_entry(void *item)
+{
+	return (unsigned long)item & RADIX_TREE_EXCEPTIONAL_ENTRY;
+}
+
 static inline void radix_tree_preload_end(void)
 {
 	preempt_enable();
@@ -128,6 +128,20 @@ extern struct rb_node *rb_last(struct rb_root *);
 extern void rb_replace_node(struct rb_node *victim, struct rb_node *new, 
 			    struct rb_root *root);
 
+/*
+ * Trees whose nodes carry a value computed from their subtree: @func
+ * recomputes it for one node from its children.  Call rb_augment_insert
+ * after rb_insert_color; rb_augment_erase_begin before rb_erase, and
+ * rb_augment_erase_end with what it returned after.
+ */
+typedef void (*rb_augment_f)(struct rb_node *node, void *data);
+
+extern void rb_augment_insert(struct rb_node *node,
+			      rb_augment_f func, void *data);
+extern struct rb_node *rb_augment_erase_begin(struct rb_node *node);
+extern void rb_augment_erase_end(struct rb_node *node,
+				 rb_augment_f func, void *data);
+
 static inline void rb_link_node(struct rb_node * node, struct rb_node * parent,
 				struct rb_node ** rb_link)
 {
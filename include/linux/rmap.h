@@ -72,6 +72,7 @@ void __anon_vma_link(struct vm_area_struct *);
  */
 void page_add_anon_rmap(struct page *, struct vm_area_struct *, unsigned long);
 void page_add_file_rmap(struct page *);
+void page_add_ksm_rmap(struct page *);
 void page_remove_rmap(struct page *);
 
 /**
@@ -90,10 +91,25 @@ static inline void page_dup_rmap(struct page *page)
  * Called from mm/vmscan.c to handle paging out
  */
 int page_referenced(struct page *, int is_locked, int ignore_token);
-int try_to_unmap(struct page *);
+int try_to_unmap(struct page *, int migration);
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+int split_huge_page_pmds(struct page *);
+#else
+static inline int split_huge_page_pmds(struct page *page) { return 0; }
+#endif
+
+#ifdef CONFIG_BATCHED_UNMAP_TLB_FLUSH
+void try_to_unmap_flush(void);
+void try_to_unmap_flush_dirty(void);
+#else
+static inline void try_to_unmap_flush(void) { }
+static inline void try_to_unmap_flush_dirty(void) { }
+#endif
 
 /*
- * Used by swapoff to help locate where page is expected in vma.
+ * Used by swapoff and page migration to help locate where page is
+ * expected in vma.
  */
 unsigned long page_address_in_vma(struct page *, struct vm_area_struct *);
 
@@ -104,7 +120,10 @@ unsigned long page_address_in_vma(struct page *, struct vm_area_struct *);
 #define anon_vma_link(vma)	do {} while (0)
 
 #define page_referenced(page,l,i) TestClearPageReferenced(page)
-#define try_to_unmap(page)	SWAP_FAIL
+#define try_to_unmap(page, migration)	SWAP_FAIL
+#define split_huge_page_pmds(page)	0
+#define try_to_unmap_flush()		do {} while (0)
+#define try_to_unmap_flush_dirty()	do {} while (0)
 
 #endif	/* CONFIG_MMU */
 
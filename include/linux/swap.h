@@ -28,7 +28,14 @@ static inline int current_is_kswapd(void)
  * the type/offset into the pte as 5/27 as well.
  */
 #define MAX_SWAPFILES_SHIFT	5
+#ifndef CONFIG_NUMA
 #define MAX_SWAPFILES		(1 << MAX_SWAPFILES_SHIFT)
+#else
+/* Use last two entries for page migration swap entries */
+#define MAX_SWAPFILES		((1 << MAX_SWAPFILES_SHIFT)-2)
+#define SWP_MIGRATION_READ	MAX_SWAPFILES
+#define SWP_MIGRATION_WRITE	(MAX_SWAPFILES + 1)
+#endif
 
 /*
  * Magic header for a swap area. The first part of the union is
@@ -137,6 +144,8 @@ struct swap_info_struct {
 	unsigned long max;
 	unsigned long inuse_pages;
 	int next;			/* next entry on swap list */
+	sector_t last_read_sector;	/* for pswpin_contig */
+	sector_t last_write_sector;	/* for pswpout_contig */
 };
 
 struct swap_list_t {
@@ -171,11 +180,35 @@ extern void lru_add_drain(void);
 extern int rotate_reclaimable_page(struct page *page);
 extern void swap_setup(void);
 
+/* linux/mm/workingset.c */
+extern void *workingset_eviction(struct page *page);
+extern void workingset_trim_shadows(struct address_space *mapping);
+extern int workingset_refault(void *shadow);
+extern void workingset_activation(struct page *page);
+
 /* linux/mm/vmscan.c */
 extern int try_to_free_pages(struct zone **, unsigned int, unsigned int);
 extern int shrink_all_memory(int);
+extern int shrink_pages(struct page **, int, unsigned int, int);
 extern int vm_swappiness;
 
+/* zone_reclaim_mode bits */
+#define RECLAIM_ZONE	(1<<0)	/* Reclaim locally before going off node */
+#define RECLAIM_WRITE	(1<<1)	/* Write out dirty pages */
+#define RECLAIM_SWAP	(1<<2)	/* Unmap and swap out pages */
+
+#ifdef CONFIG_NUMA
+extern int zone_reclaim_mode;
+extern int zone_reclaim(struct zone *, unsigned int, unsigned int);
+#else
+#define zone_reclaim_mode 0
+static inline int zone_reclaim(struct zone *z, unsigned int mask,
+				unsigned int order)
+{
+	return 0;
+}
+#endif
+
 #ifdef CONFIG_MMU
 /* linux/mm/shmem.c */
 extern int shmem_unuse(swp_entry_t entry, struct page *page);
@@ -187,8 +220,23 @@ extern void swap_unplug_io_fn(struct backing_dev_info *, struct page *);
 /* linux/mm/page_io.c */
 extern int swap_readpage(struct file *, struct page *);
 extern int swap_writepage(struct page *page, struct writeback_control *wbc);
+extern int __swap_writepage(struct page *page, struct writeback_control *wbc);
 extern int rw_swap_page_sync(int, swp_entry_t, struct page *);
 
+/* linux/mm/zswap.c */
+#ifdef CONFIG_ZSWAP
+extern int zswap_max_pool_percent;
+extern int zswap_store(struct page *);
+extern int zswap_load(struct page *);
+extern void zswap_invalidate(unsigned, pgoff_t);
+extern void zswap_invalidate_area(unsigned);
+#else
+#define zswap_store(page)			(-ENODEV)
+#define zswap_load(page)			(-ENOENT)
+#define zswap_invalidate(type, offset)		do { } while (0)
+#define zswap_invalidate_area(type)		do { } while (0)
+#endif
+
 /* linux/mm/swap_state.c */
 extern struct address_space swapper_space;
 #define total_swapcache_pages  swapper_space.nrpages
@@ -170,6 +170,15 @@ enum
 	VM_VFS_CACHE_PRESSURE=26, /* dcache/icache reclaim pressure */
 	VM_LEGACY_VA_LAYOUT=27, /* legacy/compatibility virtual address space layout */
 	VM_SWAP_TOKEN_TIMEOUT=28, /* default time for token time out */
+	VM_TRANSPARENT_HUGEPAGE=29, /* map anonymous memory with huge pages */
+	VM_KHUGEPAGED_PAGES_TO_SCAN=30, /* pages khugepaged scans per pass */
+	VM_KHUGEPAGED_SCAN_SLEEP=31, /* msecs khugepaged sleeps between passes */
+	VM_NR_OVERCOMMIT_HUGEPAGES=32, /* surplus huge pages allowed on demand */
+	VM_ZONE_RECLAIM_MODE=33, /* reclaim local zones before going off node */
+	VM_ZSWAP_MAX_POOL_PERCENT=34, /* RAM for the compressed swap cache */
+	VM_KSM_RUN=35,		/* ksmd merges identical anonymous pages */
+	VM_KSM_PAGES_TO_SCAN=36, /* pages ksmd scans per pass */
+	VM_KSM_SLEEP=37,	/* msecs ksmd sleeps between passes */
 };
 
 
@@ -0,0 +1,34 @@
+#ifndef _LINUX_VMACACHE_H
+#define _LINUX_VMACACHE_H
+
+/*
+ * Per-task cache of recent find_vma results.  See mm/vmacache.c.
+ */
+
+#include <linux/sched.h>
+#include <linux/mm.h>
+
+static inline void vmacache_flush(struct task_struct *tsk)
+{
+	memset(tsk->vmacache, 0, sizeof(tsk->vmacache));
+}
+
+extern void vmacache_flush_all(struct mm_struct *mm);
+extern void vmacache_update(unsigned long addr, struct vm_area_struct *newvma);
+extern struct vm_area_struct *vmacache_find(struct mm_struct *mm,
+					    unsigned long addr);
+
+/*
+ * A vma of @mm is going away: every task's cached vmas of @mm become
+ * stale.  Needs mmap_sem held for writing.
+ */
+static inline void vmacache_invalidate(struct mm_struct *mm)
+{
+	mm->vmacache_seqnum++;
+
+	/* A task which slept through a whole wrap must not match again */
+	if (unlikely(mm->vmacache_seqnum == 0))
+		vmacache_flush_all(mm);
+}
+
+#endif /* _LINUX_VMACACHE_H */
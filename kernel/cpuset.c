@@ -32,7 +32,9 @@
 #include <linux/kernel.h>
 #include <linux/kmod.h>
 #include <linux/list.h>
+#include <linux/memctl.h>
 #include <linux/mm.h>
+#include <linux/huge_mm.h>
 #include <linux/module.h>
 #include <linux/mount.h>
 #include <linux/namei.h>
@@ -77,6 +79,11 @@ struct cpuset {
 	 * recent time this cpuset changed its mems_allowed.
 	 */
 	 int mems_generation;
+
+#ifdef CONFIG_CPUSET_MEMCTL
+	/* Page charges and limit, see mm/memctl.c; NULL in top_cpuset */
+	struct mem_group *mem_group;
+#endif
 };
 
 /* bits in struct cpuset flags field */
@@ -218,6 +225,9 @@ static void cpuset_diput(struct dentry *dentry, struct inode *inode)
 	if (S_ISDIR(inode->i_mode)) {
 		struct cpuset *cs = dentry->d_fsdata;
 		BUG_ON(!(is_removed(cs)));
+#ifdef CONFIG_CPUSET_MEMCTL
+		mem_group_put(cs->mem_group);
+#endif
 		kfree(cs);
 	}
 	iput(inode);
@@ -721,6 +731,18 @@ static int attach_task(struct cpuset *cs, char *buf)
 	guarantee_online_cpus(cs, &cpus);
 	set_cpus_allowed(tsk, cpus);
 
+#ifdef CONFIG_CPUSET_MEMCTL
+	if (cs->mem_group) {
+		struct mm_struct *mm = get_task_mm(tsk);
+
+		/* Pages khugepaged collapsed would not be charged */
+		if (mm) {
+			khugepaged_forget(mm);
+			mmput(mm);
+		}
+	}
+#endif
+
 	put_task_struct(tsk);
 	if (atomic_dec_and_test(&oldcs->count))
 		check_for_release(oldcs);
@@ -738,6 +760,9 @@ typedef enum {
 	FILE_MEM_EXCLUSIVE,
 	FILE_NOTIFY_ON_RELEASE,
 	FILE_TASKLIST,
+	FILE_MEMORY_LIMIT,
+	FILE_MEMORY_USAGE,
+	FILE_MEMORY_FAILCNT,
 } cpuset_filetype_t;
 
 static ssize_t cpuset_common_file_write(struct file *file, const char __user *userbuf,
@@ -854,6 +879,27 @@ static int cpuset_sprintf_memlist(char *page, struct cpuset *cs)
 	return nodelist_scnprintf(page, PAGE_SIZE, mask);
 }
 
+#ifdef CONFIG_CPUSET_MEMCTL
+static int cpuset_sprintf_memory(char *page, struct cpuset *cs,
+				 cpuset_filetype_t type)
+{
+	struct mem_group *mg = cs->mem_group;
+
+	switch (type) {
+	case FILE_MEMORY_LIMIT:
+		if (mg->limit == MEM_GROUP_UNLIMITED)
+			return sprintf(page, "unlimited");
+		return sprintf(page, "%llu",
+			       (unsigned long long)mg->limit << PAGE_SHIFT);
+	case FILE_MEMORY_USAGE:
+		return sprintf(page, "%llu",
+			       (unsigned long long)mg->usage << PAGE_SHIFT);
+	default:
+		return sprintf(page, "%lu", mg->failcnt);
+	}
+}
+#endif
+
 static ssize_t cpuset_common_file_read(struct file *file, char __user *buf,
 				size_t nbytes, loff_t *ppos)
 {
@@ -887,6 +933,13 @@ static ssize_t cpuset_common_file_read(struct file *file, char __user *buf,
 	case FILE_NOTIFY_ON_RELEASE:
 		*s++ = notify_on_release(cs) ? '1' : '0';
 		break;
+#ifdef CONFIG_CPUSET_MEMCTL
+	case FILE_MEMORY_LIMIT:
+	case FILE_MEMORY_USAGE:
+	case FILE_MEMORY_FAILCNT:
+		s += cpuset_sprintf_memory(s, cs, type);
+		break;
+#endif
 	default:
 		retval = -EINVAL;
 		goto out;
@@ -1215,6 +1268,76 @@ static struct cftype cft_notify_on_release = {
 	.private = FILE_NOTIFY_ON_RELEASE,
 };
 
+#ifdef CONFIG_CPUSET_MEMCTL
+/*
+ * The limit is set outside cpuset_sem: lowering it reclaims, which must
+ * not wait on anything needing cpuset_sem.  The open file keeps the
+ * cpuset, and so its mem_group, from going away.
+ */
+static int cpuset_memory_limit_write(struct file *file,
+				     const char __user *userbuf,
+				     size_t nbytes, loff_t *unused_ppos)
+{
+	struct cpuset *cs = __d_cs(file->f_dentry->d_parent);
+	char buffer[32];
+	unsigned long limit;
+	char *end;
+
+	if (nbytes >= sizeof(buffer))
+		return -E2BIG;
+	if (copy_from_user(buffer, userbuf, nbytes))
+		return -EFAULT;
+	buffer[nbytes] = 0;	/* nul-terminate */
+
+	if (!strncmp(buffer, "unlimited", 9))
+		limit = MEM_GROUP_UNLIMITED;
+	else {
+		limit = memparse(buffer, &end) >> PAGE_SHIFT;
+		if (end == buffer)
+			return -EINVAL;
+	}
+
+	if (is_removed(cs))
+		return -ENODEV;
+	mem_group_set_limit(cs->mem_group, limit);
+	return nbytes;
+}
+
+static struct cftype cft_memory_limit = {
+	.name = "memory_limit_in_bytes",
+	.write = cpuset_memory_limit_write,
+	.private = FILE_MEMORY_LIMIT,
+};
+
+static struct cftype cft_memory_usage = {
+	.name = "memory_usage_in_bytes",
+	.private = FILE_MEMORY_USAGE,
+};
+
+static struct cftype cft_memory_failcnt = {
+	.name = "memory_failcnt",
+	.private = FILE_MEMORY_FAILCNT,
+};
+
+static int cpuset_populate_memctl(struct dentry *cs_dentry)
+{
+	int err;
+
+	/* The top cpuset is not charged */
+	if (!__d_cs(cs_dentry)->mem_group)
+		return 0;
+	if ((err = cpuset_add_file(cs_dentry, &cft_memory_limit)) < 0)
+		return err;
+	if ((err = cpuset_add_file(cs_dentry, &cft_memory_usage)) < 0)
+		return err;
+	if ((err = cpuset_add_file(cs_dentry, &cft_memory_failcnt)) < 0)
+		return err;
+	return 0;
+}
+#else
+#define cpuset_populate_memctl(cs_dentry)	0
+#endif
+
 static int cpuset_populate_dir(struct dentry *cs_dentry)
 {
 	int err;
@@ -1231,6 +1354,8 @@ static int cpuset_populate_dir(struct dentry *cs_dentry)
 		return err;
 	if ((err = cpuset_add_file(cs_dentry, &cft_tasks)) < 0)
 		return err;
+	if ((err = cpuset_populate_memctl(cs_dentry)) < 0)
+		return err;
 	return 0;
 }
 
@@ -1251,6 +1376,13 @@ static long cpuset_create(struct cpuset *parent, const char *name, int mode)
 	cs = kmalloc(sizeof(*cs), GFP_KERNEL);
 	if (!cs)
 		return -ENOMEM;
+#ifdef CONFIG_CPUSET_MEMCTL
+	cs->mem_group = mem_group_alloc();
+	if (!cs->mem_group) {
+		kfree(cs);
+		return -ENOMEM;
+	}
+#endif
 
 	down(&cpuset_sem);
 	refresh_mems();
@@ -1286,6 +1418,9 @@ static long cpuset_create(struct cpuset *parent, const char *name, int mode)
 err:
 	list_del(&cs->sibling);
 	up(&cpuset_sem);
+#ifdef CONFIG_CPUSET_MEMCTL
+	mem_group_put(cs->mem_group);
+#endif
 	kfree(cs);
 	return err;
 }
@@ -1445,6 +1580,43 @@ const cpumask_t cpuset_cpus_allowed(const struct task_struct *tsk)
 	return mask;
 }
 
+#ifdef CONFIG_CPUSET_MEMCTL
+/**
+ * cpuset_get_mem_group - the mem_group to charge current's pages to
+ *
+ * Description: Returns current's cpuset's mem_group with a reference
+ * held, or NULL if its pages are not charged.  task_lock keeps an
+ * attach_task() from releasing the cpuset under us.
+ **/
+
+struct mem_group *cpuset_get_mem_group(void)
+{
+	struct mem_group *mg = NULL;
+
+	task_lock(current);
+	if (current->cpuset) {
+		mg = current->cpuset->mem_group;
+		if (mg)
+			atomic_inc(&mg->count);
+	}
+	task_unlock(current);
+	return mg;
+}
+
+/*
+ * Are current's pages charged?  Only a hint: it may be moved meanwhile.
+ */
+int cpuset_charges_memory(void)
+{
+	int ret;
+
+	task_lock(current);
+	ret = current->cpuset && current->cpuset->mem_group;
+	task_unlock(current);
+	return ret;
+}
+#endif
+
 void cpuset_init_current_mems_allowed(void)
 {
 	current->mems_allowed = NODE_MASK_ALL;
@@ -40,6 +40,9 @@
 #include <linux/audit.h>
 #include <linux/profile.h>
 #include <linux/rmap.h>
+#include <linux/huge_mm.h>
+#include <linux/ksm.h>
+#include <linux/vmacache.h>
 #include <linux/acct.h>
 
 #include <asm/pgtable.h>
@@ -192,7 +195,7 @@ static inline int dup_mmap(struct mm_struct * mm, struct mm_struct * oldmm)
 	flush_cache_mm(current->mm);
 	mm->locked_vm = 0;
 	mm->mmap = NULL;
-	mm->mmap_cache = NULL;
+	mm->vmacache_seqnum = 0;
 	mm->free_area_cache = oldmm->mmap_base;
 	mm->map_count = 0;
 	set_mm_counter(mm, rss, 0);
@@ -202,6 +205,7 @@ static inline int dup_mmap(struct mm_struct * mm, struct mm_struct * oldmm)
 	rb_link = &mm->mm_rb.rb_node;
 	rb_parent = NULL;
 	pprev = &mm->mmap;
+	ksm_fork(mm, oldmm);
 
 	for (mpnt = current->mm->mmap ; mpnt ; mpnt = mpnt->vm_next) {
 		struct file *file;
@@ -315,6 +319,16 @@ static struct mm_struct * mm_init(struct mm_struct * mm)
 	atomic_set(&mm->mm_count, 1);
 	init_rwsem(&mm->mmap_sem);
 	INIT_LIST_HEAD(&mm->mmlist);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	INIT_LIST_HEAD(&mm->khugepaged_list);
+#endif
+#ifdef CONFIG_KSM
+	INIT_LIST_HEAD(&mm->ksm_list);
+#endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	seqcount_init(&mm->mm_rb_seq);
+	seqcount_init(&mm->fault_seq);
+#endif
 	mm->core_waiters = 0;
 	mm->nr_ptes = 0;
 	spin_lock_init(&mm->page_table_lock);
@@ -366,6 +380,8 @@ void mmput(struct mm_struct *mm)
 {
 	if (atomic_dec_and_test(&mm->mm_users)) {
 		exit_aio(mm);
+		khugepaged_exit(mm);
+		ksm_exit(mm);
 		exit_mmap(mm);
 		if (!list_empty(&mm->mmlist)) {
 			spin_lock(&mmlist_lock);
@@ -452,6 +468,8 @@ static int copy_mm(unsigned long clone_flags, struct task_struct * tsk)
 
 	tsk->mm = NULL;
 	tsk->active_mm = NULL;
+	tsk->vmacache_seqnum = 0;
+	vmacache_flush(tsk);
 
 	/*
 	 * Are we cloning a kernel thread?
@@ -35,6 +35,8 @@
 #include <linux/highuid.h>
 #include <linux/writeback.h>
 #include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
+#include <linux/ksm.h>
 #include <linux/security.h>
 #include <linux/initrd.h>
 #include <linux/times.h>
@@ -753,6 +755,101 @@ static ctl_table vm_table[] = {
 		.mode		= 0644,
 		.proc_handler	= &proc_dointvec,
 	 },
+	 {
+		.ctl_name	= VM_NR_OVERCOMMIT_HUGEPAGES,
+		.procname	= "nr_overcommit_hugepages",
+		.data		= &nr_overcommit_huge_pages,
+		.maxlen		= sizeof(unsigned long),
+		.mode		= 0644,
+		.proc_handler	= &proc_doulongvec_minmax,
+		.extra1		= (void *)&hugetlb_zero,
+		.extra2		= (void *)&hugetlb_infinity,
+	 },
+#endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	{
+		.ctl_name	= VM_TRANSPARENT_HUGEPAGE,
+		.procname	= "transparent_hugepage",
+		.data		= &sysctl_transparent_hugepage,
+		.maxlen		= sizeof(sysctl_transparent_hugepage),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec,
+	},
+	{
+		.ctl_name	= VM_KHUGEPAGED_PAGES_TO_SCAN,
+		.procname	= "khugepaged_pages_to_scan",
+		.data		= &sysctl_khugepaged_pages_to_scan,
+		.maxlen		= sizeof(sysctl_khugepaged_pages_to_scan),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+	},
+	{
+		.ctl_name	= VM_KHUGEPAGED_SCAN_SLEEP,
+		.procname	= "khugepaged_scan_sleep_millisecs",
+		.data		= &sysctl_khugepaged_scan_sleep_millisecs,
+		.maxlen		= sizeof(sysctl_khugepaged_scan_sleep_millisecs),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+	},
+#endif
+#ifdef CONFIG_KSM
+	{
+		.ctl_name	= VM_KSM_RUN,
+		.procname	= "ksm_run",
+		.data		= &sysctl_ksm_run,
+		.maxlen		= sizeof(sysctl_ksm_run),
+		.mode		= 0644,
+		.proc_handler	= &ksm_run_sysctl_handler,
+	},
+	{
+		.ctl_name	= VM_KSM_PAGES_TO_SCAN,
+		.procname	= "ksm_pages_to_scan",
+		.data		= &sysctl_ksm_pages_to_scan,
+		.maxlen		= sizeof(sysctl_ksm_pages_to_scan),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+	},
+	{
+		.ctl_name	= VM_KSM_SLEEP,
+		.procname	= "ksm_sleep_millisecs",
+		.data		= &sysctl_ksm_sleep_millisecs,
+		.maxlen		= sizeof(sysctl_ksm_sleep_millisecs),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+	},
+#endif
+#ifdef CONFIG_ZSWAP
+	{
+		.ctl_name	= VM_ZSWAP_MAX_POOL_PERCENT,
+		.procname	= "zswap_max_pool_percent",
+		.data		= &zswap_max_pool_percent,
+		.maxlen		= sizeof(zswap_max_pool_percent),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+		.extra2		= &one_hundred,
+	},
+#endif
+#ifdef CONFIG_NUMA
+	{
+		.ctl_name	= VM_ZONE_RECLAIM_MODE,
+		.procname	= "zone_reclaim_mode",
+		.data		= &zone_reclaim_mode,
+		.maxlen		= sizeof(zone_reclaim_mode),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+	},
 #endif
 	{
 		.ctl_name	= VM_LOWMEM_RESERVE_RATIO,
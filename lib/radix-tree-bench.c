@@ -0,0 +1,182 @@
+/*
+ * lib/radix-tree-bench.c - time radix tree operations
+ *
+ * Loading this module builds radix trees of increasing size and prints
+ * the cost per item of inserting, looking up, tagging, gang looking up
+ * by tag (in small and large batches) and deleting the whole range,
+ * against deleting item by item.
+ *
+ * The trees are private, so no locking is needed; items are never
+ * dereferenced, so they are simply (index + 1).
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/radix-tree.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <asm/div64.h>
+
+static int max_order = 20;
+module_param(max_order, int, 0);
+MODULE_PARM_DESC(max_order, "log2 of the largest tree, 10 to 22 (default 20)");
+
+#define BENCH_TAG	0
+#define BENCH_BATCH_MAX	256
+
+static void **results;
+
+#define item_of(index)	((void *)((index) + 1))
+
+/* Average nanoseconds per item since @start */
+static unsigned long per_item(unsigned long long start, unsigned long nr)
+{
+	unsigned long long ns = sched_clock() - start;
+
+	do_div(ns, nr);
+	return (unsigned long)ns;
+}
+
+static int bench_insert(struct radix_tree_root *root, unsigned long nr)
+{
+	unsigned long index;
+	int error;
+
+	for (index = 0; index < nr; index++) {
+		error = radix_tree_preload(GFP_KERNEL);
+		if (error)
+			return error;
+		error = radix_tree_insert(root, index, item_of(index));
+		radix_tree_preload_end();
+		if (error)
+			return error;
+	}
+	return 0;
+}
+
+static int bench_lookup(struct radix_tree_root *root, unsigned long nr)
+{
+	unsigned long index;
+
+	for (index = 0; index < nr; index++) {
+		if (radix_tree_lookup(root, index) != item_of(index))
+			return -EINVAL;
+	}
+	return 0;
+}
+
+static unsigned long bench_gang_lookup_tag(struct radix_tree_root *root,
+				unsigned int batch)
+{
+	unsigned long index = 0;
+	unsigned long nr_found = 0;
+	unsigned int nr;
+
+	while ((nr = radix_tree_gang_lookup_tag(root, results, index,
+						batch, BENCH_TAG)) != 0) {
+		nr_found += nr;
+		index = (unsigned long)results[nr - 1];	/* last index + 1 */
+	}
+	return nr_found;
+}
+
+static int bench_one(unsigned long nr)
+{
+	RADIX_TREE(tree, GFP_ATOMIC);
+	unsigned long long start;
+	unsigned long insert, lookup, tag, gang_small, gang_large;
+	unsigned long delete_range, delete;
+	unsigned long index;
+	int error;
+
+	start = sched_clock();
+	error = bench_insert(&tree, nr);
+	insert = per_item(start, nr);
+	if (error)
+		goto out;
+
+	start = sched_clock();
+	error = bench_lookup(&tree, nr);
+	lookup = per_item(start, nr);
+	if (error)
+		goto out;
+	cond_resched();
+
+	start = sched_clock();
+	for (index = 0; index < nr; index++)
+		radix_tree_tag_set(&tree, index, BENCH_TAG);
+	tag = per_item(start, nr);
+
+	error = -EINVAL;
+	start = sched_clock();
+	if (bench_gang_lookup_tag(&tree, 16) != nr)
+		goto out;
+	gang_small = per_item(start, nr);
+
+	start = sched_clock();
+	if (bench_gang_lookup_tag(&tree, BENCH_BATCH_MAX) != nr)
+		goto out;
+	gang_large = per_item(start, nr);
+	cond_resched();
+
+	start = sched_clock();
+	if (radix_tree_delete_range(&tree, 0, ~0UL) != nr || tree.rnode)
+		goto out;
+	delete_range = per_item(start, nr);
+	cond_resched();
+
+	error = bench_insert(&tree, nr);
+	if (error)
+		goto out;
+	start = sched_clock();
+	for (index = 0; index < nr; index++)
+		radix_tree_delete(&tree, index);
+	delete = per_item(start, nr);
+
+	printk(KERN_INFO "radix-tree-bench: %8lu items (ns/item): "
+		"insert %lu lookup %lu tag %lu gang-tag/16 %lu gang-tag/%d %lu "
+		"delete-range %lu delete %lu\n",
+		nr, insert, lookup, tag, gang_small, BENCH_BATCH_MAX,
+		gang_large, delete_range, delete);
+	error = 0;
+out:
+	radix_tree_delete_range(&tree, 0, ~0UL);
+	return error;
+}
+
+static int __init radix_tree_bench_init(void)
+{
+	int order;
+	int error = 0;
+
+	if (max_order < 10 || max_order > 22)
+		return -EINVAL;
+
+	results = kmalloc(BENCH_BATCH_MAX * sizeof(void *), GFP_KERNEL);
+	if (!results)
+		return -ENOMEM;
+
+	for (order = 10; order <= max_order; order += 2) {
+		error = bench_one(1UL << order);
+		if (error) {
+			printk(KERN_ERR "radix-tree-bench: failed at %lu items: "
+				"%d\n", 1UL << order, error);
+			break;
+		}
+	}
+
+	kfree(results);
+	return error;
+}
+
+static void __exit radix_tree_bench_exit(void)
+{
+}
+
+module_init(radix_tree_bench_init);
+module_exit(radix_tree_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Radix tree benchmark");
@@ -29,10 +29,11 @@
 #include <linux/gfp.h>
 #include <linux/string.h>
 #include <linux/bitops.h>
+#include <linux/rcupdate.h>
 
 
 #ifdef __KERNEL__
-#define RADIX_TREE_MAP_SHIFT	6
+#define RADIX_TREE_MAP_SHIFT	CONFIG_RADIX_TREE_MAP_SHIFT
 #else
 #define RADIX_TREE_MAP_SHIFT	3	/* For more stressful testing */
 #endif
@@ -44,8 +45,19 @@
 #define RADIX_TREE_TAG_LONGS	\
 	((RADIX_TREE_MAP_SIZE + BITS_PER_LONG - 1) / BITS_PER_LONG)
 
+/*
+ * Lookups (radix_tree_lookup, radix_tree_lookup_slot and the untagged
+ * gang lookups) may run under rcu_read_lock() alone, concurrently with
+ * modifications done under the tree's lock: nodes and items are
+ * published with rcu_assign_pointer() and nodes are freed by RCU.  A
+ * node records its own height, so a lockless lookup never needs
+ * root->height, which changes independently of root->rnode.  Tags are
+ * only for lookups under the lock.
+ */
 struct radix_tree_node {
+	unsigned int	height;		/* of the subtree rooted here */
 	unsigned int	count;
+	struct rcu_head	rcu_head;
 	void		*slots[RADIX_TREE_MAP_SIZE];
 	unsigned long	tags[RADIX_TREE_TAGS][RADIX_TREE_TAG_LONGS];
 };
@@ -97,10 +109,22 @@ radix_tree_node_alloc(struct radix_tree_root *root)
 	return ret;
 }
 
+static void radix_tree_node_rcu_free(struct rcu_head *head)
+{
+	struct radix_tree_node *node =
+			container_of(head, struct radix_tree_node, rcu_head);
+
+	kmem_cache_free(radix_tree_node_cachep, node);
+}
+
+/*
+ * A freed node is empty and untagged, as the slab constructor leaves it,
+ * but lockless lookups may still be walking through it.
+ */
 static inline void
 radix_tree_node_free(struct radix_tree_node *node)
 {
-	kmem_cache_free(radix_tree_node_cachep, node);
+	call_rcu(&node->rcu_head, radix_tree_node_rcu_free);
 }
 
 /*
@@ -150,6 +174,44 @@ static inline int tag_get(struct radix_tree_node *node, int tag, int offset)
 	return test_bit(offset, &node->tags[tag][0]);
 }
 
+static inline int any_tag_set(struct radix_tree_node *node, int tag)
+{
+	int idx;
+
+	for (idx = 0; idx < RADIX_TREE_TAG_LONGS; idx++) {
+		if (node->tags[tag][idx])
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * The next slot from @offset on with @tag set, or RADIX_TREE_MAP_SIZE.
+ */
+static inline unsigned long
+next_tag(struct radix_tree_node *node, int tag, unsigned long offset)
+{
+	if (offset >= RADIX_TREE_MAP_SIZE)
+		return RADIX_TREE_MAP_SIZE;
+	return find_next_bit(&node->tags[tag][0], RADIX_TREE_MAP_SIZE, offset);
+}
+
+/*
+ * The range of slots of @node, which covers indices from @base on, that
+ * holds indices @first to @last.  The caller makes sure they overlap.
+ */
+static inline void node_range(struct radix_tree_node *node,
+		unsigned long base, unsigned long first, unsigned long last,
+		unsigned long *start, unsigned long *end)
+{
+	unsigned int shift = (node->height - 1) * RADIX_TREE_MAP_SHIFT;
+
+	*start = first > base ? (first - base) >> shift : 0;
+	*end = (last - base) >> shift;
+	if (*end > RADIX_TREE_MAP_MASK)
+		*end = RADIX_TREE_MAP_MASK;
+}
+
 /*
  *	Return the maximum key which can be store into a
  *	radix tree with height HEIGHT.
@@ -209,7 +271,8 @@ static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
 		}
 
 		node->count = 1;
-		root->rnode = node;
+		node->height = root->height + 1;
+		rcu_assign_pointer(root->rnode, node);
 		root->height++;
 	} while (height > root->height);
 out:
@@ -250,7 +313,8 @@ int radix_tree_insert(struct radix_tree_root *root,
 			/* Have to add a child node.  */
 			if (!(tmp = radix_tree_node_alloc(root)))
 				return -ENOMEM;
-			*slot = tmp;
+			tmp->height = height;
+			rcu_assign_pointer(*slot, tmp);
 			if (node)
 				node->count++;
 		}
@@ -271,42 +335,72 @@ int radix_tree_insert(struct radix_tree_root *root,
 		BUG_ON(tag_get(node, 1, offset));
 	}
 
-	*slot = item;
+	rcu_assign_pointer(*slot, item);
 	return 0;
 }
 EXPORT_SYMBOL(radix_tree_insert);
 
-/**
- *	radix_tree_lookup    -    perform lookup operation on a radix tree
- *	@root:		radix tree root
- *	@index:		index key
- *
- *	Lookup the item at the position @index in the radix tree @root.
- */
-void *radix_tree_lookup(struct radix_tree_root *root, unsigned long index)
+static inline void **__lookup_slot(struct radix_tree_root *root,
+				   unsigned long index)
 {
 	unsigned int height, shift;
-	struct radix_tree_node **slot;
+	struct radix_tree_node *node, **slot;
 
-	height = root->height;
+	node = rcu_dereference(root->rnode);
+	if (node == NULL)
+		return NULL;
+
+	height = node->height;
 	if (index > radix_tree_maxindex(height))
 		return NULL;
 
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
-	slot = &root->rnode;
-
-	while (height > 0) {
-		if (*slot == NULL)
-			return NULL;
 
+	for ( ; ; ) {
 		slot = (struct radix_tree_node **)
-			((*slot)->slots +
-				((index >> shift) & RADIX_TREE_MAP_MASK));
+			(node->slots + ((index >> shift) & RADIX_TREE_MAP_MASK));
+		if (--height == 0)
+			break;
+		node = rcu_dereference(*slot);
+		if (node == NULL)
+			return NULL;
 		shift -= RADIX_TREE_MAP_SHIFT;
-		height--;
 	}
 
-	return *slot;
+	return (void **)slot;
+}
+
+/**
+ *	radix_tree_lookup_slot    -    lookup a slot in a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *
+ *	Lookup the slot corresponding to the position @index in the radix tree
+ *	@root. This is useful for update-if-exists operations, under the lock
+ *	serialising modifications of the tree.  Under rcu_read_lock() alone
+ *	the slot stays valid but its contents may change: read them with
+ *	radix_tree_deref_slot().
+ */
+void **radix_tree_lookup_slot(struct radix_tree_root *root, unsigned long index)
+{
+	return __lookup_slot(root, index);
+}
+EXPORT_SYMBOL(radix_tree_lookup_slot);
+
+/**
+ *	radix_tree_lookup    -    perform lookup operation on a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *
+ *	Lookup the item at the position @index in the radix tree @root.
+ *	May be called under rcu_read_lock() instead of the tree's lock.
+ */
+void *radix_tree_lookup(struct radix_tree_root *root, unsigned long index)
+{
+	void **slot;
+
+	slot = __lookup_slot(root, index);
+	return slot != NULL ? radix_tree_deref_slot(slot) : NULL;
 }
 EXPORT_SYMBOL(radix_tree_lookup);
 
@@ -467,23 +561,28 @@ int radix_tree_tag_get(struct radix_tree_root *root,
 EXPORT_SYMBOL(radix_tree_tag_get);
 #endif
 
+/*
+ * Collect the slots of up to @max_items present items from @index on,
+ * below @slot, leaving out exceptional entries.  Safe under
+ * rcu_read_lock(): each pointer is read once.
+ */
 static unsigned int
-__lookup(struct radix_tree_root *root, void **results, unsigned long index,
+__lookup(struct radix_tree_node *slot, void ***results, unsigned long index,
 	unsigned int max_items, unsigned long *next_index)
 {
 	unsigned int nr_found = 0;
 	unsigned int shift;
-	unsigned int height = root->height;
-	struct radix_tree_node *slot;
+	unsigned int height = slot->height;
+	struct radix_tree_node *child = NULL;
 
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
-	slot = root->rnode;
 
 	while (height > 0) {
 		unsigned long i = (index >> shift) & RADIX_TREE_MAP_MASK;
 
 		for ( ; i < RADIX_TREE_MAP_SIZE; i++) {
-			if (slot->slots[i] != NULL)
+			child = rcu_dereference(slot->slots[i]);
+			if (child != NULL)
 				break;
 			index &= ~((1UL << shift) - 1);
 			index += 1UL << shift;
@@ -497,22 +596,54 @@ __lookup(struct radix_tree_root *root, void **results, unsigned long index,
 			unsigned long j = index & RADIX_TREE_MAP_MASK;
 
 			for ( ; j < RADIX_TREE_MAP_SIZE; j++) {
+				void *item = rcu_dereference(slot->slots[j]);
+
 				index++;
-				if (slot->slots[j]) {
-					results[nr_found++] = slot->slots[j];
+				if (item && !radix_tree_exceptional_entry(item)) {
+					results[nr_found++] = &slot->slots[j];
 					if (nr_found == max_items)
 						goto out;
 				}
 			}
 		}
 		shift -= RADIX_TREE_MAP_SHIFT;
-		slot = slot->slots[i];
+		slot = child;
 	}
 out:
 	*next_index = index;
 	return nr_found;
 }
 
+static unsigned int
+__gang_lookup_slot(struct radix_tree_root *root, void ***results,
+			unsigned long first_index, unsigned int max_items)
+{
+	struct radix_tree_node *node;
+	unsigned long max_index;
+	unsigned long cur_index = first_index;
+	unsigned int ret = 0;
+
+	node = rcu_dereference(root->rnode);
+	if (node == NULL)
+		return 0;
+	max_index = radix_tree_maxindex(node->height);
+
+	while (ret < max_items) {
+		unsigned int nr_found;
+		unsigned long next_index;	/* Index of next search */
+
+		if (cur_index > max_index)
+			break;
+		nr_found = __lookup(node, results + ret, cur_index,
+					max_items - ret, &next_index);
+		ret += nr_found;
+		if (next_index == 0)
+			break;
+		cur_index = next_index;
+	}
+	return ret;
+}
+
 /**
  *	radix_tree_gang_lookup - perform multiple lookup on a radix tree
  *	@root:		radix tree root
@@ -522,7 +653,8 @@ out:
  *
  *	Performs an index-ascending scan of the tree for present items.  Places
  *	them at *@results and returns the number of items which were placed at
- *	*@results.
+ *	*@results.  Exceptional entries are not returned.  Under
+ *	rcu_read_lock() items deleted meanwhile may be left out.
  *
  *	The implementation is naive.
  */
@@ -530,31 +662,42 @@ unsigned int
 radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 			unsigned long first_index, unsigned int max_items)
 {
-	const unsigned long max_index = radix_tree_maxindex(root->height);
-	unsigned long cur_index = first_index;
-	unsigned int ret = 0;
+	unsigned int nr_found, i, ret = 0;
 
-	while (ret < max_items) {
-		unsigned int nr_found;
-		unsigned long next_index;	/* Index of next search */
+	/* The slots go into @results, then are replaced by their items */
+	nr_found = __gang_lookup_slot(root, (void ***)results,
+					first_index, max_items);
+	for (i = 0; i < nr_found; i++) {
+		void *item = radix_tree_deref_slot((void **)results[i]);
 
-		if (cur_index > max_index)
-			break;
-		nr_found = __lookup(root, results + ret, cur_index,
-					max_items - ret, &next_index);
-		ret += nr_found;
-		if (next_index == 0)
-			break;
-		cur_index = next_index;
+		if (item)
+			results[ret++] = item;
 	}
 	return ret;
 }
 EXPORT_SYMBOL(radix_tree_gang_lookup);
 
-/*
- * FIXME: the two tag_get()s here should use find_next_bit() instead of
- * open-coding the search.
+/**
+ *	radix_tree_gang_lookup_slot - perform multiple slot lookup on a radix tree
+ *	@root:		radix tree root
+ *	@results:	where the results of the lookup are placed
+ *	@first_index:	start the lookup from this key
+ *	@max_items:	place up to this many items at *results
+ *
+ *	Like radix_tree_gang_lookup(), but returns the slots of the items, for
+ *	lockless callers which need to check that an item is still in place
+ *	after taking a reference on it.  Read the slots with
+ *	radix_tree_deref_slot(): under rcu_read_lock() they may have been
+ *	emptied meanwhile.
  */
+unsigned int
+radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
+			unsigned long first_index, unsigned int max_items)
+{
+	return __gang_lookup_slot(root, results, first_index, max_items);
+}
+EXPORT_SYMBOL(radix_tree_gang_lookup_slot);
+
 static unsigned int
 __lookup_tag(struct radix_tree_root *root, void **results, unsigned long index,
 	unsigned int max_items, unsigned long *next_index, int tag)
@@ -569,32 +712,35 @@ __lookup_tag(struct radix_tree_root *root, void **results, unsigned long index,
 
 	while (height > 0) {
 		unsigned long i = (index >> shift) & RADIX_TREE_MAP_MASK;
+		unsigned long j = next_tag(slot, tag, i);
 
-		for ( ; i < RADIX_TREE_MAP_SIZE; i++) {
-			if (tag_get(slot, tag, i)) {
-				BUG_ON(slot->slots[i] == NULL);
-				break;
-			}
+		if (j > i) {
+			/* Skip the untagged subtrees in one go */
 			index &= ~((1UL << shift) - 1);
-			index += 1UL << shift;
+			index += (j - i) << shift;
 			if (index == 0)
 				goto out;	/* 32-bit wraparound */
 		}
-		if (i == RADIX_TREE_MAP_SIZE)
+		if (j == RADIX_TREE_MAP_SIZE)
 			goto out;
+		i = j;
+		BUG_ON(slot->slots[i] == NULL);
 		height--;
 		if (height == 0) {	/* Bottom level: grab some items */
-			unsigned long j = index & RADIX_TREE_MAP_MASK;
-
-			for ( ; j < RADIX_TREE_MAP_SIZE; j++) {
-				index++;
-				if (tag_get(slot, tag, j)) {
-					BUG_ON(slot->slots[j] == NULL);
-					results[nr_found++] = slot->slots[j];
-					if (nr_found == max_items)
-						goto out;
+			index &= ~RADIX_TREE_MAP_MASK;
+			for ( ; ; j++) {
+				j = next_tag(slot, tag, j);
+				if (j == RADIX_TREE_MAP_SIZE)
+					break;
+				BUG_ON(slot->slots[j] == NULL);
+				results[nr_found++] = slot->slots[j];
+				if (nr_found == max_items) {
+					index += j + 1;
+					goto out;
 				}
 			}
+			index += RADIX_TREE_MAP_SIZE;
+			break;
 		}
 		shift -= RADIX_TREE_MAP_SHIFT;
 		slot = slot->slots[i];
@@ -732,6 +878,113 @@ out:
 }
 EXPORT_SYMBOL(radix_tree_delete);
 
+/*
+ * Delete the items (only the exceptional entries if @exceptional) from
+ * @first to @last below @node, which covers indices from @base on.  The
+ * caller frees @node if that leaves it empty.
+ */
+static unsigned long
+__delete_range(struct radix_tree_node *node, unsigned long base,
+		unsigned long first, unsigned long last, int exceptional)
+{
+	unsigned int shift = (node->height - 1) * RADIX_TREE_MAP_SHIFT;
+	unsigned long nr_deleted = 0;
+	unsigned long i, end;
+	int tag;
+
+	node_range(node, base, first, last, &i, &end);
+	for ( ; i <= end; i++) {
+		struct radix_tree_node *child = node->slots[i];
+
+		if (child == NULL)
+			continue;
+		if (node->height > 1) {
+			nr_deleted += __delete_range(child,
+					base + (i << shift), first, last,
+					exceptional);
+			if (child->count) {
+				for (tag = 0; tag < RADIX_TREE_TAGS; tag++) {
+					if (!any_tag_set(child, tag))
+						tag_clear(node, tag, i);
+				}
+				continue;
+			}
+			radix_tree_node_free(child);
+		} else {
+			if (exceptional && !radix_tree_exceptional_entry(child))
+				continue;
+			nr_deleted++;
+		}
+		node->slots[i] = NULL;
+		node->count--;
+		for (tag = 0; tag < RADIX_TREE_TAGS; tag++)
+			tag_clear(node, tag, i);
+	}
+	return nr_deleted;
+}
+
+static unsigned long __radix_tree_delete_range(struct radix_tree_root *root,
+		unsigned long first, unsigned long last, int exceptional)
+{
+	struct radix_tree_node *node = root->rnode;
+	unsigned long nr_deleted;
+
+	if (node == NULL || first > last ||
+			first > radix_tree_maxindex(root->height))
+		return 0;
+
+	nr_deleted = __delete_range(node, 0, first, last, exceptional);
+	if (node->count == 0) {
+		root->rnode = NULL;
+		root->height = 0;
+		radix_tree_node_free(node);
+	}
+	return nr_deleted;
+}
+
+/**
+ *	radix_tree_delete_range    -    delete a range of items from a radix tree
+ *	@root:		radix tree root
+ *	@first:		first index of the range
+ *	@last:		last index of the range (inclusive)
+ *
+ *	Remove all the items from @first to @last, clearing their tags and
+ *	freeing the nodes left empty.  Unlike calling radix_tree_delete() for
+ *	each item, this visits every node once instead of walking down from
+ *	the root for every item.
+ *
+ *	There is deliberately no range tag clear to go with it.  The page
+ *	cache clears a dirty tag only after seeing under tree_lock that its
+ *	page is clean.  Clearing a range of tags would lose the tag of a
+ *	page that set_page_dirty() had just tagged.  Deletion clears the
+ *	tags of the items it removes, which is all truncation needs.
+ *
+ *	Returns the number of items deleted.
+ */
+unsigned long radix_tree_delete_range(struct radix_tree_root *root,
+			unsigned long first, unsigned long last)
+{
+	return __radix_tree_delete_range(root, first, last, 0);
+}
+EXPORT_SYMBOL(radix_tree_delete_range);
+
+/**
+ *	radix_tree_delete_exceptional - delete a range of exceptional entries
+ *	@root:		radix tree root
+ *	@first:		first index of the range
+ *	@last:		last index of the range (inclusive)
+ *
+ *	Like radix_tree_delete_range(), but leaves the ordinary items alone.
+ *
+ *	Returns the number of entries deleted.
+ */
+unsigned long radix_tree_delete_exceptional(struct radix_tree_root *root,
+			unsigned long first, unsigned long last)
+{
+	return __radix_tree_delete_range(root, first, last, 1);
+}
+EXPORT_SYMBOL(radix_tree_delete_exceptional);
+
 /**
  *	radix_tree_tagged - test whether any items in the tree are tagged
  *	@root:		radix tree root
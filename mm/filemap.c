@@ -20,6 +20,7 @@
 #include <linux/swap.h>
 #include <linux/mman.h>
 #include <linux/pagemap.h>
+#include <linux/memctl.h>
 #include <linux/file.h>
 #include <linux/uio.h>
 #include <linux/hash.h>
@@ -100,6 +101,9 @@
  *    ->inode_lock		(zap_pte_range->set_page_dirty)
  *    ->private_lock		(zap_pte_range->__set_page_dirty_buffers)
  *
+ *  ->mapping->tree_lock
+ *    ->zone.lru_lock		(shrink_list->workingset_eviction)
+ *
  *  ->task->proc_lock
  *    ->dcache_lock		(proc_pid_lookup)
  */
@@ -119,6 +123,37 @@ void __remove_from_page_cache(struct page *page)
 	pagecache_acct(-1);
 }
 
+/*
+ * As __remove_from_page_cache(), but leave @shadow in the page's slot.
+ * The page must be clean and not under writeback: it has no tags to clear.
+ */
+void __remove_from_page_cache_shadow(struct page *page, void *shadow)
+{
+	struct address_space *mapping = page->mapping;
+	void **slot;
+
+	workingset_trim_shadows(mapping);
+
+	slot = radix_tree_lookup_slot(&mapping->page_tree, page->index);
+	BUG_ON(!slot || *slot != page);
+	rcu_assign_pointer(*slot, shadow);
+	mapping->nrshadows++;
+	page->mapping = NULL;
+	mapping->nrpages--;
+	pagecache_acct(-1);
+}
+
+/*
+ * Drop the shadow entries of @mapping from index @start on.
+ */
+void clear_shadow_entries(struct address_space *mapping, pgoff_t start)
+{
+	write_lock_irq(&mapping->tree_lock);
+	mapping->nrshadows -= radix_tree_delete_exceptional(&mapping->page_tree,
+							start, ~0UL);
+	write_unlock_irq(&mapping->tree_lock);
+}
+
 void remove_from_page_cache(struct page *page)
 {
 	struct address_space *mapping = page->mapping;
@@ -131,6 +166,34 @@ void remove_from_page_cache(struct page *page)
 	write_unlock_irq(&mapping->tree_lock);
 }
 
+/*
+ * Remove @nr locked pages of @mapping from the page cache under a single
+ * hold of tree_lock.  Each run of pages with consecutive indices goes in
+ * one radix_tree_delete_range(): since we hold the locks of all the pages
+ * in the run, nothing else can be in that range of the tree.
+ */
+void remove_from_page_cache_batch(struct address_space *mapping,
+				struct page **pages, int nr)
+{
+	int i, j;
+
+	write_lock_irq(&mapping->tree_lock);
+	for (i = 0; i < nr; i = j) {
+		BUG_ON(!PageLocked(pages[i]) || pages[i]->mapping != mapping);
+		for (j = i + 1; j < nr; j++) {
+			if (pages[j]->index != pages[j - 1]->index + 1)
+				break;
+		}
+		radix_tree_delete_range(&mapping->page_tree,
+				pages[i]->index, pages[j - 1]->index);
+	}
+	for (i = 0; i < nr; i++)
+		pages[i]->mapping = NULL;
+	mapping->nrpages -= nr;
+	pagecache_acct(-nr);
+	write_unlock_irq(&mapping->tree_lock);
+}
+
 static int sync_page(void *word)
 {
 	struct address_space *mapping;
@@ -352,30 +415,65 @@ int filemap_write_and_wait_range(struct address_space *mapping,
 	return retval;
 }
 
+/*
+ * Insert @page at @offset, over the shadow entry an earlier page there
+ * left when it was evicted, if any: that goes into *@shadowp.
+ */
+static int page_cache_tree_insert(struct address_space *mapping,
+			struct page *page, pgoff_t offset, void **shadowp)
+{
+	void **slot;
+
+	slot = radix_tree_lookup_slot(&mapping->page_tree, offset);
+	if (slot && *slot) {
+		if (!radix_tree_exceptional_entry(*slot))
+			return -EEXIST;
+		*shadowp = *slot;
+		rcu_assign_pointer(*slot, page);
+		mapping->nrshadows--;
+		return 0;
+	}
+	return radix_tree_insert(&mapping->page_tree, offset, page);
+}
+
 /*
  * This function is used to add newly allocated pagecache pages:
  * the page is new, so we can just run SetPageLocked() against it.
  * The other page state flags were set by rmqueue().
  *
  * This function does not add the page to the LRU.  The caller must do that.
+ * A page which refaults soon after its eviction gets PG_active, and goes
+ * on the active list.
  */
 int add_to_page_cache(struct page *page, struct address_space *mapping,
 		pgoff_t offset, int gfp_mask)
 {
-	int error = radix_tree_preload(gfp_mask & ~__GFP_HIGHMEM);
+	int error = memctl_charge(page, gfp_mask);
+	void *shadow = NULL;
 
+	if (error)
+		return error;
+	error = radix_tree_preload(gfp_mask & ~__GFP_HIGHMEM);
 	if (error == 0) {
+		/* Lockless lookups may find the page as soon as it is in */
+		page_cache_get(page);
+		SetPageLocked(page);
+		page->mapping = mapping;
+		page->index = offset;
+
 		write_lock_irq(&mapping->tree_lock);
-		error = radix_tree_insert(&mapping->page_tree, offset, page);
+		error = page_cache_tree_insert(mapping, page, offset, &shadow);
 		if (!error) {
-			page_cache_get(page);
-			SetPageLocked(page);
-			page->mapping = mapping;
-			page->index = offset;
 			mapping->nrpages++;
 			pagecache_acct(1);
 		}
 		write_unlock_irq(&mapping->tree_lock);
+		if (error) {
+			page->mapping = NULL;
+			ClearPageLocked(page);
+			__put_page(page);
+		} else if (shadow && workingset_refault(shadow))
+			SetPageActive(page);
 		radix_tree_preload_end();
 	}
 	return error;
@@ -482,17 +580,37 @@ EXPORT_SYMBOL(__lock_page);
 
 /*
  * a rather lightweight function, finding and getting a reference to a
- * hashed page atomically.
+ * hashed page atomically.  It does not take tree_lock, so a cache hit
+ * writes nothing but the page's count: see page_cache_get_speculative().
  */
 struct page * find_get_page(struct address_space *mapping, unsigned long offset)
 {
+	void **pagep;
 	struct page *page;
 
-	read_lock_irq(&mapping->tree_lock);
-	page = radix_tree_lookup(&mapping->page_tree, offset);
-	if (page)
-		page_cache_get(page);
-	read_unlock_irq(&mapping->tree_lock);
+	pagecache_lookup_lock(mapping);
+repeat:
+	page = NULL;
+	pagep = radix_tree_lookup_slot(&mapping->page_tree, offset);
+	if (pagep) {
+		page = radix_tree_deref_slot(pagep);
+		if (unlikely(!page))
+			goto out;
+		if (radix_tree_exceptional_entry(page)) {
+			/* The shadow of an evicted page */
+			page = NULL;
+			goto out;
+		}
+		if (!page_cache_get_speculative(page))
+			goto repeat;
+		/* Has the page been freed, or moved, meanwhile? */
+		if (unlikely(page != *pagep)) {
+			page_cache_release(page);
+			goto repeat;
+		}
+	}
+out:
+	pagecache_lookup_unlock(mapping);
 	return page;
 }
 
@@ -507,7 +625,8 @@ struct page *find_trylock_page(struct address_space *mapping, unsigned long offs
 
 	read_lock_irq(&mapping->tree_lock);
 	page = radix_tree_lookup(&mapping->page_tree, offset);
-	if (page && TestSetPageLocked(page))
+	if (page && (radix_tree_exceptional_entry(page) ||
+		     TestSetPageLocked(page)))
 		page = NULL;
 	read_unlock_irq(&mapping->tree_lock);
 	return page;
@@ -534,6 +653,8 @@ struct page *find_lock_page(struct address_space *mapping,
 	read_lock_irq(&mapping->tree_lock);
 repeat:
 	page = radix_tree_lookup(&mapping->page_tree, offset);
+	if (page && radix_tree_exceptional_entry(page))
+		page = NULL;
 	if (page) {
 		page_cache_get(page);
 		if (TestSetPageLocked(page)) {
@@ -615,20 +736,37 @@ EXPORT_SYMBOL(find_or_create_page);
  * The search returns a group of mapping-contiguous pages with ascending
  * indexes.  There may be holes in the indices due to not-present pages.
  *
- * find_get_pages() returns the number of pages which were found.
+ * find_get_pages() returns the number of pages which were found.  Like
+ * find_get_page() it does not take tree_lock.
  */
 unsigned find_get_pages(struct address_space *mapping, pgoff_t start,
 			    unsigned int nr_pages, struct page **pages)
 {
 	unsigned int i;
-	unsigned int ret;
-
-	read_lock_irq(&mapping->tree_lock);
-	ret = radix_tree_gang_lookup(&mapping->page_tree,
-				(void **)pages, start, nr_pages);
-	for (i = 0; i < ret; i++)
-		page_cache_get(pages[i]);
-	read_unlock_irq(&mapping->tree_lock);
+	unsigned int ret = 0;
+	unsigned int nr_found;
+
+	pagecache_lookup_lock(mapping);
+	/* The slots go into @pages, then are replaced by their pages */
+	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
+				(void ***)pages, start, nr_pages);
+	for (i = 0; i < nr_found; i++) {
+		void **pagep = (void **)pages[i];
+		struct page *page;
+repeat:
+		page = radix_tree_deref_slot(pagep);
+		/* Evicted meanwhile, perhaps leaving a shadow entry */
+		if (unlikely(!page || radix_tree_exceptional_entry(page)))
+			continue;
+		if (!page_cache_get_speculative(page))
+			goto repeat;
+		if (unlikely(page != *pagep)) {
+			page_cache_release(page);
+			goto repeat;
+		}
+		pages[ret++] = page;
+	}
+	pagecache_lookup_unlock(mapping);
 	return ret;
 }
 
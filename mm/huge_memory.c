@@ -0,0 +1,758 @@
+/*
+ * mm/huge_memory.c - transparent huge pages for anonymous memory
+ *
+ * Private anonymous areas which cover a whole, aligned pmd are faulted
+ * in with one HPAGE_PMD_ORDER block from the page allocator, mapped by
+ * a single huge pmd.  If no such block is free the fault falls back to
+ * ordinary ptes, and khugepaged collapses the range later on.
+ *
+ * The block is not a compound page: every subpage carries its own count,
+ * mapcount and anon rmap, sits on the LRU and is freed on its own.  So
+ * splitting a huge pmd back into ptes needs nothing but a page table,
+ * and everything beyond the pmd walkers sees ordinary anonymous pages.
+ *
+ * Huge pmds are only ever changed under mm->page_table_lock.  They are
+ * split whenever something wants to work on part of one (mprotect,
+ * mremap, partial munmap, madvise), on the first write after fork, and
+ * by reclaim before it swaps out one of their pages: see
+ * split_huge_page_pmds() in rmap.c.  All the subpages share the pmd's
+ * referenced bit.
+ */
+
+#include <linux/mm.h>
+#include <linux/huge_mm.h>
+#include <linux/memctl.h>
+#include <linux/highmem.h>
+#include <linux/swap.h>
+#include <linux/pagemap.h>
+#include <linux/rmap.h>
+#include <linux/kthread.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+
+#include <asm/pgalloc.h>
+#include <asm/tlb.h>
+#include <asm/tlbflush.h>
+
+int sysctl_transparent_hugepage = 1;
+int sysctl_khugepaged_pages_to_scan = HPAGE_PMD_NR * 8;
+int sysctl_khugepaged_scan_sleep_millisecs = 10000;
+
+/*
+ * mms which have had a huge fault fall back to ptes, scanned round robin
+ * by khugepaged.  The cursor holds no reference: khugepaged_exit moves it
+ * on when its mm goes away.
+ */
+static LIST_HEAD(khugepaged_mms);
+static DEFINE_SPINLOCK(khugepaged_lock);
+static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
+static struct {
+	struct mm_struct *mm;
+	unsigned long address;
+} khugepaged_scan;
+
+/*
+ * Split the block into independent pages straight away, there is no
+ * head page to keep track of.
+ */
+static struct page *alloc_hugepage(void)
+{
+	struct page *page;
+	int i;
+
+	page = alloc_pages(GFP_HIGHUSER | __GFP_NOWARN | __GFP_NORETRY,
+			   HPAGE_PMD_ORDER);
+	if (page)
+		for (i = 1; i < HPAGE_PMD_NR; i++)
+			set_page_count(page + i, 1);
+	return page;
+}
+
+static void free_hugepage(struct page *page)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		__free_page(page + i);
+}
+
+/*
+ * After fork a block is mapped by several huge pmds, in different mms.
+ * The first subpage's ->private counts them, so that nr_anon_huge_pages
+ * counts each page once.  An anonymous page only uses ->private in the
+ * swap cache, which reclaim adds it to after splitting every huge pmd.
+ */
+static DEFINE_SPINLOCK(huge_pmd_count_lock);
+
+static void huge_pmd_count_inc(struct page *page)
+{
+	spin_lock(&huge_pmd_count_lock);
+	set_page_private(page, page_private(page) + 1);
+	if (page_private(page) == 1)
+		add_page_state(nr_anon_huge_pages, HPAGE_PMD_NR);
+	spin_unlock(&huge_pmd_count_lock);
+}
+
+static void huge_pmd_count_dec(struct page *page)
+{
+	spin_lock(&huge_pmd_count_lock);
+	set_page_private(page, page_private(page) - 1);
+	if (!page_private(page))
+		sub_page_state(nr_anon_huge_pages, HPAGE_PMD_NR);
+	spin_unlock(&huge_pmd_count_lock);
+}
+
+/*
+ * Install @page as the huge pmd for the range at @haddr, setting up
+ * rmap for each subpage.  Called under page_table_lock with *pmd empty.
+ */
+static void set_huge_pmd(struct mm_struct *mm, struct vm_area_struct *vma,
+			 unsigned long haddr, pmd_t *pmd, struct page *page)
+{
+	pte_t entry;
+	int i;
+
+	entry = pte_mkyoung(pte_mkdirty(mk_pte(page, vma->vm_page_prot)));
+	if (vma->vm_flags & VM_WRITE)
+		entry = pte_mkwrite(entry);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page_add_anon_rmap(page + i, vma, haddr + i * PAGE_SIZE);
+		lru_cache_add_active(page + i);
+	}
+	set_pmd(pmd, pte_mkhuge_pmd(entry));
+	huge_pmd_count_inc(page);
+}
+
+/*
+ * Fault on an empty pmd in a huge-capable vma.  Called without any
+ * locks but mmap_sem.
+ */
+int do_huge_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			   unsigned long address, pmd_t *pmd, int write_access)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page;
+	int i;
+
+	/* Huge pages are not charged: see mm/memctl.c */
+	if (!sysctl_transparent_hugepage || cpuset_charges_memory())
+		return VM_FAULT_FALLBACK;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end) {
+		khugepaged_enter(vma);
+		return VM_FAULT_FALLBACK;
+	}
+	if (unlikely(anon_vma_prepare(vma)))
+		return VM_FAULT_OOM;
+
+	page = alloc_hugepage();
+	if (!page) {
+		inc_page_state(thp_fault_fallback);
+		khugepaged_enter(vma);
+		return VM_FAULT_FALLBACK;
+	}
+	inc_page_state(thp_fault_alloc);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		clear_user_highpage(page + i, haddr + i * PAGE_SIZE);
+		cond_resched();
+	}
+
+	spin_lock(&mm->page_table_lock);
+	if (!pmd_none(*pmd)) {
+		/* Somebody else faulted it in meanwhile */
+		spin_unlock(&mm->page_table_lock);
+		free_hugepage(page);
+		return VM_FAULT_MINOR;
+	}
+	set_huge_pmd(mm, vma, haddr, pmd, page);
+	add_mm_counter(mm, rss, HPAGE_PMD_NR);
+	spin_unlock(&mm->page_table_lock);
+	return VM_FAULT_MINOR;
+}
+
+/*
+ * Fault on a present huge pmd: update the referenced and dirty bits, or
+ * split it if this is a write to a pmd shared with fork, and let
+ * do_wp_page deal with the individual pages.
+ */
+int do_huge_pmd_fault(struct mm_struct *mm, struct vm_area_struct *vma,
+		      unsigned long address, pmd_t *pmd, int write_access)
+{
+	pte_t entry;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		return VM_FAULT_FALLBACK;
+	}
+	entry = pmd_huge_pte(*pmd);
+	if (write_access && !pte_write(entry)) {
+		spin_unlock(&mm->page_table_lock);
+		if (split_huge_pmd(vma, pmd, address))
+			return VM_FAULT_OOM;
+		return VM_FAULT_FALLBACK;
+	}
+	entry = pte_mkyoung(entry);
+	if (write_access)
+		entry = pte_mkdirty(entry);
+	set_pmd(pmd, pte_mkhuge_pmd(entry));
+	spin_unlock(&mm->page_table_lock);
+	return VM_FAULT_MINOR;
+}
+
+/*
+ * __follow_page on a huge pmd, with page_table_lock held.
+ */
+struct page *follow_huge_anon_pmd(struct mm_struct *mm, unsigned long address,
+				  pmd_t *pmd, int write)
+{
+	pte_t entry = pmd_huge_pte(*pmd);
+	struct page *page;
+
+	if (write && !pte_write(entry))
+		return NULL;
+	page = pte_page(entry) + ((address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT);
+	if (write && !pte_dirty(entry) && !PageDirty(page))
+		set_page_dirty(page);
+	mark_page_accessed(page);
+	return page;
+}
+
+/*
+ * fork: share the huge pmd write-protected, as copy_one_pte does for
+ * ptes.  Called with dst_mm->page_table_lock held.  Returns -EAGAIN if
+ * reclaim split the pmd before we got src_mm's lock: the caller copies
+ * its page table instead.
+ */
+int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		  pmd_t *dst_pmd, pmd_t *src_pmd)
+{
+	struct page *page;
+	int i;
+
+	spin_lock(&src_mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*src_pmd))) {
+		spin_unlock(&src_mm->page_table_lock);
+		return -EAGAIN;
+	}
+	pmdp_set_wrprotect(src_pmd);
+	page = huge_pmd_page(*src_pmd);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		get_page(page + i);
+		page_dup_rmap(page + i);
+	}
+	set_pmd(dst_pmd, *src_pmd);
+
+	huge_pmd_count_inc(page);
+	spin_unlock(&src_mm->page_table_lock);
+
+	add_mm_counter(dst_mm, rss, HPAGE_PMD_NR);
+	add_mm_counter(dst_mm, anon_rss, HPAGE_PMD_NR);
+	return 0;
+}
+
+/*
+ * Unmap a whole huge pmd.  Called under page_table_lock from
+ * zap_pmd_range; the caller flushes the TLB before the pages are freed.
+ */
+void zap_huge_pmd(struct mmu_gather *tlb, pmd_t *pmd)
+{
+	struct page *page;
+	int i;
+
+	page = huge_pmd_page(pmdp_get_and_clear(pmd));
+	/* Before the pages can be freed */
+	huge_pmd_count_dec(page);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page_remove_rmap(page + i);
+		tlb_remove_page(tlb, page + i);
+	}
+	tlb->freed += HPAGE_PMD_NR;
+	add_mm_counter(tlb->mm, anon_rss, -HPAGE_PMD_NR);
+}
+
+/*
+ * The work of split_huge_pmd, under page_table_lock, with the page table
+ * @new ready to take the huge pmd's place.  Returns 1 if it did, 0 if
+ * the pmd was not huge any more.
+ */
+int __split_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+		     unsigned long address, struct page *new)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page;
+	pte_t entry, *pte;
+	pmd_t _pmd;
+	int i;
+
+	if (!pmd_trans_huge(*pmd))
+		return 0;
+
+	/*
+	 * Fill in the new table before it becomes visible.  The pmd is
+	 * cleared and flushed first so that no referenced or dirty bit set
+	 * by hardware meanwhile gets lost.
+	 */
+	entry = pmd_huge_pte(pmdp_get_and_clear(pmd));
+	flush_tlb_range(vma, haddr, haddr + HPAGE_PMD_SIZE);
+	page = pte_page(entry);
+
+	pmd_populate(mm, &_pmd, new);
+	pte = pte_offset_map(&_pmd, haddr);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		pte_t ptent = pte_wrprotect(mk_pte(page + i,
+						vma->vm_page_prot));
+		if (pte_write(entry))
+			ptent = pte_mkwrite(ptent);
+		if (pte_dirty(entry))
+			ptent = pte_mkdirty(ptent);
+		if (pte_young(entry))
+			ptent = pte_mkyoung(ptent);
+		set_pte_at(mm, haddr + i * PAGE_SIZE, pte + i, ptent);
+	}
+	pte_unmap(pte);
+
+	pmd_populate(mm, pmd, new);
+	mm->nr_ptes++;
+	inc_page_state(nr_page_table_pages);
+	huge_pmd_count_dec(page);
+	inc_page_state(thp_split);
+	return 1;
+}
+
+/**
+ * split_huge_pmd - replace a huge pmd by a page table mapping the same pages
+ * @vma: the vma mapping the huge pmd
+ * @pmd: the pmd
+ * @address: any address inside the huge pmd
+ *
+ * Needs mmap_sem and may sleep.  Returns 0, or -ENOMEM if no page table
+ * could be allocated.  Nothing happens if the pmd is not huge (any more).
+ */
+int split_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+		   unsigned long address)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *new;
+	int split;
+
+	new = pte_alloc_one(mm, address & HPAGE_PMD_MASK);
+	if (!new)
+		return -ENOMEM;
+	pte_lock_init(new);
+
+	spin_lock(&mm->page_table_lock);
+	split = __split_huge_pmd(vma, pmd, address, new);
+	spin_unlock(&mm->page_table_lock);
+
+	if (!split) {
+		pte_lock_deinit(new);
+		pte_free(new);
+	} else
+		khugepaged_enter(vma);
+	return 0;
+}
+
+static pmd_t *huge_pmd_lookup(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+	return pmd_offset(pud, address);
+}
+
+/*
+ * Split the huge pmd straddling @address, if there is one: for callers
+ * about to operate on a range starting or ending at @address.
+ */
+int split_huge_pmd_address(struct vm_area_struct *vma, unsigned long address)
+{
+	pmd_t *pmd;
+
+	if (!vma_huge_anon(vma) || !(address & ~HPAGE_PMD_MASK))
+		return 0;
+	pmd = huge_pmd_lookup(vma->vm_mm, address);
+	if (!pmd || !pmd_trans_huge(*pmd))
+		return 0;
+	return split_huge_pmd(vma, pmd, address);
+}
+
+/*
+ * Split all huge pmds between @start and @end.
+ */
+int split_huge_pmd_range(struct vm_area_struct *vma, unsigned long start,
+			 unsigned long end)
+{
+	unsigned long addr;
+	pmd_t *pmd;
+	int err;
+
+	if (!vma_huge_anon(vma))
+		return 0;
+	for (addr = start & HPAGE_PMD_MASK; addr < end;
+					addr += HPAGE_PMD_SIZE) {
+		pmd = huge_pmd_lookup(vma->vm_mm, addr);
+		if (!pmd || !pmd_trans_huge(*pmd))
+			continue;
+		err = split_huge_pmd(vma, pmd, addr);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+/*
+ * khugepaged.
+ *
+ * Register the mm of a vma which has pte-mapped ranges a huge pmd
+ * could cover.
+ */
+void khugepaged_enter(struct vm_area_struct *vma)
+{
+	struct mm_struct *mm = vma->vm_mm;
+
+	if (!list_empty(&mm->khugepaged_list) || cpuset_charges_memory())
+		return;
+	spin_lock(&khugepaged_lock);
+	if (list_empty(&mm->khugepaged_list)) {
+		list_add_tail(&mm->khugepaged_list, &khugepaged_mms);
+		wake_up_interruptible(&khugepaged_wait);
+	}
+	spin_unlock(&khugepaged_lock);
+}
+
+/*
+ * Take @mm off the list.  Returns 1 if it was on it.
+ */
+static int khugepaged_remove(struct mm_struct *mm)
+{
+	int registered = 0;
+
+	spin_lock(&khugepaged_lock);
+	if (!list_empty(&mm->khugepaged_list)) {
+		if (khugepaged_scan.mm == mm) {
+			struct list_head *next = mm->khugepaged_list.next;
+
+			khugepaged_scan.mm = next == &khugepaged_mms ? NULL :
+				list_entry(next, struct mm_struct,
+					   khugepaged_list);
+			khugepaged_scan.address = 0;
+		}
+		list_del_init(&mm->khugepaged_list);
+		registered = 1;
+	}
+	spin_unlock(&khugepaged_lock);
+	return registered;
+}
+
+/*
+ * Called from mmput before the address space is torn down.  Once off
+ * the list the mm won't be collapsed any more; cycling mmap_sem waits
+ * for a collapse already under way.
+ */
+void khugepaged_exit(struct mm_struct *mm)
+{
+	if (khugepaged_remove(mm)) {
+		down_write(&mm->mmap_sem);
+		up_write(&mm->mmap_sem);
+	}
+}
+
+/*
+ * A task of @mm has joined a cpuset whose pages are charged, and huge
+ * pages are not: don't collapse any more of its pages.  Called under
+ * cpuset_sem, which allocations may take under mmap_sem, so this cannot
+ * wait for a collapse already under way.
+ */
+void khugepaged_forget(struct mm_struct *mm)
+{
+	khugepaged_remove(mm);
+}
+
+static inline int khugepaged_mm_exiting(struct mm_struct *mm)
+{
+	return list_empty(&mm->khugepaged_list);
+}
+
+/*
+ * Can the page table @pte be replaced by a huge pmd?  Every pte must be
+ * empty, map the zero page, or map an anonymous page only this pte maps;
+ * when @exclusive, nobody else may hold a reference to that page either.
+ * Returns the number of recently referenced pages, or -1 if not.
+ */
+static int khugepaged_check_ptes(pte_t *pte, unsigned long address,
+				 int exclusive)
+{
+	int referenced = 0;
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++, address += PAGE_SIZE) {
+		pte_t pteval = pte[i];
+		struct page *page;
+
+		if (pte_none(pteval))
+			continue;
+		if (!pte_present(pteval) || !pfn_valid(pte_pfn(pteval)))
+			return -1;
+		page = pte_page(pteval);
+		if (page == ZERO_PAGE(address))
+			continue;
+		if (PageReserved(page) || !PageAnon(page) ||
+		    PageSwapCache(page) || page_mapcount(page) != 1)
+			return -1;
+		if (exclusive && page_count(page) != 1)
+			return -1;
+		if (pte_young(pteval))
+			referenced++;
+	}
+	return referenced;
+}
+
+/*
+ * The pmd at @address, if it maps a page table in a vma which could
+ * be mapped by a huge pmd.  Needs mmap_sem.
+ */
+static pmd_t *khugepaged_find_pmd(struct mm_struct *mm, unsigned long address)
+{
+	struct vm_area_struct *vma;
+	pmd_t *pmd;
+
+	vma = find_vma(mm, address);
+	if (!vma || address < vma->vm_start ||
+	    address + HPAGE_PMD_SIZE > vma->vm_end ||
+	    !vma_huge_anon(vma) || !vma->anon_vma)
+		return NULL;
+	pmd = huge_pmd_lookup(mm, address);
+	if (!pmd || !pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		return NULL;
+	return pmd;
+}
+
+/*
+ * Replace the page table at @address by a huge pmd, copying the pages
+ * over.  Takes mmap_sem for writing: faults must not refill the ptes
+ * while the copy is made.
+ */
+static void collapse_huge_page(struct mm_struct *mm, unsigned long address)
+{
+	struct vm_area_struct *vma;
+	struct page *new;
+	pmd_t *pmd, _pmd;
+	pte_t *pte;
+	int nr_pages = 0;
+	int i;
+
+	new = alloc_hugepage();
+	if (!new)
+		return;
+	inc_page_state(thp_collapse_alloc);
+	lru_add_drain();
+
+	down_write(&mm->mmap_sem);
+	if (khugepaged_mm_exiting(mm))
+		goto out;
+	pmd = khugepaged_find_pmd(mm, address);
+	if (!pmd)
+		goto out;
+	vma = find_vma(mm, address);
+
+	/*
+	 * With mmap_sem held for writing, page_table_lock keeps out all
+	 * else that could change the ptes: see the lock ordering in rmap.c.
+	 */
+	spin_lock(&mm->page_table_lock);
+	pte = pte_offset_map(pmd, address);
+	if (khugepaged_check_ptes(pte, address, 1) < 0) {
+		pte_unmap(pte);
+		spin_unlock(&mm->page_table_lock);
+		goto out;
+	}
+
+	/*
+	 * Stop other threads from writing to the old pages while they
+	 * are copied: they fault, and wait for mmap_sem.  Speculative
+	 * faults are held off too; the TLB flush waits for those still
+	 * walking to the old page table, the pte lock for any filling
+	 * in a pte there.
+	 */
+	mm_exclude_faults_begin(mm);
+	_pmd = pmdp_get_and_clear(pmd);
+	flush_tlb_range(vma, address, address + HPAGE_PMD_SIZE);
+	pte_ptl_unlock(pte_ptl_lock(mm, &_pmd));
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		unsigned long addr = address + i * PAGE_SIZE;
+		pte_t pteval = pte[i];
+		struct page *page;
+
+		if (pte_none(pteval) ||
+		    (page = pte_page(pteval)) == ZERO_PAGE(addr)) {
+			clear_user_highpage(new + i, addr);
+			continue;
+		}
+		copy_user_highpage(new + i, page, addr);
+		page_remove_rmap(page);
+		dec_mm_counter(mm, anon_rss);
+		page_cache_release(page);
+		nr_pages++;
+	}
+	pte_unmap(pte);
+
+	pte_lock_deinit(pmd_page(_pmd));
+	pte_free(pmd_page(_pmd));
+	mm->nr_ptes--;
+	dec_page_state(nr_page_table_pages);
+
+	set_huge_pmd(mm, vma, address, pmd, new);
+	add_mm_counter(mm, rss, HPAGE_PMD_NR - nr_pages);
+	mm_exclude_faults_end(mm);
+	spin_unlock(&mm->page_table_lock);
+	new = NULL;
+out:
+	up_write(&mm->mmap_sem);
+	if (new)
+		free_hugepage(new);
+}
+
+/*
+ * Scan @mm from *@addressp for a range worth collapsing, looking at no
+ * more than about @budget pages.  Returns the number of pages looked at
+ * and leaves the address to resume from in *@addressp, 0 when done.
+ */
+static int khugepaged_scan_mm(struct mm_struct *mm, unsigned long *addressp,
+			      int budget)
+{
+	struct vm_area_struct *vma;
+	unsigned long addr = *addressp;
+	int progress = 0;
+
+	down_read(&mm->mmap_sem);
+	if (khugepaged_mm_exiting(mm))
+		goto done;
+	for (vma = find_vma(mm, addr); vma; vma = vma->vm_next) {
+		unsigned long hstart, hend;
+
+		progress++;
+		if (!vma_huge_anon(vma) || !vma->anon_vma)
+			continue;
+		hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+		hend = vma->vm_end & HPAGE_PMD_MASK;
+		if (addr < hstart)
+			addr = hstart;
+		for (; addr < hend; addr += HPAGE_PMD_SIZE) {
+			spinlock_t *ptl;
+			pmd_t *pmd;
+			pte_t *pte;
+			int referenced;
+
+			if (progress >= budget)
+				goto out;
+			progress += HPAGE_PMD_NR;
+
+			pmd = khugepaged_find_pmd(mm, addr);
+			if (!pmd)
+				continue;
+			pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+			referenced = khugepaged_check_ptes(pte, addr, 0);
+			pte_unmap_unlock(pte, ptl);
+			if (referenced > 0) {
+				up_read(&mm->mmap_sem);
+				collapse_huge_page(mm, addr);
+				*addressp = addr + HPAGE_PMD_SIZE;
+				return progress;
+			}
+		}
+	}
+done:
+	addr = 0;
+out:
+	up_read(&mm->mmap_sem);
+	*addressp = addr;
+	return progress;
+}
+
+static void khugepaged_do_scan(void)
+{
+	int progress = 0;
+	int wrapped = 0;
+
+	while (!wrapped && progress < sysctl_khugepaged_pages_to_scan &&
+	       sysctl_transparent_hugepage) {
+		struct mm_struct *mm;
+		unsigned long address;
+
+		spin_lock(&khugepaged_lock);
+		if (!khugepaged_scan.mm) {
+			if (list_empty(&khugepaged_mms)) {
+				spin_unlock(&khugepaged_lock);
+				break;
+			}
+			khugepaged_scan.mm = list_entry(khugepaged_mms.next,
+					struct mm_struct, khugepaged_list);
+			khugepaged_scan.address = 0;
+		}
+		mm = khugepaged_scan.mm;
+		address = khugepaged_scan.address;
+		atomic_inc(&mm->mm_count);
+		spin_unlock(&khugepaged_lock);
+
+		progress += khugepaged_scan_mm(mm, &address,
+				sysctl_khugepaged_pages_to_scan - progress);
+
+		spin_lock(&khugepaged_lock);
+		if (khugepaged_scan.mm == mm) {
+			if (!address) {
+				/* Done with this mm, on to the next one */
+				struct list_head *next = mm->khugepaged_list.next;
+
+				if (next == &khugepaged_mms) {
+					khugepaged_scan.mm = NULL;
+					wrapped = 1;
+				} else
+					khugepaged_scan.mm = list_entry(next,
+						struct mm_struct, khugepaged_list);
+			}
+			khugepaged_scan.address = address;
+		}
+		spin_unlock(&khugepaged_lock);
+		mmdrop(mm);
+		cond_resched();
+	}
+}
+
+static int khugepaged(void *dummy)
+{
+	set_user_nice(current, 19);
+
+	for ( ; ; ) {
+		if (current->flags & PF_FREEZE)
+			refrigerator(PF_FREEZE);
+
+		khugepaged_do_scan();
+
+		if (list_empty(&khugepaged_mms) || !sysctl_transparent_hugepage)
+			wait_event_interruptible(khugepaged_wait,
+				!list_empty(&khugepaged_mms) &&
+				sysctl_transparent_hugepage);
+		else
+			wait_event_interruptible_timeout(khugepaged_wait, 0,
+				msecs_to_jiffies(
+					sysctl_khugepaged_scan_sleep_millisecs));
+	}
+	return 0;
+}
+
+static int __init khugepaged_init(void)
+{
+	kthread_run(khugepaged, NULL, "khugepaged");
+	return 0;
+}
+
+module_init(khugepaged_init)
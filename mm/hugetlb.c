@@ -13,13 +13,22 @@
 #include <linux/nodemask.h>
 
 const unsigned long hugetlb_zero = 0, hugetlb_infinity = ~0UL;
-static unsigned long nr_huge_pages, free_huge_pages;
+static unsigned long nr_huge_pages, free_huge_pages, surplus_huge_pages;
 unsigned long max_huge_pages;
+unsigned long nr_overcommit_huge_pages;
 static struct list_head hugepage_freelists[MAX_NUMNODES];
 static unsigned int nr_huge_pages_node[MAX_NUMNODES];
 static unsigned int free_huge_pages_node[MAX_NUMNODES];
+static unsigned int surplus_huge_pages_node[MAX_NUMNODES];
 static DEFINE_SPINLOCK(hugetlb_lock);
 
+/*
+ * The pool is made of persistent pages, sized by nr_hugepages, and
+ * surplus pages which alloc_huge_page takes from the buddy allocator
+ * when the pool runs dry (at most nr_overcommit_hugepages of them) and
+ * which go straight back to the buddy allocator when they are freed.
+ */
+
 static void enqueue_huge_page(struct page *page)
 {
 	int nid = page_to_nid(page);
@@ -28,65 +37,145 @@ static void enqueue_huge_page(struct page *page)
 	free_huge_pages_node[nid]++;
 }
 
-static struct page *dequeue_huge_page(void)
+static struct page *dequeue_huge_page_node(int nid)
+{
+	struct page *page;
+
+	if (list_empty(&hugepage_freelists[nid]))
+		return NULL;
+	page = list_entry(hugepage_freelists[nid].next, struct page, lru);
+	list_del(&page->lru);
+	free_huge_pages--;
+	free_huge_pages_node[nid]--;
+	return page;
+}
+
+/*
+ * Take a free page from @nid if it has one, else from any node the
+ * mempolicy of @vma allows.  A NULL @vma allows any node.
+ */
+static struct page *dequeue_huge_page(int nid, struct vm_area_struct *vma,
+				unsigned long addr)
 {
-	int nid = numa_node_id();
-	struct page *page = NULL;
+	struct page *page;
 
-	if (list_empty(&hugepage_freelists[nid])) {
-		for (nid = 0; nid < MAX_NUMNODES; ++nid)
-			if (!list_empty(&hugepage_freelists[nid]))
-				break;
+	page = dequeue_huge_page_node(nid);
+	if (page)
+		return page;
+	for (nid = 0; nid < MAX_NUMNODES; ++nid) {
+		if (list_empty(&hugepage_freelists[nid]))
+			continue;
+		if (vma && !mpol_node_valid(nid, vma, addr))
+			continue;
+		return dequeue_huge_page_node(nid);
 	}
-	if (nid >= 0 && nid < MAX_NUMNODES &&
-	    !list_empty(&hugepage_freelists[nid])) {
-		page = list_entry(hugepage_freelists[nid].next,
-				  struct page, lru);
-		list_del(&page->lru);
-		free_huge_pages--;
-		free_huge_pages_node[nid]--;
+	return NULL;
+}
+
+static void update_and_free_page(struct page *page)
+{
+	int i;
+	nr_huge_pages--;
+	nr_huge_pages_node[page_zone(page)->zone_pgdat->node_id]--;
+	for (i = 0; i < (HPAGE_SIZE / PAGE_SIZE); i++) {
+		page[i].flags &= ~(1 << PG_locked | 1 << PG_error | 1 << PG_referenced |
+				1 << PG_dirty | 1 << PG_active | 1 << PG_reserved |
+				1 << PG_private | 1<< PG_writeback);
+		set_page_count(&page[i], 0);
 	}
-	return page;
+	set_page_count(page, 1);
+	__free_pages(page, HUGETLB_PAGE_ORDER);
 }
 
-static struct page *alloc_fresh_huge_page(void)
+static int alloc_fresh_huge_page(void)
 {
 	static int nid = 0;
 	struct page *page;
 	page = alloc_pages_node(nid, GFP_HIGHUSER|__GFP_COMP|__GFP_NOWARN,
 					HUGETLB_PAGE_ORDER);
 	nid = (nid + 1) % num_online_nodes();
-	if (page) {
-		nr_huge_pages++;
-		nr_huge_pages_node[page_to_nid(page)]++;
-	}
-	return page;
+	if (!page)
+		return 0;
+	spin_lock(&hugetlb_lock);
+	nr_huge_pages++;
+	nr_huge_pages_node[page_to_nid(page)]++;
+	enqueue_huge_page(page);
+	spin_unlock(&hugetlb_lock);
+	return 1;
 }
 
 void free_huge_page(struct page *page)
 {
+	int nid = page_to_nid(page);
+
 	BUG_ON(page_count(page));
 
 	INIT_LIST_HEAD(&page->lru);
 	page[1].mapping = NULL;
 
 	spin_lock(&hugetlb_lock);
-	enqueue_huge_page(page);
+	if (surplus_huge_pages_node[nid]) {
+		update_and_free_page(page);
+		surplus_huge_pages--;
+		surplus_huge_pages_node[nid]--;
+	} else
+		enqueue_huge_page(page);
 	spin_unlock(&hugetlb_lock);
 }
 
-struct page *alloc_huge_page(void)
+/*
+ * The pool is empty: try for a surplus page from the buddy allocator.
+ * The counters are bumped before allocating so that racing callers
+ * cannot overshoot nr_overcommit_huge_pages.
+ */
+static struct page *alloc_buddy_huge_page(int nid, struct vm_area_struct *vma,
+				unsigned long addr)
 {
 	struct page *page;
-	int i;
 
 	spin_lock(&hugetlb_lock);
-	page = dequeue_huge_page();
-	if (!page) {
+	if (surplus_huge_pages >= nr_overcommit_huge_pages) {
 		spin_unlock(&hugetlb_lock);
 		return NULL;
 	}
+	nr_huge_pages++;
+	surplus_huge_pages++;
+	spin_unlock(&hugetlb_lock);
+
+	page = alloc_pages_node(nid, GFP_HIGHUSER|__GFP_COMP|
+				__GFP_NOWARN|__GFP_NORETRY, HUGETLB_PAGE_ORDER);
+	if (page && !mpol_node_valid(page_to_nid(page), vma, addr)) {
+		__free_pages(page, HUGETLB_PAGE_ORDER);
+		page = NULL;
+	}
+
+	spin_lock(&hugetlb_lock);
+	if (page) {
+		nid = page_to_nid(page);
+		nr_huge_pages_node[nid]++;
+		surplus_huge_pages_node[nid]++;
+	} else {
+		nr_huge_pages--;
+		surplus_huge_pages--;
+	}
+	spin_unlock(&hugetlb_lock);
+	return page;
+}
+
+struct page *alloc_huge_page(struct vm_area_struct *vma, unsigned long addr)
+{
+	int nid = mpol_first_node(vma, addr);
+	struct page *page;
+	int i;
+
+	spin_lock(&hugetlb_lock);
+	page = dequeue_huge_page(nid, vma, addr);
 	spin_unlock(&hugetlb_lock);
+	if (!page) {
+		page = alloc_buddy_huge_page(nid, vma, addr);
+		if (!page)
+			return NULL;
+	}
 	set_page_count(page, 1);
 	page[1].mapping = (void *)free_huge_page;
 	for (i = 0; i < (HPAGE_SIZE/PAGE_SIZE); ++i)
@@ -97,20 +186,14 @@ struct page *alloc_huge_page(void)
 static int __init hugetlb_init(void)
 {
 	unsigned long i;
-	struct page *page;
 
 	for (i = 0; i < MAX_NUMNODES; ++i)
 		INIT_LIST_HEAD(&hugepage_freelists[i]);
 
-	for (i = 0; i < max_huge_pages; ++i) {
-		page = alloc_fresh_huge_page();
-		if (!page)
+	for (i = 0; i < max_huge_pages; ++i)
+		if (!alloc_fresh_huge_page())
 			break;
-		spin_lock(&hugetlb_lock);
-		enqueue_huge_page(page);
-		spin_unlock(&hugetlb_lock);
-	}
-	max_huge_pages = free_huge_pages = nr_huge_pages = i;
+	max_huge_pages = i;
 	printk("Total HugeTLB memory allocated, %ld\n", free_huge_pages);
 	return 0;
 }
@@ -125,20 +208,7 @@ static int __init hugetlb_setup(char *s)
 __setup("hugepages=", hugetlb_setup);
 
 #ifdef CONFIG_SYSCTL
-static void update_and_free_page(struct page *page)
-{
-	int i;
-	nr_huge_pages--;
-	nr_huge_pages_node[page_zone(page)->zone_pgdat->node_id]--;
-	for (i = 0; i < (HPAGE_SIZE / PAGE_SIZE); i++) {
-		page[i].flags &= ~(1 << PG_locked | 1 << PG_error | 1 << PG_referenced |
-				1 << PG_dirty | 1 << PG_active | 1 << PG_reserved |
-				1 << PG_private | 1<< PG_writeback);
-		set_page_count(&page[i], 0);
-	}
-	set_page_count(page, 1);
-	__free_pages(page, HUGETLB_PAGE_ORDER);
-}
+#define persistent_huge_pages	(nr_huge_pages - surplus_huge_pages)
 
 #ifdef CONFIG_HIGHMEM
 static void try_to_free_low(unsigned long count)
@@ -147,6 +217,8 @@ static void try_to_free_low(unsigned long count)
 	for (i = 0; i < MAX_NUMNODES; ++i) {
 		struct page *page, *next;
 		list_for_each_entry_safe(page, next, &hugepage_freelists[i], lru) {
+			if (count >= persistent_huge_pages)
+				return;
 			if (PageHighMem(page))
 				continue;
 			list_del(&page->lru);
@@ -154,8 +226,6 @@ static void try_to_free_low(unsigned long count)
 			nid = page_zone(page)->zone_pgdat->node_id;
 			free_huge_pages--;
 			free_huge_pages_node[nid]--;
-			if (count >= nr_huge_pages)
-				return;
 		}
 	}
 }
@@ -165,29 +235,79 @@ static inline void try_to_free_low(unsigned long count)
 }
 #endif
 
+/*
+ * Move one page between the surplus and persistent counts of a node:
+ * @delta < 0 makes a surplus page persistent, @delta > 0 marks a
+ * persistent page surplus so that it is freed when it is released.
+ */
+static int adjust_pool_surplus(int delta)
+{
+	static int prev_nid;
+	int nid = prev_nid;
+	int i;
+
+	for (i = 0; i < MAX_NUMNODES; i++) {
+		nid = (nid + 1) % MAX_NUMNODES;
+		if (delta < 0 && !surplus_huge_pages_node[nid])
+			continue;
+		if (delta > 0 && surplus_huge_pages_node[nid] >=
+						nr_huge_pages_node[nid])
+			continue;
+		surplus_huge_pages += delta;
+		surplus_huge_pages_node[nid] += delta;
+		prev_nid = nid;
+		return 1;
+	}
+	return 0;
+}
+
 static unsigned long set_max_huge_pages(unsigned long count)
 {
-	while (count > nr_huge_pages) {
-		struct page *page = alloc_fresh_huge_page();
-		if (!page)
-			return nr_huge_pages;
-		spin_lock(&hugetlb_lock);
-		enqueue_huge_page(page);
+	unsigned long min_count, ret;
+
+	/*
+	 * Growing the pool takes over surplus pages first, then allocates
+	 * fresh ones.  Growing can fail, in which case the pool is left as
+	 * big as it could be made.
+	 */
+	spin_lock(&hugetlb_lock);
+	while (surplus_huge_pages && count > persistent_huge_pages) {
+		if (!adjust_pool_surplus(-1))
+			break;
+	}
+	while (count > persistent_huge_pages) {
+		int ok;
+
 		spin_unlock(&hugetlb_lock);
+		ok = alloc_fresh_huge_page();
+		spin_lock(&hugetlb_lock);
+		if (!ok)
+			goto out;
 	}
-	if (count >= nr_huge_pages)
-		return nr_huge_pages;
 
-	spin_lock(&hugetlb_lock);
-	try_to_free_low(count);
-	while (count < nr_huge_pages) {
-		struct page *page = dequeue_huge_page();
+	/*
+	 * Shrinking frees what is free right now and turns the pages that
+	 * are still in use into surplus pages, which free_huge_page hands
+	 * back to the buddy allocator as they are released.
+	 */
+	min_count = nr_huge_pages - free_huge_pages;
+	if (min_count < count)
+		min_count = count;
+	try_to_free_low(min_count);
+	while (min_count < persistent_huge_pages) {
+		struct page *page = dequeue_huge_page(0, NULL, 0);
 		if (!page)
 			break;
 		update_and_free_page(page);
 	}
+	while (count < persistent_huge_pages) {
+		if (!adjust_pool_surplus(1))
+			break;
+	}
+out:
+	ret = persistent_huge_pages;
 	spin_unlock(&hugetlb_lock);
-	return nr_huge_pages;
+	return ret;
 }
 
 int hugetlb_sysctl_handler(struct ctl_table *table, int write,
@@ -205,9 +325,11 @@ int hugetlb_report_meminfo(char *buf)
 	return sprintf(buf,
 			"HugePages_Total: %5lu\n"
 			"HugePages_Free:  %5lu\n"
+			"HugePages_Surp:  %5lu\n"
 			"Hugepagesize:    %5lu kB\n",
 			nr_huge_pages,
 			free_huge_pages,
+			surplus_huge_pages,
 			HPAGE_SIZE/1024);
 }
 
@@ -215,14 +337,21 @@ int hugetlb_report_node_meminfo(int nid, char *buf)
 {
 	return sprintf(buf,
 		"Node %d HugePages_Total: %5u\n"
-		"Node %d HugePages_Free:  %5u\n",
+		"Node %d HugePages_Free:  %5u\n"
+		"Node %d HugePages_Surp:  %5u\n",
 		nid, nr_huge_pages_node[nid],
-		nid, free_huge_pages_node[nid]);
+		nid, free_huge_pages_node[nid],
+		nid, surplus_huge_pages_node[nid]);
 }
 
 int is_hugepage_mem_enough(size_t size)
 {
-	return (size + ~HPAGE_MASK)/HPAGE_SIZE <= free_huge_pages;
+	unsigned long avail = free_huge_pages;
+
+	/* surplus pages may still be allocated on demand */
+	if (nr_overcommit_huge_pages > surplus_huge_pages)
+		avail += nr_overcommit_huge_pages - surplus_huge_pages;
+	return (size + ~HPAGE_MASK)/HPAGE_SIZE <= avail;
 }
 
 /* Return the number pages of memory we physically have, in PAGE_SIZE units. */
@@ -0,0 +1,838 @@
+/*
+ * mm/ksm.c - merging of identical anonymous pages
+ *
+ * Many processes can hold pages of the same contents without knowing of
+ * each other: the guests of a virtual machine monitor booting the same
+ * kernel, or the workers of a server which built the same tables.  An
+ * application marks such areas with madvise(MADV_MERGEABLE), and ksmd
+ * scans their anonymous pages, a few at a time, for duplicates.
+ *
+ * Each page scanned is checksummed and looked up in two hash tables:
+ *
+ *   the stable table, of the KSM pages already merged.  A page of the
+ *	same contents is replaced by the KSM page at once;
+ *
+ *   the unstable table, of the pages scanned so far in this pass.  Its
+ *	entries are only addresses: the pages there may have changed or
+ *	gone since.  A page of the same contents as one still there is
+ *	merged with it into a new KSM page, which goes into the stable
+ *	table.  Otherwise the page goes into the unstable table itself.
+ *
+ * The unstable table is emptied at the end of each pass, and KSM pages
+ * nobody maps any more are dropped from the stable table.
+ *
+ * A KSM page is an ordinary anonymous page with no anon_vma behind it,
+ * mapped read-only by the ptes it replaced: page_add_ksm_rmap() counts
+ * them.  A write to it through any of them faults, and do_wp_page()
+ * copies it, never reusing it in place.  Without an anon_vma there is no
+ * finding those ptes again, so KSM pages are kept off the LRU: they are
+ * neither reclaimed nor migrated, and are not charged to a memctl group.
+ * Huge pmds are split when an area is registered, and not made there.
+ *
+ * Before a page is replaced its pte is write protected, and the page is
+ * only replaced if nothing but its ptes holds a reference to it, so that
+ * no get_user_pages() user can write to it behind our back, and if its
+ * contents still match.  ksmd never holds two mms' mmap_sems at once.
+ *
+ * Only ksmd looks at the tables, so they need no locking.
+ */
+
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/ksm.h>
+#include <linux/huge_mm.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/swap.h>
+#include <linux/rmap.h>
+#include <linux/jhash.h>
+#include <linux/slab.h>
+#include <linux/sysctl.h>
+#include <linux/seq_file.h>
+#include <linux/kthread.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+
+#include <asm/tlbflush.h>
+
+int sysctl_ksm_run;
+int sysctl_ksm_pages_to_scan = 100;
+int sysctl_ksm_sleep_millisecs = 20;
+
+#define KSM_HASH_BITS	12
+#define KSM_HASH_SIZE	(1 << KSM_HASH_BITS)
+#define KSM_HASH_MASK	(KSM_HASH_SIZE - 1)
+
+/* A KSM page, holding a reference to it */
+struct stable_node {
+	struct hlist_node hash;
+	struct page *kpage;
+	u32 checksum;
+};
+
+/* A page scanned in this pass, holding a reference to its mm_struct */
+struct unstable_item {
+	struct hlist_node hash;
+	struct mm_struct *mm;
+	unsigned long address;
+	u32 checksum;
+};
+
+static struct hlist_head stable_hash[KSM_HASH_SIZE];
+static struct hlist_head unstable_hash[KSM_HASH_SIZE];
+static kmem_cache_t *stable_node_cachep;
+static kmem_cache_t *unstable_item_cachep;
+
+/* For /proc/ksminfo */
+static unsigned long ksm_pages_shared;		/* KSM pages */
+static unsigned long ksm_pages_sharing;		/* more ptes mapping them */
+static unsigned long ksm_pages_unshared;	/* in the unstable table */
+static unsigned long ksm_full_scans;
+
+/*
+ * mms with mergeable areas, scanned round robin by ksmd.  The cursor
+ * holds no reference: ksm_exit moves it on when its mm goes away.
+ */
+static LIST_HEAD(ksm_mms);
+static DEFINE_SPINLOCK(ksm_lock);
+static DECLARE_WAIT_QUEUE_HEAD(ksm_wait);
+static struct {
+	struct mm_struct *mm;
+	unsigned long address;
+} ksm_scan;
+
+static void ksm_enter(struct mm_struct *mm)
+{
+	if (!list_empty(&mm->ksm_list))
+		return;
+	spin_lock(&ksm_lock);
+	if (list_empty(&mm->ksm_list)) {
+		list_add_tail(&mm->ksm_list, &ksm_mms);
+		wake_up_interruptible(&ksm_wait);
+	}
+	spin_unlock(&ksm_lock);
+}
+
+/*
+ * A child inherits its parent's mergeable areas.  Called from dup_mmap.
+ */
+void ksm_fork(struct mm_struct *mm, struct mm_struct *oldmm)
+{
+	if (!list_empty(&oldmm->ksm_list))
+		ksm_enter(mm);
+}
+
+/*
+ * Called from mmput before the address space is torn down.  Once off
+ * the list the mm won't be merged any more; cycling mmap_sem waits for
+ * a merge already under way.
+ */
+void ksm_exit(struct mm_struct *mm)
+{
+	int registered = 0;
+
+	spin_lock(&ksm_lock);
+	if (!list_empty(&mm->ksm_list)) {
+		if (ksm_scan.mm == mm) {
+			struct list_head *next = mm->ksm_list.next;
+
+			ksm_scan.mm = next == &ksm_mms ? NULL :
+				list_entry(next, struct mm_struct, ksm_list);
+			ksm_scan.address = 0;
+		}
+		list_del_init(&mm->ksm_list);
+		registered = 1;
+	}
+	spin_unlock(&ksm_lock);
+
+	if (registered) {
+		down_write(&mm->mmap_sem);
+		up_write(&mm->mmap_sem);
+	}
+}
+
+static inline int ksm_mm_exiting(struct mm_struct *mm)
+{
+	return list_empty(&mm->ksm_list);
+}
+
+/*
+ * Map and lock the pte at @address, if there is a page table there.
+ * Needs mmap_sem: mergeable areas have no huge pmds.
+ */
+static pte_t *ksm_pte_lock(struct mm_struct *mm, unsigned long address,
+			   spinlock_t **ptlp)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+	pmd = pmd_offset(pud, address);
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		return NULL;
+	return pte_offset_map_lock(mm, pmd, address, ptlp);
+}
+
+/*
+ * The anonymous page mapped at @address, if it could be merged, with
+ * a reference held.  Needs mmap_sem.
+ */
+static struct page *ksm_get_page(struct mm_struct *mm, unsigned long address)
+{
+	struct page *page = NULL;
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	pte = ksm_pte_lock(mm, address, &ptl);
+	if (!pte)
+		return NULL;
+	if (pte_present(*pte) && pfn_valid(pte_pfn(*pte))) {
+		page = pfn_to_page(pte_pfn(*pte));
+		if (PageReserved(page) || !PageAnon(page) || PageKsm(page))
+			page = NULL;
+		else
+			get_page(page);
+	}
+	pte_unmap_unlock(pte, ptl);
+	return page;
+}
+
+/*
+ * As ksm_get_page, but taking @mm's mmap_sem: for unstable table items,
+ * whose page may have been unmapped, or whose area may have gone.
+ */
+static struct page *get_mergeable_page(struct mm_struct *mm,
+				       unsigned long address)
+{
+	struct vm_area_struct *vma;
+	struct page *page = NULL;
+
+	down_read(&mm->mmap_sem);
+	if (ksm_mm_exiting(mm))
+		goto out;
+	vma = find_vma(mm, address);
+	if (!vma || address < vma->vm_start ||
+	    !(vma->vm_flags & VM_MERGEABLE) || !vma->anon_vma)
+		goto out;
+	page = ksm_get_page(mm, address);
+out:
+	up_read(&mm->mmap_sem);
+	return page;
+}
+
+static u32 calc_checksum(struct page *page)
+{
+	void *addr = kmap_atomic(page, KM_USER0);
+	u32 checksum;
+
+	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	kunmap_atomic(addr, KM_USER0);
+	return checksum;
+}
+
+static int pages_identical(struct page *page1, struct page *page2)
+{
+	char *addr1, *addr2;
+	int ret;
+
+	addr1 = kmap_atomic(page1, KM_USER0);
+	addr2 = kmap_atomic(page2, KM_USER1);
+	ret = !memcmp(addr1, addr2, PAGE_SIZE);
+	kunmap_atomic(addr2, KM_USER1);
+	kunmap_atomic(addr1, KM_USER0);
+	return ret;
+}
+
+/*
+ * Make the pte mapping @page at @address read-only and clean, as long
+ * as nobody but the ptes, the swap cache and our caller holds a
+ * reference to @page.  Returns 0 with the pte in *@orig_pte if so.
+ */
+static int write_protect_page(struct vm_area_struct *vma,
+			      unsigned long address, struct page *page,
+			      pte_t *orig_pte)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	spinlock_t *ptl;
+	pte_t *pte;
+	int err = -EFAULT;
+
+	pte = ksm_pte_lock(mm, address, &ptl);
+	if (!pte)
+		return err;
+	if (!pte_present(*pte) || pte_pfn(*pte) != page_to_pfn(page))
+		goto out_unlock;
+
+	if (pte_write(*pte) || pte_dirty(*pte)) {
+		pte_t entry;
+
+		flush_cache_page(vma, address, page_to_pfn(page));
+		/*
+		 * Clear the pte first, so that no other cpu can write
+		 * through it while the references are counted.
+		 */
+		entry = ptep_clear_flush(vma, address, pte);
+		if (page_mapcount(page) + 1 + PageSwapCache(page) !=
+		    page_count(page)) {
+			set_pte_at(mm, address, pte, entry);
+			goto out_unlock;
+		}
+		if (pte_dirty(entry))
+			set_page_dirty(page);
+		entry = pte_mkclean(pte_wrprotect(entry));
+		set_pte_at(mm, address, pte, entry);
+	}
+	*orig_pte = *pte;
+	err = 0;
+
+out_unlock:
+	pte_unmap_unlock(pte, ptl);
+	return err;
+}
+
+/*
+ * Replace @page, write protected at @address as *@orig_pte was, by the
+ * KSM page @kpage.
+ */
+static int replace_page(struct vm_area_struct *vma, unsigned long address,
+			struct page *page, struct page *kpage, pte_t orig_pte)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	pte = ksm_pte_lock(mm, address, &ptl);
+	if (!pte)
+		return -EFAULT;
+	if (!pte_same(*pte, orig_pte)) {
+		pte_unmap_unlock(pte, ptl);
+		return -EFAULT;
+	}
+
+	get_page(kpage);
+	page_add_ksm_rmap(kpage);
+
+	flush_cache_page(vma, address, pte_pfn(*pte));
+	ptep_clear_flush(vma, address, pte);
+	set_pte_at(mm, address, pte, mk_pte(kpage, vma->vm_page_prot));
+
+	page_remove_rmap(page);
+	put_page(page);
+
+	pte_unmap_unlock(pte, ptl);
+	return 0;
+}
+
+/*
+ * Replace @page, mapped at @address in @vma, by @kpage if their contents
+ * match.  Needs mmap_sem.  Returns 0 if merged.
+ */
+static int try_to_merge_one_page(struct vm_area_struct *vma,
+				 unsigned long address, struct page *page,
+				 struct page *kpage)
+{
+	pte_t orig_pte = __pte(0);
+	int err = -EFAULT;
+
+	if (page == kpage)
+		return 0;
+	/*
+	 * The page lock keeps do_wp_page from reusing the page in place
+	 * once its pte has been write protected.
+	 */
+	if (TestSetPageLocked(page))
+		return -EBUSY;
+	if (write_protect_page(vma, address, page, &orig_pte) == 0 &&
+	    pages_identical(page, kpage))
+		err = replace_page(vma, address, page, kpage, orig_pte);
+	unlock_page(page);
+	return err;
+}
+
+static int try_to_merge_with_ksm_page(struct mm_struct *mm,
+				      unsigned long address, struct page *page,
+				      struct page *kpage)
+{
+	struct vm_area_struct *vma;
+	int err = -EFAULT;
+
+	down_read(&mm->mmap_sem);
+	if (ksm_mm_exiting(mm))
+		goto out;
+	vma = find_vma(mm, address);
+	if (!vma || address < vma->vm_start ||
+	    !(vma->vm_flags & VM_MERGEABLE))
+		goto out;
+	err = try_to_merge_one_page(vma, address, page, kpage);
+out:
+	up_read(&mm->mmap_sem);
+	return err;
+}
+
+/*
+ * Undo a merge by writing to the page: do_wp_page gives it a copy.
+ */
+static void break_cow(struct mm_struct *mm, unsigned long address)
+{
+	struct vm_area_struct *vma;
+
+	down_read(&mm->mmap_sem);
+	if (ksm_mm_exiting(mm))
+		goto out;
+	vma = find_vma(mm, address);
+	if (vma && address >= vma->vm_start)
+		handle_mm_fault(mm, vma, address, 1);
+out:
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Merge two pages of the same contents into a new KSM page.  Returns it,
+ * with the reference the stable table is to hold, or NULL.
+ */
+static struct page *try_to_merge_two_pages(struct mm_struct *mm1,
+		unsigned long address1, struct page *page1,
+		struct mm_struct *mm2, unsigned long address2,
+		struct page *page2)
+{
+	struct page *kpage;
+
+	kpage = alloc_page(GFP_HIGHUSER);
+	if (!kpage)
+		return NULL;
+	copy_highpage(kpage, page1);
+	kpage->mapping = (struct address_space *)PAGE_MAPPING_ANON;
+
+	if (try_to_merge_with_ksm_page(mm1, address1, page1, kpage))
+		goto fail;
+	if (try_to_merge_with_ksm_page(mm2, address2, page2, kpage)) {
+		break_cow(mm1, address1);
+		goto fail;
+	}
+	return kpage;
+
+fail:
+	put_page(kpage);
+	return NULL;
+}
+
+static struct page *stable_search(struct page *page, u32 checksum)
+{
+	struct stable_node *node;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(node, pos, &stable_hash[checksum & KSM_HASH_MASK],
+			     hash) {
+		if (node->checksum == checksum && page_mapped(node->kpage) &&
+		    pages_identical(page, node->kpage))
+			return node->kpage;
+	}
+	return NULL;
+}
+
+static void stable_insert(struct page *kpage, u32 checksum)
+{
+	struct stable_node *node;
+
+	node = kmem_cache_alloc(stable_node_cachep, GFP_KERNEL);
+	if (!node) {
+		/* It goes when its ptes do, just not merged with again */
+		put_page(kpage);
+		return;
+	}
+	node->kpage = kpage;
+	node->checksum = checksum;
+	hlist_add_head(&node->hash, &stable_hash[checksum & KSM_HASH_MASK]);
+	ksm_pages_shared++;
+}
+
+/*
+ * Drop the KSM pages nobody maps any more, and count the ptes mapping
+ * the others.
+ */
+static void stable_prune(void)
+{
+	unsigned long sharing = 0;
+	int i;
+
+	for (i = 0; i < KSM_HASH_SIZE; i++) {
+		struct stable_node *node;
+		struct hlist_node *pos, *n;
+
+		hlist_for_each_entry_safe(node, pos, n, &stable_hash[i], hash) {
+			if (page_mapped(node->kpage)) {
+				sharing += page_mapcount(node->kpage) - 1;
+				continue;
+			}
+			hlist_del(&node->hash);
+			put_page(node->kpage);
+			kmem_cache_free(stable_node_cachep, node);
+			ksm_pages_shared--;
+		}
+	}
+	ksm_pages_sharing = sharing;
+}
+
+/*
+ * An earlier page of this pass with the same contents as @page, if one
+ * is still there, returned in *@tree_pagep with a reference held.
+ */
+static struct unstable_item *unstable_search(struct page *page, u32 checksum,
+					     struct page **tree_pagep)
+{
+	struct unstable_item *item;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(item, pos,
+			     &unstable_hash[checksum & KSM_HASH_MASK], hash) {
+		struct page *tree_page;
+
+		if (item->checksum != checksum)
+			continue;
+		tree_page = get_mergeable_page(item->mm, item->address);
+		if (!tree_page)
+			continue;
+		/* The same page, shared with us by fork, is no match */
+		if (tree_page != page && pages_identical(page, tree_page)) {
+			*tree_pagep = tree_page;
+			return item;
+		}
+		put_page(tree_page);
+	}
+	return NULL;
+}
+
+static void unstable_insert(struct mm_struct *mm, unsigned long address,
+			    u32 checksum)
+{
+	struct unstable_item *item;
+
+	item = kmem_cache_alloc(unstable_item_cachep, GFP_KERNEL);
+	if (!item)
+		return;
+	atomic_inc(&mm->mm_count);
+	item->mm = mm;
+	item->address = address;
+	item->checksum = checksum;
+	hlist_add_head(&item->hash, &unstable_hash[checksum & KSM_HASH_MASK]);
+	ksm_pages_unshared++;
+}
+
+static void unstable_remove(struct unstable_item *item)
+{
+	hlist_del(&item->hash);
+	mmdrop(item->mm);
+	kmem_cache_free(unstable_item_cachep, item);
+	ksm_pages_unshared--;
+}
+
+static void unstable_flush(void)
+{
+	int i;
+
+	for (i = 0; i < KSM_HASH_SIZE; i++)
+		while (!hlist_empty(&unstable_hash[i]))
+			unstable_remove(hlist_entry(unstable_hash[i].first,
+					struct unstable_item, hash));
+}
+
+/*
+ * Merge @page, mapped at @address in @mm, with a page of the same
+ * contents if there is one, or remember it for those to come.
+ */
+static void cmp_and_merge_page(struct mm_struct *mm, unsigned long address,
+			       struct page *page)
+{
+	struct unstable_item *item;
+	struct page *kpage, *tree_page;
+	u32 checksum;
+
+	checksum = calc_checksum(page);
+
+	kpage = stable_search(page, checksum);
+	if (kpage) {
+		if (!try_to_merge_with_ksm_page(mm, address, page, kpage))
+			ksm_pages_sharing++;
+		return;
+	}
+
+	item = unstable_search(page, checksum, &tree_page);
+	if (item) {
+		kpage = try_to_merge_two_pages(mm, address, page,
+					       item->mm, item->address,
+					       tree_page);
+		put_page(tree_page);
+		if (kpage) {
+			stable_insert(kpage, checksum);
+			ksm_pages_sharing++;
+			unstable_remove(item);
+		}
+		return;
+	}
+
+	unstable_insert(mm, address, checksum);
+}
+
+/*
+ * Scan @mm from *@addressp, looking at no more than about @budget
+ * pages.  Returns the number of pages looked at and leaves the address
+ * to resume from in *@addressp, 0 when done.
+ */
+static int ksm_scan_mm(struct mm_struct *mm, unsigned long *addressp,
+		       int budget)
+{
+	struct vm_area_struct *vma;
+	unsigned long addr = *addressp;
+	int progress = 0;
+
+	down_read(&mm->mmap_sem);
+	while (progress < budget) {
+		struct page *page;
+
+		if (ksm_mm_exiting(mm))
+			goto done;
+		vma = find_vma(mm, addr);
+		while (vma && (!(vma->vm_flags & VM_MERGEABLE) ||
+			       !vma->anon_vma)) {
+			progress++;
+			vma = vma->vm_next;
+		}
+		if (!vma)
+			goto done;
+		if (addr < vma->vm_start)
+			addr = vma->vm_start;
+
+		progress++;
+		page = ksm_get_page(mm, addr);
+		addr += PAGE_SIZE;
+		if (!page)
+			continue;
+		up_read(&mm->mmap_sem);
+		cmp_and_merge_page(mm, addr - PAGE_SIZE, page);
+		put_page(page);
+		cond_resched();
+		down_read(&mm->mmap_sem);
+	}
+	up_read(&mm->mmap_sem);
+	*addressp = addr;
+	return progress;
+
+done:
+	up_read(&mm->mmap_sem);
+	*addressp = 0;
+	return progress;
+}
+
+static void ksm_do_scan(void)
+{
+	int progress = 0;
+
+	/* Pages on our pagevecs hold a reference, and would not merge */
+	lru_add_drain();
+
+	while (progress < sysctl_ksm_pages_to_scan && sysctl_ksm_run) {
+		struct mm_struct *mm;
+		unsigned long address;
+		int wrapped = 0;
+
+		spin_lock(&ksm_lock);
+		if (!ksm_scan.mm) {
+			if (list_empty(&ksm_mms)) {
+				spin_unlock(&ksm_lock);
+				break;
+			}
+			ksm_scan.mm = list_entry(ksm_mms.next,
+					struct mm_struct, ksm_list);
+			ksm_scan.address = 0;
+		}
+		mm = ksm_scan.mm;
+		address = ksm_scan.address;
+		atomic_inc(&mm->mm_count);
+		spin_unlock(&ksm_lock);
+
+		progress += ksm_scan_mm(mm, &address,
+				sysctl_ksm_pages_to_scan - progress);
+
+		spin_lock(&ksm_lock);
+		if (ksm_scan.mm == mm) {
+			if (!address) {
+				/* Done with this mm, on to the next one */
+				struct list_head *next = mm->ksm_list.next;
+
+				if (next == &ksm_mms) {
+					ksm_scan.mm = NULL;
+					wrapped = 1;
+				} else
+					ksm_scan.mm = list_entry(next,
+						struct mm_struct, ksm_list);
+			}
+			ksm_scan.address = address;
+		}
+		spin_unlock(&ksm_lock);
+		mmdrop(mm);
+
+		if (wrapped) {
+			unstable_flush();
+			stable_prune();
+			ksm_full_scans++;
+			break;
+		}
+		cond_resched();
+	}
+}
+
+static int ksmd(void *dummy)
+{
+	set_user_nice(current, 19);
+
+	for ( ; ; ) {
+		if (current->flags & PF_FREEZE)
+			refrigerator(PF_FREEZE);
+
+		ksm_do_scan();
+
+		if (list_empty(&ksm_mms) || !sysctl_ksm_run) {
+			/* Don't keep the mms of the table pinned while idle */
+			unstable_flush();
+			stable_prune();
+			wait_event_interruptible(ksm_wait,
+				!list_empty(&ksm_mms) && sysctl_ksm_run);
+		} else
+			wait_event_interruptible_timeout(ksm_wait, 0,
+				msecs_to_jiffies(sysctl_ksm_sleep_millisecs));
+	}
+	return 0;
+}
+
+int ksm_run_sysctl_handler(ctl_table *table, int write, struct file *file,
+			   void __user *buffer, size_t *length, loff_t *ppos)
+{
+	proc_dointvec(table, write, file, buffer, length, ppos);
+	if (write)
+		wake_up_interruptible(&ksm_wait);
+	return 0;
+}
+
+/*
+ * Write to each KSM page mapped in [@start, @end) of @vma, so that it
+ * gets a page of its own.  Called with mmap_sem held for writing.
+ */
+static int unmerge_ksm_pages(struct vm_area_struct *vma,
+			     unsigned long start, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr;
+
+	for (addr = start; addr < end; addr += PAGE_SIZE) {
+		spinlock_t *ptl;
+		pte_t *pte;
+		int ksm = 0;
+
+		if (signal_pending(current))
+			return -ERESTARTSYS;
+		pte = ksm_pte_lock(mm, addr, &ptl);
+		if (!pte)
+			continue;
+		if (pte_present(*pte) && pfn_valid(pte_pfn(*pte)))
+			ksm = PageKsm(pfn_to_page(pte_pfn(*pte)));
+		pte_unmap_unlock(pte, ptl);
+		if (ksm && handle_mm_fault(mm, vma, addr, 1) == VM_FAULT_OOM)
+			return -ENOMEM;
+		cond_resched();
+	}
+	return 0;
+}
+
+/**
+ * ksm_madvise - register or unregister an area for merging
+ * @vma: the vma [@start, @end) is in
+ * @start: start of the area
+ * @end: end of the area
+ * @advice: MADV_MERGEABLE or MADV_UNMERGEABLE
+ * @vm_flags: the flags the area is to have, updated
+ *
+ * Advice on areas which cannot be merged, shared or special ones, is
+ * ignored.  Called by madvise with mmap_sem held for writing, before
+ * the area is split off.
+ */
+int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
+		unsigned long end, int advice, unsigned long *vm_flags)
+{
+	int err;
+
+	switch (advice) {
+	case MADV_MERGEABLE:
+		if (*vm_flags & (VM_MERGEABLE|VM_SHARED|VM_MAYSHARE|VM_IO|
+				 VM_RESERVED|VM_HUGETLB|VM_NONLINEAR))
+			return 0;
+		err = split_huge_pmd_range(vma, start, end);
+		if (err)
+			return err;
+		ksm_enter(vma->vm_mm);
+		*vm_flags |= VM_MERGEABLE;
+		break;
+
+	case MADV_UNMERGEABLE:
+		if (!(*vm_flags & VM_MERGEABLE))
+			return 0;
+		if (vma->anon_vma) {
+			err = unmerge_ksm_pages(vma, start, end);
+			if (err)
+				return err;
+		}
+		*vm_flags &= ~VM_MERGEABLE;
+		break;
+	}
+	return 0;
+}
+
+#ifdef CONFIG_PROC_FS
+static void *ksminfo_start(struct seq_file *m, loff_t *pos)
+{
+	return *pos ? NULL : SEQ_START_TOKEN;
+}
+
+static void *ksminfo_next(struct seq_file *m, void *arg, loff_t *pos)
+{
+	++*pos;
+	return NULL;
+}
+
+static void ksminfo_stop(struct seq_file *m, void *arg)
+{
+}
+
+static int ksminfo_show(struct seq_file *m, void *arg)
+{
+	seq_printf(m, "pages_shared   %lu\n", ksm_pages_shared);
+	seq_printf(m, "pages_sharing  %lu\n", ksm_pages_sharing);
+	seq_printf(m, "pages_unshared %lu\n", ksm_pages_unshared);
+	seq_printf(m, "full_scans     %lu\n", ksm_full_scans);
+	return 0;
+}
+
+struct seq_operations ksminfo_op = {
+	.start	= ksminfo_start,
+	.next	= ksminfo_next,
+	.stop	= ksminfo_stop,
+	.show	= ksminfo_show,
+};
+#endif /* CONFIG_PROC_FS */
+
+static int __init ksm_init(void)
+{
+	stable_node_cachep = kmem_cache_create("ksm_stable_node",
+			sizeof(struct stable_node), 0, SLAB_PANIC, NULL, NULL);
+	unstable_item_cachep = kmem_cache_create("ksm_unstable_item",
+			sizeof(struct unstable_item), 0, SLAB_PANIC, NULL, NULL);
+	kthread_run(ksmd, NULL, "ksmd");
+	return 0;
+}
+
+module_init(ksm_init)
@@ -9,6 +9,7 @@
 #include <linux/pagemap.h>
 #include <linux/syscalls.h>
 #include <linux/hugetlb.h>
+#include <linux/ksm.h>
 
 /*
  * We can potentially split a vm area into separate
@@ -18,8 +19,32 @@ static long madvise_behavior(struct vm_area_struct * vma, unsigned long start,
 			     unsigned long end, int behavior)
 {
 	struct mm_struct * mm = vma->vm_mm;
+	unsigned long new_flags = vma->vm_flags & ~VM_READHINTMASK;
 	int error = 0;
 
+	switch (behavior) {
+	case MADV_SEQUENTIAL:
+		new_flags |= VM_SEQ_READ;
+		break;
+	case MADV_RANDOM:
+		new_flags |= VM_RAND_READ;
+		break;
+#ifdef CONFIG_KSM
+	case MADV_MERGEABLE:
+	case MADV_UNMERGEABLE:
+		new_flags = vma->vm_flags;
+		error = ksm_madvise(vma, start, end, behavior, &new_flags);
+		if (error)
+			goto out;
+		break;
+#endif
+	default:
+		break;
+	}
+
+	if (new_flags == vma->vm_flags)
+		goto out;
+
 	if (start != vma->vm_start) {
 		error = split_vma(mm, vma, start, 1);
 		if (error)
@@ -33,20 +58,12 @@ static long madvise_behavior(struct vm_area_struct * vma, unsigned long start,
 	}
 
 	/*
-	 * vm_flags is protected by the mmap_sem held in write mode.
+	 * vm_flags is protected by the mmap_sem held in write mode,
+	 * and by vm_sequence from speculative faults.
 	 */
-	VM_ClearReadHint(vma);
-
-	switch (behavior) {
-	case MADV_SEQUENTIAL:
-		vma->vm_flags |= VM_SEQ_READ;
-		break;
-	case MADV_RANDOM:
-		vma->vm_flags |= VM_RAND_READ;
-		break;
-	default:
-		break;
-	}
+	vma_write_begin(vma);
+	vma->vm_flags = new_flags;
+	vma_write_end(vma);
 
 out:
 	if (error == -ENOMEM)
@@ -120,6 +137,10 @@ static long madvise_vma(struct vm_area_struct * vma, unsigned long start,
 	case MADV_NORMAL:
 	case MADV_SEQUENTIAL:
 	case MADV_RANDOM:
+#ifdef CONFIG_KSM
+	case MADV_MERGEABLE:
+	case MADV_UNMERGEABLE:
+#endif
 		error = madvise_behavior(vma, start, end, behavior);
 		break;
 
@@ -161,6 +182,9 @@ static long madvise_vma(struct vm_area_struct * vma, unsigned long start,
  *		some pages ahead.
  *  MADV_DONTNEED - the application is finished with the given range,
  *		so the kernel can free resources associated with it.
+ *  MADV_MERGEABLE - the range is likely to hold pages of the same
+ *		contents as others so marked: ksmd may merge them.
+ *  MADV_UNMERGEABLE - undo MADV_MERGEABLE, unsharing any merged pages.
  *
  * return values:
  *  zero    - success
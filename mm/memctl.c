@@ -0,0 +1,217 @@
+/*
+ * mm/memctl.c - memory controller for cpusets
+ *
+ * Each cpuset but the top one has a mem_group, which is charged for the
+ * page cache and anonymous pages its tasks bring in, and which may be
+ * given a limit through the cpuset's memory_limit_in_bytes file.  Page
+ * placement alone cannot keep one job from evicting another's working
+ * set when both share a node: a charge which would take a group over
+ * its limit first reclaims from that group's own pages, and fails only
+ * when they cannot be reclaimed.  The pages of other groups, and global
+ * reclaim, are left alone.
+ *
+ * Pages are charged to the cpuset of the task adding them to the page
+ * cache, or faulting them in as anonymous pages (zero fill, copy on
+ * write and swapin), and uncharged when they are freed.  A page stays
+ * charged to its group when its task moves to another cpuset, and keeps
+ * the group alive after its cpuset is removed.
+ *
+ * Kernel allocations are not charged, nor are transparent huge pages:
+ * tasks of a charged cpuset fault small pages instead, and khugepaged
+ * forgets the mm of a task which joins one.
+ *
+ * Each group keeps its pages on a list of its own in charge order.
+ * Reclaim takes them from the cold end and rotates them to the other,
+ * handing them to shrink_pages(), which takes them off whichever zone
+ * LRU list they are on: referenced pages go back to the active list and
+ * come round again later.  As in try_to_free_pages(), each pass which
+ * frees nothing lowers the priority, scanning more of the list next
+ * time and waiting for some writeback to complete in between; a charge
+ * fails only when a pass over the whole list frees nothing.
+ *
+ * The group lock nests inside everything: it is taken by the page
+ * freeing path, from any context.
+ */
+
+#include <linux/mm.h>
+#include <linux/memctl.h>
+#include <linux/blkdev.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/swap.h>
+
+/* Pages taken off a group's list at a time for reclaim */
+#define MEMCTL_RECLAIM_BATCH	SWAP_CLUSTER_MAX
+
+struct mem_group *mem_group_alloc(void)
+{
+	struct mem_group *mg;
+
+	mg = kmalloc(sizeof(*mg), GFP_KERNEL);
+	if (!mg)
+		return NULL;
+	spin_lock_init(&mg->lock);
+	mg->usage = 0;
+	mg->limit = MEM_GROUP_UNLIMITED;
+	mg->failcnt = 0;
+	INIT_LIST_HEAD(&mg->pages);
+	atomic_set(&mg->count, 1);
+	return mg;
+}
+
+void mem_group_put(struct mem_group *mg)
+{
+	if (atomic_dec_and_test(&mg->count))
+		kfree(mg);
+}
+
+/*
+ * One reclaim pass over @mg's pages: scan usage >> @priority of them, a
+ * batch at a time, until a batch worth has been freed.  Returns the
+ * number freed.
+ */
+static int mem_group_reclaim(struct mem_group *mg, unsigned int gfp_mask,
+			     int priority)
+{
+	struct page *pages[MEMCTL_RECLAIM_BATCH];
+	unsigned long flags;
+	unsigned long scan;
+	int nr_freed = 0;
+
+	scan = max(mg->usage >> priority, (unsigned long)MEMCTL_RECLAIM_BATCH);
+	while (scan && nr_freed < MEMCTL_RECLAIM_BATCH) {
+		int nr_pages = 0;
+
+		spin_lock_irqsave(&mg->lock, flags);
+		/* Each page is seen once: they are rotated as they are taken */
+		if (scan > mg->usage)
+			scan = mg->usage;
+		while (scan && nr_pages < MEMCTL_RECLAIM_BATCH) {
+			struct page *page;
+
+			scan--;
+			page = list_entry(mg->pages.prev, struct page, mem_lru);
+			list_move(&page->mem_lru, &mg->pages);
+			if (get_page_testone(page)) {
+				/* It is being freed, and will be uncharged */
+				__put_page(page);
+				continue;
+			}
+			pages[nr_pages++] = page;
+		}
+		spin_unlock_irqrestore(&mg->lock, flags);
+
+		if (nr_pages)
+			nr_freed += shrink_pages(pages, nr_pages, gfp_mask,
+						 priority);
+	}
+	return nr_freed;
+}
+
+/**
+ * memctl_charge - charge a page to the current task's cpuset
+ * @page: the page, which nobody else can charge meanwhile
+ * @gfp_mask: what reclaim may do to make room for it
+ *
+ * Reclaims from the group first if it is at its limit.  Returns 0 if
+ * the page is charged (or was already, or the task's cpuset is not
+ * charged at all), or -ENOMEM if the group has no room for it.
+ */
+int memctl_charge(struct page *page, unsigned int gfp_mask)
+{
+	struct mem_group *mg;
+	unsigned long flags;
+	int priority = DEF_PRIORITY;
+
+	if (page->mem_group)
+		return 0;
+	mg = cpuset_get_mem_group();
+	if (!mg)
+		return 0;
+
+	spin_lock_irqsave(&mg->lock, flags);
+	/*
+	 * Reclaim's own allocations go over the limit: they are what
+	 * bring it back under.
+	 */
+	while (mg->usage >= mg->limit && !(current->flags & PF_MEMALLOC)) {
+		if (!(gfp_mask & __GFP_WAIT) || priority < 0) {
+			mg->failcnt++;
+			spin_unlock_irqrestore(&mg->lock, flags);
+			mem_group_put(mg);
+			return -ENOMEM;
+		}
+		spin_unlock_irqrestore(&mg->lock, flags);
+		if (!mem_group_reclaim(mg, gfp_mask, priority)) {
+			/* Look harder, once some writeback has completed */
+			priority--;
+			blk_congestion_wait(WRITE, HZ/10);
+		}
+		spin_lock_irqsave(&mg->lock, flags);
+	}
+	mg->usage++;
+	list_add(&page->mem_lru, &mg->pages);
+	page->mem_group = mg;		/* Our reference is now the page's */
+	spin_unlock_irqrestore(&mg->lock, flags);
+	return 0;
+}
+
+/*
+ * Called by the page allocator as a charged page is freed.
+ */
+void __memctl_uncharge(struct page *page)
+{
+	struct mem_group *mg = page->mem_group;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mg->lock, flags);
+	list_del(&page->mem_lru);
+	mg->usage--;
+	spin_unlock_irqrestore(&mg->lock, flags);
+	page->mem_group = NULL;
+	mem_group_put(mg);
+}
+
+/*
+ * Migration replaces @page by @newpage: the charge goes with it.
+ */
+void memctl_migrate(struct page *page, struct page *newpage)
+{
+	struct mem_group *mg = page->mem_group;
+	unsigned long flags;
+
+	if (!mg)
+		return;
+	spin_lock_irqsave(&mg->lock, flags);
+	list_add(&newpage->mem_lru, &page->mem_lru);
+	list_del(&page->mem_lru);
+	newpage->mem_group = mg;
+	page->mem_group = NULL;
+	spin_unlock_irqrestore(&mg->lock, flags);
+}
+
+/**
+ * mem_group_set_limit - set the most pages a group may have charged
+ * @mg: the group
+ * @limit: the limit, in pages
+ *
+ * Reclaims the group down to a lowered limit as far as it can: charges
+ * reclaim whatever is left over.
+ */
+void mem_group_set_limit(struct mem_group *mg, unsigned long limit)
+{
+	unsigned long flags;
+	int priority = DEF_PRIORITY;
+
+	spin_lock_irqsave(&mg->lock, flags);
+	mg->limit = limit;
+	spin_unlock_irqrestore(&mg->lock, flags);
+
+	while (mg->usage > mg->limit && !signal_pending(current)) {
+		if (!mem_group_reclaim(mg, GFP_KERNEL, priority)) {
+			if (--priority < 0)
+				break;
+			blk_congestion_wait(WRITE, HZ/10);
+		}
+	}
+}
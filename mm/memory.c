@@ -46,6 +46,9 @@
 #include <linux/highmem.h>
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
+#include <linux/huge_mm.h>
+#include <linux/memctl.h>
+#include <linux/ksm.h>
 #include <linux/module.h>
 #include <linux/init.h>
 
@@ -119,6 +122,7 @@ static inline void clear_pte_range(struct mmu_gather *tlb, pmd_t *pmd,
 		pmd_clear(pmd);
 		dec_page_state(nr_page_table_pages);
 		tlb->mm->nr_ptes--;
+		pte_lock_deinit(page);
 		pte_free_tlb(tlb, page);
 	}
 }
@@ -193,29 +197,46 @@ void clear_page_range(struct mmu_gather *tlb,
 	} while (pgd++, addr = next, addr != end);
 }
 
+/*
+ * Allocate a page table page and install it under pmd.  Called without
+ * the page_table_lock, which is taken only to install the page.
+ */
+static int __pte_alloc(struct mm_struct *mm, pmd_t *pmd, unsigned long address)
+{
+	struct page *new;
+
+	new = pte_alloc_one(mm, address);
+	if (!new)
+		return -ENOMEM;
+	pte_lock_init(new);
+
+	spin_lock(&mm->page_table_lock);
+	/*
+	 * Somebody else may have populated the entry meanwhile.
+	 */
+	if (pmd_present(*pmd)) {
+		pte_lock_deinit(new);
+		pte_free(new);
+	} else {
+		mm->nr_ptes++;
+		inc_page_state(nr_page_table_pages);
+		pmd_populate(mm, pmd, new);
+	}
+	spin_unlock(&mm->page_table_lock);
+	return 0;
+}
+
 pte_t fastcall * pte_alloc_map(struct mm_struct *mm, pmd_t *pmd, unsigned long address)
 {
 	if (!pmd_present(*pmd)) {
-		struct page *new;
+		int err;
 
 		spin_unlock(&mm->page_table_lock);
-		new = pte_alloc_one(mm, address);
+		err = __pte_alloc(mm, pmd, address);
 		spin_lock(&mm->page_table_lock);
-		if (!new)
+		if (err)
 			return NULL;
-		/*
-		 * Because we dropped the lock, we should re-check the
-		 * entry, as somebody else could have populated it..
-		 */
-		if (pmd_present(*pmd)) {
-			pte_free(new);
-			goto out;
-		}
-		mm->nr_ptes++;
-		inc_page_state(nr_page_table_pages);
-		pmd_populate(mm, pmd, new);
 	}
-out:
 	return pte_offset_map(pmd, address);
 }
 
@@ -256,7 +277,7 @@ out:
 static inline void
 copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pte_t *dst_pte, pte_t *src_pte, unsigned long vm_flags,
-		unsigned long addr)
+		unsigned long addr, int *rss, int *anon_rss)
 {
 	pte_t pte = *src_pte;
 	struct page *page;
@@ -265,13 +286,26 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	/* pte contains position in swap or file, so copy. */
 	if (unlikely(!pte_present(pte))) {
 		if (!pte_file(pte)) {
-			swap_duplicate(pte_to_swp_entry(pte));
+			swp_entry_t entry = pte_to_swp_entry(pte);
+
+			swap_duplicate(entry);
 			/* make sure dst_mm is on swapoff's mmlist. */
 			if (unlikely(list_empty(&dst_mm->mmlist))) {
 				spin_lock(&mmlist_lock);
 				list_add(&dst_mm->mmlist, &src_mm->mmlist);
 				spin_unlock(&mmlist_lock);
 			}
+			/*
+			 * A page under migration in a COW mapping must come
+			 * back write protected in both parent and child.
+			 */
+			if (is_write_migration_entry(entry) &&
+			    (vm_flags & (VM_SHARED | VM_MAYWRITE)) ==
+							VM_MAYWRITE) {
+				make_migration_entry_read(&entry);
+				pte = swp_entry_to_pte(entry);
+				set_pte_at(src_mm, addr, src_pte, pte);
+			}
 		}
 		set_pte_at(dst_mm, addr, dst_pte, pte);
 		return;
@@ -309,9 +343,9 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pte = pte_mkclean(pte);
 	pte = pte_mkold(pte);
 	get_page(page);
-	inc_mm_counter(dst_mm, rss);
+	(*rss)++;
 	if (PageAnon(page))
-		inc_mm_counter(dst_mm, anon_rss);
+		(*anon_rss)++;
 	set_pte_at(dst_mm, addr, dst_pte, pte);
 	page_dup_rmap(page);
 }
@@ -323,8 +357,10 @@ static int copy_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	pte_t *src_pte, *dst_pte;
 	unsigned long vm_flags = vma->vm_flags;
 	int progress;
+	int rss, anon_rss;
 
 again:
+	rss = anon_rss = 0;
 	dst_pte = pte_alloc_map(dst_mm, dst_pmd, addr);
 	if (!dst_pte)
 		return -ENOMEM;
@@ -345,10 +381,14 @@ again:
 			progress++;
 			continue;
 		}
-		copy_one_pte(dst_mm, src_mm, dst_pte, src_pte, vm_flags, addr);
+		copy_one_pte(dst_mm, src_mm, dst_pte, src_pte, vm_flags, addr,
+			     &rss, &anon_rss);
 		progress += 8;
 	} while (dst_pte++, src_pte++, addr += PAGE_SIZE, addr != end);
 	spin_unlock(&src_mm->page_table_lock);
+	/* The child's counters are atomic with split ptlocks: batch them */
+	add_mm_counter(dst_mm, rss, rss);
+	add_mm_counter(dst_mm, anon_rss, anon_rss);
 
 	pte_unmap_nested(src_pte - 1);
 	pte_unmap(dst_pte - 1);
@@ -358,12 +398,60 @@ again:
 	return 0;
 }
 
+/*
+ * Can a fault in the child fill in this vma's ptes as well as fork
+ * copying them would?  Not hugetlb ones, nor nonlinear ones, which a
+ * fault does not know where to find, nor those of a reserved vma,
+ * which map pages set up by remap_pfn_range and the like.
+ */
+static inline int vma_refillable(struct vm_area_struct *vma)
+{
+	return !(vma->vm_flags & (VM_HUGETLB | VM_NONLINEAR | VM_RESERVED));
+}
+
+/*
+ * Can the ptes from @addr to @end of a refillable file vma be left for
+ * the child to fault in?  Yes if they map nothing but page cache pages:
+ * copied-on-write pages and their swap entries are to be found nowhere
+ * else.  Only the parent's faults could add those meanwhile, and it
+ * holds mmap_sem for writing.
+ */
+static int pte_range_refillable(struct mm_struct *mm, pmd_t *pmd,
+				unsigned long addr, unsigned long end)
+{
+	pte_t *pte;
+	spinlock_t *ptl;
+	int ret = 1;
+	int i;
+
+	pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	for (i = 0; addr != end; i++, addr += PAGE_SIZE) {
+		pte_t ptent = pte[i];
+		unsigned long pfn;
+
+		if (pte_none(ptent))
+			continue;
+		if (!pte_present(ptent)) {
+			ret = 0;
+			break;
+		}
+		pfn = pte_pfn(ptent);
+		if (!pfn_valid(pfn) || PageAnon(pfn_to_page(pfn))) {
+			ret = 0;
+			break;
+		}
+	}
+	pte_unmap_unlock(pte, ptl);
+	return ret;
+}
+
 static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pud_t *dst_pud, pud_t *src_pud, struct vm_area_struct *vma,
 		unsigned long addr, unsigned long end)
 {
 	pmd_t *src_pmd, *dst_pmd;
 	unsigned long next;
+	int lazy = vma->vm_file && vma_refillable(vma);
 
 	dst_pmd = pmd_alloc(dst_mm, dst_pud, addr);
 	if (!dst_pmd)
@@ -371,8 +459,17 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 	src_pmd = pmd_offset(src_pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		/* Split by reclaim meanwhile: copy its ptes then */
+		if (pmd_trans_huge(*src_pmd) &&
+		    !copy_huge_pmd(dst_mm, src_mm, dst_pmd, src_pmd))
+			continue;
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
+		if (lazy && pte_range_refillable(src_mm, src_pmd, addr, next)) {
+			inc_page_state(fork_ptable_skip);
+			continue;
+		}
+		inc_page_state(fork_ptable_copy);
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
 						vma, addr, next))
 			return -ENOMEM;
@@ -410,6 +507,19 @@ int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	unsigned long addr = vma->vm_start;
 	unsigned long end = vma->vm_end;
 
+	/*
+	 * Don't copy ptes where a page fault will fill them in correctly:
+	 * fork gets much lighter when there are big file mappings, shared
+	 * or private and unwritten, though faulting is slower than copying
+	 * if the child goes on to touch them all.  Where a private file
+	 * mapping has pages copied on write, the page tables mapping none
+	 * of them are still left: see copy_pmd_range.
+	 */
+	if (vma_refillable(vma) && !vma->anon_vma) {
+		inc_page_state(fork_vma_skip);
+		return 0;
+	}
+
 	if (is_vm_hugetlb_page(vma))
 		return copy_hugetlb_page_range(dst_mm, src_mm, vma);
 
@@ -431,7 +541,9 @@ static void zap_pte_range(struct mmu_gather *tlb, pmd_t *pmd,
 				struct zap_details *details)
 {
 	pte_t *pte;
+	spinlock_t *ptl;
 
+	ptl = pte_ptl_lock(tlb->mm, pmd);
 	pte = pte_offset_map(pmd, addr);
 	do {
 		pte_t ptent = *pte;
@@ -494,6 +606,7 @@ static void zap_pte_range(struct mmu_gather *tlb, pmd_t *pmd,
 		pte_clear(tlb->mm, addr, pte);
 	} while (pte++, addr += PAGE_SIZE, addr != end);
 	pte_unmap(pte - 1);
+	pte_ptl_unlock(ptl);
 }
 
 static inline void zap_pmd_range(struct mmu_gather *tlb, pud_t *pud,
@@ -506,6 +619,15 @@ static inline void zap_pmd_range(struct mmu_gather *tlb, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pmd_trans_huge(*pmd)) {
+			/*
+			 * Only partly covered if zap_page_range could not
+			 * split it: leave it be then, madvise is advisory.
+			 */
+			if (next - addr == PMD_SIZE)
+				zap_huge_pmd(tlb, pmd);
+			continue;
+		}
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		zap_pte_range(tlb, pmd, addr, next, details);
@@ -572,8 +694,11 @@ static void unmap_page_range(struct mmu_gather *tlb, struct vm_area_struct *vma,
  * Unmap all pages in the vma list.  Called under page_table_lock.
  *
  * We aim to not hold page_table_lock for too long (for scheduling latency
- * reasons).  So zap pages in ZAP_BLOCK_SIZE bytecounts.  This means we need to
- * return the ending mmu_gather to the caller.
+ * reasons).  So zap pages in ZAP_BLOCK_SIZE bytecounts, checking between them
+ * whether to drop the lock.  This means we need to return the ending
+ * mmu_gather to the caller.  The gather is only finished, and the TLBs
+ * flushed, when the lock is dropped: it flushes itself when it fills, and
+ * otherwise a small block size would cost a flush IPI every few pages.
  *
  * Only addresses between `start' and `end' will be unmapped.
  *
@@ -624,6 +749,8 @@ int unmap_vmas(struct mmu_gather **tlbp, struct mm_struct *mm,
 				unmap_hugepage_range(vma, start, end);
 			} else {
 				block = min(zap_bytes, end - start);
+				block = huge_pmd_block_end(vma, start + block,
+							end) - start;
 				unmap_page_range(*tlbp, vma, start,
 						start + block, details);
 			}
@@ -632,26 +759,26 @@ int unmap_vmas(struct mmu_gather **tlbp, struct mm_struct *mm,
 			zap_bytes -= block;
 			if ((long)zap_bytes > 0)
 				continue;
+			zap_bytes = ZAP_BLOCK_SIZE;
 
-			tlb_finish_mmu(*tlbp, tlb_start, start);
+			if (!need_resched() &&
+			    !need_lockbreak(&mm->page_table_lock) &&
+			    !(i_mmap_lock && need_lockbreak(i_mmap_lock)))
+				continue;
 
-			if (need_resched() ||
-				need_lockbreak(&mm->page_table_lock) ||
-				(i_mmap_lock && need_lockbreak(i_mmap_lock))) {
-				if (i_mmap_lock) {
-					/* must reset count of rss freed */
-					*tlbp = tlb_gather_mmu(mm, fullmm);
-					details->break_addr = start;
-					goto out;
-				}
-				spin_unlock(&mm->page_table_lock);
-				cond_resched();
-				spin_lock(&mm->page_table_lock);
+			tlb_finish_mmu(*tlbp, tlb_start, start);
+			if (i_mmap_lock) {
+				/* must reset count of rss freed */
+				*tlbp = tlb_gather_mmu(mm, fullmm);
+				details->break_addr = start;
+				goto out;
 			}
+			spin_unlock(&mm->page_table_lock);
+			cond_resched();
+			spin_lock(&mm->page_table_lock);
 
 			*tlbp = tlb_gather_mmu(mm, fullmm);
 			tlb_start_valid = 0;
-			zap_bytes = ZAP_BLOCK_SIZE;
 		}
 	}
 out:
@@ -678,6 +805,10 @@ void zap_page_range(struct vm_area_struct *vma, unsigned long address,
 		return;
 	}
 
+	/* Huge pmds are only ever zapped whole */
+	split_huge_pmd_address(vma, address);
+	split_huge_pmd_address(vma, end);
+
 	lru_add_drain();
 	spin_lock(&mm->page_table_lock);
 	tlb = tlb_gather_mmu(mm, 0);
@@ -688,21 +819,28 @@ void zap_page_range(struct vm_area_struct *vma, unsigned long address,
 
 /*
  * Do a quick page-table lookup for a single page.
- * mm->page_table_lock must be held.
+ * mm->page_table_lock must be held.  If get is set, a reference is
+ * taken on the page while its pte is still locked: a racing COW fault
+ * might otherwise free it between the lookup and the caller's get_page.
  */
 static struct page *
-__follow_page(struct mm_struct *mm, unsigned long address, int read, int write)
+__follow_page(struct mm_struct *mm, unsigned long address, int read, int write,
+		int get)
 {
 	pgd_t *pgd;
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *ptep, pte;
+	spinlock_t *ptl;
 	unsigned long pfn;
 	struct page *page;
 
 	page = follow_huge_addr(mm, address, write);
-	if (! IS_ERR(page))
+	if (! IS_ERR(page)) {
+		if (page && get && !PageReserved(page))
+			page_cache_get(page);
 		return page;
+	}
 
 	pgd = pgd_offset(mm, address);
 	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
@@ -713,31 +851,44 @@ __follow_page(struct mm_struct *mm, unsigned long address, int read, int write)
 		goto out;
 	
 	pmd = pmd_offset(pud, address);
+	if (pmd_trans_huge(*pmd)) {
+		page = follow_huge_anon_pmd(mm, address, pmd, write);
+		if (page && get)
+			page_cache_get(page);
+		return page;
+	}
 	if (pmd_none(*pmd) || unlikely(pmd_bad(*pmd)))
 		goto out;
-	if (pmd_huge(*pmd))
-		return follow_huge_pmd(mm, address, pmd, write);
+	if (pmd_huge(*pmd)) {
+		page = follow_huge_pmd(mm, address, pmd, write);
+		if (page && get && !PageReserved(page))
+			page_cache_get(page);
+		return page;
+	}
 
+	ptl = pte_ptl_lock(mm, pmd);
 	ptep = pte_offset_map(pmd, address);
-	if (!ptep)
-		goto out;
-
 	pte = *ptep;
-	pte_unmap(ptep);
+	page = NULL;
 	if (pte_present(pte)) {
 		if (write && !pte_write(pte))
-			goto out;
+			goto unlock;
 		if (read && !pte_read(pte))
-			goto out;
+			goto unlock;
 		pfn = pte_pfn(pte);
 		if (pfn_valid(pfn)) {
 			page = pfn_to_page(pfn);
 			if (write && !pte_dirty(pte) && !PageDirty(page))
 				set_page_dirty(page);
 			mark_page_accessed(page);
-			return page;
+			if (get && !PageReserved(page))
+				page_cache_get(page);
 		}
 	}
+unlock:
+	pte_unmap(ptep);
+	pte_ptl_unlock(ptl);
+	return page;
 
 out:
 	return NULL;
@@ -746,30 +897,26 @@ out:
 struct page *
 follow_page(struct mm_struct *mm, unsigned long address, int write)
 {
-	return __follow_page(mm, address, /*read*/0, write);
+	return __follow_page(mm, address, /*read*/0, write, /*get*/0);
+}
+
+/*
+ * As follow_page, but with a reference taken on the page for the caller.
+ */
+struct page *
+follow_page_get(struct mm_struct *mm, unsigned long address)
+{
+	return __follow_page(mm, address, /*read*/0, /*write*/0, /*get*/1);
 }
 
 int
 check_user_page_readable(struct mm_struct *mm, unsigned long address)
 {
-	return __follow_page(mm, address, /*read*/1, /*write*/0) != NULL;
+	return __follow_page(mm, address, /*read*/1, /*write*/0, /*get*/0) != NULL;
 }
 
 EXPORT_SYMBOL(check_user_page_readable);
 
-/* 
- * Given a physical address, is there a useful struct page pointing to
- * it?  This may become more complex in the future if we start dealing
- * with IO-aperture pages for direct-IO.
- */
-
-static inline struct page *get_page_map(struct page *page)
-{
-	if (!pfn_valid(page_to_pfn(page)))
-		return NULL;
-	return page;
-}
-
 
 static inline int
 untouched_anonymous_page(struct mm_struct* mm, struct vm_area_struct *vma,
@@ -869,7 +1016,8 @@ int get_user_pages(struct task_struct *tsk, struct mm_struct *mm,
 			int lookup_write = write;
 
 			cond_resched_lock(&mm->page_table_lock);
-			while (!(map = follow_page(mm, start, lookup_write))) {
+			while (!(map = __follow_page(mm, start, /*read*/0,
+					lookup_write, /*get*/pages != NULL))) {
 				/*
 				 * Shortcut for anonymous pages. We don't want
 				 * to force the creation of pages tables for
@@ -908,17 +1056,9 @@ int get_user_pages(struct task_struct *tsk, struct mm_struct *mm,
 				spin_lock(&mm->page_table_lock);
 			}
 			if (pages) {
-				pages[i] = get_page_map(map);
-				if (!pages[i]) {
-					spin_unlock(&mm->page_table_lock);
-					while (i--)
-						page_cache_release(pages[i]);
-					i = -EFAULT;
-					goto out;
-				}
+				/* __follow_page took the reference */
+				pages[i] = map;
 				flush_dcache_page(pages[i]);
-				if (!PageReserved(pages[i]))
-					page_cache_get(pages[i]);
 			}
 			if (vmas)
 				vmas[i] = vma;
@@ -928,7 +1068,6 @@ int get_user_pages(struct task_struct *tsk, struct mm_struct *mm,
 		} while(len && start < vma->vm_end);
 		spin_unlock(&mm->page_table_lock);
 	} while(len);
-out:
 	return i;
 }
 
@@ -938,15 +1077,18 @@ static int zeromap_pte_range(struct mm_struct *mm, pmd_t *pmd,
 			unsigned long addr, unsigned long end, pgprot_t prot)
 {
 	pte_t *pte;
+	spinlock_t *ptl;
 
 	pte = pte_alloc_map(mm, pmd, addr);
 	if (!pte)
 		return -ENOMEM;
+	ptl = pte_ptl_lock(mm, pmd);
 	do {
 		pte_t zero_pte = pte_wrprotect(mk_pte(ZERO_PAGE(addr), prot));
 		BUG_ON(!pte_none(*pte));
 		set_pte_at(mm, addr, pte, zero_pte);
 	} while (pte++, addr += PAGE_SIZE, addr != end);
+	pte_ptl_unlock(ptl);
 	pte_unmap(pte - 1);
 	return 0;
 }
@@ -1018,16 +1160,19 @@ static int remap_pte_range(struct mm_struct *mm, pmd_t *pmd,
 			unsigned long pfn, pgprot_t prot)
 {
 	pte_t *pte;
+	spinlock_t *ptl;
 
 	pte = pte_alloc_map(mm, pmd, addr);
 	if (!pte)
 		return -ENOMEM;
+	ptl = pte_ptl_lock(mm, pmd);
 	do {
 		BUG_ON(!pte_none(*pte));
 		if (!pfn_valid(pfn) || PageReserved(pfn_to_page(pfn)))
 			set_pte_at(mm, addr, pte, pfn_pte(pfn, prot));
 		pfn++;
 	} while (pte++, addr += PAGE_SIZE, addr != end);
+	pte_ptl_unlock(ptl);
 	pte_unmap(pte - 1);
 	return 0;
 }
@@ -1123,7 +1268,7 @@ static inline pte_t maybe_mkwrite(pte_t pte, struct vm_area_struct *vma)
 }
 
 /*
- * We hold the mm semaphore for reading and vma->vm_mm->page_table_lock
+ * We hold the mm semaphore for reading and the pte lock
  */
 static inline void break_cow(struct vm_area_struct * vma, struct page * new_page, unsigned long address, 
 		pte_t *page_table)
@@ -1154,11 +1299,12 @@ static inline void break_cow(struct vm_area_struct * vma, struct page * new_page
  * change only once the write actually happens. This avoids a few races,
  * and potentially makes it more efficient.
  *
- * We hold the mm semaphore and the page_table_lock on entry and exit
- * with the page_table_lock released.
+ * We hold the mm semaphore and the pte lock on entry and exit
+ * with the pte lock released.
  */
 static int do_wp_page(struct mm_struct *mm, struct vm_area_struct * vma,
-	unsigned long address, pte_t *page_table, pmd_t *pmd, pte_t pte)
+	unsigned long address, pte_t *page_table, pmd_t *pmd, spinlock_t *ptl,
+	pte_t pte)
 {
 	struct page *old_page, *new_page;
 	unsigned long pfn = pte_pfn(pte);
@@ -1170,15 +1316,15 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct * vma,
 		 * at least the kernel stops what it's doing before it corrupts
 		 * data, but for the moment just pretend this is OOM.
 		 */
-		pte_unmap(page_table);
+		pte_unmap_unlock(page_table, ptl);
 		printk(KERN_ERR "do_wp_page: bogus page at address %08lx\n",
 				address);
-		spin_unlock(&mm->page_table_lock);
 		return VM_FAULT_OOM;
 	}
 	old_page = pfn_to_page(pfn);
 
-	if (!TestSetPageLocked(old_page)) {
+	/* A KSM page is never written, however few map it now */
+	if (!PageKsm(old_page) && !TestSetPageLocked(old_page)) {
 		int reuse = can_share_swap_page(old_page);
 		unlock_page(old_page);
 		if (reuse) {
@@ -1188,19 +1334,17 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct * vma,
 			ptep_set_access_flags(vma, address, page_table, entry, 1);
 			update_mmu_cache(vma, address, entry);
 			lazy_mmu_prot_update(entry);
-			pte_unmap(page_table);
-			spin_unlock(&mm->page_table_lock);
+			pte_unmap_unlock(page_table, ptl);
 			return VM_FAULT_MINOR;
 		}
 	}
-	pte_unmap(page_table);
 
 	/*
 	 * Ok, we need to copy. Oh, well..
 	 */
 	if (!PageReserved(old_page))
 		page_cache_get(old_page);
-	spin_unlock(&mm->page_table_lock);
+	pte_unmap_unlock(page_table, ptl);
 
 	if (unlikely(anon_vma_prepare(vma)))
 		goto no_new_page;
@@ -1214,11 +1358,14 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct * vma,
 			goto no_new_page;
 		copy_user_highpage(new_page, old_page, address);
 	}
+	if (memctl_charge(new_page, GFP_HIGHUSER)) {
+		page_cache_release(new_page);
+		goto no_new_page;
+	}
 	/*
 	 * Re-check the pte - we dropped the lock
 	 */
-	spin_lock(&mm->page_table_lock);
-	page_table = pte_offset_map(pmd, address);
+	page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
 	if (likely(pte_same(*page_table, pte))) {
 		if (PageAnon(old_page))
 			dec_mm_counter(mm, anon_rss);
@@ -1234,10 +1381,9 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct * vma,
 		/* Free the old page.. */
 		new_page = old_page;
 	}
-	pte_unmap(page_table);
+	pte_unmap_unlock(page_table, ptl);
 	page_cache_release(new_page);
 	page_cache_release(old_page);
-	spin_unlock(&mm->page_table_lock);
 	return VM_FAULT_MINOR;
 
 no_new_page:
@@ -1564,38 +1710,105 @@ void swapin_readahead(swp_entry_t entry, unsigned long addr,struct vm_area_struc
 	lru_add_drain();	/* Push any new pages onto the LRU now */
 }
 
+#define SWAP_RA_MAX_PAGES	32
+
+/*
+ * Swap readahead for a fault: rather than neighbouring swap slots, read
+ * the swap entries found in the neighbouring ptes, an aligned block of
+ * (1 << page_cluster) pages around @address clipped to the vma.  This
+ * brings back the part of the address space the task is about to touch
+ * however its pages were laid out in swap; when swap-out clustering did
+ * its job the reads are sequential on disk as well.
+ *
+ * The block is at most SWAP_RA_MAX_PAGES and aligned, so it never
+ * crosses a page table page.  Caller holds down_read on mmap_sem.
+ */
+static void swapin_readahead_vma(struct vm_area_struct *vma, pmd_t *pmd,
+				unsigned long address)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	swp_entry_t entries[SWAP_RA_MAX_PAGES];
+	unsigned long addrs[SWAP_RA_MAX_PAGES];
+	unsigned long start, end, addr, window;
+	struct page *new_page;
+	pte_t *start_pte, *pte;
+	spinlock_t *ptl;
+	int i, nr = 0;
+
+	if (!page_cluster)	/* no readahead */
+		return;
+
+	window = min(1UL << page_cluster, (unsigned long)SWAP_RA_MAX_PAGES);
+	window <<= PAGE_SHIFT;
+	start = address & ~(window - 1);
+	end = start + window;
+	if (start < vma->vm_start)
+		start = vma->vm_start;
+	if (end - 1 > vma->vm_end - 1)
+		end = vma->vm_end;
+
+	start_pte = pte_offset_map_lock(mm, pmd, start, &ptl);
+	for (addr = start, pte = start_pte; addr != end;
+	     addr += PAGE_SIZE, pte++) {
+		pte_t ptent = *pte;
+		swp_entry_t entry;
+
+		if (pte_none(ptent) || pte_present(ptent) || pte_file(ptent))
+			continue;
+		entry = pte_to_swp_entry(ptent);
+		if (is_migration_entry(entry))
+			continue;
+		entries[nr] = entry;
+		addrs[nr] = addr;
+		nr++;
+	}
+	pte_unmap_unlock(start_pte, ptl);
+
+	for (i = 0; i < nr; i++) {
+		new_page = read_swap_cache_async(entries[i], vma, addrs[i]);
+		if (!new_page)
+			break;
+		page_cache_release(new_page);
+	}
+	lru_add_drain();	/* Push any new pages onto the LRU now */
+}
+
 /*
- * We hold the mm semaphore and the page_table_lock on entry and
- * should release the pagetable lock on exit..
+ * We hold the mm semaphore and the pte lock on entry and
+ * should release the pte lock on exit..
  */
 static int do_swap_page(struct mm_struct * mm,
 	struct vm_area_struct * vma, unsigned long address,
-	pte_t *page_table, pmd_t *pmd, pte_t orig_pte, int write_access)
+	pte_t *page_table, pmd_t *pmd, spinlock_t *ptl,
+	pte_t orig_pte, int write_access)
 {
 	struct page *page;
 	swp_entry_t entry = pte_to_swp_entry(orig_pte);
 	pte_t pte;
 	int ret = VM_FAULT_MINOR;
 
-	pte_unmap(page_table);
-	spin_unlock(&mm->page_table_lock);
+	if (is_migration_entry(entry)) {
+		migration_entry_wait(page_table, ptl, entry);
+		goto out;
+	}
+
+	pte_unmap_unlock(page_table, ptl);
 	page = lookup_swap_cache(entry);
 	if (!page) {
- 		swapin_readahead(entry, address, vma);
+		swapin_readahead_vma(vma, pmd, address);
  		page = read_swap_cache_async(entry, vma, address);
 		if (!page) {
 			/*
 			 * Back out if somebody else faulted in this pte while
 			 * we released the page table lock.
 			 */
-			spin_lock(&mm->page_table_lock);
-			page_table = pte_offset_map(pmd, address);
+			page_table = pte_offset_map_lock(mm, pmd, address,
+							 &ptl);
 			if (likely(pte_same(*page_table, orig_pte)))
 				ret = VM_FAULT_OOM;
 			else
 				ret = VM_FAULT_MINOR;
-			pte_unmap(page_table);
-			spin_unlock(&mm->page_table_lock);
+			pte_unmap_unlock(page_table, ptl);
 			goto out;
 		}
 
@@ -1607,16 +1820,20 @@ static int do_swap_page(struct mm_struct * mm,
 
 	mark_page_accessed(page);
 	lock_page(page);
+	if (memctl_charge(page, GFP_HIGHUSER)) {
+		unlock_page(page);
+		page_cache_release(page);
+		ret = VM_FAULT_OOM;
+		goto out;
+	}
 
 	/*
 	 * Back out if somebody else faulted in this pte while we
 	 * released the page table lock.
 	 */
-	spin_lock(&mm->page_table_lock);
-	page_table = pte_offset_map(pmd, address);
+	page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
 	if (unlikely(!pte_same(*page_table, orig_pte))) {
-		pte_unmap(page_table);
-		spin_unlock(&mm->page_table_lock);
+		pte_unmap_unlock(page_table, ptl);
 		unlock_page(page);
 		page_cache_release(page);
 		ret = VM_FAULT_MINOR;
@@ -1643,7 +1860,7 @@ static int do_swap_page(struct mm_struct * mm,
 
 	if (write_access) {
 		if (do_wp_page(mm, vma, address,
-				page_table, pmd, pte) == VM_FAULT_OOM)
+				page_table, pmd, ptl, pte) == VM_FAULT_OOM)
 			ret = VM_FAULT_OOM;
 		goto out;
 	}
@@ -1651,21 +1868,20 @@ static int do_swap_page(struct mm_struct * mm,
 	/* No need to invalidate - it was non-present before */
 	update_mmu_cache(vma, address, pte);
 	lazy_mmu_prot_update(pte);
-	pte_unmap(page_table);
-	spin_unlock(&mm->page_table_lock);
+	pte_unmap_unlock(page_table, ptl);
 out:
 	return ret;
 }
 
 /*
- * We are called with the MM semaphore and page_table_lock
- * spinlock held to protect against concurrent faults in
+ * We are called with the MM semaphore and the pte lock
+ * held to protect against concurrent faults in
  * multithreaded programs. 
  */
 static int
 do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
-		pte_t *page_table, pmd_t *pmd, int write_access,
-		unsigned long addr)
+		pte_t *page_table, pmd_t *pmd, spinlock_t *ptl,
+		int write_access, unsigned long addr)
 {
 	pte_t entry;
 	struct page * page = ZERO_PAGE(addr);
@@ -1676,22 +1892,23 @@ do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	/* ..except if it's a write access */
 	if (write_access) {
 		/* Allocate our own private page. */
-		pte_unmap(page_table);
-		spin_unlock(&mm->page_table_lock);
+		pte_unmap_unlock(page_table, ptl);
 
 		if (unlikely(anon_vma_prepare(vma)))
 			goto no_mem;
 		page = alloc_zeroed_user_highpage(vma, addr);
 		if (!page)
 			goto no_mem;
+		if (memctl_charge(page, GFP_HIGHUSER)) {
+			page_cache_release(page);
+			goto no_mem;
+		}
 
-		spin_lock(&mm->page_table_lock);
-		page_table = pte_offset_map(pmd, addr);
+		page_table = pte_offset_map_lock(mm, pmd, addr, &ptl);
 
 		if (!pte_none(*page_table)) {
-			pte_unmap(page_table);
+			pte_unmap_unlock(page_table, ptl);
 			page_cache_release(page);
-			spin_unlock(&mm->page_table_lock);
 			goto out;
 		}
 		inc_mm_counter(mm, rss);
@@ -1704,12 +1921,11 @@ do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	}
 
 	set_pte_at(mm, addr, page_table, entry);
-	pte_unmap(page_table);
 
 	/* No need to invalidate - it was non-present before */
 	update_mmu_cache(vma, addr, entry);
 	lazy_mmu_prot_update(entry);
-	spin_unlock(&mm->page_table_lock);
+	pte_unmap_unlock(page_table, ptl);
 out:
 	return VM_FAULT_MINOR;
 no_mem:
@@ -1725,12 +1941,13 @@ no_mem:
  * As this is called only for pages that do not currently exist, we
  * do not need to flush old virtual caches or the TLB.
  *
- * This is called with the MM semaphore held and the page table
- * spinlock held. Exit with the spinlock released.
+ * This is called with the MM semaphore held and the pte lock
+ * held. Exit with the pte lock released.
  */
 static int
 do_no_page(struct mm_struct *mm, struct vm_area_struct *vma,
-	unsigned long address, int write_access, pte_t *page_table, pmd_t *pmd)
+	unsigned long address, int write_access, pte_t *page_table, pmd_t *pmd,
+	spinlock_t *ptl)
 {
 	struct page * new_page;
 	struct address_space *mapping = NULL;
@@ -1741,9 +1958,8 @@ do_no_page(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	if (!vma->vm_ops || !vma->vm_ops->nopage)
 		return do_anonymous_page(mm, vma, page_table,
-					pmd, write_access, address);
-	pte_unmap(page_table);
-	spin_unlock(&mm->page_table_lock);
+					pmd, ptl, write_access, address);
+	pte_unmap_unlock(page_table, ptl);
 
 	if (vma->vm_file) {
 		mapping = vma->vm_file->f_mapping;
@@ -1778,13 +1994,17 @@ retry:
 		page = alloc_page_vma(GFP_HIGHUSER, vma, address);
 		if (!page)
 			goto oom;
+		if (memctl_charge(page, GFP_HIGHUSER)) {
+			page_cache_release(page);
+			goto oom;
+		}
 		copy_user_highpage(page, new_page, address);
 		page_cache_release(new_page);
 		new_page = page;
 		anon = 1;
 	}
 
-	spin_lock(&mm->page_table_lock);
+	page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
 	/*
 	 * For a file-backed vma, someone could have truncated or otherwise
 	 * invalidated this page.  If unmap_mapping_range got called,
@@ -1792,11 +2012,10 @@ retry:
 	 */
 	if (mapping && unlikely(sequence != mapping->truncate_count)) {
 		sequence = mapping->truncate_count;
-		spin_unlock(&mm->page_table_lock);
+		pte_unmap_unlock(page_table, ptl);
 		page_cache_release(new_page);
 		goto retry;
 	}
-	page_table = pte_offset_map(pmd, address);
 
 	/*
 	 * This silly early PAGE_DIRTY setting removes a race
@@ -1823,19 +2042,17 @@ retry:
 			page_add_anon_rmap(new_page, vma, address);
 		} else
 			page_add_file_rmap(new_page);
-		pte_unmap(page_table);
 	} else {
 		/* One of our sibling threads was faster, back out. */
-		pte_unmap(page_table);
+		pte_unmap_unlock(page_table, ptl);
 		page_cache_release(new_page);
-		spin_unlock(&mm->page_table_lock);
 		goto out;
 	}
 
 	/* no need to invalidate: a not-present page shouldn't be cached */
 	update_mmu_cache(vma, address, entry);
 	lazy_mmu_prot_update(entry);
-	spin_unlock(&mm->page_table_lock);
+	pte_unmap_unlock(page_table, ptl);
 out:
 	return ret;
 oom:
@@ -1850,7 +2067,8 @@ oom:
  * nonlinear vmas.
  */
 static int do_file_page(struct mm_struct * mm, struct vm_area_struct * vma,
-	unsigned long address, int write_access, pte_t *pte, pmd_t *pmd)
+	unsigned long address, int write_access, pte_t *pte, pmd_t *pmd,
+	spinlock_t *ptl)
 {
 	unsigned long pgoff;
 	int err;
@@ -1863,13 +2081,13 @@ static int do_file_page(struct mm_struct * mm, struct vm_area_struct * vma,
 	if (!vma->vm_ops || !vma->vm_ops->populate || 
 			(write_access && !(vma->vm_flags & VM_SHARED))) {
 		pte_clear(mm, address, pte);
-		return do_no_page(mm, vma, address, write_access, pte, pmd);
+		return do_no_page(mm, vma, address, write_access, pte, pmd,
+				  ptl);
 	}
 
 	pgoff = pte_to_pgoff(*pte);
 
-	pte_unmap(pte);
-	spin_unlock(&mm->page_table_lock);
+	pte_unmap_unlock(pte, ptl);
 
 	err = vma->vm_ops->populate(vma, address & PAGE_MASK, PAGE_SIZE, vma->vm_page_prot, pgoff, 0);
 	if (err == -ENOMEM)
@@ -1888,21 +2106,22 @@ static int do_file_page(struct mm_struct * mm, struct vm_area_struct * vma,
  * with external mmu caches can use to update those (ie the Sparc or
  * PowerPC hashed page tables that act as extended TLBs).
  *
- * Note the "page_table_lock". It is to protect against kswapd removing
- * pages from under us. Note that kswapd only ever _removes_ pages, never
- * adds them. As such, once we have noticed that the page is not present,
- * we can drop the lock early.
+ * Note the pte lock (see pte_lockptr: the page_table_lock, or a lock
+ * per page table page on larger SMP). It is to protect against kswapd
+ * removing pages from under us. Note that kswapd only ever _removes_
+ * pages, never adds them. As such, once we have noticed that the page
+ * is not present, we can drop the lock early.
  *
  * The adding of pages is protected by the MM semaphore (which we hold),
  * so we don't need to worry about a page being suddenly been added into
  * our VM.
  *
- * We enter with the pagetable spinlock held, we are supposed to
+ * We enter with the pte lock held, we are supposed to
  * release it when done.
  */
 static inline int handle_pte_fault(struct mm_struct *mm,
 	struct vm_area_struct * vma, unsigned long address,
-	int write_access, pte_t *pte, pmd_t *pmd)
+	int write_access, pte_t *pte, pmd_t *pmd, spinlock_t *ptl)
 {
 	pte_t entry;
 
@@ -1914,15 +2133,19 @@ static inline int handle_pte_fault(struct mm_struct *mm,
 		 * drop the lock.
 		 */
 		if (pte_none(entry))
-			return do_no_page(mm, vma, address, write_access, pte, pmd);
+			return do_no_page(mm, vma, address, write_access,
+					  pte, pmd, ptl);
 		if (pte_file(entry))
-			return do_file_page(mm, vma, address, write_access, pte, pmd);
-		return do_swap_page(mm, vma, address, pte, pmd, entry, write_access);
+			return do_file_page(mm, vma, address, write_access,
+					    pte, pmd, ptl);
+		return do_swap_page(mm, vma, address, pte, pmd, ptl,
+				    entry, write_access);
 	}
 
 	if (write_access) {
 		if (!pte_write(entry))
-			return do_wp_page(mm, vma, address, pte, pmd, entry);
+			return do_wp_page(mm, vma, address, pte, pmd, ptl,
+					  entry);
 
 		entry = pte_mkdirty(entry);
 	}
@@ -1930,8 +2153,7 @@ static inline int handle_pte_fault(struct mm_struct *mm,
 	ptep_set_access_flags(vma, address, pte, entry, write_access);
 	update_mmu_cache(vma, address, entry);
 	lazy_mmu_prot_update(entry);
-	pte_unmap(pte);
-	spin_unlock(&mm->page_table_lock);
+	pte_unmap_unlock(pte, ptl);
 	return VM_FAULT_MINOR;
 }
 
@@ -1945,6 +2167,8 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct * vma,
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *pte;
+	spinlock_t *ptl;
+	int ret;
 
 	__set_current_state(TASK_RUNNING);
 
@@ -1954,31 +2178,195 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct * vma,
 		return VM_FAULT_SIGBUS;	/* mapping truncation does this. */
 
 	/*
-	 * We need the page table lock to synchronize with kswapd
-	 * and the SMP-safe atomic PTE updates.
+	 * Page tables are only freed with mmap_sem held for writing, so
+	 * we can walk down to the pte without the page_table_lock: it is
+	 * needed only to populate a missing level.  The pte lock then
+	 * synchronizes with kswapd and the SMP-safe atomic PTE updates.
+	 * A huge pmd may be split under us, but only ever into a page
+	 * table: do_huge_pmd_fault rechecks and sends us round again.
 	 */
+retry:
 	pgd = pgd_offset(mm, address);
-	spin_lock(&mm->page_table_lock);
+	if (unlikely(pgd_none(*pgd)))
+		goto populate;
+	pud = pud_offset(pgd, address);
+	if (unlikely(pud_none(*pud)))
+		goto populate;
+	pmd = pmd_offset(pud, address);
+	if (unlikely(!pmd_present(*pmd)))
+		goto populate;
+	if (pmd_trans_huge(*pmd)) {
+		ret = do_huge_pmd_fault(mm, vma, address, pmd, write_access);
+		if (ret != VM_FAULT_FALLBACK)
+			return ret;
+		goto retry;
+	}
+	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
+	return handle_pte_fault(mm, vma, address, write_access, pte, pmd, ptl);
 
+populate:
+	spin_lock(&mm->page_table_lock);
 	pud = pud_alloc(mm, pgd, address);
 	if (!pud)
 		goto oom;
-
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		goto oom;
-
-	pte = pte_alloc_map(mm, pmd, address);
-	if (!pte)
-		goto oom;
-	
-	return handle_pte_fault(mm, vma, address, write_access, pte, pmd);
+	spin_unlock(&mm->page_table_lock);
+	if (pmd_none(*pmd) && vma_huge_anon(vma)) {
+		ret = do_huge_anonymous_page(mm, vma, address, pmd,
+					     write_access);
+		if (ret != VM_FAULT_FALLBACK)
+			return ret;
+	}
+	if (!pmd_present(*pmd) && __pte_alloc(mm, pmd, address))
+		return VM_FAULT_OOM;
+	goto retry;
 
  oom:
 	spin_unlock(&mm->page_table_lock);
 	return VM_FAULT_OOM;
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Can a fault on this vma be handled speculatively?  Only the simplest
+ * kind: private anonymous memory, without a NUMA policy to look up.
+ */
+static inline int speculative_vma(struct vm_area_struct *vma, int write_access)
+{
+	if (vma->vm_ops || vma->vm_file || vma_policy(vma))
+		return 0;
+	if (vma->vm_flags & (VM_SHARED | VM_HUGETLB | VM_IO | VM_RESERVED |
+			     VM_GROWSDOWN | VM_GROWSUP))
+		return 0;
+	if (write_access)
+		return (vma->vm_flags & VM_WRITE) && vma->anon_vma;
+	return vma->vm_flags & (VM_READ | VM_EXEC);
+}
+
+/*
+ * handle_speculative_fault - fault in an anonymous page without mmap_sem
+ *
+ * Threads faulting in fresh memory while another thread holds mmap_sem
+ * for writing (in mmap, munmap or brk, say) would otherwise all queue
+ * behind it.  Here a fault on a pte_none pte of a private anonymous vma
+ * is handled on a copy of the vma found by find_vma_speculative, with
+ * interrupts disabled while walking the page tables: the architecture
+ * frees page tables only after a TLB flush IPI, which cannot complete
+ * meanwhile.  Once the pte lock is held, the vma's sequence count tells
+ * whether what the copy says still holds, and mm->fault_seq whether
+ * someone moving page tables around wants us out of the way; anyone
+ * changing the vma after that has to wait for the pte lock.
+ *
+ * Returns VM_FAULT_MINOR when the fault has been handled, and otherwise
+ * VM_FAULT_FALLBACK: the caller must then take mmap_sem and go through
+ * handle_mm_fault, which also decides whether the access is allowed.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+		int write_access)
+{
+	struct vm_area_struct copy, *vma;
+	struct page *page = NULL;
+	unsigned seq, fault_seq;
+	unsigned long flags;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t pmdval;
+	pte_t *pte, entry;
+	spinlock_t *ptl;
+
+again:
+	rcu_read_lock();
+	fault_seq = read_seqcount_begin(&mm->fault_seq);
+	if (fault_seq & 1)
+		goto out_rcu;
+	vma = find_vma_speculative(mm, address, &copy, &seq);
+	if (!vma || !speculative_vma(&copy, write_access))
+		goto out_rcu;
+
+	local_irq_save(flags);
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		goto out_irq;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		goto out_irq;
+	/* Work on a copy of the pmd: it may be cleared under us */
+	pmdval = *pmd_offset(pud, address);
+	barrier();
+	if (!pmd_present(pmdval) || pmd_trans_huge(pmdval))
+		goto out_irq;
+
+	pte = pte_offset_map(&pmdval, address);
+	if (!pte_none(*pte))
+		goto out_unmap;
+
+	if (write_access && !page) {
+		pte_unmap(pte);
+		local_irq_restore(flags);
+		rcu_read_unlock();
+		page = alloc_zeroed_user_highpage(&copy, address);
+		if (!page)
+			return VM_FAULT_FALLBACK;
+		if (memctl_charge(page, GFP_HIGHUSER)) {
+			page_cache_release(page);
+			return VM_FAULT_FALLBACK;
+		}
+		goto again;
+	}
+
+	/*
+	 * Spinning here with interrupts disabled could deadlock against
+	 * a lock holder waiting for us to take its TLB flush IPI.
+	 */
+	ptl = pte_lockptr(mm, &pmdval);
+	if (!spin_trylock(ptl))
+		goto out_unmap;
+	if (read_seqcount_retry(&vma->vm_sequence, seq) ||
+	    read_seqcount_retry(&mm->fault_seq, fault_seq) ||
+	    !pte_none(*pte))
+		goto out_unlock;
+	local_irq_restore(flags);
+
+	if (write_access) {
+		inc_mm_counter(mm, rss);
+		entry = maybe_mkwrite(pte_mkdirty(mk_pte(page,
+							 copy.vm_page_prot)),
+				      &copy);
+		lru_cache_add_active(page);
+		SetPageReferenced(page);
+		page_add_anon_rmap(page, &copy, address);
+	} else
+		entry = pte_wrprotect(mk_pte(ZERO_PAGE(address),
+					     copy.vm_page_prot));
+
+	set_pte_at(mm, address, pte, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(&copy, address, entry);
+	lazy_mmu_prot_update(entry);
+	pte_unmap_unlock(pte, ptl);
+	rcu_read_unlock();
+
+	inc_page_state(pgfault);
+	inc_page_state(pgspecfault);
+	return VM_FAULT_MINOR;
+
+out_unlock:
+	spin_unlock(ptl);
+out_unmap:
+	pte_unmap(pte);
+out_irq:
+	local_irq_restore(flags);
+out_rcu:
+	rcu_read_unlock();
+	if (page)
+		page_cache_release(page);
+	return VM_FAULT_FALLBACK;
+}
+#endif
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -63,6 +63,7 @@
 #include <linux/mm.h>
 #include <linux/highmem.h>
 #include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
 #include <linux/kernel.h>
 #include <linux/sched.h>
 #include <linux/mm.h>
@@ -76,6 +77,9 @@
 #include <linux/init.h>
 #include <linux/compat.h>
 #include <linux/mempolicy.h>
+#include <linux/migrate.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
 #include <asm/tlbflush.h>
 #include <asm/uaccess.h>
 
@@ -84,6 +88,9 @@ static kmem_cache_t *sn_cache;
 
 #define PDprintk(fmt...)
 
+/* Internal flags */
+#define MPOL_MF_INVERT	(MPOL_MF_INTERNAL << 0)	/* Invert check for nodemask */
+
 /* Highest zone. An specific allocation for a zone below that is not
    policied. */
 static int policy_zone;
@@ -237,17 +244,45 @@ static struct mempolicy *mpol_new(int mode, unsigned long *nodes)
 	return policy;
 }
 
-/* Ensure all existing pages follow the policy. */
+/* Does a page on @nid fail the check against @nodes? */
+static inline int misplaced_node(int nid, unsigned long *nodes,
+				unsigned long flags)
+{
+	return !test_bit(nid, nodes) == !(flags & MPOL_MF_INVERT);
+}
+
+/*
+ * Queue a misplaced page for migration.  Unless all pages are to be
+ * moved, leave alone the pages we share with other processes.
+ */
+static void migrate_page_add(struct page *page, struct list_head *pagelist,
+				unsigned long flags)
+{
+	if ((flags & MPOL_MF_MOVE_ALL) || page_mapcount(page) == 1)
+		isolate_lru_page(page, pagelist);
+}
+
+/*
+ * Ensure all existing pages follow the policy: check that the pages of
+ * the range lie on @nodes (with MPOL_MF_INVERT, that none of them does).
+ * With MPOL_MF_MOVE or MPOL_MF_MOVE_ALL the pages which do not are put
+ * on @pagelist for migration, else they fail the check.
+ */
 static int
-verify_pages(struct mm_struct *mm,
-	     unsigned long addr, unsigned long end, unsigned long *nodes)
+check_pages(struct vm_area_struct *vma, unsigned long addr, unsigned long end,
+	    unsigned long *nodes, unsigned long flags,
+	    struct list_head *pagelist)
 {
+	struct mm_struct *mm = vma->vm_mm;
+
 	while (addr < end) {
 		struct page *p;
+		spinlock_t *ptl;
 		pte_t *pte;
 		pmd_t *pmd;
 		pud_t *pud;
 		pgd_t *pgd;
+		int err = 0;
 		pgd = pgd_offset(mm, addr);
 		if (pgd_none(*pgd)) {
 			unsigned long next = (addr + PGDIR_SIZE) & PGDIR_MASK;
@@ -266,16 +301,29 @@ verify_pages(struct mm_struct *mm,
 			addr = (addr + PMD_SIZE) & PMD_MASK;
 			continue;
 		}
+		if (pmd_trans_huge(*pmd)) {
+			/* A huge page lies on a single node, and stays there */
+			p = huge_pmd_page(*pmd);
+			if (misplaced_node(page_to_nid(p), nodes, flags) &&
+			    (flags & MPOL_MF_STRICT))
+				return -EIO;
+			addr = (addr + PMD_SIZE) & PMD_MASK;
+			continue;
+		}
 		p = NULL;
-		pte = pte_offset_map(pmd, addr);
-		if (pte_present(*pte))
+		pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+		if (pte_present(*pte) && pfn_valid(pte_pfn(*pte)))
 			p = pte_page(*pte);
-		pte_unmap(pte);
-		if (p) {
-			unsigned nid = page_to_nid(p);
-			if (!test_bit(nid, nodes))
-				return -EIO;
+		if (p && !PageReserved(p) &&
+		    misplaced_node(page_to_nid(p), nodes, flags)) {
+			if (flags & (MPOL_MF_MOVE|MPOL_MF_MOVE_ALL))
+				migrate_page_add(p, pagelist, flags);
+			else
+				err = -EIO;
 		}
+		pte_unmap_unlock(pte, ptl);
+		if (err)
+			return err;
 		addr += PAGE_SIZE;
 	}
 	return 0;
@@ -284,7 +332,8 @@ verify_pages(struct mm_struct *mm,
 /* Step 1: check the range */
 static struct vm_area_struct *
 check_range(struct mm_struct *mm, unsigned long start, unsigned long end,
-	    unsigned long *nodes, unsigned long flags)
+	    unsigned long *nodes, unsigned long flags,
+	    struct list_head *pagelist)
 {
 	int err;
 	struct vm_area_struct *first, *vma, *prev;
@@ -298,9 +347,11 @@ check_range(struct mm_struct *mm, unsigned long start, unsigned long end,
 			return ERR_PTR(-EFAULT);
 		if (prev && prev->vm_end < vma->vm_start)
 			return ERR_PTR(-EFAULT);
-		if ((flags & MPOL_MF_STRICT) && !is_vm_hugetlb_page(vma)) {
-			err = verify_pages(vma->vm_mm,
-					   vma->vm_start, vma->vm_end, nodes);
+		if ((flags & (MPOL_MF_STRICT|MPOL_MF_MOVE|MPOL_MF_MOVE_ALL)) &&
+		    !is_vm_hugetlb_page(vma)) {
+			err = check_pages(vma, max(start, vma->vm_start),
+					  min(end, vma->vm_end), nodes, flags,
+					  pagelist);
 			if (err) {
 				first = ERR_PTR(err);
 				break;
@@ -354,6 +405,27 @@ static int mbind_range(struct vm_area_struct *vma, unsigned long start,
 	return err;
 }
 
+/*
+ * Allocate the page a misplaced page is moved to by mbind, following
+ * the new policy of the vma which maps it.  @private is the first vma
+ * of the range.
+ */
+static struct page *new_vma_page(struct page *page, unsigned long private)
+{
+	struct vm_area_struct *vma = (struct vm_area_struct *)private;
+	unsigned long address = 0;
+
+	while (vma) {
+		address = page_address_in_vma(page, vma);
+		if (address != -EFAULT)
+			break;
+		vma = vma->vm_next;
+	}
+	if (!vma)
+		address = 0;	/* fall back on the process policy */
+	return alloc_page_vma(migrate_gfp_mask(page), vma, address);
+}
+
 /* Change policy for a memory range */
 asmlinkage long sys_mbind(unsigned long start, unsigned long len,
 			  unsigned long mode,
@@ -365,14 +437,18 @@ asmlinkage long sys_mbind(unsigned long start, unsigned long len,
 	struct mempolicy *new;
 	unsigned long end;
 	DECLARE_BITMAP(nodes, MAX_NUMNODES);
+	LIST_HEAD(pagelist);
 	int err;
 
-	if ((flags & ~(unsigned long)(MPOL_MF_STRICT)) || mode > MPOL_MAX)
+	if ((flags & ~(unsigned long)(MPOL_MF_STRICT|MPOL_MF_MOVE|
+					MPOL_MF_MOVE_ALL)) || mode > MPOL_MAX)
 		return -EINVAL;
+	if ((flags & MPOL_MF_MOVE_ALL) && !capable(CAP_SYS_NICE))
+		return -EPERM;
 	if (start & ~PAGE_MASK)
 		return -EINVAL;
 	if (mode == MPOL_DEFAULT)
-		flags &= ~MPOL_MF_STRICT;
+		flags &= ~(MPOL_MF_STRICT|MPOL_MF_MOVE|MPOL_MF_MOVE_ALL);
 	len = (len + PAGE_SIZE - 1) & PAGE_MASK;
 	end = start + len;
 	if (end < start)
@@ -391,11 +467,23 @@ asmlinkage long sys_mbind(unsigned long start, unsigned long len,
 	PDprintk("mbind %lx-%lx mode:%ld nodes:%lx\n",start,start+len,
 			mode,nodes[0]);
 
+	if (flags & (MPOL_MF_MOVE|MPOL_MF_MOVE_ALL))
+		lru_add_drain();
+
 	down_write(&mm->mmap_sem);
-	vma = check_range(mm, start, end, nodes, flags);
+	vma = check_range(mm, start, end, nodes, flags, &pagelist);
 	err = PTR_ERR(vma);
-	if (!IS_ERR(vma))
+	if (!IS_ERR(vma)) {
+		int nr_failed = 0;
+
 		err = mbind_range(vma, start, end, new);
+		if (!list_empty(&pagelist))
+			nr_failed = migrate_pages(&pagelist, new_vma_page,
+						(unsigned long)vma);
+		if (!err && nr_failed && (flags & MPOL_MF_STRICT))
+			err = -EIO;
+	} else
+		putback_lru_pages(&pagelist);
 	up_write(&mm->mmap_sem);
 	mpol_free(new);
 	return err;
@@ -550,6 +638,297 @@ asmlinkage long sys_get_mempolicy(int __user *policy,
 	return err;
 }
 
+/*
+ * Find the mm of the process whose pages are to be moved.  The caller
+ * needs the rights it would need to change the scheduling of @pid.
+ */
+static struct mm_struct *get_migration_mm(pid_t pid)
+{
+	struct task_struct *task;
+	struct mm_struct *mm;
+
+	read_lock(&tasklist_lock);
+	task = pid ? find_task_by_pid(pid) : current;
+	if (!task) {
+		read_unlock(&tasklist_lock);
+		return ERR_PTR(-ESRCH);
+	}
+	if ((current->euid != task->suid) && (current->euid != task->uid) &&
+	    (current->uid != task->suid) && (current->uid != task->uid) &&
+	    !capable(CAP_SYS_NICE)) {
+		read_unlock(&tasklist_lock);
+		return ERR_PTR(-EPERM);
+	}
+	mm = get_task_mm(task);
+	read_unlock(&tasklist_lock);
+	if (!mm)
+		return ERR_PTR(-EINVAL);
+	return mm;
+}
+
+/* @private maps each source node to its target node */
+static struct page *new_node_page(struct page *page, unsigned long private)
+{
+	int *node_map = (int *)private;
+
+	return alloc_pages_node(node_map[page_to_nid(page)],
+				migrate_gfp_mask(page), 0);
+}
+
+/*
+ * Move the pages of @mm which lie on the nodes of @from to the nodes of
+ * @to: the n-th node of @from maps to the n-th node of @to, wrapping
+ * around when @to has fewer nodes.  All pages are gathered before any
+ * is moved, so that a node which is both a source and a target does not
+ * have its incoming pages moved on again.
+ *
+ * Returns the number of pages which could not be moved.
+ */
+static int do_migrate_pages(struct mm_struct *mm, unsigned long *from,
+			    unsigned long *to, unsigned long flags)
+{
+	DECLARE_BITMAP(sources, MAX_NUMNODES);
+	struct vm_area_struct *vma;
+	LIST_HEAD(pagelist);
+	int *node_map;
+	int source, dest = -1;
+	int err = 0;
+
+	node_map = kmalloc(MAX_NUMNODES * sizeof(int), GFP_KERNEL);
+	if (!node_map)
+		return -ENOMEM;
+
+	bitmap_zero(sources, MAX_NUMNODES);
+	for (source = find_first_bit(from, MAX_NUMNODES);
+	     source < MAX_NUMNODES;
+	     source = find_next_bit(from, MAX_NUMNODES, source + 1)) {
+		dest = find_next_bit(to, MAX_NUMNODES, dest + 1);
+		if (dest >= MAX_NUMNODES)
+			dest = find_first_bit(to, MAX_NUMNODES);
+		node_map[source] = dest;
+		if (source != dest)
+			__set_bit(source, sources);
+	}
+
+	lru_add_drain();
+	down_read(&mm->mmap_sem);
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (is_vm_hugetlb_page(vma))
+			continue;
+		check_pages(vma, vma->vm_start, vma->vm_end, sources,
+			    flags | MPOL_MF_INVERT, &pagelist);
+	}
+	if (!list_empty(&pagelist))
+		err = migrate_pages(&pagelist, new_node_page,
+				    (unsigned long)node_map);
+	up_read(&mm->mmap_sem);
+
+	kfree(node_map);
+	return err;
+}
+
+asmlinkage long sys_migrate_pages(pid_t pid, unsigned long maxnode,
+				  const unsigned long __user *old_nodes,
+				  const unsigned long __user *new_nodes)
+{
+	struct mm_struct *mm;
+	DECLARE_BITMAP(old, MAX_NUMNODES);
+	DECLARE_BITMAP(new, MAX_NUMNODES);
+	unsigned long flags;
+	int err;
+
+	/* Any set of online nodes will do: check them like a preferred mask */
+	err = get_nodes(old, (unsigned long __user *)old_nodes, maxnode,
+			MPOL_PREFERRED);
+	if (err)
+		return err;
+	err = get_nodes(new, (unsigned long __user *)new_nodes, maxnode,
+			MPOL_BIND);
+	if (err)
+		return err;
+
+	mm = get_migration_mm(pid);
+	if (IS_ERR(mm))
+		return PTR_ERR(mm);
+
+	flags = capable(CAP_SYS_NICE) ? MPOL_MF_MOVE_ALL : MPOL_MF_MOVE;
+	err = do_migrate_pages(mm, old, new, flags);
+	mmput(mm);
+	return err;
+}
+
+/*
+ * move_pages works through the address list in chunks, each described
+ * by an array of page_to_node in a page of its own, ending with an entry
+ * whose node is MAX_NUMNODES.
+ */
+struct page_to_node {
+	unsigned long addr;
+	struct page *page;
+	int node;
+	int status;
+};
+
+#define MOVE_PAGES_CHUNK	(PAGE_SIZE / sizeof(struct page_to_node) - 1)
+
+static struct page *new_page_node(struct page *page, unsigned long private)
+{
+	struct page_to_node *pm = (struct page_to_node *)private;
+
+	while (pm->node != MAX_NUMNODES && pm->page != page)
+		pm++;
+	if (pm->node == MAX_NUMNODES)
+		return NULL;
+	return alloc_pages_node(pm->node, migrate_gfp_mask(page), 0);
+}
+
+/*
+ * Move the pages of a chunk whose node is not negative, then store in
+ * the status of each entry the node its page is on, or an error.
+ */
+static void do_move_pages(struct mm_struct *mm, struct page_to_node *pm,
+			  unsigned long flags)
+{
+	struct page_to_node *pp;
+	LIST_HEAD(pagelist);
+
+	lru_add_drain();
+	down_read(&mm->mmap_sem);
+
+	for (pp = pm; pp->node != MAX_NUMNODES; pp++) {
+		struct vm_area_struct *vma;
+		struct page *page;
+		int err;
+
+		pp->page = NULL;
+		err = -EFAULT;
+		vma = find_vma(mm, pp->addr);
+		if (!vma || pp->addr < vma->vm_start ||
+		    is_vm_hugetlb_page(vma) ||
+		    (vma->vm_flags & (VM_IO|VM_RESERVED)))
+			goto set_status;
+
+		spin_lock(&mm->page_table_lock);
+		page = follow_page_get(mm, pp->addr);
+		spin_unlock(&mm->page_table_lock);
+
+		err = -ENOENT;
+		if (!page)
+			goto set_status;
+		if (PageReserved(page))
+			goto put_and_set;
+
+		err = page_to_nid(page);
+		if (pp->node < 0 || err == pp->node)
+			goto put_and_set;
+
+		err = -EACCES;
+		if (page_mapcount(page) > 1 && !(flags & MPOL_MF_MOVE_ALL))
+			goto put_and_set;
+
+		err = -EBUSY;
+		if (!isolate_lru_page(page, &pagelist)) {
+			pp->page = page;
+			err = 0;
+		}
+put_and_set:
+		put_page(page);
+set_status:
+		pp->status = err;
+	}
+
+	if (!list_empty(&pagelist)) {
+		migrate_pages(&pagelist, new_page_node, (unsigned long)pm);
+
+		/* Report where the pages we tried to move ended up */
+		for (pp = pm; pp->node != MAX_NUMNODES; pp++) {
+			struct page *page;
+
+			if (!pp->page)
+				continue;
+			spin_lock(&mm->page_table_lock);
+			page = follow_page_get(mm, pp->addr);
+			spin_unlock(&mm->page_table_lock);
+			pp->status = -ENOENT;
+			if (page) {
+				pp->status = page_to_nid(page);
+				put_page(page);
+			}
+		}
+	}
+
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Move the pages at the addresses @pages of process @pid to the nodes
+ * @nodes, storing in @status the node each page ends up on or a negative
+ * error.  Without @nodes, only report where the pages are.
+ */
+asmlinkage long sys_move_pages(pid_t pid, unsigned long nr_pages,
+			       const void __user * __user *pages,
+			       const int __user *nodes,
+			       int __user *status, int flags)
+{
+	struct page_to_node *pm;
+	struct mm_struct *mm;
+	unsigned long i, j, chunk;
+	int err;
+
+	if (flags & ~(MPOL_MF_MOVE|MPOL_MF_MOVE_ALL))
+		return -EINVAL;
+	if ((flags & MPOL_MF_MOVE_ALL) && !capable(CAP_SYS_NICE))
+		return -EPERM;
+
+	mm = get_migration_mm(pid);
+	if (IS_ERR(mm))
+		return PTR_ERR(mm);
+
+	err = -ENOMEM;
+	pm = (struct page_to_node *)__get_free_page(GFP_KERNEL);
+	if (!pm)
+		goto out;
+
+	for (i = 0; i < nr_pages; i += chunk) {
+		chunk = min_t(unsigned long, nr_pages - i, MOVE_PAGES_CHUNK);
+
+		for (j = 0; j < chunk; j++) {
+			const void __user *p;
+			int node = -1;
+
+			err = -EFAULT;
+			if (get_user(p, pages + i + j))
+				goto out_free;
+			pm[j].addr = (unsigned long)p;
+
+			if (nodes) {
+				if (get_user(node, nodes + i + j))
+					goto out_free;
+				err = -ENODEV;
+				if (node < 0 || node >= MAX_NUMNODES ||
+				    !node_online(node))
+					goto out_free;
+			}
+			pm[j].node = node;
+		}
+		pm[chunk].node = MAX_NUMNODES;
+
+		do_move_pages(mm, pm, flags);
+
+		err = -EFAULT;
+		for (j = 0; j < chunk; j++)
+			if (put_user(pm[j].status, status + i + j))
+				goto out_free;
+	}
+	err = 0;
+
+out_free:
+	free_page((unsigned long)pm);
+out:
+	mmput(mm);
+	return err;
+}
+
 #ifdef CONFIG_COMPAT
 
 asmlinkage long compat_sys_get_mempolicy(int __user *policy,
@@ -627,6 +1006,63 @@ asmlinkage long compat_sys_mbind(compat_ulong_t start, compat_ulong_t len,
 	return sys_mbind(start, len, mode, nm, nr_bits+1, flags);
 }
 
+asmlinkage long compat_sys_migrate_pages(compat_pid_t pid,
+				compat_ulong_t maxnode,
+				const compat_ulong_t __user *old_nodes,
+				const compat_ulong_t __user *new_nodes)
+{
+	unsigned long __user *old = NULL;
+	unsigned long __user *new = NULL;
+	unsigned long nr_bits, alloc_size;
+	DECLARE_BITMAP(bm, MAX_NUMNODES);
+
+	nr_bits = min_t(unsigned long, maxnode-1, MAX_NUMNODES);
+	alloc_size = ALIGN(nr_bits, BITS_PER_LONG) / 8;
+
+	if (old_nodes) {
+		if (compat_get_bitmap(bm, (compat_ulong_t __user *)old_nodes,
+				      nr_bits))
+			return -EFAULT;
+		old = compat_alloc_user_space(new_nodes ? alloc_size*2 :
+							  alloc_size);
+		if (new_nodes)
+			new = old + alloc_size / sizeof(unsigned long);
+		if (copy_to_user(old, bm, alloc_size))
+			return -EFAULT;
+	}
+	if (new_nodes) {
+		if (compat_get_bitmap(bm, (compat_ulong_t __user *)new_nodes,
+				      nr_bits))
+			return -EFAULT;
+		if (!new)
+			new = compat_alloc_user_space(alloc_size);
+		if (copy_to_user(new, bm, alloc_size))
+			return -EFAULT;
+	}
+
+	return sys_migrate_pages(pid, nr_bits+1, old, new);
+}
+
+asmlinkage long compat_sys_move_pages(compat_pid_t pid,
+				compat_ulong_t nr_pages,
+				compat_uptr_t __user *pages32,
+				const int __user *nodes,
+				int __user *status, int flags)
+{
+	const void __user * __user *pages;
+	compat_ulong_t i;
+
+	pages = compat_alloc_user_space(nr_pages * sizeof(void *));
+	for (i = 0; i < nr_pages; i++) {
+		compat_uptr_t p;
+
+		if (get_user(p, pages32 + i) ||
+		    put_user(compat_ptr(p), pages + i))
+			return -EFAULT;
+	}
+	return sys_move_pages(pid, nr_pages, pages, nodes, status, flags);
+}
+
 #endif
 
 /* Return effective policy for a VMA */
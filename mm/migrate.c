@@ -0,0 +1,433 @@
+/*
+ * mm/migrate.c - move pages from one NUMA node to another
+ *
+ * A page is taken off the LRU, locked and unmapped through the reverse
+ * map.  Anonymous ptes are left holding a migration entry, which makes
+ * faults on them wait for the page lock.  The contents and state of the
+ * page are then copied to a page on the target node, which replaces it
+ * in the page cache or swap cache, and the migration entries are turned
+ * into ptes for the new page.  File pages are simply unmapped: they are
+ * faulted back in from the page cache, which by then holds the new page.
+ *
+ * The users are mbind(MPOL_MF_MOVE) and the migrate_pages and move_pages
+ * system calls, all in mm/mempolicy.c.
+ */
+
+#include <linux/mm.h>
+#include <linux/migrate.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/pagemap.h>
+#include <linux/buffer_head.h>
+#include <linux/mm_inline.h>
+#include <linux/highmem.h>
+#include <linux/rmap.h>
+#include <linux/huge_mm.h>
+#include <linux/memctl.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
+
+/*
+ * Take a page off the LRU for migration, adding it to @pagelist with a
+ * reference held.  Fails if the page is not on the LRU, which includes
+ * pages still sitting in another cpu's lru_add pagevec.
+ */
+int isolate_lru_page(struct page *page, struct list_head *pagelist)
+{
+	int ret = -EBUSY;
+
+	if (PageLRU(page)) {
+		struct zone *zone = page_zone(page);
+
+		spin_lock_irq(&zone->lru_lock);
+		if (TestClearPageLRU(page)) {
+			if (get_page_testone(page)) {
+				/* It is being freed elsewhere */
+				__put_page(page);
+				SetPageLRU(page);
+			} else {
+				ret = 0;
+				if (PageActive(page))
+					del_page_from_active_list(zone, page);
+				else
+					del_page_from_inactive_list(zone, page);
+				list_add_tail(&page->lru, pagelist);
+			}
+		}
+		spin_unlock_irq(&zone->lru_lock);
+	}
+	return ret;
+}
+
+/*
+ * Put an isolated page back on the LRU and drop the isolation reference.
+ */
+static inline void move_to_lru(struct page *page)
+{
+	if (PageActive(page)) {
+		ClearPageActive(page);
+		lru_cache_add_active(page);
+	} else
+		lru_cache_add(page);
+	put_page(page);
+}
+
+void putback_lru_pages(struct list_head *l)
+{
+	struct page *page, *page2;
+
+	list_for_each_entry_safe(page, page2, l, lru) {
+		list_del(&page->lru);
+		move_to_lru(page);
+	}
+}
+
+/*
+ * A fault found a migration entry: wait for the migration to finish.
+ * Entered with the pte lock held, which is dropped.
+ */
+void migration_entry_wait(pte_t *ptep, spinlock_t *ptl, swp_entry_t entry)
+{
+	struct page *page;
+
+	page = migration_entry_to_page(entry);
+	get_page(page);
+	pte_unmap_unlock(ptep, ptl);
+	wait_on_page_locked(page);
+	put_page(page);
+}
+
+/*
+ * Replace the migration entry for @old in @vma by a pte for @new.
+ */
+static void remove_migration_pte(struct vm_area_struct *vma,
+				struct page *old, struct page *new)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long address;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *ptep, pte;
+	spinlock_t *ptl;
+	swp_entry_t entry;
+
+	address = page_address_in_vma(new, vma);
+	if (address == -EFAULT)
+		return;
+
+	spin_lock(&mm->page_table_lock);
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		goto out_unlock;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		goto out_unlock;
+
+	pmd = pmd_offset(pud, address);
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		goto out_unlock;
+
+	ptl = pte_ptl_lock(mm, pmd);
+	ptep = pte_offset_map(pmd, address);
+	pte = *ptep;
+	if (pte_none(pte) || pte_present(pte) || pte_file(pte))
+		goto out_unmap;
+
+	entry = pte_to_swp_entry(pte);
+	if (!is_migration_entry(entry) ||
+	    migration_entry_to_page(entry) != old)
+		goto out_unmap;
+
+	get_page(new);
+	pte = pte_mkold(mk_pte(new, vma->vm_page_prot));
+	if (is_write_migration_entry(entry))
+		pte = pte_mkwrite(pte);
+	set_pte_at(mm, address, ptep, pte);
+	page_add_anon_rmap(new, vma, address);
+	inc_mm_counter(mm, rss);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, address, pte);
+	lazy_mmu_prot_update(pte);
+
+out_unmap:
+	pte_unmap(ptep);
+	pte_ptl_unlock(ptl);
+out_unlock:
+	spin_unlock(&mm->page_table_lock);
+}
+
+/*
+ * Restore the ptes of an anonymous page which try_to_unmap() turned into
+ * migration entries, pointing them at @new (which is @old if the migration
+ * failed).  The caller holds rcu_read_lock, which keeps the anon_vma from
+ * being freed under us now that @old is unmapped.
+ */
+static void remove_migration_ptes(struct page *old, struct page *new)
+{
+	struct anon_vma *anon_vma;
+	struct vm_area_struct *vma;
+	unsigned long mapping;
+
+	mapping = (unsigned long)new->mapping;
+	if (!mapping || !(mapping & PAGE_MAPPING_ANON))
+		return;
+
+	anon_vma = (struct anon_vma *)(mapping - PAGE_MAPPING_ANON);
+	spin_lock(&anon_vma->lock);
+	list_for_each_entry(vma, &anon_vma->head, anon_vma_node)
+		remove_migration_pte(vma, old, new);
+	spin_unlock(&anon_vma->lock);
+}
+
+/*
+ * Switch the page cache or swap cache slot of @page over to @newpage.
+ * The page is locked and unmapped, so the only references left must be
+ * our isolation reference and the one held by the radix tree: freezing
+ * the count on that under tree_lock stops anyone finding the page
+ * meanwhile.
+ */
+static int migrate_page_move_mapping(struct address_space *mapping,
+				struct page *newpage, struct page *page)
+{
+	struct page **radix_pointer;
+
+	if (!mapping) {
+		/* Anonymous page without swap cache */
+		if (page_count(page) != 1)
+			return -EAGAIN;
+		return 0;
+	}
+
+	write_lock_irq(&mapping->tree_lock);
+
+	radix_pointer = (struct page **)radix_tree_lookup_slot(
+						&mapping->page_tree,
+						page_index(page));
+
+	/* Freezing the count keeps lockless lookups off the old page */
+	if (!radix_pointer || *radix_pointer != page ||
+	    !page_freeze_refs(page, 2 + !!PagePrivate(page))) {
+		write_unlock_irq(&mapping->tree_lock);
+		return -EAGAIN;
+	}
+
+	/* The radix tree's reference moves to the new page */
+	get_page(newpage);
+	if (PageSwapCache(page)) {
+		SetPageSwapCache(newpage);
+		set_page_private(newpage, page_private(page));
+	}
+
+	rcu_assign_pointer(*radix_pointer, newpage);
+	page_unfreeze_refs(page, 1 + !!PagePrivate(page));
+	write_unlock_irq(&mapping->tree_lock);
+
+	return 0;
+}
+
+/*
+ * Copy the contents and state of @page to @newpage.
+ */
+static void migrate_page_copy(struct page *newpage, struct page *page)
+{
+	copy_highpage(newpage, page);
+
+	if (PageError(page))
+		SetPageError(newpage);
+	if (PageReferenced(page))
+		SetPageReferenced(newpage);
+	if (PageUptodate(page))
+		SetPageUptodate(newpage);
+	if (PageActive(page))
+		SetPageActive(newpage);
+	if (PageChecked(page))
+		SetPageChecked(newpage);
+	if (PageMappedToDisk(page))
+		SetPageMappedToDisk(newpage);
+
+	if (PageDirty(page)) {
+		clear_page_dirty_for_io(page);
+		set_page_dirty(newpage);
+	}
+
+	ClearPageSwapCache(page);
+	ClearPageActive(page);
+	set_page_private(page, 0);
+	page->mapping = NULL;
+
+	memctl_migrate(page, newpage);
+}
+
+static int move_to_new_page(struct page *newpage, struct page *page)
+{
+	int rc;
+
+	newpage->index = page->index;
+	newpage->mapping = page->mapping;
+
+	rc = migrate_page_move_mapping(page_mapping(page), newpage, page);
+	if (rc) {
+		newpage->mapping = NULL;
+		return rc;
+	}
+
+	migrate_page_copy(newpage, page);
+	if (PageAnon(newpage))
+		remove_migration_ptes(page, newpage);
+	return 0;
+}
+
+/*
+ * Move one isolated page.  Returns 0 when the page has been moved (or
+ * has been freed meanwhile), -EAGAIN when the caller should try again
+ * later, and another error when the page cannot be moved.
+ */
+static int unmap_and_move(new_page_t get_new_page, unsigned long private,
+			struct page *page, int force)
+{
+	struct page *newpage;
+	int rcu_locked = 0;
+	int rc = 0;
+
+	newpage = get_new_page(page, private);
+	if (!newpage)
+		return -ENOMEM;
+
+	if (page_count(page) == 1)
+		/* page was freed from under us. So we are done. */
+		goto move_newpage;
+
+	rc = -EAGAIN;
+	if (TestSetPageLocked(page)) {
+		if (!force)
+			goto move_newpage;
+		lock_page(page);
+	}
+
+	if (PageWriteback(page)) {
+		if (!force)
+			goto unlock;
+		wait_on_page_writeback(page);
+	}
+
+	/*
+	 * Buffers are not carried over to the new page: drop them, writing
+	 * a dirty page out first.
+	 */
+	if (PagePrivate(page)) {
+		if (PageDirty(page)) {
+			if (!force || !page->mapping ||
+			    !page->mapping->a_ops->writepage)
+				goto unlock;
+			/* write_one_page unlocks the page */
+			write_one_page(page, 0);
+			goto move_newpage;
+		}
+		if (!try_to_release_page(page, GFP_KERNEL))
+			goto unlock;
+	}
+
+	if (TestSetPageLocked(newpage))
+		BUG();
+
+	/*
+	 * Once an anonymous page is unmapped nothing pins its anon_vma but
+	 * RCU: hold it until the migration entries are gone again.
+	 */
+	if (PageAnon(page)) {
+		rcu_read_lock();
+		rcu_locked = 1;
+	}
+
+	if (try_to_unmap(page, 1) == SWAP_FAIL)
+		rc = -EBUSY;
+	else if (!page_mapped(page))
+		rc = move_to_new_page(newpage, page);
+
+	if (rc)
+		remove_migration_ptes(page, page);
+	if (rcu_locked)
+		rcu_read_unlock();
+
+	unlock_page(newpage);
+unlock:
+	unlock_page(page);
+move_newpage:
+	if (rc != -EAGAIN) {
+		/*
+		 * Done with the old page: it is freed now if it was moved,
+		 * and goes back to the LRU if it could not be.
+		 */
+		list_del(&page->lru);
+		if (rc)
+			move_to_lru(page);
+		else {
+			ClearPageActive(page);
+			put_page(page);
+		}
+	}
+	if (!rc && newpage->mapping)
+		move_to_lru(newpage);
+	else
+		put_page(newpage);
+	return rc;
+}
+
+/*
+ * migrate_pages - move the pages on @from to pages got from @get_new_page
+ *
+ * The pages on @from must have been isolated with isolate_lru_page().
+ * Pages are retried a few times while they are busy, waiting for page
+ * locks and writeback only on the later passes.  The pages left over are
+ * put back on the LRU.
+ *
+ * Returns the number of pages which could not be moved, or a negative
+ * error if new pages could not be allocated.
+ */
+int migrate_pages(struct list_head *from, new_page_t get_new_page,
+			unsigned long private)
+{
+	int retry = 1;
+	int nr_failed = 0;
+	int pass = 0;
+	struct page *page;
+	struct page *page2;
+	int rc;
+
+	for (pass = 0; pass < 10 && retry; pass++) {
+		retry = 0;
+
+		list_for_each_entry_safe(page, page2, from, lru) {
+			cond_resched();
+
+			rc = unmap_and_move(get_new_page, private,
+						page, pass > 2);
+
+			switch (rc) {
+			case -ENOMEM:
+				goto out;
+			case -EAGAIN:
+				retry++;
+				break;
+			case 0:
+				break;
+			default:
+				/* Permanent failure */
+				nr_failed++;
+				break;
+			}
+		}
+	}
+	rc = 0;
+out:
+	putback_lru_pages(from);
+
+	if (rc)
+		return rc;
+
+	return nr_failed + retry;
+}
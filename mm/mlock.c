@@ -7,6 +7,7 @@
 
 #include <linux/mman.h>
 #include <linux/mm.h>
+#include <linux/huge_mm.h>
 #include <linux/mempolicy.h>
 #include <linux/syscalls.h>
 
@@ -24,6 +25,13 @@ static int mlock_fixup(struct vm_area_struct *vma, struct vm_area_struct **prev,
 		goto out;
 	}
 
+	/* Merging moves the vma boundaries, as splitting does */
+	ret = split_huge_pmd_address(vma, start);
+	if (!ret)
+		ret = split_huge_pmd_address(vma, end);
+	if (ret)
+		goto out;
+
 	pgoff = vma->vm_pgoff + ((start - vma->vm_start) >> PAGE_SHIFT);
 	*prev = vma_merge(mm, *prev, start, end, newflags, vma->anon_vma,
 			  vma->vm_file, pgoff, vma_policy(vma));
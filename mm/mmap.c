@@ -19,11 +19,13 @@
 #include <linux/personality.h>
 #include <linux/security.h>
 #include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
 #include <linux/profile.h>
 #include <linux/module.h>
 #include <linux/mount.h>
 #include <linux/mempolicy.h>
 #include <linux/rmap.h>
+#include <linux/vmacache.h>
 
 #include <asm/uaccess.h>
 #include <asm/cacheflush.h>
@@ -57,6 +59,81 @@ pgprot_t protection_map[16] = {
 
 int sysctl_overcommit_memory = OVERCOMMIT_GUESS;  /* heuristic overcommit */
 int sysctl_overcommit_ratio = 50;	/* default is 50% */
+
+/*
+ * Each vma in the rbtree records the largest free gap following any vma
+ * of its subtree, up to the next vma or TASK_SIZE: unmapped_area() looks
+ * only where a hole of the size wanted can be.  The gap after a vma
+ * changes with its vm_end, and with its successor, so changing vm_start
+ * means updating the vma before.  The gap below the first vma is not in
+ * the tree, and is looked at separately.
+ *
+ * Changes to the tree are made with mmap_sem held for writing; only
+ * expand_stack changes gaps with it held for reading, and serializes
+ * against itself with page_table_lock.
+ */
+static inline unsigned long vma_gap(struct vm_area_struct *vma)
+{
+	unsigned long end = vma->vm_next ? vma->vm_next->vm_start : TASK_SIZE;
+
+	return end > vma->vm_end ? end - vma->vm_end : 0;
+}
+
+static unsigned long vma_compute_subtree_gap(struct vm_area_struct *vma)
+{
+	unsigned long max = vma_gap(vma), subtree_gap;
+
+	if (vma->vm_rb.rb_left) {
+		subtree_gap = rb_entry(vma->vm_rb.rb_left,
+				struct vm_area_struct, vm_rb)->rb_subtree_gap;
+		if (subtree_gap > max)
+			max = subtree_gap;
+	}
+	if (vma->vm_rb.rb_right) {
+		subtree_gap = rb_entry(vma->vm_rb.rb_right,
+				struct vm_area_struct, vm_rb)->rb_subtree_gap;
+		if (subtree_gap > max)
+			max = subtree_gap;
+	}
+	return max;
+}
+
+static void vma_gap_callback(struct rb_node *node, void *data)
+{
+	struct vm_area_struct *vma = rb_entry(node, struct vm_area_struct, vm_rb);
+
+	vma->rb_subtree_gap = vma_compute_subtree_gap(vma);
+}
+
+/*
+ * The gap after @vma has changed: carry it up the tree as far as it
+ * makes a difference.
+ */
+static void vma_gap_update(struct vm_area_struct *vma)
+{
+	struct rb_node *node = &vma->vm_rb;
+
+	while (node) {
+		struct vm_area_struct *tmp;
+		unsigned long gap;
+
+		tmp = rb_entry(node, struct vm_area_struct, vm_rb);
+		gap = vma_compute_subtree_gap(tmp);
+		if (tmp->rb_subtree_gap == gap)
+			break;
+		tmp->rb_subtree_gap = gap;
+		node = node->rb_parent;
+	}
+}
+
+/* The vm_start of @vma has changed, and with it the gap before */
+static void vma_gap_update_prev(struct vm_area_struct *vma)
+{
+	struct rb_node *prev = rb_prev(&vma->vm_rb);
+
+	if (prev)
+		vma_gap_update(rb_entry(prev, struct vm_area_struct, vm_rb));
+}
 int sysctl_max_map_count = DEFAULT_MAX_MAP_COUNT;
 atomic_t vm_committed_space = ATOMIC_INIT(0);
 
@@ -172,6 +249,28 @@ static void __remove_shared_vm_struct(struct vm_area_struct *vma,
 	flush_dcache_mmap_unlock(mapping);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static void free_vma_rcu(struct rcu_head *head)
+{
+	kmem_cache_free(vm_area_cachep,
+		container_of(head, struct vm_area_struct, vm_rcu_head));
+}
+
+/*
+ * A speculative fault may still be looking at the vma: free it once
+ * that cannot be so.
+ */
+static inline void free_vma(struct vm_area_struct *vma)
+{
+	call_rcu(&vma->vm_rcu_head, free_vma_rcu);
+}
+#else
+static inline void free_vma(struct vm_area_struct *vma)
+{
+	kmem_cache_free(vm_area_cachep, vma);
+}
+#endif
+
 /*
  * Remove one vm structure and free it.
  */
@@ -192,7 +291,7 @@ static void remove_vm_struct(struct vm_area_struct *vma)
 		fput(file);
 	anon_vma_unlink(vma);
 	mpol_free(vma_policy(vma));
-	kmem_cache_free(vm_area_cachep, vma);
+	free_vma(vma);
 }
 
 /*
@@ -278,6 +377,10 @@ void validate_mm(struct mm_struct *mm)
 	int i = 0;
 	struct vm_area_struct *tmp = mm->mmap;
 	while (tmp) {
+		if (tmp->rb_subtree_gap != vma_compute_subtree_gap(tmp))
+			printk("free gap %lx, should be %lx\n",
+			       tmp->rb_subtree_gap,
+			       vma_compute_subtree_gap(tmp)), bug = 1;
 		tmp = tmp->vm_next;
 		i++;
 	}
@@ -305,6 +408,11 @@ find_vma_prepare(struct mm_struct *mm, unsigned long addr,
 	rb_prev = __rb_parent = NULL;
 	vma = NULL;
 
+	/* Not looked at when addr is inside a vma, but still set */
+	*pprev = NULL;
+	*rb_link = NULL;
+	*rb_parent = NULL;
+
 	while (*__rb_link) {
 		struct vm_area_struct *vma_tmp;
 
@@ -322,7 +430,6 @@ find_vma_prepare(struct mm_struct *mm, unsigned long addr,
 		}
 	}
 
-	*pprev = NULL;
 	if (rb_prev)
 		*pprev = rb_entry(rb_prev, struct vm_area_struct, vm_rb);
 	*rb_link = __rb_link;
@@ -350,8 +457,13 @@ __vma_link_list(struct mm_struct *mm, struct vm_area_struct *vma,
 void __vma_link_rb(struct mm_struct *mm, struct vm_area_struct *vma,
 		struct rb_node **rb_link, struct rb_node *rb_parent)
 {
+	mm_rb_write_begin(mm);
 	rb_link_node(&vma->vm_rb, rb_parent, rb_link);
 	rb_insert_color(&vma->vm_rb, &mm->mm_rb);
+	rb_augment_insert(&vma->vm_rb, vma_gap_callback, NULL);
+	mm_rb_write_end(mm);
+	/* The gap after the vma before now ends at this one */
+	vma_gap_update_prev(vma);
 }
 
 static inline void __vma_link_file(struct vm_area_struct *vma)
@@ -434,10 +546,16 @@ static inline void
 __vma_unlink(struct mm_struct *mm, struct vm_area_struct *vma,
 		struct vm_area_struct *prev)
 {
+	struct rb_node *deepest;
+
 	prev->vm_next = vma->vm_next;
+	mm_rb_write_begin(mm);
+	deepest = rb_augment_erase_begin(&vma->vm_rb);
 	rb_erase(&vma->vm_rb, &mm->mm_rb);
-	if (mm->mmap_cache == vma)
-		mm->mmap_cache = prev;
+	rb_augment_erase_end(deepest, vma_gap_callback, NULL);
+	mm_rb_write_end(mm);
+	vma_gap_update(prev);
+	vmacache_invalidate(mm);
 }
 
 /*
@@ -459,6 +577,7 @@ void vma_adjust(struct vm_area_struct *vma, unsigned long start,
 	struct anon_vma *anon_vma = NULL;
 	long adjust_next = 0;
 	int remove_next = 0;
+	int start_changed;
 
 	if (next && !insert) {
 		if (end >= next->vm_end) {
@@ -490,6 +609,14 @@ again:			remove_next = 1 + (end > next->vm_end);
 		}
 	}
 
+	/*
+	 * Speculative faults must not trust what they saw of vma and next
+	 * while we change them; a next removed stays marked until freed.
+	 */
+	vma_write_begin(vma);
+	if (adjust_next || remove_next)
+		vma_write_begin(next);
+
 	if (file) {
 		mapping = file->f_mapping;
 		if (!(vma->vm_flags & VM_NONLINEAR))
@@ -541,6 +668,7 @@ again:			remove_next = 1 + (end > next->vm_end);
 			vma_prio_tree_remove(next, root);
 	}
 
+	start_changed = start != vma->vm_start;
 	vma->vm_start = start;
 	vma->vm_end = end;
 	vma->vm_pgoff = pgoff;
@@ -575,6 +703,10 @@ again:			remove_next = 1 + (end > next->vm_end);
 		__insert_vm_struct(mm, insert);
 	}
 
+	vma_gap_update(vma);
+	if (start_changed)
+		vma_gap_update_prev(vma);
+
 	if (anon_vma)
 		spin_unlock(&anon_vma->lock);
 	if (mapping)
@@ -585,18 +717,23 @@ again:			remove_next = 1 + (end > next->vm_end);
 			fput(file);
 		mm->map_count--;
 		mpol_free(vma_policy(next));
-		kmem_cache_free(vm_area_cachep, next);
+		free_vma(next);
 		/*
 		 * In mprotect's case 6 (see comments on vma_merge),
 		 * we must remove another next too. It would clutter
 		 * up the code too much to do both in one go.
 		 */
 		if (remove_next == 2) {
+			vma_write_end(vma);
 			next = vma->vm_next;
 			goto again;
 		}
 	}
 
+	vma_write_end(vma);
+	if (adjust_next)
+		vma_write_end(next);
+
 	validate_mm(mm);
 }
 
@@ -1140,6 +1277,158 @@ unacct_error:
 
 EXPORT_SYMBOL(do_mmap_pgoff);
 
+/**
+ * unmapped_area - find the lowest free range of the current mm
+ * @len: length of the range wanted
+ * @low: lowest address it may start at
+ * @high: highest address it may end at
+ *
+ * Walks the vma tree in address order, skipping the subtrees whose
+ * largest gap is smaller than @len.  Returns the address, or -ENOMEM.
+ * Needs mmap_sem held.
+ */
+unsigned long unmapped_area(unsigned long len, unsigned long low,
+			    unsigned long high)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	unsigned long gap_start, gap_end;
+
+	if (len > high || low > high - len)
+		return -ENOMEM;
+	high -= len;		/* now the highest start */
+
+	/* The hole below the first vma is not in the tree */
+	if (!mm->mmap || low + len <= mm->mmap->vm_start)
+		return low;
+
+	vma = rb_entry(mm->mm_rb.rb_node, struct vm_area_struct, vm_rb);
+	if (vma->rb_subtree_gap < len)
+		return -ENOMEM;
+
+	for (;;) {
+		/* The gaps on the left all end at or below vm_start */
+		if (vma->vm_rb.rb_left && vma->vm_start >= low + len) {
+			struct vm_area_struct *left;
+
+			left = rb_entry(vma->vm_rb.rb_left,
+					struct vm_area_struct, vm_rb);
+			if (left->rb_subtree_gap >= len) {
+				vma = left;
+				continue;
+			}
+		}
+check_current:
+		if (vma->vm_end > high)
+			return -ENOMEM;
+		gap_start = max(vma->vm_end, low);
+		gap_end = vma->vm_next ? vma->vm_next->vm_start : TASK_SIZE;
+		if (gap_end >= gap_start + len)
+			return gap_start;
+
+		if (vma->vm_rb.rb_right) {
+			struct vm_area_struct *right;
+
+			right = rb_entry(vma->vm_rb.rb_right,
+					 struct vm_area_struct, vm_rb);
+			if (right->rb_subtree_gap >= len) {
+				vma = right;
+				continue;
+			}
+		}
+
+		/* Back up to the first ancestor we are on the left of */
+		for (;;) {
+			struct rb_node *prev = &vma->vm_rb;
+
+			if (!prev->rb_parent)
+				return -ENOMEM;
+			vma = rb_entry(prev->rb_parent,
+				       struct vm_area_struct, vm_rb);
+			if (prev == vma->vm_rb.rb_left)
+				goto check_current;
+		}
+	}
+}
+
+/**
+ * unmapped_area_topdown - find the highest free range of the current mm
+ * @len: length of the range wanted
+ * @low: lowest address it may start at
+ * @high: highest address it may end at
+ *
+ * As unmapped_area(), walking the tree from the top down.
+ */
+unsigned long unmapped_area_topdown(unsigned long len, unsigned long low,
+				    unsigned long high)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	unsigned long gap_start, gap_end;
+
+	if (len > high || low > high - len)
+		return -ENOMEM;
+	if (!mm->mmap)
+		return high - len;
+
+	vma = rb_entry(mm->mm_rb.rb_node, struct vm_area_struct, vm_rb);
+	if (vma->rb_subtree_gap < len)
+		goto check_first;
+
+	for (;;) {
+		/* The gaps on the right all start above vm_end */
+		if (vma->vm_rb.rb_right && vma->vm_end <= high - len) {
+			struct vm_area_struct *right;
+
+			right = rb_entry(vma->vm_rb.rb_right,
+					 struct vm_area_struct, vm_rb);
+			if (right->rb_subtree_gap >= len) {
+				vma = right;
+				continue;
+			}
+		}
+check_current:
+		gap_end = vma->vm_next ? vma->vm_next->vm_start : TASK_SIZE;
+		if (gap_end < low + len)
+			return -ENOMEM;
+		if (gap_end > high)
+			gap_end = high;
+		gap_start = max(vma->vm_end, low);
+		if (gap_end >= gap_start + len)
+			return gap_end - len;
+
+		if (vma->vm_rb.rb_left) {
+			struct vm_area_struct *left;
+
+			left = rb_entry(vma->vm_rb.rb_left,
+					struct vm_area_struct, vm_rb);
+			if (left->rb_subtree_gap >= len) {
+				vma = left;
+				continue;
+			}
+		}
+
+		/* Back up to the first ancestor we are on the right of */
+		for (;;) {
+			struct rb_node *prev = &vma->vm_rb;
+
+			if (!prev->rb_parent)
+				goto check_first;
+			vma = rb_entry(prev->rb_parent,
+				       struct vm_area_struct, vm_rb);
+			if (prev == vma->vm_rb.rb_right)
+				goto check_current;
+		}
+	}
+
+check_first:
+	/* The hole below the first vma is not in the tree */
+	gap_end = min(mm->mmap->vm_start, high);
+	if (gap_end >= low + len)
+		return gap_end - len;
+	return -ENOMEM;
+}
+
 /* Get an address range which is currently unmapped.
  * For shmat() with addr=0.
  *
@@ -1158,7 +1447,6 @@ arch_get_unmapped_area(struct file *filp, unsigned long addr,
 {
 	struct mm_struct *mm = current->mm;
 	struct vm_area_struct *vma;
-	unsigned long start_addr;
 
 	if (len > TASK_SIZE)
 		return -ENOMEM;
@@ -1170,31 +1458,8 @@ arch_get_unmapped_area(struct file *filp, unsigned long addr,
 		    (!vma || addr + len <= vma->vm_start))
 			return addr;
 	}
-	start_addr = addr = mm->free_area_cache;
 
-full_search:
-	for (vma = find_vma(mm, addr); ; vma = vma->vm_next) {
-		/* At this point:  (!vma || addr < vma->vm_end). */
-		if (TASK_SIZE - len < addr) {
-			/*
-			 * Start a new search - just in case we missed
-			 * some holes.
-			 */
-			if (start_addr != TASK_UNMAPPED_BASE) {
-				start_addr = addr = TASK_UNMAPPED_BASE;
-				goto full_search;
-			}
-			return -ENOMEM;
-		}
-		if (!vma || addr + len <= vma->vm_start) {
-			/*
-			 * Remember the place where we stopped the search:
-			 */
-			mm->free_area_cache = addr + len;
-			return addr;
-		}
-		addr = vma->vm_end;
-	}
+	return unmapped_area(len, TASK_UNMAPPED_BASE, TASK_SIZE);
 }
 #endif	
 
@@ -1236,32 +1501,9 @@ arch_get_unmapped_area_topdown(struct file *filp, const unsigned long addr0,
 	}
 
 	/* either no address requested or can't fit in requested address hole */
-	addr = mm->free_area_cache;
-
-	/* make sure it can fit in the remaining address space */
-	if (addr >= len) {
-		vma = find_vma(mm, addr-len);
-		if (!vma || addr <= vma->vm_start)
-			/* remember the address as a hint for next time */
-			return (mm->free_area_cache = addr-len);
-	}
-
-	addr = mm->mmap_base-len;
-
-	do {
-		/*
-		 * Lookup failure means no vma is above this address,
-		 * else if new region fits below vma->vm_start,
-		 * return with success:
-		 */
-		vma = find_vma(mm, addr);
-		if (!vma || addr+len <= vma->vm_start)
-			/* remember the address as a hint for next time */
-			return (mm->free_area_cache = addr);
-
-		/* try just below the current vma->vm_start */
-		addr = vma->vm_start-len;
-	} while (len <= vma->vm_start);
+	addr = unmapped_area_topdown(len, PAGE_SIZE, mm->mmap_base);
+	if (!(addr & ~PAGE_MASK))
+		return addr;
 
 	/*
 	 * A failed mmap() very likely causes application failure,
@@ -1269,14 +1511,7 @@ arch_get_unmapped_area_topdown(struct file *filp, const unsigned long addr0,
 	 * can happen with large stack limits and large mmap()
 	 * allocations.
 	 */
-	mm->free_area_cache = TASK_UNMAPPED_BASE;
-	addr = arch_get_unmapped_area(filp, addr0, len, pgoff, flags);
-	/*
-	 * Restore the topdown base:
-	 */
-	mm->free_area_cache = mm->mmap_base;
-
-	return addr;
+	return arch_get_unmapped_area(filp, addr0, len, pgoff, flags);
 }
 #endif
 
@@ -1339,9 +1574,8 @@ struct vm_area_struct * find_vma(struct mm_struct * mm, unsigned long addr)
 
 	if (mm) {
 		/* Check the cache first. */
-		/* (Cache hit rate is typically around 35%.) */
-		vma = mm->mmap_cache;
-		if (!(vma && vma->vm_end > addr && vma->vm_start <= addr)) {
+		vma = vmacache_find(mm, addr);
+		if (!vma) {
 			struct rb_node * rb_node;
 
 			rb_node = mm->mm_rb.rb_node;
@@ -1362,7 +1596,7 @@ struct vm_area_struct * find_vma(struct mm_struct * mm, unsigned long addr)
 					rb_node = rb_node->rb_right;
 			}
 			if (vma)
-				mm->mmap_cache = vma;
+				vmacache_update(addr, vma);
 		}
 	}
 	return vma;
@@ -1370,6 +1604,71 @@ struct vm_area_struct * find_vma(struct mm_struct * mm, unsigned long addr)
 
 EXPORT_SYMBOL(find_vma);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * find_vma_speculative - find_vma without mmap_sem, for page faults
+ *
+ * Returns the vma containing @addr, having copied it to @copy and its
+ * sequence count to @seq, or NULL when there is none or the tree kept
+ * changing under us.  The caller must not dereference the vma itself:
+ * it may already be on its way to being freed.  Checking vm_sequence
+ * against @seq, once the caller is done with @copy, tells whether what
+ * it saw still holds.  The vmacache is left alone, it belongs to the
+ * mmap_sem holders.
+ */
+struct vm_area_struct *find_vma_speculative(struct mm_struct *mm,
+		unsigned long addr, struct vm_area_struct *copy, unsigned *seq)
+{
+	struct vm_area_struct *vma;
+	struct rb_node *rb_node;
+	unsigned rb_seq;
+	int depth, tries = 0;
+
+	rcu_read_lock();
+retry:
+	if (++tries > 3)
+		goto fail;
+	rb_seq = read_seqcount_begin(&mm->mm_rb_seq);
+	if (rb_seq & 1)
+		goto retry;
+
+	vma = NULL;
+	rb_node = mm->mm_rb.rb_node;
+	/* A rebalancing seen half done must not keep us here for ever */
+	for (depth = 0; rb_node && depth < 2 * BITS_PER_LONG; depth++) {
+		struct vm_area_struct *vma_tmp;
+
+		vma_tmp = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+		if (vma_tmp->vm_end > addr) {
+			vma = vma_tmp;
+			if (vma_tmp->vm_start <= addr)
+				break;
+			rb_node = rb_node->rb_left;
+		} else
+			rb_node = rb_node->rb_right;
+	}
+	if (read_seqcount_retry(&mm->mm_rb_seq, rb_seq))
+		goto retry;
+	if (!vma)
+		goto fail;
+
+	*seq = read_seqcount_begin(&vma->vm_sequence);
+	if (*seq & 1)
+		goto retry;
+	*copy = *vma;
+	if (read_seqcount_retry(&vma->vm_sequence, *seq))
+		goto retry;
+	if (addr < copy->vm_start || addr >= copy->vm_end)
+		goto fail;
+
+	rcu_read_unlock();
+	return vma;
+fail:
+	rcu_read_unlock();
+	return NULL;
+}
+#endif
+
 /* Same as find_vma, but also return a pointer to the previous VMA in *pprev. */
 struct vm_area_struct *
 find_vma_prev(struct mm_struct *mm, unsigned long addr,
@@ -1484,8 +1783,17 @@ int expand_stack(struct vm_area_struct * vma, unsigned long address)
 		grow = (address - vma->vm_end) >> PAGE_SHIFT;
 
 		error = acct_stack_growth(vma, size, grow);
-		if (!error)
+		if (!error) {
+			/*
+			 * The anon_vma lock is per vma: page_table_lock
+			 * keeps the gaps of two stacks growing at once
+			 * straight.
+			 */
+			spin_lock(&vma->vm_mm->page_table_lock);
 			vma->vm_end = address;
+			vma_gap_update(vma);
+			spin_unlock(&vma->vm_mm->page_table_lock);
+		}
 	}
 	anon_vma_unlock(vma);
 	return error;
@@ -1540,8 +1848,12 @@ int expand_stack(struct vm_area_struct *vma, unsigned long address)
 
 		error = acct_stack_growth(vma, size, grow);
 		if (!error) {
+			/* As above, for the gap before the vma */
+			spin_lock(&vma->vm_mm->page_table_lock);
 			vma->vm_start = address;
 			vma->vm_pgoff -= grow;
+			vma_gap_update_prev(vma);
+			spin_unlock(&vma->vm_mm->page_table_lock);
 		}
 	}
 	anon_vma_unlock(vma);
@@ -1706,15 +2018,25 @@ detach_vmas_to_be_unmapped(struct mm_struct *mm, struct vm_area_struct *vma,
 	struct vm_area_struct *tail_vma = NULL;
 
 	insertion_point = (prev ? &prev->vm_next : &mm->mmap);
+	mm_rb_write_begin(mm);
 	do {
+		struct rb_node *deepest;
+
+		/* Left marked: speculative faults must keep off it now */
+		vma_write_begin(vma);
+		deepest = rb_augment_erase_begin(&vma->vm_rb);
 		rb_erase(&vma->vm_rb, &mm->mm_rb);
+		rb_augment_erase_end(deepest, vma_gap_callback, NULL);
 		mm->map_count--;
 		tail_vma = vma;
 		vma = vma->vm_next;
 	} while (vma && vma->vm_start < end);
+	mm_rb_write_end(mm);
 	*insertion_point = vma;
 	tail_vma->vm_next = NULL;
-	mm->mmap_cache = NULL;		/* Kill the cache. */
+	if (prev)
+		vma_gap_update(prev);
+	vmacache_invalidate(mm);
 }
 
 /*
@@ -1733,6 +2055,10 @@ int split_vma(struct mm_struct * mm, struct vm_area_struct * vma,
 	if (mm->map_count >= sysctl_max_map_count)
 		return -ENOMEM;
 
+	/* A huge pmd must not straddle two vmas */
+	if (split_huge_pmd_address(vma, addr))
+		return -ENOMEM;
+
 	new = kmem_cache_alloc(vm_area_cachep, SLAB_KERNEL);
 	if (!new)
 		return -ENOMEM;
@@ -1976,7 +2302,7 @@ void exit_mmap(struct mm_struct *mm)
 	tlb_finish_mmu(tlb, 0, MM_VM_SIZE(mm));
 
 	vma = mm->mmap;
-	mm->mmap = mm->mmap_cache = NULL;
+	mm->mmap = NULL;
 	mm->mm_rb = RB_ROOT;
 	set_mm_counter(mm, rss, 0);
 	mm->total_vm = 0;
@@ -10,6 +10,7 @@
 
 #include <linux/mm.h>
 #include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
 #include <linux/slab.h>
 #include <linux/shm.h>
 #include <linux/mman.h>
@@ -29,7 +30,10 @@ static void change_pte_range(struct mm_struct *mm, pmd_t *pmd,
 		unsigned long addr, unsigned long end, pgprot_t newprot)
 {
 	pte_t *pte;
+	spinlock_t *ptl;
 
+	/* Speculative faults may be filling in ptes here meanwhile */
+	ptl = pte_ptl_lock(mm, pmd);
 	pte = pte_offset_map(pmd, addr);
 	do {
 		if (pte_present(*pte)) {
@@ -45,6 +49,7 @@ static void change_pte_range(struct mm_struct *mm, pmd_t *pmd,
 		}
 	} while (pte++, addr += PAGE_SIZE, addr != end);
 	pte_unmap(pte - 1);
+	pte_ptl_unlock(ptl);
 }
 
 static inline void change_pmd_range(struct mm_struct *mm, pud_t *pud,
@@ -135,6 +140,14 @@ mprotect_fixup(struct vm_area_struct *vma, struct vm_area_struct **pprev,
 
 	newprot = protection_map[newflags & 0xf];
 
+	/*
+	 * A huge pmd maps with a single protection: split the ones in
+	 * the range, and those the new vma boundaries would cut through.
+	 */
+	error = split_huge_pmd_range(vma, start, end);
+	if (error)
+		goto fail;
+
 	/*
 	 * First try to merge with previous and/or next vma.
 	 */
@@ -163,11 +176,13 @@ mprotect_fixup(struct vm_area_struct *vma, struct vm_area_struct **pprev,
 success:
 	/*
 	 * vm_flags and vm_page_prot are protected by the mmap_sem
-	 * held in write mode.
+	 * held in write mode, and by vm_sequence from speculative faults.
 	 */
+	vma_write_begin(vma);
 	vma->vm_flags = newflags;
 	vma->vm_page_prot = newprot;
 	change_protection(vma, start, end, newprot);
+	vma_write_end(vma);
 	__vm_stat_account(mm, oldflags, vma->vm_file, -nrpages);
 	__vm_stat_account(mm, newflags, vma->vm_file, nrpages);
 	return 0;
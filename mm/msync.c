@@ -19,14 +19,17 @@
 
 /*
  * Called with mm->page_table_lock held to protect against other
- * threads/the swapper from ripping pte's out from under us.
+ * threads/the swapper from ripping pte's out from under us; the pte
+ * lock is taken here, as page faults may run concurrently.
  */
 
 static void sync_pte_range(struct vm_area_struct *vma, pmd_t *pmd,
 				unsigned long addr, unsigned long end)
 {
 	pte_t *pte;
+	spinlock_t *ptl;
 
+	ptl = pte_ptl_lock(vma->vm_mm, pmd);
 	pte = pte_offset_map(pmd, addr);
 	do {
 		unsigned long pfn;
@@ -46,6 +49,7 @@ static void sync_pte_range(struct vm_area_struct *vma, pmd_t *pmd,
 			set_page_dirty(page);
 	} while (pte++, addr += PAGE_SIZE, addr != end);
 	pte_unmap(pte - 1);
+	pte_ptl_unlock(ptl);
 }
 
 static inline void sync_pmd_range(struct vm_area_struct *vma, pud_t *pud,
@@ -32,6 +32,7 @@
 #include <linux/sysctl.h>
 #include <linux/cpu.h>
 #include <linux/cpuset.h>
+#include <linux/memctl.h>
 #include <linux/nodemask.h>
 #include <linux/vmalloc.h>
 
@@ -148,7 +149,7 @@ static void prep_compound_page(struct page *page, unsigned long order)
 		struct page *p = page + i;
 
 		SetPageCompound(p);
-		p->private = (unsigned long)page;
+		set_page_private(p, (unsigned long)page);
 	}
 }
 
@@ -168,7 +169,7 @@ static void destroy_compound_page(struct page *page, unsigned long order)
 
 		if (!PageCompound(p))
 			bad_page(__FUNCTION__, page);
-		if (p->private != (unsigned long)page)
+		if (page_private(p) != (unsigned long)page)
 			bad_page(__FUNCTION__, page);
 		ClearPageCompound(p);
 	}
@@ -181,18 +182,18 @@ static void destroy_compound_page(struct page *page, unsigned long order)
  * So, we don't need atomic page->flags operations here.
  */
 static inline unsigned long page_order(struct page *page) {
-	return page->private;
+	return page_private(page);
 }
 
 static inline void set_page_order(struct page *page, int order) {
-	page->private = order;
+	set_page_private(page, order);
 	__SetPagePrivate(page);
 }
 
 static inline void rmv_page_order(struct page *page)
 {
 	__ClearPagePrivate(page);
-	page->private = 0;
+	set_page_private(page, 0);
 }
 
 /*
@@ -452,8 +453,9 @@ static void prep_new_page(struct page *page, int order)
 
 	page->flags &= ~(1 << PG_uptodate | 1 << PG_error |
 			1 << PG_referenced | 1 << PG_arch_1 |
-			1 << PG_checked | 1 << PG_mappedtodisk);
-	page->private = 0;
+			1 << PG_checked | 1 << PG_mappedtodisk |
+			1 << PG_swapbacked);
+	set_page_private(page, 0);
 	set_page_refs(page, order);
 	kernel_map_pages(page, 1 << order, 1);
 }
@@ -612,6 +614,7 @@ static void fastcall free_hot_cold_page(struct page *page, int cold)
 	inc_page_state(pgfree);
 	if (PageAnon(page))
 		page->mapping = NULL;
+	memctl_uncharge(page);
 	free_pages_check(__FUNCTION__, page);
 	pcp = &zone->pageset[get_cpu()].pcp[cold];
 	local_irq_save(flags);
@@ -762,13 +765,22 @@ __alloc_pages(unsigned int __nocast gfp_mask, unsigned int order,
 	/* Go through the zonelist once, looking for a zone with enough free */
 	for (i = 0; (z = zones[i]) != NULL; i++) {
 
-		if (!zone_watermark_ok(z, order, z->pages_low,
-				       classzone_idx, 0, 0))
-			continue;
-
 		if (!cpuset_zone_allowed(z))
 			continue;
 
+		if (!zone_watermark_ok(z, order, z->pages_low,
+				       classzone_idx, 0, 0)) {
+			/*
+			 * Rather than spill onto the next node, try to free
+			 * some local page cache first.
+			 */
+			if (!zone_reclaim_mode ||
+			    !zone_reclaim(z, gfp_mask, order) ||
+			    !zone_watermark_ok(z, order, z->pages_low,
+					       classzone_idx, 0, 0))
+				continue;
+		}
+
 		page = buffered_rmqueue(z, order, gfp_mask);
 		if (page)
 			goto got_pg;
@@ -1145,8 +1157,10 @@ void __get_zone_counts(unsigned long *active, unsigned long *inactive,
 	*inactive = 0;
 	*free = 0;
 	for (i = 0; i < MAX_NR_ZONES; i++) {
-		*active += zones[i].nr_active;
-		*inactive += zones[i].nr_inactive;
+		*active += zones[i].nr_lru[LRU_ACTIVE_ANON] +
+				zones[i].nr_lru[LRU_ACTIVE_FILE];
+		*inactive += zones[i].nr_lru[LRU_INACTIVE_ANON] +
+				zones[i].nr_lru[LRU_INACTIVE_FILE];
 		*free += zones[i].free_pages;
 	}
 }
@@ -1271,8 +1285,10 @@ void show_free_areas(void)
 			" min:%lukB"
 			" low:%lukB"
 			" high:%lukB"
-			" active:%lukB"
-			" inactive:%lukB"
+			" active_anon:%lukB"
+			" inactive_anon:%lukB"
+			" active_file:%lukB"
+			" inactive_file:%lukB"
 			" present:%lukB"
 			" pages_scanned:%lu"
 			" all_unreclaimable? %s"
@@ -1282,8 +1298,10 @@ void show_free_areas(void)
 			K(zone->pages_min),
 			K(zone->pages_low),
 			K(zone->pages_high),
-			K(zone->nr_active),
-			K(zone->nr_inactive),
+			K(zone->nr_lru[LRU_ACTIVE_ANON]),
+			K(zone->nr_lru[LRU_INACTIVE_ANON]),
+			K(zone->nr_lru[LRU_ACTIVE_FILE]),
+			K(zone->nr_lru[LRU_INACTIVE_FILE]),
 			K(zone->present_pages),
 			zone->pages_scanned,
 			(zone->all_unreclaimable ? "yes" : "no")
@@ -1631,12 +1649,16 @@ static void __init free_area_init_core(struct pglist_data *pgdat,
 
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
+	pgdat->nr_kswapd = 0;
 	pgdat->kswapd_max_order = 0;
+	memset(pgdat->kswapd_order_runs, 0, sizeof(pgdat->kswapd_order_runs));
+	memset(pgdat->kswapd_order_ok, 0, sizeof(pgdat->kswapd_order_ok));
 	
 	for (j = 0; j < MAX_NR_ZONES; j++) {
 		struct zone *zone = pgdat->node_zones + j;
 		unsigned long size, realsize;
 		unsigned long batch;
+		enum lru_list l;
 
 		zone_table[NODEZONE(nid, j)] = zone;
 		realsize = size = zones_size[j];
@@ -1690,12 +1712,15 @@ static void __init free_area_init_core(struct pglist_data *pgdat,
 		}
 		printk(KERN_DEBUG "  %s zone: %lu pages, LIFO batch:%lu\n",
 				zone_names[j], realsize, batch);
-		INIT_LIST_HEAD(&zone->active_list);
-		INIT_LIST_HEAD(&zone->inactive_list);
-		zone->nr_scan_active = 0;
-		zone->nr_scan_inactive = 0;
-		zone->nr_active = 0;
-		zone->nr_inactive = 0;
+		for_each_lru(l) {
+			INIT_LIST_HEAD(&zone->lru[l]);
+			zone->nr_scan[l] = 0;
+			zone->nr_lru[l] = 0;
+		}
+		zone->recent_rotated[0] = zone->recent_rotated[1] = 0;
+		zone->recent_scanned[0] = zone->recent_scanned[1] = 0;
+		zone->inactive_ratio = 1;
+		zone->inactive_age = 0;
 		if (!size)
 			continue;
 
@@ -1836,6 +1861,32 @@ struct seq_operations fragmentation_op = {
 	.show	= frag_show,
 };
 
+/*
+ * For each order, how often kswapd was woken for it, and how often it
+ * got all the node's zones above their watermarks at that order.
+ */
+static int kswapd_show(struct seq_file *m, void *arg)
+{
+	pg_data_t *pgdat = (pg_data_t *)arg;
+	int order;
+
+	seq_printf(m, "Node %d, %8s ", pgdat->node_id, "runs");
+	for (order = 0; order < MAX_ORDER; ++order)
+		seq_printf(m, "%6lu ", pgdat->kswapd_order_runs[order]);
+	seq_printf(m, "\nNode %d, %8s ", pgdat->node_id, "ok");
+	for (order = 0; order < MAX_ORDER; ++order)
+		seq_printf(m, "%6lu ", pgdat->kswapd_order_ok[order]);
+	seq_putc(m, '\n');
+	return 0;
+}
+
+struct seq_operations kswapdinfo_op = {
+	.start	= frag_start,
+	.next	= frag_next,
+	.stop	= frag_stop,
+	.show	= kswapd_show,
+};
+
 static char *vmstat_text[] = {
 	"nr_dirty",
 	"nr_writeback",
@@ -1843,11 +1894,14 @@ static char *vmstat_text[] = {
 	"nr_page_table_pages",
 	"nr_mapped",
 	"nr_slab",
+	"nr_anon_huge_pages",
 
 	"pgpgin",
 	"pgpgout",
 	"pswpin",
 	"pswpout",
+	"pswpin_contig",
+	"pswpout_contig",
 	"pgalloc_high",
 
 	"pgalloc_normal",
@@ -1858,6 +1912,7 @@ static char *vmstat_text[] = {
 
 	"pgfault",
 	"pgmajfault",
+	"pgspecfault",
 	"pgrefill_high",
 	"pgrefill_normal",
 	"pgrefill_dma",
@@ -1872,6 +1927,7 @@ static char *vmstat_text[] = {
 	"pgscan_direct_high",
 	"pgscan_direct_normal",
 	"pgscan_direct_dma",
+	"pglumpy",
 	"pginodesteal",
 
 	"slabs_scanned",
@@ -1881,6 +1937,27 @@ static char *vmstat_text[] = {
 	"allocstall",
 
 	"pgrotated",
+
+	"workingset_refault",
+	"workingset_activate",
+
+	"zone_reclaim_success",
+	"zone_reclaim_failed",
+
+	"thp_fault_alloc",
+	"thp_fault_fallback",
+	"thp_collapse_alloc",
+	"thp_split",
+
+	"fork_vma_skip",
+	"fork_ptable_copy",
+	"fork_ptable_skip",
+
+	"vmacache_find_calls",
+	"vmacache_find_hits",
+
+	"unmap_tlb_deferred",
+	"unmap_tlb_flush",
 };
 
 static void *vmstat_start(struct seq_file *m, loff_t *pos)
@@ -2057,6 +2134,37 @@ static void setup_per_zone_pages_min(void)
 	}
 }
 
+/*
+ * The inactive anon list should be big enough that a page has a chance
+ * to be referenced again before it is swapped out.  But on big zones
+ * keeping half of the anon pages inactive means a lot of needless
+ * faults, so let the ratio grow with the square root of the size:
+ *
+ *  zone size    ratio    max inactive anon
+ *     10MB        1         5MB
+ *    100MB        1        50MB
+ *      1GB        3       250MB
+ *     10GB       10       0.9GB
+ *    100GB       31         3GB
+ *      1TB      101        10GB
+ */
+static void setup_per_zone_inactive_ratio(void)
+{
+	struct zone *zone;
+
+	for_each_zone(zone) {
+		unsigned int gb, ratio;
+
+		/* Zone size in gigabytes */
+		gb = zone->present_pages >> (30 - PAGE_SHIFT);
+		ratio = int_sqrt(10 * gb);
+		if (!ratio)
+			ratio = 1;
+
+		zone->inactive_ratio = ratio;
+	}
+}
+
 /*
  * Initialise min_free_kbytes.
  *
@@ -2094,6 +2202,7 @@ static int __init init_per_zone_pages_min(void)
 		min_free_kbytes = 65536;
 	setup_per_zone_pages_min();
 	setup_per_zone_lowmem_reserve();
+	setup_per_zone_inactive_ratio();
 	return 0;
 }
 module_init(init_per_zone_pages_min)
@@ -44,6 +44,25 @@ static struct bio *get_swap_bio(unsigned int __nocast gfp_flags, pgoff_t index,
 	return bio;
 }
 
+/*
+ * Does this swap I/O start where the previous one in the same direction
+ * on the device ended?  pswpin_contig and pswpout_contig against pswpin
+ * and pswpout show how much of the swap traffic is sequential.  Racy,
+ * but it is only statistics.
+ */
+static int swap_io_contiguous(struct bio *bio, pgoff_t index, int rw)
+{
+	swp_entry_t entry = { .val = index, };
+	struct swap_info_struct *sis = get_swap_info_struct(swp_type(entry));
+	sector_t *last;
+	int ret;
+
+	last = (rw & WRITE) ? &sis->last_write_sector : &sis->last_read_sector;
+	ret = (bio->bi_sector == *last + (PAGE_SIZE >> 9));
+	*last = bio->bi_sector;
+	return ret;
+}
+
 static int end_swap_bio_write(struct bio *bio, unsigned int bytes_done, int err)
 {
 	const int uptodate = test_bit(BIO_UPTODATE, &bio->bi_flags);
@@ -84,14 +103,27 @@ static int end_swap_bio_read(struct bio *bio, unsigned int bytes_done, int err)
  */
 int swap_writepage(struct page *page, struct writeback_control *wbc)
 {
-	struct bio *bio;
-	int ret = 0, rw = WRITE;
-
 	if (remove_exclusive_swap_page(page)) {
 		unlock_page(page);
-		goto out;
+		return 0;
+	}
+	if (zswap_store(page) == 0) {
+		/* Kept compressed in memory: nothing to write */
+		unlock_page(page);
+		return 0;
 	}
-	bio = get_swap_bio(GFP_NOIO, page->private, page, end_swap_bio_write);
+	return __swap_writepage(page, wbc);
+}
+
+/*
+ * Write the page to its swap slot on the device.
+ */
+int __swap_writepage(struct page *page, struct writeback_control *wbc)
+{
+	struct bio *bio;
+	int ret = 0, rw = WRITE;
+
+	bio = get_swap_bio(GFP_NOIO, page_private(page), page, end_swap_bio_write);
 	if (bio == NULL) {
 		set_page_dirty(page);
 		unlock_page(page);
@@ -101,6 +133,8 @@ int swap_writepage(struct page *page, struct writeback_control *wbc)
 	if (wbc->sync_mode == WB_SYNC_ALL)
 		rw |= (1 << BIO_RW_SYNC);
 	inc_page_state(pswpout);
+	if (swap_io_contiguous(bio, page_private(page), WRITE))
+		inc_page_state(pswpout_contig);
 	set_page_writeback(page);
 	unlock_page(page);
 	submit_bio(rw, bio);
@@ -115,13 +149,25 @@ int swap_readpage(struct file *file, struct page *page)
 
 	BUG_ON(!PageLocked(page));
 	ClearPageUptodate(page);
-	bio = get_swap_bio(GFP_KERNEL, page->private, page, end_swap_bio_read);
+	ret = zswap_load(page);
+	if (ret != -ENOENT) {
+		if (ret)
+			SetPageError(page);
+		else
+			SetPageUptodate(page);
+		unlock_page(page);
+		goto out;
+	}
+	ret = 0;
+	bio = get_swap_bio(GFP_KERNEL, page_private(page), page, end_swap_bio_read);
 	if (bio == NULL) {
 		unlock_page(page);
 		ret = -ENOMEM;
 		goto out;
 	}
 	inc_page_state(pswpin);
+	if (swap_io_contiguous(bio, page_private(page), READ))
+		inc_page_state(pswpin_contig);
 	submit_bio(READ, bio);
 out:
 	return ret;
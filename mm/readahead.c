@@ -280,7 +280,7 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 			break;
 
 		page = radix_tree_lookup(&mapping->page_tree, page_offset);
-		if (page)
+		if (page && !radix_tree_exceptional_entry(page))
 			continue;
 
 		read_unlock_irq(&mapping->tree_lock);
@@ -32,7 +32,7 @@
  *   page->flags PG_locked (lock_page)
  *     mapping->i_mmap_lock
  *       anon_vma->lock
- *         mm->page_table_lock
+ *         mm->page_table_lock, then pte lock (if split: see pte_lockptr)
  *           zone->lru_lock (in mark_page_accessed)
  *           swap_list_lock (in swap_free etc's swap_info_get)
  *             mmlist_lock (in mmput, drain_mmlist and others)
@@ -52,9 +52,11 @@
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/rmap.h>
+#include <linux/huge_mm.h>
 #include <linux/rcupdate.h>
 
 #include <asm/tlbflush.h>
+#include <asm/tlb.h>
 
 //#define RMAP_DEBUG /* can be enabled only for debugging */
 
@@ -226,7 +228,7 @@ vma_address(struct page *page, struct vm_area_struct *vma)
 
 /*
  * At what user virtual address is page expected in vma? checking that the
- * page matches the vma: currently only used by unuse_process, on anon pages.
+ * page matches the vma: used by unuse_process and by page migration.
  */
 unsigned long page_address_in_vma(struct page *page, struct vm_area_struct *vma)
 {
@@ -235,7 +237,8 @@ unsigned long page_address_in_vma(struct page *page, struct vm_area_struct *vma)
 		    (void *)page->mapping - PAGE_MAPPING_ANON)
 			return -EFAULT;
 	} else if (page->mapping && !(vma->vm_flags & VM_NONLINEAR)) {
-		if (vma->vm_file->f_mapping != page->mapping)
+		if (!vma->vm_file ||
+		    vma->vm_file->f_mapping != page->mapping)
 			return -EFAULT;
 	} else
 		return -EFAULT;
@@ -255,6 +258,7 @@ static int page_referenced_one(struct page *page,
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *pte;
+	spinlock_t *ptl;
 	int referenced = 0;
 
 	if (!get_mm_counter(mm, rss))
@@ -277,6 +281,28 @@ static int page_referenced_one(struct page *page,
 	if (!pmd_present(*pmd))
 		goto out_unlock;
 
+	if (pmd_trans_huge(*pmd)) {
+		/*
+		 * The subpages share the pmd's referenced bit: the first one
+		 * to find it set passes it on to the others as PG_referenced.
+		 */
+		if (huge_pmd_maps_page(*pmd, page)) {
+			if (pmdp_test_and_clear_young(pmd)) {
+				struct page *head = huge_pmd_page(*pmd);
+				int i;
+
+				flush_tlb_page(vma, address);
+				for (i = 0; i < HPAGE_PMD_NR; i++)
+					if (head + i != page)
+						SetPageReferenced(head + i);
+				referenced++;
+			}
+			(*mapcount)--;
+		}
+		goto out_unlock;
+	}
+
+	ptl = pte_ptl_lock(mm, pmd);
 	pte = pte_offset_map(pmd, address);
 	if (!pte_present(*pte))
 		goto out_unmap;
@@ -294,6 +320,7 @@ static int page_referenced_one(struct page *page,
 
 out_unmap:
 	pte_unmap(pte);
+	pte_ptl_unlock(ptl);
 out_unlock:
 	spin_unlock(&mm->page_table_lock);
 out:
@@ -425,7 +452,7 @@ int page_referenced(struct page *page, int is_locked, int ignore_token)
  * @vma:	the vm area in which the mapping is added
  * @address:	the user virtual address mapped
  *
- * The caller needs to hold the mm->page_table_lock.
+ * The caller needs to hold the pte lock.
  */
 void page_add_anon_rmap(struct page *page,
 	struct vm_area_struct *vma, unsigned long address)
@@ -455,7 +482,7 @@ void page_add_anon_rmap(struct page *page,
  * page_add_file_rmap - add pte mapping to a file page
  * @page: the page to add the mapping to
  *
- * The caller needs to hold the mm->page_table_lock.
+ * The caller needs to hold the pte lock.
  */
 void page_add_file_rmap(struct page *page)
 {
@@ -467,11 +494,26 @@ void page_add_file_rmap(struct page *page)
 		inc_page_state(nr_mapped);
 }
 
+#ifdef CONFIG_KSM
+/**
+ * page_add_ksm_rmap - add pte mapping to a KSM page
+ * @page: the page to add the mapping to
+ *
+ * KSM pages have no anon_vma to set up: see mm/ksm.c.
+ * The caller needs to hold the pte lock.
+ */
+void page_add_ksm_rmap(struct page *page)
+{
+	if (atomic_inc_and_test(&page->_mapcount))
+		inc_page_state(nr_mapped);
+}
+#endif
+
 /**
  * page_remove_rmap - take down pte mapping from a page
  * @page: page to remove mapping from
  *
- * Caller needs to hold the mm->page_table_lock.
+ * Caller needs to hold the pte lock.
  */
 void page_remove_rmap(struct page *page)
 {
@@ -494,11 +536,56 @@ void page_remove_rmap(struct page *page)
 	}
 }
 
+#ifdef CONFIG_BATCHED_UNMAP_TLB_FLUSH
+/*
+ * Reclaim sets current->unmap_batch to have try_to_unmap leave the TLB
+ * flushes to it.  A stale entry left cached by another cpu may still be
+ * read through, which is no worse than the read racing with the unmap,
+ * until the page is freed: shrink_list flushes before freeing.  But a
+ * stale entry which is dirty may also be written through, after the
+ * page is written out, and the write lost: so a dirty pte is flushed
+ * before the page goes any further.  A clean entry cannot be written
+ * through: the cpu must set the dirty bit in the pte, and finds it gone.
+ */
+static inline int unmap_batch_active(void)
+{
+	return current->unmap_batch != NULL;
+}
+
+/**
+ * try_to_unmap_flush - flush the TLB entries reclaim has left behind
+ */
+void try_to_unmap_flush(void)
+{
+	struct mmu_unmap_batch *batch = current->unmap_batch;
+
+	if (batch && batch->need_flush) {
+		tlb_unmap_batch_flush(batch);
+		inc_page_state(unmap_tlb_flush);
+	}
+}
+
+/**
+ * try_to_unmap_flush_dirty - flush them if any of the ptes was dirty
+ */
+void try_to_unmap_flush_dirty(void)
+{
+	struct mmu_unmap_batch *batch = current->unmap_batch;
+
+	if (batch && batch->dirty)
+		try_to_unmap_flush();
+}
+#else
+#define unmap_batch_active()			0
+#define tlb_unmap_batch_add(batch, mm, pteval)	do { } while (0)
+#endif
+
 /*
  * Subfunctions of try_to_unmap: try_to_unmap_one called
  * repeatedly from either try_to_unmap_anon or try_to_unmap_file.
  */
-static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma)
+static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
+				int migration)
 {
 	struct mm_struct *mm = vma->vm_mm;
 	unsigned long address;
@@ -506,6 +593,7 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma)
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *pte;
+	spinlock_t *ptl;
 	pte_t pteval;
 	int ret = SWAP_AGAIN;
 
@@ -533,6 +621,13 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma)
 	if (!pmd_present(*pmd))
 		goto out_unlock;
 
+	if (pmd_trans_huge(*pmd)) {
+		if (huge_pmd_maps_page(*pmd, page))
+			ret = SWAP_FAIL;
+		goto out_unlock;
+	}
+
+	ptl = pte_ptl_lock(mm, pmd);
 	pte = pte_offset_map(pmd, address);
 	if (!pte_present(*pte))
 		goto out_unmap;
@@ -544,9 +639,11 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma)
 	 * If the page is mlock()d, we cannot swap it out.
 	 * If it's recently referenced (perhaps page_referenced
 	 * skipped over this mm) then we should reactivate it.
+	 * Neither stops migration, which puts the page back.
 	 */
-	if ((vma->vm_flags & (VM_LOCKED|VM_RESERVED)) ||
-			ptep_clear_flush_young(vma, address, pte)) {
+	if ((vma->vm_flags & VM_RESERVED) ||
+	    (!migration && ((vma->vm_flags & VM_LOCKED) ||
+			ptep_clear_flush_young(vma, address, pte)))) {
 		ret = SWAP_FAIL;
 		goto out_unmap;
 	}
@@ -554,7 +651,7 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma)
 	/*
 	 * Don't pull an anonymous page out from under get_user_pages.
 	 * GUP carefully breaks COW and raises page count (while holding
-	 * page_table_lock, as we have here) to make sure that the page
+	 * the pte lock, as we have here) to make sure that the page
 	 * cannot be freed.  If we unmap that page here, a user write
 	 * access to the virtual address will bring back the page, but
 	 * its raised count will (ironically) be taken to mean it's not
@@ -574,24 +671,39 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma)
 
 	/* Nuke the page table entry. */
 	flush_cache_page(vma, address, page_to_pfn(page));
-	pteval = ptep_clear_flush(vma, address, pte);
+	if (!migration && unmap_batch_active()) {
+		/* Reclaim flushes before the page can be freed */
+		pteval = ptep_get_and_clear(mm, address, pte);
+		tlb_unmap_batch_add(current->unmap_batch, mm, pteval);
+		inc_page_state(unmap_tlb_deferred);
+	} else
+		pteval = ptep_clear_flush(vma, address, pte);
 
 	/* Move the dirty bit to the physical page now the pte is gone. */
 	if (pte_dirty(pteval))
 		set_page_dirty(page);
 
 	if (PageAnon(page)) {
-		swp_entry_t entry = { .val = page->private };
-		/*
-		 * Store the swap location in the pte.
-		 * See handle_pte_fault() ...
-		 */
-		BUG_ON(!PageSwapCache(page));
-		swap_duplicate(entry);
-		if (list_empty(&mm->mmlist)) {
-			spin_lock(&mmlist_lock);
-			list_add(&mm->mmlist, &init_mm.mmlist);
-			spin_unlock(&mmlist_lock);
+		swp_entry_t entry = { .val = page_private(page) };
+
+		if (migration) {
+			/*
+			 * Store the pfn of the page in a migration entry,
+			 * for remove_migration_ptes() to find it by.
+			 */
+			entry = make_migration_entry(page, pte_write(pteval));
+		} else {
+			/*
+			 * Store the swap location in the pte.
+			 * See handle_pte_fault() ...
+			 */
+			BUG_ON(!PageSwapCache(page));
+			swap_duplicate(entry);
+			if (list_empty(&mm->mmlist)) {
+				spin_lock(&mmlist_lock);
+				list_add(&mm->mmlist, &init_mm.mmlist);
+				spin_unlock(&mmlist_lock);
+			}
 		}
 		set_pte_at(mm, address, pte, swp_entry_to_pte(entry));
 		BUG_ON(pte_file(*pte));
@@ -604,6 +716,7 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma)
 
 out_unmap:
 	pte_unmap(pte);
+	pte_ptl_unlock(ptl);
 out_unlock:
 	spin_unlock(&mm->page_table_lock);
 out:
@@ -640,6 +753,7 @@ static void try_to_unmap_cluster(unsigned long cursor,
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *pte;
+	spinlock_t *ptl;
 	pte_t pteval;
 	struct page *page;
 	unsigned long address;
@@ -671,6 +785,7 @@ static void try_to_unmap_cluster(unsigned long cursor,
 	if (!pmd_present(*pmd))
 		goto out_unlock;
 
+	ptl = pte_ptl_lock(mm, pmd);
 	for (pte = pte_offset_map(pmd, address);
 			address < end; pte++, address += PAGE_SIZE) {
 
@@ -708,12 +823,13 @@ static void try_to_unmap_cluster(unsigned long cursor,
 	}
 
 	pte_unmap(pte);
+	pte_ptl_unlock(ptl);
 
 out_unlock:
 	spin_unlock(&mm->page_table_lock);
 }
 
-static int try_to_unmap_anon(struct page *page)
+static int try_to_unmap_anon(struct page *page, int migration)
 {
 	struct anon_vma *anon_vma;
 	struct vm_area_struct *vma;
@@ -724,7 +840,7 @@ static int try_to_unmap_anon(struct page *page)
 		return ret;
 
 	list_for_each_entry(vma, &anon_vma->head, anon_vma_node) {
-		ret = try_to_unmap_one(page, vma);
+		ret = try_to_unmap_one(page, vma, migration);
 		if (ret == SWAP_FAIL || !page_mapped(page))
 			break;
 	}
@@ -735,13 +851,14 @@ static int try_to_unmap_anon(struct page *page)
 /**
  * try_to_unmap_file - unmap file page using the object-based rmap method
  * @page: the page to unmap
+ * @migration: unmapping for migration
  *
  * Find all the mappings of a page using the mapping pointer and the vma chains
  * contained in the address_space struct it points to.
  *
  * This function is only called from try_to_unmap for object-based pages.
  */
-static int try_to_unmap_file(struct page *page)
+static int try_to_unmap_file(struct page *page, int migration)
 {
 	struct address_space *mapping = page->mapping;
 	pgoff_t pgoff = page->index << (PAGE_CACHE_SHIFT - PAGE_SHIFT);
@@ -755,7 +872,7 @@ static int try_to_unmap_file(struct page *page)
 
 	spin_lock(&mapping->i_mmap_lock);
 	vma_prio_tree_foreach(vma, &iter, &mapping->i_mmap, pgoff, pgoff) {
-		ret = try_to_unmap_one(page, vma);
+		ret = try_to_unmap_one(page, vma, migration);
 		if (ret == SWAP_FAIL || !page_mapped(page))
 			goto out;
 	}
@@ -835,6 +952,7 @@ out:
 /**
  * try_to_unmap - try to remove all page table mappings to a page
  * @page: the page to get unmapped
+ * @migration: leave migration entries behind, see mm/migrate.c
  *
  * Tries to remove all the page table entries which are mapping this
  * page, used in the pageout path.  Caller must hold the page lock.
@@ -844,7 +962,7 @@ out:
  * SWAP_AGAIN	- we missed a mapping, try again later
  * SWAP_FAIL	- the page is unswappable
  */
-int try_to_unmap(struct page *page)
+int try_to_unmap(struct page *page, int migration)
 {
 	int ret;
 
@@ -852,11 +970,90 @@ int try_to_unmap(struct page *page)
 	BUG_ON(!PageLocked(page));
 
 	if (PageAnon(page))
-		ret = try_to_unmap_anon(page);
+		ret = try_to_unmap_anon(page, migration);
 	else
-		ret = try_to_unmap_file(page);
+		ret = try_to_unmap_file(page, migration);
 
 	if (!page_mapped(page))
 		ret = SWAP_SUCCESS;
 	return ret;
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Split the huge pmd mapping @page in @vma, if there is one, into the
+ * page table @new.  Returns 1 if @new was used.
+ */
+static int split_huge_pmd_one(struct page *page, struct vm_area_struct *vma,
+			      struct page *new)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long address;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	int split = 0;
+
+	address = vma_address(page, vma);
+	if (address == -EFAULT || !vma_huge_anon(vma))
+		return 0;
+
+	spin_lock(&mm->page_table_lock);
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		goto out_unlock;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		goto out_unlock;
+	pmd = pmd_offset(pud, address);
+	if (pmd_trans_huge(*pmd) && huge_pmd_maps_page(*pmd, page))
+		split = __split_huge_pmd(vma, pmd, address, new);
+out_unlock:
+	spin_unlock(&mm->page_table_lock);
+	return split;
+}
+
+/**
+ * split_huge_page_pmds - split the huge pmds mapping an anonymous page
+ * @page: the locked page reclaim is about to swap out
+ *
+ * try_to_unmap() can only unmap pages mapped by ptes, and an anonymous
+ * page must not go into the swap cache while a huge pmd maps it: so
+ * reclaim splits every huge pmd mapping the page first.  No mmap_sem is
+ * needed for that: a split only ever turns a huge pmd into a page table,
+ * which the fault path and the page table walkers all allow for, and
+ * khugepaged collapses under the page_table_lock taken here too.
+ *
+ * Returns 0, or -ENOMEM if no page table could be allocated.
+ */
+int split_huge_page_pmds(struct page *page)
+{
+	struct anon_vma *anon_vma;
+	struct vm_area_struct *vma;
+	struct page *new;
+	int split;
+
+	BUG_ON(!PageLocked(page));
+
+	/* One page table per huge pmd, allocated outside the locks */
+	do {
+		new = pte_alloc_one(NULL, 0);
+		if (!new)
+			return -ENOMEM;
+		pte_lock_init(new);
+
+		split = 0;
+		anon_vma = page_lock_anon_vma(page);
+		if (anon_vma) {
+			list_for_each_entry(vma, &anon_vma->head, anon_vma_node)
+				if ((split = split_huge_pmd_one(page, vma, new)))
+					break;
+			spin_unlock(&anon_vma->lock);
+		}
+	} while (split);
+
+	pte_lock_deinit(new);
+	pte_free(new);
+	return 0;
+}
+#endif
@@ -73,7 +73,7 @@
 #define BOGO_DIRENT_SIZE 20
 
 /* Keep swapped page count in private field of indirect struct page */
-#define nr_swapped		private
+#define nr_swapped		u.private
 
 /* Flag allocation requirements to shmem_getpage and shmem_swp_alloc */
 enum sgp_type {
@@ -24,6 +24,7 @@
 #include <linux/module.h>
 #include <linux/mm_inline.h>
 #include <linux/buffer_head.h>	/* for try_to_release_page() */
+#include <linux/backing-dev.h>
 #include <linux/module.h>
 #include <linux/percpu_counter.h>
 #include <linux/percpu.h>
@@ -39,7 +40,7 @@ int page_cluster;
 void put_page(struct page *page)
 {
 	if (unlikely(PageCompound(page))) {
-		page = (struct page *)page->private;
+		page = (struct page *)page_private(page);
 		if (put_page_testzero(page)) {
 			void (*dtor)(struct page *page);
 
@@ -86,8 +87,7 @@ int rotate_reclaimable_page(struct page *page)
 	zone = page_zone(page);
 	spin_lock_irqsave(&zone->lru_lock, flags);
 	if (PageLRU(page) && !PageActive(page)) {
-		list_del(&page->lru);
-		list_add_tail(&page->lru, &zone->inactive_list);
+		list_move_tail(&page->lru, &zone->lru[page_lru_base_type(page)]);
 		inc_page_state(pgrotated);
 	}
 	if (!test_clear_page_writeback(page))
@@ -108,6 +108,9 @@ void fastcall activate_page(struct page *page)
 		del_page_from_inactive_list(zone, page);
 		SetPageActive(page);
 		add_page_to_active_list(zone, page);
+		zone->recent_rotated[page_is_file_cache(page)]++;
+		if (page_is_file_cache(page))
+			workingset_activation(page);
 		inc_page_state(pgactivate);
 	}
 	spin_unlock_irq(&zone->lru_lock);
@@ -282,9 +285,26 @@ void __pagevec_release_nonlru(struct pagevec *pvec)
 	pagevec_reinit(pvec);
 }
 
+/*
+ * Choose the LRU lists of a page going onto the LRU (see mm_inline.h).
+ * Page cache pages have ->mapping set by now; a page without one is a
+ * new anonymous page.  tmpfs and ramfs pages cannot be written back to
+ * a file, so they go with the anonymous pages.
+ */
+static inline void set_page_lru_type(struct page *page)
+{
+	struct address_space *mapping = page->mapping;
+
+	if (!mapping || PageAnon(page) || PageSwapCache(page) ||
+	    !mapping_cap_writeback_dirty(mapping))
+		SetPageSwapBacked(page);
+}
+
 /*
  * Add the passed pages to the LRU, then drop the caller's refcount
- * on them.  Reinitialises the caller's pagevec.
+ * on them.  Reinitialises the caller's pagevec.  Pages which
+ * add_to_page_cache() found to be refaulting come with PG_active set,
+ * and go on the active list.
  */
 void __pagevec_lru_add(struct pagevec *pvec)
 {
@@ -301,9 +321,10 @@ void __pagevec_lru_add(struct pagevec *pvec)
 			zone = pagezone;
 			spin_lock_irq(&zone->lru_lock);
 		}
+		set_page_lru_type(page);
 		if (TestSetPageLRU(page))
 			BUG();
-		add_page_to_inactive_list(zone, page);
+		add_page_to_lru_list(zone, page, page_lru(page));
 	}
 	if (zone)
 		spin_unlock_irq(&zone->lru_lock);
@@ -328,6 +349,7 @@ void __pagevec_lru_add_active(struct pagevec *pvec)
 			zone = pagezone;
 			spin_lock_irq(&zone->lru_lock);
 		}
+		set_page_lru_type(page);
 		if (TestSetPageLRU(page))
 			BUG();
 		if (TestSetPageActive(page))
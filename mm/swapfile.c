@@ -8,6 +8,7 @@
 #include <linux/config.h>
 #include <linux/mm.h>
 #include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
 #include <linux/mman.h>
 #include <linux/slab.h>
 #include <linux/kernel_stat.h>
@@ -63,7 +64,7 @@ void swap_unplug_io_fn(struct backing_dev_info *unused_bdi, struct page *page)
 	swp_entry_t entry;
 
 	down_read(&swap_unplug_sem);
-	entry.val = page->private;
+	entry.val = page_private(page);
 	if (PageSwapCache(page)) {
 		struct block_device *bdev = swap_info[swp_type(entry)].bdev;
 		struct backing_dev_info *bdi;
@@ -255,6 +256,7 @@ static int swap_entry_free(struct swap_info_struct *p, unsigned long offset)
 				p->highest_bit = offset;
 			nr_swap_pages++;
 			p->inuse_pages--;
+			zswap_invalidate(p - swap_info, offset);
 		}
 	}
 	return count;
@@ -285,7 +287,7 @@ static int exclusive_swap_page(struct page *page)
 	struct swap_info_struct * p;
 	swp_entry_t entry;
 
-	entry.val = page->private;
+	entry.val = page_private(page);
 	p = swap_info_get(entry);
 	if (p) {
 		/* Is the only swap cache user the cache itself? */
@@ -353,7 +355,7 @@ int remove_exclusive_swap_page(struct page *page)
 	if (page_count(page) != 2) /* 2: us + cache */
 		return 0;
 
-	entry.val = page->private;
+	entry.val = page_private(page);
 	p = swap_info_get(entry);
 	if (!p)
 		return 0;
@@ -363,10 +365,13 @@ int remove_exclusive_swap_page(struct page *page)
 	if (p->swap_map[swp_offset(entry)] == 1) {
 		/* Recheck the page count with the swapcache lock held.. */
 		write_lock_irq(&swapper_space.tree_lock);
-		if ((page_count(page) == 2) && !PageWriteback(page)) {
-			__delete_from_swap_cache(page);
-			SetPageDirty(page);
-			retval = 1;
+		if (page_freeze_refs(page, 2)) {
+			if (!PageWriteback(page)) {
+				__delete_from_swap_cache(page);
+				SetPageDirty(page);
+				retval = 1;
+			}
+			page_unfreeze_refs(page, 2);
 		}
 		write_unlock_irq(&swapper_space.tree_lock);
 	}
@@ -389,6 +394,9 @@ void free_swap_and_cache(swp_entry_t entry)
 	struct swap_info_struct * p;
 	struct page *page = NULL;
 
+	if (is_migration_entry(entry))
+		return;
+
 	p = swap_info_get(entry);
 	if (p) {
 		if (swap_entry_free(p, swp_offset(entry)) == 1)
@@ -440,8 +448,10 @@ static int unuse_pte_range(struct vm_area_struct *vma, pmd_t *pmd,
 				swp_entry_t entry, struct page *page)
 {
 	pte_t *pte;
+	spinlock_t *ptl;
 	pte_t swp_pte = swp_entry_to_pte(entry);
 
+	ptl = pte_ptl_lock(vma->vm_mm, pmd);
 	pte = pte_offset_map(pmd, addr);
 	do {
 		/*
@@ -451,10 +461,12 @@ static int unuse_pte_range(struct vm_area_struct *vma, pmd_t *pmd,
 		if (unlikely(pte_same(*pte, swp_pte))) {
 			unuse_pte(vma, pte, addr, entry, page);
 			pte_unmap(pte);
+			pte_ptl_unlock(ptl);
 			return 1;
 		}
 	} while (pte++, addr += PAGE_SIZE, addr != end);
 	pte_unmap(pte - 1);
+	pte_ptl_unlock(ptl);
 	return 0;
 }
 
@@ -468,6 +480,8 @@ static inline int unuse_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pmd_trans_huge(*pmd))	/* never maps swap cache */
+			continue;
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		if (unuse_pte_range(vma, pmd, addr, next, entry, page))
@@ -1054,7 +1068,7 @@ int page_queue_congested(struct page *page)
 	BUG_ON(!PageLocked(page));	/* It pins the swap_info_struct */
 
 	if (PageSwapCache(page)) {
-		swp_entry_t entry = { .val = page->private };
+		swp_entry_t entry = { .val = page_private(page) };
 		struct swap_info_struct *sis;
 
 		sis = get_swap_info_struct(swp_type(entry));
@@ -1165,6 +1179,7 @@ asmlinkage long sys_swapoff(const char __user * specialfile)
 	swap_device_unlock(p);
 	swap_list_unlock();
 	up(&swapon_sem);
+	zswap_invalidate_area(type);
 	vfree(swap_map);
 	inode = mapping->host;
 	if (S_ISBLK(inode->i_mode)) {
@@ -1604,6 +1619,9 @@ int swap_duplicate(swp_entry_t entry)
 	unsigned long offset, type;
 	int result = 0;
 
+	if (is_migration_entry(entry))
+		return 1;
+
 	type = swp_type(entry);
 	if (type >= nr_swapfiles)
 		goto bad_file;
@@ -42,22 +42,49 @@ static inline void truncate_partial_page(struct page *page, unsigned partial)
  * its lock, b) when a concurrent invalidate_inode_pages got there first and
  * c) when tmpfs swizzles a page between a tmpfs inode and swapper_space.
  */
-static void
-truncate_complete_page(struct address_space *mapping, struct page *page)
+static void truncate_prepare_page(struct page *page)
 {
-	if (page->mapping != mapping)
-		return;
-
 	if (PagePrivate(page))
 		do_invalidatepage(page, 0);
 
 	clear_page_dirty(page);
 	ClearPageUptodate(page);
 	ClearPageMappedToDisk(page);
+}
+
+static void
+truncate_complete_page(struct address_space *mapping, struct page *page)
+{
+	if (page->mapping != mapping)
+		return;
+
+	truncate_prepare_page(page);
 	remove_from_page_cache(page);
 	page_cache_release(page);	/* pagecache ref */
 }
 
+/*
+ * The same for a batch of locked pages which are all still in @mapping:
+ * they leave the radix tree together, a node at a time where their
+ * indices are consecutive.  Unlocks the pages.
+ */
+static void truncate_complete_pages(struct address_space *mapping,
+				struct page **pages, int nr)
+{
+	int i;
+
+	if (!nr)
+		return;
+
+	for (i = 0; i < nr; i++)
+		truncate_prepare_page(pages[i]);
+	remove_from_page_cache_batch(mapping, pages, nr);
+	for (i = 0; i < nr; i++) {
+		page_cache_release(pages[i]);	/* pagecache ref */
+		unlock_page(pages[i]);
+	}
+}
+
 /*
  * This is for invalidate_inode_pages().  That function can be called at
  * any time, and is not supposed to throw away dirty pages.  But pages can
@@ -122,11 +149,14 @@ void truncate_inode_pages(struct address_space *mapping, loff_t lstart)
 	int i;
 
 	if (mapping->nrpages == 0)
-		return;
+		goto shadows;
 
 	pagevec_init(&pvec, 0);
 	next = start;
 	while (pagevec_lookup(&pvec, mapping, next, PAGEVEC_SIZE)) {
+		struct page *locked[PAGEVEC_SIZE];
+		int nr_locked = 0;
+
 		for (i = 0; i < pagevec_count(&pvec); i++) {
 			struct page *page = pvec.pages[i];
 			pgoff_t page_index = page->index;
@@ -136,13 +166,13 @@ void truncate_inode_pages(struct address_space *mapping, loff_t lstart)
 			next++;
 			if (TestSetPageLocked(page))
 				continue;
-			if (PageWriteback(page)) {
+			if (PageWriteback(page) || page->mapping != mapping) {
 				unlock_page(page);
 				continue;
 			}
-			truncate_complete_page(mapping, page);
-			unlock_page(page);
+			locked[nr_locked++] = page;
 		}
+		truncate_complete_pages(mapping, locked, nr_locked);
 		pagevec_release(&pvec);
 		cond_resched();
 	}
@@ -179,6 +209,11 @@ void truncate_inode_pages(struct address_space *mapping, loff_t lstart)
 		}
 		pagevec_release(&pvec);
 	}
+
+shadows:
+	/* The pages are gone: so is any point in knowing when they went */
+	if (mapping->nrshadows)
+		clear_shadow_entries(mapping, start);
 }
 
 EXPORT_SYMBOL(truncate_inode_pages);
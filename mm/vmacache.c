@@ -0,0 +1,90 @@
+/*
+ * mm/vmacache.c - per-task cache of find_vma results
+ *
+ * A single last-result cache per mm is shared by all the threads of a
+ * process, so threads working in different places keep replacing each
+ * other's entry, and a thread alternating between two or three vmas
+ * misses every time.
+ * Each task instead keeps a few vmas of its own mm, hashed by address,
+ * for find_vma to check before walking the rbtree.
+ *
+ * Nothing is done to the caches as vmas go: removing a vma from an mm
+ * bumps mm->vmacache_seqnum, and a task whose vmacache_seqnum no longer
+ * matches its mm's flushes its cache before next using it.  A vma whose
+ * bounds merely change stays valid, find_vma checks the address against
+ * it anyway.  The sequence numbers are read and changed under mmap_sem.
+ */
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/vmacache.h>
+
+/* Neighbouring vmas, mapped a pmd or more apart, share no slot */
+#define VMACACHE_HASH(addr)	(((addr) >> PMD_SHIFT) & (VMACACHE_SIZE - 1))
+
+/*
+ * The sequence number has wrapped: a task which has not looked since
+ * might see its stale one match again, so flush them all.
+ */
+void vmacache_flush_all(struct mm_struct *mm)
+{
+	struct task_struct *g, *p;
+
+	read_lock(&tasklist_lock);
+	do_each_thread(g, p) {
+		if (p->mm == mm)
+			vmacache_flush(p);
+	} while_each_thread(g, p);
+	read_unlock(&tasklist_lock);
+}
+
+/*
+ * Only a task's own mm is cached: find_vma is also used on other tasks'
+ * mms, by ptrace and /proc.  Kernel threads borrowing an mm with use_mm
+ * flush their cache as they take it.
+ */
+static inline int vmacache_valid_mm(struct mm_struct *mm)
+{
+	return current->mm == mm;
+}
+
+static int vmacache_valid(struct mm_struct *mm)
+{
+	struct task_struct *curr = current;
+
+	if (!vmacache_valid_mm(mm))
+		return 0;
+
+	if (mm->vmacache_seqnum != curr->vmacache_seqnum) {
+		/* Something went since we last looked: start again */
+		curr->vmacache_seqnum = mm->vmacache_seqnum;
+		vmacache_flush(curr);
+		return 0;
+	}
+	return 1;
+}
+
+void vmacache_update(unsigned long addr, struct vm_area_struct *newvma)
+{
+	if (vmacache_valid_mm(newvma->vm_mm))
+		current->vmacache[VMACACHE_HASH(addr)] = newvma;
+}
+
+struct vm_area_struct *vmacache_find(struct mm_struct *mm, unsigned long addr)
+{
+	int i;
+
+	inc_page_state(vmacache_find_calls);
+	if (!vmacache_valid(mm))
+		return NULL;
+
+	for (i = 0; i < VMACACHE_SIZE; i++) {
+		struct vm_area_struct *vma = current->vmacache[i];
+
+		if (vma && vma->vm_start <= addr && vma->vm_end > addr) {
+			inc_page_state(vmacache_find_hits);
+			return vma;
+		}
+	}
+	return NULL;
+}
@@ -33,8 +33,11 @@
 #include <linux/cpuset.h>
 #include <linux/notifier.h>
 #include <linux/rwsem.h>
+#include <linux/seq_file.h>
+#include <linux/kallsyms.h>
 
 #include <asm/tlbflush.h>
+#include <asm/tlb.h>
 #include <asm/div64.h>
 
 #include <linux/swapops.h>
@@ -61,19 +64,23 @@ struct scan_control {
 	/* Incremented by the number of pages reclaimed */
 	unsigned long nr_reclaimed;
 
-	unsigned long nr_mapped;	/* From page_state */
-
 	/* How many pages shrink_cache() should reclaim */
 	int nr_to_reclaim;
 
 	/* Ask shrink_caches, or shrink_zone to scan at this priority */
 	unsigned int priority;
 
+	/* The allocation order reclaim is for: see isolate_lru_pages() */
+	int order;
+
 	/* This context's GFP mask */
 	unsigned int gfp_mask;
 
 	int may_writepage;
 
+	/* Can mapped pages be unmapped and anonymous pages be swapped out? */
+	int may_swap;
+
 	/* This context's SWAP_CLUSTER_MAX. If freeing memory for
 	 * suspend, we effectively ignore SWAP_CLUSTER_MAX.
 	 * In this context, it doesn't matter that we scan the
@@ -87,9 +94,19 @@ struct scan_control {
  */
 struct shrinker {
 	shrinker_t		shrinker;
+	node_shrinker_t		node_shrinker;	/* instead of ->shrinker */
 	struct list_head	list;
 	int			seeks;	/* seeks to recreate an obj */
-	long			nr;	/* objs pending delete */
+	int			batch;	/* objs to scan per call */
+
+	/* For /proc/shrinkers: unlocked, so only roughly right */
+	unsigned long		calls;
+	unsigned long		scanned;
+	unsigned long		freed;	/* as the size it reports fell */
+	unsigned long long	ns;	/* time spent in the callback */
+
+	long			nr[0];	/* objs pending delete, per node
+					   for node shrinkers */
 };
 
 #define lru_to_page(_head) (list_entry((_head)->prev, struct page, lru))
@@ -126,31 +143,66 @@ struct shrinker {
  * From 0 .. 100.  Higher means more swappy.
  */
 int vm_swappiness = 60;
-static long total_memory;
 
 static LIST_HEAD(shrinker_list);
 static DECLARE_RWSEM(shrinker_rwsem);
 
+#define SHRINK_BATCH 128
+
+static struct shrinker *alloc_shrinker(int seeks, int batch, int nr_nodes)
+{
+	struct shrinker *shrinker;
+	size_t size = sizeof(*shrinker) + nr_nodes * sizeof(long);
+
+	shrinker = kmalloc(size, GFP_KERNEL);
+	if (shrinker) {
+		memset(shrinker, 0, size);
+		shrinker->seeks = seeks;
+		shrinker->batch = batch ? batch : SHRINK_BATCH;
+	}
+	return shrinker;
+}
+
+static void add_shrinker(struct shrinker *shrinker)
+{
+	down_write(&shrinker_rwsem);
+	list_add_tail(&shrinker->list, &shrinker_list);
+	up_write(&shrinker_rwsem);
+}
+
 /*
  * Add a shrinker callback to be called from the vm
  */
-struct shrinker *set_shrinker(int seeks, shrinker_t theshrinker)
+struct shrinker *set_shrinker(int seeks, int batch, shrinker_t theshrinker)
 {
-        struct shrinker *shrinker;
-
-        shrinker = kmalloc(sizeof(*shrinker), GFP_KERNEL);
-        if (shrinker) {
-	        shrinker->shrinker = theshrinker;
-	        shrinker->seeks = seeks;
-	        shrinker->nr = 0;
-	        down_write(&shrinker_rwsem);
-	        list_add_tail(&shrinker->list, &shrinker_list);
-	        up_write(&shrinker_rwsem);
+	struct shrinker *shrinker;
+
+	shrinker = alloc_shrinker(seeks, batch, 1);
+	if (shrinker) {
+		shrinker->shrinker = theshrinker;
+		add_shrinker(shrinker);
 	}
 	return shrinker;
 }
 EXPORT_SYMBOL(set_shrinker);
 
+/*
+ * Add a shrinker callback for a cache kept per node
+ */
+struct shrinker *set_node_shrinker(int seeks, int batch,
+				node_shrinker_t theshrinker)
+{
+	struct shrinker *shrinker;
+
+	shrinker = alloc_shrinker(seeks, batch, MAX_NUMNODES);
+	if (shrinker) {
+		shrinker->node_shrinker = theshrinker;
+		add_shrinker(shrinker);
+	}
+	return shrinker;
+}
+EXPORT_SYMBOL(set_node_shrinker);
+
 /*
  * Remove one
  */
@@ -163,7 +215,13 @@ void remove_shrinker(struct shrinker *shrinker)
 }
 EXPORT_SYMBOL(remove_shrinker);
 
-#define SHRINK_BATCH 128
+static int do_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	if (shrinker->node_shrinker)
+		return (*shrinker->node_shrinker)(sc);
+	return (*shrinker->shrinker)(sc->nr_to_scan, sc->gfp_mask);
+}
+
 /*
  * Call the shrink functions to age shrinkable caches
  *
@@ -180,11 +238,21 @@ EXPORT_SYMBOL(remove_shrinker);
  * `lru_pages' represents the number of on-LRU pages in all the zones which
  * are eligible for the caller's allocation attempt.  It is used for balancing
  * slab reclaim versus page reclaim.
+ *
+ * `zone' is the zone being reclaimed, or NULL when reclaim is for several
+ * nodes.  Node shrinkers are asked about that zone's node only, and their
+ * pending work is kept per node; the others are always asked about all of
+ * their objects.
  */
 static int shrink_slab(unsigned long scanned, unsigned int gfp_mask,
-			unsigned long lru_pages)
+			unsigned long lru_pages, struct zone *zone)
 {
 	struct shrinker *shrinker;
+	struct shrink_control sc = {
+		.gfp_mask = gfp_mask,
+		.nid = zone ? zone->zone_pgdat->node_id : -1,
+		.zone = zone,
+	};
 
 	if (scanned == 0)
 		scanned = SWAP_CLUSTER_MAX;
@@ -195,36 +263,123 @@ static int shrink_slab(unsigned long scanned, unsigned int gfp_mask,
 	list_for_each_entry(shrinker, &shrinker_list, list) {
 		unsigned long long delta;
 		unsigned long total_scan;
+		long *nr = &shrinker->nr[0];
+		int size;
 
+		if (shrinker->node_shrinker && sc.nid >= 0)
+			nr = &shrinker->nr[sc.nid];
+
+		sc.nr_to_scan = 0;
+		size = do_shrink(shrinker, &sc);
 		delta = (4 * scanned) / shrinker->seeks;
-		delta *= (*shrinker->shrinker)(0, gfp_mask);
+		delta *= size;
 		do_div(delta, lru_pages + 1);
-		shrinker->nr += delta;
-		if (shrinker->nr < 0)
-			shrinker->nr = LONG_MAX;	/* It wrapped! */
+		*nr += delta;
+		if (*nr < 0)
+			*nr = LONG_MAX;	/* It wrapped! */
 
-		total_scan = shrinker->nr;
-		shrinker->nr = 0;
+		total_scan = *nr;
+		*nr = 0;
 
-		while (total_scan >= SHRINK_BATCH) {
-			long this_scan = SHRINK_BATCH;
+		while (total_scan >= shrinker->batch) {
+			unsigned long long start = sched_clock();
 			int shrink_ret;
 
-			shrink_ret = (*shrinker->shrinker)(this_scan, gfp_mask);
+			sc.nr_to_scan = shrinker->batch;
+			shrink_ret = do_shrink(shrinker, &sc);
 			if (shrink_ret == -1)
 				break;
-			mod_page_state(slabs_scanned, this_scan);
-			total_scan -= this_scan;
+			shrinker->ns += sched_clock() - start;
+			shrinker->calls++;
+			shrinker->scanned += sc.nr_to_scan;
+			if (shrink_ret < size)
+				shrinker->freed += size - shrink_ret;
+			size = shrink_ret;
+			mod_page_state(slabs_scanned, sc.nr_to_scan);
+			total_scan -= sc.nr_to_scan;
 
 			cond_resched();
 		}
 
-		shrinker->nr += total_scan;
+		*nr += total_scan;
 	}
 	up_read(&shrinker_rwsem);
 	return 0;
 }
 
+#ifdef CONFIG_PROC_FS
+/*
+ * /proc/shrinkers: what each shrinker has scanned and freed, and how long
+ * its callbacks took, since boot.
+ */
+static void *shrinkers_start(struct seq_file *m, loff_t *pos)
+{
+	struct list_head *p;
+	loff_t n = *pos;
+
+	down_read(&shrinker_rwsem);
+	if (!n)
+		return SEQ_START_TOKEN;
+	list_for_each(p, &shrinker_list) {
+		if (!--n)
+			return list_entry(p, struct shrinker, list);
+	}
+	return NULL;
+}
+
+static void *shrinkers_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct list_head *p = (v == SEQ_START_TOKEN) ? &shrinker_list :
+				&((struct shrinker *)v)->list;
+
+	++*pos;
+	return p->next == &shrinker_list ? NULL :
+		list_entry(p->next, struct shrinker, list);
+}
+
+static void shrinkers_stop(struct seq_file *m, void *v)
+{
+	up_read(&shrinker_rwsem);
+}
+
+static int shrinkers_show(struct seq_file *m, void *v)
+{
+	struct shrinker *shrinker = v;
+	char namebuf[KSYM_NAME_LEN + 1];
+	unsigned long fn, size, offset;
+	unsigned long long us;
+	const char *name;
+	char *modname;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_printf(m, "%-28s %5s %5s %10s %12s %12s %12s\n", "# name",
+			"seeks", "batch", "calls", "scanned", "freed", "usecs");
+		return 0;
+	}
+
+	fn = shrinker->node_shrinker ? (unsigned long)shrinker->node_shrinker :
+			(unsigned long)shrinker->shrinker;
+	name = kallsyms_lookup(fn, &size, &offset, &modname, namebuf);
+	if (name)
+		seq_printf(m, "%-28s", name);
+	else
+		seq_printf(m, "%-28p", (void *)fn);
+	us = shrinker->ns;
+	do_div(us, 1000);
+	seq_printf(m, " %5d %5d %10lu %12lu %12lu %12llu\n", shrinker->seeks,
+		shrinker->batch, shrinker->calls, shrinker->scanned,
+		shrinker->freed, us);
+	return 0;
+}
+
+struct seq_operations shrinkers_op = {
+	.start	= shrinkers_start,
+	.next	= shrinkers_next,
+	.stop	= shrinkers_stop,
+	.show	= shrinkers_show,
+};
+#endif /* CONFIG_PROC_FS */
+
 /* Called without lock on whether page is mapped, so answer is unstable */
 static inline int page_mapping_inuse(struct page *page)
 {
@@ -360,22 +515,74 @@ static pageout_t pageout(struct page *page, struct address_space *mapping)
 	return PAGE_CLEAN;
 }
 
+#ifdef CONFIG_SWAP
+/*
+ * Anonymous pages come off the LRU in eviction order, and add_to_swap()
+ * hands out swap slots in the order it is called.  Sort the anonymous
+ * pages which still need swap by anon_vma and then by index, which for
+ * an anonymous page is its virtual address, so that the pages of one
+ * process which are swapped out together land next to each other in
+ * swap and can be read back together.
+ *
+ * A plain insertion sort: this only runs on batches of SWAP_CLUSTER_MAX.
+ * The page fields are read without the page lock, which is fine for
+ * picking an order.
+ */
+static inline int anon_page_before(struct page *a, struct page *b)
+{
+	if (a->mapping != b->mapping)
+		return (unsigned long)a->mapping < (unsigned long)b->mapping;
+	return a->index < b->index;
+}
+
+static void cluster_anon_pages(struct list_head *page_list)
+{
+	LIST_HEAD(anon);
+	struct page *page, *next, *pos;
+
+	list_for_each_entry_safe(page, next, page_list, lru) {
+		if (!PageAnon(page) || PageSwapCache(page))
+			continue;
+		/* shrink_list takes pages from the tail: keep that end lowest */
+		list_for_each_entry(pos, &anon, lru)
+			if (anon_page_before(pos, page))
+				break;
+		list_move_tail(&page->lru, &pos->lru);
+	}
+	list_splice(&anon, page_list);
+}
+#else
+#define cluster_anon_pages(page_list)	do { } while (0)
+#endif
+
 /*
  * shrink_list adds the number of reclaimed pages to sc->nr_reclaimed
  */
 static int shrink_list(struct list_head *page_list, struct scan_control *sc)
 {
 	LIST_HEAD(ret_pages);
+	LIST_HEAD(free_pages);
 	struct pagevec freed_pvec;
+	struct page *page, *next;
 	int pgactivate = 0;
 	int reclaimed = 0;
+#ifdef CONFIG_BATCHED_UNMAP_TLB_FLUSH
+	struct mmu_unmap_batch batch;
+	/* pageout may allocate, and so reclaim, under us */
+	struct mmu_unmap_batch *saved_batch = current->unmap_batch;
+
+	tlb_unmap_batch_init(&batch);
+	current->unmap_batch = &batch;
+#endif
 
 	cond_resched();
 
-	pagevec_init(&freed_pvec, 1);
+	if (sc->may_swap && total_swap_pages &&
+	    sc->swap_cluster_max <= SWAP_CLUSTER_MAX)
+		cluster_anon_pages(page_list);
+
 	while (!list_empty(page_list)) {
 		struct address_space *mapping;
-		struct page *page;
 		int may_enter_fs;
 		int referenced;
 
@@ -402,12 +609,18 @@ static int shrink_list(struct list_head *page_list, struct scan_control *sc)
 		if (referenced && page_mapping_inuse(page))
 			goto activate_locked;
 
+		if (!sc->may_swap && (page_mapped(page) ||
+				(PageAnon(page) && !PageSwapCache(page))))
+			goto keep_locked;
+
 #ifdef CONFIG_SWAP
 		/*
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
 		 */
 		if (PageAnon(page) && !PageSwapCache(page)) {
+			if (split_huge_page_pmds(page))
+				goto activate_locked;
 			if (!add_to_swap(page))
 				goto activate_locked;
 		}
@@ -422,7 +635,14 @@ static int shrink_list(struct list_head *page_list, struct scan_control *sc)
 		 * processes. Try to unmap it here.
 		 */
 		if (page_mapped(page) && mapping) {
-			switch (try_to_unmap(page)) {
+			int ret = try_to_unmap(page, 0);
+
+			/*
+			 * Another cpu still writing to the page through a
+			 * stale TLB entry would lose its writes to pageout.
+			 */
+			try_to_unmap_flush_dirty();
+			switch (ret) {
 			case SWAP_FAIL:
 				goto activate_locked;
 			case SWAP_AGAIN:
@@ -500,34 +720,50 @@ static int shrink_list(struct list_head *page_list, struct scan_control *sc)
 		 * The non-racy check for busy page.  It is critical to check
 		 * PageDirty _after_ making sure that the page is freeable and
 		 * not in use by anybody. 	(pagecache + us == 2)
+		 * Freezing the count also keeps lockless lookups from taking
+		 * a reference until the page is out of the cache.
 		 */
-		if (page_count(page) != 2 || PageDirty(page)) {
-			write_unlock_irq(&mapping->tree_lock);
-			goto keep_locked;
+		if (!page_freeze_refs(page, 2))
+			goto cannot_free;
+		if (PageDirty(page)) {
+			page_unfreeze_refs(page, 2);
+			goto cannot_free;
 		}
 
 #ifdef CONFIG_SWAP
 		if (PageSwapCache(page)) {
-			swp_entry_t swap = { .val = page->private };
+			swp_entry_t swap = { .val = page_private(page) };
 			__delete_from_swap_cache(page);
+			/* Only our reference is left; the pagecache one went */
+			page_unfreeze_refs(page, 1);
 			write_unlock_irq(&mapping->tree_lock);
 			swap_free(swap);
-			__put_page(page);	/* The pagecache ref */
 			goto free_it;
 		}
 #endif /* CONFIG_SWAP */
 
-		__remove_from_page_cache(page);
+		/*
+		 * A file page leaves a shadow entry behind, which tells
+		 * add_to_page_cache() how long it was gone if it comes back.
+		 */
+		if (page_is_file_cache(page))
+			__remove_from_page_cache_shadow(page,
+					workingset_eviction(page));
+		else
+			__remove_from_page_cache(page);
+		page_unfreeze_refs(page, 1);
 		write_unlock_irq(&mapping->tree_lock);
-		__put_page(page);
 
 free_it:
 		unlock_page(page);
 		reclaimed++;
-		if (!pagevec_add(&freed_pvec, page))
-			__pagevec_release_nonlru(&freed_pvec);
+		list_add(&page->lru, &free_pages);
 		continue;
 
+cannot_free:
+		write_unlock_irq(&mapping->tree_lock);
+		goto keep_locked;
+
 activate_locked:
 		SetPageActive(page);
 		pgactivate++;
@@ -538,6 +774,18 @@ keep:
 		BUG_ON(PageLRU(page));
 	}
 	list_splice(&ret_pages, page_list);
+
+	/* One flush for the whole batch, before any of its pages is freed */
+	try_to_unmap_flush();
+#ifdef CONFIG_BATCHED_UNMAP_TLB_FLUSH
+	current->unmap_batch = saved_batch;
+#endif
+	pagevec_init(&freed_pvec, 1);
+	list_for_each_entry_safe(page, next, &free_pages, lru) {
+		list_del(&page->lru);
+		if (!pagevec_add(&freed_pvec, page))
+			__pagevec_release_nonlru(&freed_pvec);
+	}
 	if (pagevec_count(&freed_pvec))
 		__pagevec_release_nonlru(&freed_pvec);
 	mod_page_state(pgactivate, pgactivate);
@@ -559,17 +807,29 @@ keep:
  * @src:	The LRU list to pull pages off.
  * @dst:	The temp list to put pages on to.
  * @scanned:	The number of pages that were scanned.
+ * @order:	The allocation order reclaim is for.
+ *
+ * For an order above 0 this is "lumpy reclaim": with each page from the
+ * tail of @src it also takes the pages of its naturally aligned block of
+ * 1 << @order pages which are on the same list, so that reclaiming them
+ * together frees a block of the order wanted, where reclaiming pages in
+ * LRU order would free them scattered over the zone.
  *
  * returns how many pages were moved onto *@dst.
  */
 static int isolate_lru_pages(int nr_to_scan, struct list_head *src,
-			     struct list_head *dst, int *scanned)
+			     struct list_head *dst, int *scanned, int order)
 {
 	int nr_taken = 0;
+	int nr_lumpy = 0;
 	struct page *page;
 	int scan = 0;
 
 	while (scan++ < nr_to_scan && !list_empty(src)) {
+		struct zone *zone;
+		unsigned long pfn, end_pfn;
+		int active, file;
+
 		page = lru_to_page(src);
 		prefetchw_prev_lru_page(page, src, flags);
 
@@ -588,20 +848,62 @@ static int isolate_lru_pages(int nr_to_scan, struct list_head *src,
 			list_add(&page->lru, dst);
 			nr_taken++;
 		}
+
+		if (!order)
+			continue;
+
+		zone = page_zone(page);
+		active = PageActive(page);
+		file = page_is_file_cache(page);
+		pfn = page_to_pfn(page);
+		end_pfn = (pfn | ((1UL << order) - 1)) + 1;
+		for (pfn &= ~((1UL << order) - 1); pfn < end_pfn; pfn++) {
+			struct page *cursor_page;
+
+			if (!pfn_valid(pfn))
+				break;
+			cursor_page = pfn_to_page(pfn);
+			if (cursor_page == page)
+				continue;
+			if (unlikely(page_zone(cursor_page) != zone))
+				break;
+			/* Only from this list: the caller accounts by list */
+			if (!PageLRU(cursor_page) ||
+			    !PageActive(cursor_page) != !active ||
+			    page_is_file_cache(cursor_page) != file)
+				continue;
+			if (!TestClearPageLRU(cursor_page))
+				BUG();
+			if (get_page_testone(cursor_page)) {
+				__put_page(cursor_page);
+				SetPageLRU(cursor_page);
+				continue;
+			}
+			list_move(&cursor_page->lru, dst);
+			nr_taken++;
+			nr_lumpy++;
+			scan++;
+		}
 	}
 
+	if (nr_lumpy)
+		mod_page_state(pglumpy, nr_lumpy);
 	*scanned = scan;
 	return nr_taken;
 }
 
 /*
  * shrink_cache() adds the number of pages reclaimed to sc->nr_reclaimed
+ *
+ * It works on the inactive anon list, or on the inactive file list if
+ * @file is set.
  */
-static void shrink_cache(struct zone *zone, struct scan_control *sc)
+static void shrink_cache(struct zone *zone, struct scan_control *sc, int file)
 {
 	LIST_HEAD(page_list);
 	struct pagevec pvec;
 	int max_scan = sc->nr_to_scan;
+	enum lru_list lru = LRU_INACTIVE_ANON + (file ? LRU_FILE : 0);
 
 	pagevec_init(&pvec, 1);
 
@@ -614,9 +916,10 @@ static void shrink_cache(struct zone *zone, struct scan_control *sc)
 		int nr_freed;
 
 		nr_taken = isolate_lru_pages(sc->swap_cluster_max,
-					     &zone->inactive_list,
-					     &page_list, &nr_scan);
-		zone->nr_inactive -= nr_taken;
+					     &zone->lru[lru],
+					     &page_list, &nr_scan, sc->order);
+		zone->nr_lru[lru] -= nr_taken;
+		zone->recent_scanned[file] += nr_taken;
 		zone->pages_scanned += nr_scan;
 		spin_unlock_irq(&zone->lru_lock);
 
@@ -636,16 +939,18 @@ static void shrink_cache(struct zone *zone, struct scan_control *sc)
 
 		spin_lock_irq(&zone->lru_lock);
 		/*
-		 * Put back any unfreeable pages.
+		 * Put back any unfreeable pages.  Those shrink_list() found
+		 * in use count against scanning this type.
 		 */
 		while (!list_empty(&page_list)) {
 			page = lru_to_page(&page_list);
 			if (TestSetPageLRU(page))
 				BUG();
 			list_del(&page->lru);
-			if (PageActive(page))
+			if (PageActive(page)) {
 				add_page_to_active_list(zone, page);
-			else
+				zone->recent_rotated[file]++;
+			} else
 				add_page_to_inactive_list(zone, page);
 			if (!pagevec_add(&pvec, page)) {
 				spin_unlock_irq(&zone->lru_lock);
@@ -675,9 +980,14 @@ done:
  *
  * The downside is that we have to touch page->_count against each page.
  * But we had to alter page->flags anyway.
+ *
+ * It works on the active anon list, or on the active file list if @file
+ * is set.  With the two types on separate lists there is no need to
+ * guess whether mapped pages should be reclaimed: only the ones still
+ * referenced stay active, and count against scanning this type.
  */
 static void
-refill_inactive_zone(struct zone *zone, struct scan_control *sc)
+refill_inactive_zone(struct zone *zone, struct scan_control *sc, int file)
 {
 	int pgmoved;
 	int pgdeactivate = 0;
@@ -688,59 +998,30 @@ refill_inactive_zone(struct zone *zone, struct scan_control *sc)
 	LIST_HEAD(l_active);	/* Pages to go onto the active_list */
 	struct page *page;
 	struct pagevec pvec;
-	int reclaim_mapped = 0;
-	long mapped_ratio;
-	long distress;
-	long swap_tendency;
+	enum lru_list lru = LRU_INACTIVE_ANON + (file ? LRU_FILE : 0);
+	unsigned long rotated = 0;
 
 	lru_add_drain();
 	spin_lock_irq(&zone->lru_lock);
-	pgmoved = isolate_lru_pages(nr_pages, &zone->active_list,
-				    &l_hold, &pgscanned);
+	pgmoved = isolate_lru_pages(nr_pages, &zone->lru[lru + LRU_ACTIVE],
+				    &l_hold, &pgscanned, 0);
 	zone->pages_scanned += pgscanned;
-	zone->nr_active -= pgmoved;
+	zone->nr_lru[lru + LRU_ACTIVE] -= pgmoved;
+	zone->recent_scanned[file] += pgmoved;
 	spin_unlock_irq(&zone->lru_lock);
 
-	/*
-	 * `distress' is a measure of how much trouble we're having reclaiming
-	 * pages.  0 -> no problems.  100 -> great trouble.
-	 */
-	distress = 100 >> zone->prev_priority;
-
-	/*
-	 * The point of this algorithm is to decide when to start reclaiming
-	 * mapped memory instead of just pagecache.  Work out how much memory
-	 * is mapped.
-	 */
-	mapped_ratio = (sc->nr_mapped * 100) / total_memory;
-
-	/*
-	 * Now decide how much we really want to unmap some pages.  The mapped
-	 * ratio is downgraded - just because there's a lot of mapped memory
-	 * doesn't necessarily mean that page reclaim isn't succeeding.
-	 *
-	 * The distress ratio is important - we don't want to start going oom.
-	 *
-	 * A 100% value of vm_swappiness overrides this algorithm altogether.
-	 */
-	swap_tendency = mapped_ratio / 2 + distress + vm_swappiness;
-
-	/*
-	 * Now use this metric to decide whether to start moving mapped memory
-	 * onto the inactive list.
-	 */
-	if (swap_tendency >= 100)
-		reclaim_mapped = 1;
-
 	while (!list_empty(&l_hold)) {
 		cond_resched();
 		page = lru_to_page(&l_hold);
 		list_del(&page->lru);
 		if (page_mapped(page)) {
-			if (!reclaim_mapped ||
-			    (total_swap_pages == 0 && PageAnon(page)) ||
-			    page_referenced(page, 0, sc->priority <= 0)) {
+			if (!sc->may_swap) {
+				list_add(&page->lru, &l_active);
+				continue;
+			}
+			if (page_referenced(page, 0, sc->priority <= 0)) {
 				list_add(&page->lru, &l_active);
+				rotated++;
 				continue;
 			}
 		}
@@ -750,6 +1031,7 @@ refill_inactive_zone(struct zone *zone, struct scan_control *sc)
 	pagevec_init(&pvec, 1);
 	pgmoved = 0;
 	spin_lock_irq(&zone->lru_lock);
+	zone->recent_rotated[file] += rotated;
 	while (!list_empty(&l_inactive)) {
 		page = lru_to_page(&l_inactive);
 		prefetchw_prev_lru_page(page, &l_inactive, flags);
@@ -757,10 +1039,10 @@ refill_inactive_zone(struct zone *zone, struct scan_control *sc)
 			BUG();
 		if (!TestClearPageActive(page))
 			BUG();
-		list_move(&page->lru, &zone->inactive_list);
+		list_move(&page->lru, &zone->lru[lru]);
 		pgmoved++;
 		if (!pagevec_add(&pvec, page)) {
-			zone->nr_inactive += pgmoved;
+			zone->nr_lru[lru] += pgmoved;
 			spin_unlock_irq(&zone->lru_lock);
 			pgdeactivate += pgmoved;
 			pgmoved = 0;
@@ -770,7 +1052,7 @@ refill_inactive_zone(struct zone *zone, struct scan_control *sc)
 			spin_lock_irq(&zone->lru_lock);
 		}
 	}
-	zone->nr_inactive += pgmoved;
+	zone->nr_lru[lru] += pgmoved;
 	pgdeactivate += pgmoved;
 	if (buffer_heads_over_limit) {
 		spin_unlock_irq(&zone->lru_lock);
@@ -785,17 +1067,17 @@ refill_inactive_zone(struct zone *zone, struct scan_control *sc)
 		if (TestSetPageLRU(page))
 			BUG();
 		BUG_ON(!PageActive(page));
-		list_move(&page->lru, &zone->active_list);
+		list_move(&page->lru, &zone->lru[lru + LRU_ACTIVE]);
 		pgmoved++;
 		if (!pagevec_add(&pvec, page)) {
-			zone->nr_active += pgmoved;
+			zone->nr_lru[lru + LRU_ACTIVE] += pgmoved;
 			pgmoved = 0;
 			spin_unlock_irq(&zone->lru_lock);
 			__pagevec_release(&pvec);
 			spin_lock_irq(&zone->lru_lock);
 		}
 	}
-	zone->nr_active += pgmoved;
+	zone->nr_lru[lru + LRU_ACTIVE] += pgmoved;
 	spin_unlock_irq(&zone->lru_lock);
 	pagevec_release(&pvec);
 
@@ -803,51 +1085,144 @@ refill_inactive_zone(struct zone *zone, struct scan_control *sc)
 	mod_page_state(pgdeactivate, pgdeactivate);
 }
 
+/*
+ * The active anon list is only aged while the inactive one is small:
+ * anonymous pages are expensive to get back, and those on the inactive
+ * list are the ones which get a last chance to be referenced.
+ */
+static inline int inactive_anon_is_low(struct zone *zone)
+{
+	return zone->nr_lru[LRU_INACTIVE_ANON] * zone->inactive_ratio <
+		zone->nr_lru[LRU_ACTIVE_ANON];
+}
+
+/*
+ * Decide how much of the anon [0] and file [1] lists of @zone to scan,
+ * in percent.
+ *
+ * Scanning a type costs in proportion to how many of the pages scanned
+ * turn out to be in use and are rotated back onto the active list, so
+ * each type is scanned in proportion to scanned/rotated, weighted with
+ * vm_swappiness for anon and 200 - vm_swappiness for file pages.  Reclaim
+ * then follows whichever type is actually giving up pages, whatever the
+ * size of the other.
+ */
+static void get_scan_ratio(struct zone *zone, struct scan_control *sc,
+			unsigned long *percent)
+{
+	unsigned long anon, file, free;
+	unsigned long anon_prio, file_prio;
+	unsigned long ap, fp;
+
+	/* Without swap space, scanning anonymous pages is pointless */
+	if (!sc->may_swap || nr_swap_pages <= 0) {
+		percent[0] = 0;
+		percent[1] = 100;
+		return;
+	}
+
+	anon = zone->nr_lru[LRU_ACTIVE_ANON] + zone->nr_lru[LRU_INACTIVE_ANON];
+	file = zone->nr_lru[LRU_ACTIVE_FILE] + zone->nr_lru[LRU_INACTIVE_FILE];
+
+	/* Too little page cache left to matter: go for the anon pages */
+	free = zone->free_pages;
+	if (file + free <= zone->pages_high) {
+		percent[0] = 100;
+		percent[1] = 0;
+		return;
+	}
+
+	/*
+	 * Halve the history once a quarter of the lists has been scanned,
+	 * so that it follows the current workload.
+	 */
+	if (unlikely(zone->recent_scanned[0] > anon / 4)) {
+		spin_lock_irq(&zone->lru_lock);
+		zone->recent_scanned[0] /= 2;
+		zone->recent_rotated[0] /= 2;
+		spin_unlock_irq(&zone->lru_lock);
+	}
+
+	if (unlikely(zone->recent_scanned[1] > file / 4)) {
+		spin_lock_irq(&zone->lru_lock);
+		zone->recent_scanned[1] /= 2;
+		zone->recent_rotated[1] /= 2;
+		spin_unlock_irq(&zone->lru_lock);
+	}
+
+	anon_prio = vm_swappiness;
+	file_prio = 200 - vm_swappiness;
+
+	/* The + 1 keep a type with no history from being ignored */
+	ap = (anon_prio + 1) * (zone->recent_scanned[0] + 1);
+	ap /= zone->recent_rotated[0] + 1;
+
+	fp = (file_prio + 1) * (zone->recent_scanned[1] + 1);
+	fp /= zone->recent_rotated[1] + 1;
+
+	percent[0] = 100 * ap / (ap + fp + 1);
+	percent[1] = 100 - percent[0];
+}
+
 /*
  * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
  */
 static void
 shrink_zone(struct zone *zone, struct scan_control *sc)
 {
-	unsigned long nr_active;
-	unsigned long nr_inactive;
+	unsigned long nr[NR_LRU_LISTS];
+	unsigned long percent[2];
+	enum lru_list l;
 
-	/*
-	 * Add one to `nr_to_scan' just to make sure that the kernel will
-	 * slowly sift through the active list.
-	 */
-	zone->nr_scan_active += (zone->nr_active >> sc->priority) + 1;
-	nr_active = zone->nr_scan_active;
-	if (nr_active >= sc->swap_cluster_max)
-		zone->nr_scan_active = 0;
-	else
-		nr_active = 0;
+	get_scan_ratio(zone, sc, percent);
 
-	zone->nr_scan_inactive += (zone->nr_inactive >> sc->priority) + 1;
-	nr_inactive = zone->nr_scan_inactive;
-	if (nr_inactive >= sc->swap_cluster_max)
-		zone->nr_scan_inactive = 0;
-	else
-		nr_inactive = 0;
+	for_each_lru(l) {
+		int file = is_file_lru(l);
+		unsigned long scan;
+
+		scan = zone->nr_lru[l];
+		if (sc->priority) {
+			scan >>= sc->priority;
+			scan = (scan * percent[file]) / 100;
+		}
+		zone->nr_scan[l] += scan;
+		nr[l] = zone->nr_scan[l];
+		if (nr[l] >= sc->swap_cluster_max)
+			zone->nr_scan[l] = 0;
+		else
+			nr[l] = 0;
+	}
 
 	sc->nr_to_reclaim = sc->swap_cluster_max;
 
-	while (nr_active || nr_inactive) {
-		if (nr_active) {
-			sc->nr_to_scan = min(nr_active,
+	/*
+	 * The active file list is always aged along with the inactive
+	 * one; the active anon list only when its inactive list runs low.
+	 */
+	while (nr[LRU_INACTIVE_ANON] || nr[LRU_ACTIVE_FILE] ||
+	       nr[LRU_INACTIVE_FILE]) {
+		for_each_lru(l) {
+			if (!nr[l])
+				continue;
+			sc->nr_to_scan = min(nr[l],
 					(unsigned long)sc->swap_cluster_max);
-			nr_active -= sc->nr_to_scan;
-			refill_inactive_zone(zone, sc);
+			nr[l] -= sc->nr_to_scan;
+			if (!is_active_lru(l))
+				shrink_cache(zone, sc, is_file_lru(l));
+			else if (is_file_lru(l) || inactive_anon_is_low(zone))
+				refill_inactive_zone(zone, sc, is_file_lru(l));
 		}
+		if (sc->nr_to_reclaim <= 0)
+			break;
+	}
 
-		if (nr_inactive) {
-			sc->nr_to_scan = min(nr_inactive,
-					(unsigned long)sc->swap_cluster_max);
-			nr_inactive -= sc->nr_to_scan;
-			shrink_cache(zone, sc);
-			if (sc->nr_to_reclaim <= 0)
-				break;
-		}
+	/*
+	 * Even when no anonymous pages were to be reclaimed, keep some on
+	 * the inactive list, ready for when they are.
+	 */
+	if (sc->may_swap && total_swap_pages && inactive_anon_is_low(zone)) {
+		sc->nr_to_scan = SWAP_CLUSTER_MAX;
+		refill_inactive_zone(zone, sc, 0);
 	}
 
 	throttle_vm_writeout();
@@ -920,6 +1295,8 @@ int try_to_free_pages(struct zone **zones,
 
 	sc.gfp_mask = gfp_mask;
 	sc.may_writepage = 0;
+	sc.may_swap = 1;
+	sc.order = order;
 
 	inc_page_state(allocstall);
 
@@ -930,17 +1307,16 @@ int try_to_free_pages(struct zone **zones,
 			continue;
 
 		zone->temp_priority = DEF_PRIORITY;
-		lru_pages += zone->nr_active + zone->nr_inactive;
+		lru_pages += zone_lru_pages(zone);
 	}
 
 	for (priority = DEF_PRIORITY; priority >= 0; priority--) {
-		sc.nr_mapped = read_page_state(nr_mapped);
 		sc.nr_scanned = 0;
 		sc.nr_reclaimed = 0;
 		sc.priority = priority;
 		sc.swap_cluster_max = SWAP_CLUSTER_MAX;
 		shrink_caches(zones, &sc);
-		shrink_slab(sc.nr_scanned, gfp_mask, lru_pages);
+		shrink_slab(sc.nr_scanned, gfp_mask, lru_pages, NULL);
 		if (reclaim_state) {
 			sc.nr_reclaimed += reclaim_state->reclaimed_slab;
 			reclaim_state->reclaimed_slab = 0;
@@ -1004,6 +1380,11 @@ out:
  * of the number of free pages in the lower zones.  This interoperates with
  * the page allocator fallback scheme to ensure that aging of pages is balanced
  * across the zones.
+ *
+ * Woken for an order above 0, kswapd reclaims lumpily until the zones have
+ * free blocks of that order above their watermarks.  If a pass at every
+ * priority does not get there, it settles for the order-0 watermarks rather
+ * than scanning on for blocks the zones may not be able to give.
  */
 static int balance_pgdat(pg_data_t *pgdat, int nr_pages, int order)
 {
@@ -1014,13 +1395,18 @@ static int balance_pgdat(pg_data_t *pgdat, int nr_pages, int order)
 	int total_scanned, total_reclaimed;
 	struct reclaim_state *reclaim_state = current->reclaim_state;
 	struct scan_control sc;
+	const int wanted_order = order;
+
+	if (nr_pages == 0)
+		pgdat->kswapd_order_runs[order]++;
 
 loop_again:
 	total_scanned = 0;
 	total_reclaimed = 0;
 	sc.gfp_mask = GFP_KERNEL;
 	sc.may_writepage = 0;
-	sc.nr_mapped = read_page_state(nr_mapped);
+	sc.may_swap = 1;
+	sc.order = order;
 
 	inc_page_state(pageoutrun);
 
@@ -1065,7 +1451,7 @@ scan:
 		for (i = 0; i <= end_zone; i++) {
 			struct zone *zone = pgdat->node_zones + i;
 
-			lru_pages += zone->nr_active + zone->nr_inactive;
+			lru_pages += zone_lru_pages(zone);
 		}
 
 		/*
@@ -1100,14 +1486,13 @@ scan:
 			sc.swap_cluster_max = nr_pages? nr_pages : SWAP_CLUSTER_MAX;
 			shrink_zone(zone, &sc);
 			reclaim_state->reclaimed_slab = 0;
-			shrink_slab(sc.nr_scanned, GFP_KERNEL, lru_pages);
+			shrink_slab(sc.nr_scanned, GFP_KERNEL, lru_pages, zone);
 			sc.nr_reclaimed += reclaim_state->reclaimed_slab;
 			total_reclaimed += sc.nr_reclaimed;
 			total_scanned += sc.nr_scanned;
 			if (zone->all_unreclaimable)
 				continue;
-			if (zone->pages_scanned >= (zone->nr_active +
-							zone->nr_inactive) * 4)
+			if (zone->pages_scanned >= zone_lru_pages(zone) * 4)
 				zone->all_unreclaimable = 1;
 			/*
 			 * If we've done a decent amount of scanning and
@@ -1146,12 +1531,37 @@ out:
 	}
 	if (!all_zones_ok) {
 		cond_resched();
+		if (order && priority < 0)
+			order = 0;
 		goto loop_again;
 	}
 
+	if (nr_pages == 0 && order == wanted_order)
+		pgdat->kswapd_order_ok[order]++;
 	return total_reclaimed;
 }
 
+/*
+ * How many kswapd threads to start on each node, "kswapd_threads=" on the
+ * command line.  More than one lets a node with many cpus reclaim in
+ * parallel when its allocators outrun a single thread.
+ */
+static int kswapd_threads = 1;
+
+static int __init kswapd_threads_setup(char *str)
+{
+	kswapd_threads = simple_strtol(str, NULL, 0);
+	if (kswapd_threads < 1)
+		kswapd_threads = 1;
+	if (kswapd_threads > MAX_KSWAPD_THREADS)
+		kswapd_threads = MAX_KSWAPD_THREADS;
+	return 1;
+}
+__setup("kswapd_threads=", kswapd_threads_setup);
+
+/* Serialises kswapd threads registering in their pgdat */
+static DEFINE_SPINLOCK(kswapd_lock);
+
 /*
  * The background pageout daemon, started as a kernel thread
  * from the init process. 
@@ -1175,8 +1585,17 @@ static int kswapd(void *p)
 		.reclaimed_slab = 0,
 	};
 	cpumask_t cpumask;
+	int id;
+
+	spin_lock(&kswapd_lock);
+	id = pgdat->nr_kswapd++;
+	pgdat->kswapd[id] = tsk;
+	spin_unlock(&kswapd_lock);
 
-	daemonize("kswapd%d", pgdat->node_id);
+	if (id)
+		daemonize("kswapd%d.%d", pgdat->node_id, id);
+	else
+		daemonize("kswapd%d", pgdat->node_id);
 	cpumask = node_to_cpumask(pgdat->node_id);
 	if (!cpus_empty(cpumask))
 		set_cpus_allowed(tsk, cpumask);
@@ -1202,7 +1621,9 @@ static int kswapd(void *p)
 		if (current->flags & PF_FREEZE)
 			refrigerator(PF_FREEZE);
 
-		prepare_to_wait(&pgdat->kswapd_wait, &wait, TASK_INTERRUPTIBLE);
+		/* Exclusive: each wakeup gets one more thread reclaiming */
+		prepare_to_wait_exclusive(&pgdat->kswapd_wait, &wait,
+					TASK_INTERRUPTIBLE);
 		new_order = pgdat->kswapd_max_order;
 		pgdat->kswapd_max_order = 0;
 		if (order < new_order) {
@@ -1223,7 +1644,9 @@ static int kswapd(void *p)
 }
 
 /*
- * A zone is low on free memory, so wake its kswapd task to service it.
+ * A zone is low on free memory, so wake one of its node's kswapd threads
+ * to service it.  While the zone stays low, each allocation which finds it
+ * so wakes another, until all of them are reclaiming.
  */
 void wakeup_kswapd(struct zone *zone, int order)
 {
@@ -1272,6 +1695,173 @@ int shrink_all_memory(int nr_pages)
 }
 #endif
 
+#ifdef CONFIG_NUMA
+/*
+ * zone_reclaim_mode: when set, the allocator reclaims from a local zone
+ * which has fallen below its watermark before falling back to another
+ * node.  By default only clean unmapped page cache is reclaimed;
+ * RECLAIM_WRITE also writes dirty pages out and RECLAIM_SWAP also unmaps
+ * and swaps out pages.  See Documentation/sysctl/vm.txt.
+ */
+int zone_reclaim_mode;
+
+/*
+ * Do not try to reclaim a zone again for this long after a pass over it
+ * failed: it is likely still full of pages we are not allowed to touch.
+ */
+#define ZONE_RECLAIM_INTERVAL	(30 * HZ)
+
+/*
+ * A light pass: shrink_zone() at this priority scans 1/16th of the lists.
+ */
+#define ZONE_RECLAIM_PRIORITY	4
+
+/*
+ * Try to free 1 << order pages in @zone without leaving the node.
+ * Returns 1 if enough was reclaimed for the allocation to be retried.
+ */
+int zone_reclaim(struct zone *zone, unsigned int gfp_mask, unsigned int order)
+{
+	struct task_struct *p = current;
+	struct scan_control sc;
+	int nr_pages = 1 << order;
+
+	if (!(gfp_mask & __GFP_WAIT) || (p->flags & PF_MEMALLOC))
+		return 0;
+
+	/* Reclaiming a remote zone costs more than allocating from it */
+	if (zone->zone_pgdat != NODE_DATA(numa_node_id()))
+		return 0;
+
+	if (zone->all_unreclaimable)
+		return 0;
+
+	if (zone->last_unsuccessful_zone_reclaim &&
+	    time_before(jiffies, zone->last_unsuccessful_zone_reclaim +
+			ZONE_RECLAIM_INTERVAL))
+		return 0;
+
+	/* Without RECLAIM_WRITE, may_enter_fs keeps dirty pages off disk */
+	sc.gfp_mask = gfp_mask;
+	if (!(zone_reclaim_mode & RECLAIM_WRITE))
+		sc.gfp_mask &= ~(__GFP_IO | __GFP_FS);
+	sc.may_writepage = !!(zone_reclaim_mode & RECLAIM_WRITE);
+	sc.may_swap = !!(zone_reclaim_mode & RECLAIM_SWAP);
+	sc.order = order;
+	sc.nr_scanned = 0;
+	sc.nr_reclaimed = 0;
+	sc.priority = ZONE_RECLAIM_PRIORITY;
+	sc.swap_cluster_max = max(nr_pages, SWAP_CLUSTER_MAX);
+
+	cond_resched();
+	p->flags |= PF_MEMALLOC;
+	shrink_zone(zone, &sc);
+	p->flags &= ~PF_MEMALLOC;
+
+	if (sc.nr_reclaimed >= nr_pages) {
+		inc_page_state(zone_reclaim_success);
+		return 1;
+	}
+
+	inc_page_state(zone_reclaim_failed);
+	zone->last_unsuccessful_zone_reclaim = jiffies;
+	return 0;
+}
+#endif
+
+#ifdef CONFIG_CPUSET_MEMCTL
+/*
+ * Reclaim what can be reclaimed of @pages, for a memory controller group
+ * over its limit: see mm/memctl.c.  The caller holds a reference on each
+ * page, which is dropped.  The group chose them, so they go through
+ * shrink_list() as inactive pages whichever zone LRU list they are taken
+ * off; those still referenced are activated.  Returns the number freed.
+ */
+int shrink_pages(struct page **pages, int nr_pages, unsigned int gfp_mask,
+		 int priority)
+{
+	struct task_struct *p = current;
+	LIST_HEAD(page_list);
+	struct pagevec pvec;
+	struct scan_control sc;
+	struct zone *zone = NULL;
+	struct page *page;
+	int nr_freed;
+	int i;
+
+	pagevec_init(&pvec, 1);
+
+	lru_add_drain();
+	for (i = 0; i < nr_pages; i++) {
+		struct zone *pagezone;
+
+		page = pages[i];
+		pagezone = page_zone(page);
+		if (pagezone != zone) {
+			if (zone)
+				spin_unlock_irq(&zone->lru_lock);
+			zone = pagezone;
+			spin_lock_irq(&zone->lru_lock);
+		}
+		/* Our reference becomes the isolation reference */
+		if (TestClearPageLRU(page)) {
+			del_page_from_lru(zone, page);
+			list_add(&page->lru, &page_list);
+		} else if (!pagevec_add(&pvec, page)) {
+			spin_unlock_irq(&zone->lru_lock);
+			__pagevec_release(&pvec);
+			spin_lock_irq(&zone->lru_lock);
+		}
+	}
+	if (zone)
+		spin_unlock_irq(&zone->lru_lock);
+	pagevec_release(&pvec);
+
+	if (list_empty(&page_list))
+		return 0;
+
+	sc.gfp_mask = gfp_mask;
+	sc.may_writepage = priority < DEF_PRIORITY - 2;
+	sc.may_swap = 1;
+	sc.order = 0;
+	sc.nr_scanned = 0;
+	sc.nr_reclaimed = 0;
+	sc.priority = priority;
+	sc.swap_cluster_max = SWAP_CLUSTER_MAX;
+
+	p->flags |= PF_MEMALLOC;
+	nr_freed = shrink_list(&page_list, &sc);
+	p->flags &= ~PF_MEMALLOC;
+
+	zone = NULL;
+	while (!list_empty(&page_list)) {
+		struct zone *pagezone;
+
+		page = lru_to_page(&page_list);
+		pagezone = page_zone(page);
+		if (pagezone != zone) {
+			if (zone)
+				spin_unlock_irq(&zone->lru_lock);
+			zone = pagezone;
+			spin_lock_irq(&zone->lru_lock);
+		}
+		if (TestSetPageLRU(page))
+			BUG();
+		list_del(&page->lru);
+		add_page_to_lru_list(zone, page, page_lru(page));
+		if (!pagevec_add(&pvec, page)) {
+			spin_unlock_irq(&zone->lru_lock);
+			__pagevec_release(&pvec);
+			spin_lock_irq(&zone->lru_lock);
+		}
+	}
+	if (zone)
+		spin_unlock_irq(&zone->lru_lock);
+	pagevec_release(&pvec);
+	return nr_freed;
+}
+#endif
+
 #ifdef CONFIG_HOTPLUG_CPU
 /* It's optimal to keep kswapds on the same CPUs as their memory, but
    not required for correctness.  So if the last cpu in a node goes
@@ -1284,12 +1874,16 @@ static int __devinit cpu_callback(struct notifier_block *nfb,
 	pg_data_t *pgdat;
 	cpumask_t mask;
 
+	int i;
+
 	if (action == CPU_ONLINE) {
 		for_each_pgdat(pgdat) {
 			mask = node_to_cpumask(pgdat->node_id);
-			if (any_online_cpu(mask) != NR_CPUS)
-				/* One of our CPUs online: restore mask */
-				set_cpus_allowed(pgdat->kswapd, mask);
+			if (any_online_cpu(mask) == NR_CPUS)
+				continue;
+			/* One of our CPUs online: restore mask */
+			for (i = 0; i < pgdat->nr_kswapd; i++)
+				set_cpus_allowed(pgdat->kswapd[i], mask);
 		}
 	}
 	return NOTIFY_OK;
@@ -1299,11 +1893,16 @@ static int __devinit cpu_callback(struct notifier_block *nfb,
 static int __init kswapd_init(void)
 {
 	pg_data_t *pgdat;
+	int i, nr;
+
 	swap_setup();
-	for_each_pgdat(pgdat)
-		pgdat->kswapd
-		= find_task_by_pid(kernel_thread(kswapd, pgdat, CLONE_KERNEL));
-	total_memory = nr_free_pagecache_pages();
+	for_each_pgdat(pgdat) {
+		/* No more threads than the node has cpus to run them */
+		nr = cpus_weight(node_to_cpumask(pgdat->node_id));
+		nr = max(1, min(nr, kswapd_threads));
+		for (i = 0; i < nr; i++)
+			kernel_thread(kswapd, pgdat, CLONE_KERNEL);
+	}
 	hotcpu_notifier(cpu_callback, 0);
 	return 0;
 }
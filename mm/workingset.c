@@ -0,0 +1,171 @@
+/*
+ * mm/workingset.c - working set detection for the page cache
+ *
+ * Reclaim only sees how a page cache page was used while it is in
+ * memory.  A page read once by a streaming read bigger than memory and
+ * a page of a working set a little bigger than the inactive file list
+ * look the same to it: both go off the inactive list before they are
+ * touched a second time, so the working set never reaches the active
+ * list and is thrown out by the stream.
+ *
+ * So when shrink_list() evicts a page cache page it leaves a shadow
+ * entry in the page's slot of the mapping's radix tree, recording the
+ * page's zone and that zone's inactive_age.  inactive_age counts the
+ * evictions and activations, the events which move the pages of the
+ * inactive file list on.  When the page is faulted back in, the number
+ * of those events since its eviction - the refault distance - is how
+ * many more inactive slots it would have needed to stay in memory until
+ * it was used again.  Those could only have come out of the active list,
+ * so when the distance is no more than the size of the active file list
+ * the page is activated straight away, to compete with the active pages
+ * for the memory it should have had.  Pages of a stream are not read
+ * again, and never get there.
+ *
+ * Shadow entries go with truncation, or when their inode is freed, or a
+ * stretch at a time when a mapping has more of them than can be of use.
+ */
+
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/mmzone.h>
+#include <linux/radix-tree.h>
+#include <linux/swap.h>
+
+/*
+ * A shadow entry is the eviction counter, then the page's zone_table
+ * index, over the bits of an exceptional radix tree entry.  Eviction
+ * counters lose their top bits to that: refault distances are taken
+ * modulo what is left.
+ */
+#define NODEZONE_BITS	(MAX_NODES_SHIFT + MAX_ZONES_SHIFT)
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + NODEZONE_BITS)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+/* Below this many shadow entries a mapping is not worth checking */
+#define MIN_SHADOWS	1024
+
+/* Indices whose shadows are dropped at a time when there are too many */
+#define SHADOW_TRIM_SPAN	256
+
+static void *pack_shadow(unsigned long eviction, struct page *page)
+{
+	eviction = (eviction << NODEZONE_BITS) |
+		NODEZONE(page_to_nid(page), page_zonenum(page));
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT) |
+		RADIX_TREE_EXCEPTIONAL_ENTRY;
+	return (void *)eviction;
+}
+
+static struct zone *unpack_shadow(void *shadow, unsigned long *eviction)
+{
+	unsigned long entry = (unsigned long)shadow;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	*eviction = entry >> NODEZONE_BITS;
+	return zone_table[entry & ((1UL << NODEZONE_BITS) - 1)];
+}
+
+/**
+ * workingset_eviction - note the eviction of a page cache page
+ * @page: the page being evicted
+ *
+ * Returns the shadow entry to leave in the page's slot.  Called with
+ * the mapping's tree_lock held, interrupts off.
+ */
+void *workingset_eviction(struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	spin_lock(&zone->lru_lock);
+	eviction = ++zone->inactive_age;
+	spin_unlock(&zone->lru_lock);
+	return pack_shadow(eviction, page);
+}
+
+/*
+ * A refaulting page is only activated if fewer pages than its zone has
+ * on the active file list were evicted or activated while it was out,
+ * so no more of a mapping's shadow entries than there are active file
+ * pages can still be of use.  That limit is refreshed once a second.
+ */
+static unsigned long shadow_limit;
+static unsigned long shadow_limit_stamp;
+
+static unsigned long max_shadows(void)
+{
+	if (!shadow_limit || time_after(jiffies, shadow_limit_stamp + HZ)) {
+		unsigned long active = 0;
+		struct zone *zone;
+
+		for_each_zone(zone)
+			active += zone->nr_lru[LRU_ACTIVE_FILE];
+		shadow_limit = max(active, (unsigned long)MIN_SHADOWS);
+		shadow_limit_stamp = jiffies;
+	}
+	return shadow_limit;
+}
+
+/**
+ * workingset_trim_shadows - keep a mapping's shadow entries in bounds
+ * @mapping: the mapping a page is being evicted from
+ *
+ * Without a limit a stream through a file much bigger than memory would
+ * leave a shadow entry behind for every page it read, pinning radix
+ * tree nodes for all of them.  Past the limit each eviction drops the
+ * shadows of one stretch of SHADOW_TRIM_SPAN indices, working through
+ * the file from the start, where a stream's oldest ones are.  Called
+ * with the mapping's tree_lock held, interrupts off, so the work done
+ * is bounded.
+ */
+void workingset_trim_shadows(struct address_space *mapping)
+{
+	pgoff_t first = mapping->shadow_trim;
+	pgoff_t end;
+
+	if (mapping->nrshadows < MIN_SHADOWS ||
+	    mapping->nrshadows <= max_shadows())
+		return;
+	end = (i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1) >>
+							PAGE_CACHE_SHIFT;
+	if (first >= end)
+		first = 0;
+	mapping->nrshadows -= radix_tree_delete_exceptional(&mapping->page_tree,
+					first, first + SHADOW_TRIM_SPAN - 1);
+	mapping->shadow_trim = first + SHADOW_TRIM_SPAN;
+}
+
+/**
+ * workingset_refault - a page is coming back in over its shadow entry
+ * @shadow: the shadow entry its eviction left
+ *
+ * Returns 1 if the page was evicted recently enough to go straight onto
+ * the active list.
+ */
+int workingset_refault(void *shadow)
+{
+	struct zone *zone;
+	unsigned long eviction, refault, distance;
+
+	zone = unpack_shadow(shadow, &eviction);
+	refault = zone->inactive_age;
+	distance = (refault - eviction) & EVICTION_MASK;
+
+	inc_page_state(workingset_refault);
+	if (distance > zone->nr_lru[LRU_ACTIVE_FILE])
+		return 0;
+	inc_page_state(workingset_activate);
+	return 1;
+}
+
+/**
+ * workingset_activation - note a page cache page going onto the active list
+ * @page: the page
+ *
+ * Called with the zone's lru_lock held.
+ */
+void workingset_activation(struct page *page)
+{
+	page_zone(page)->inactive_age++;
+}
@@ -0,0 +1,483 @@
+/*
+ * mm/zswap.c - compressed cache in front of the swap devices
+ *
+ * swap_writepage() offers each page to zswap_store() before writing it:
+ * the page is deflated into a per-cpu buffer and, if it shrank to at
+ * most ZSWAP_MAX_STORED bytes, copied into the pool and never written.
+ * swap_readpage() gets it back from zswap_load(), which drops it from
+ * the pool: the page stays dirty in the swap cache, so reclaim stores
+ * it again if it is evicted once more.  An entry goes when its swap
+ * slot is freed.
+ *
+ * The pool is the compressed pages in kmalloc'ed entries, indexed by
+ * swap offset in a radix tree per swap area and kept in age order on
+ * one LRU.  Past 7/8 of vm.zswap_max_pool_percent of RAM the oldest
+ * entries are decompressed and written to their swap slots by a work
+ * item; a full pool sends new pages straight to the device.
+ *
+ * Everything is under zswap_lock: the critical sections are short and
+ * the compression itself is done outside it.
+ */
+
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/writeback.h>
+#include <linux/radix-tree.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/zlib.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/file.h>
+#include <linux/init.h>
+
+/* Fast rather than small: raw deflate over a window of one 4k page */
+#define ZSWAP_LEVEL		Z_BEST_SPEED
+#define ZSWAP_WINBITS		12
+#define ZSWAP_MEMLEVEL		8
+
+int zswap_max_pool_percent = 20;
+
+struct zswap_entry {
+	struct list_head lru;		/* on zswap_lru, oldest first */
+	unsigned int type;
+	pgoff_t offset;
+	unsigned int length;
+	unsigned char data[0];
+};
+
+/*
+ * An entry must fit in half a page of kmalloc, header and all, or it
+ * would sit in a slab of its own size and save next to nothing.
+ */
+#define ZSWAP_MAX_STORED	(PAGE_SIZE / 2 - sizeof(struct zswap_entry))
+
+/*
+ * Not GFP_ATOMIC: the store is only an optimisation, and must not dig
+ * into the reserves that interrupts and the swap-out itself depend on.
+ */
+#define ZSWAP_GFP		(__GFP_NORETRY | __GFP_NOWARN)
+
+struct zswap_area {
+	struct radix_tree_root tree;
+	unsigned long stored;		/* pages in the pool */
+	unsigned long stored_bytes;	/* and their compressed size */
+	unsigned long stores;
+	unsigned long loads;
+	unsigned long poor_compression;	/* rejected: compressed too little */
+	unsigned long pool_full;	/* rejected: pool at its limit */
+	unsigned long written_back;	/* aged out to the swap device */
+};
+
+static struct zswap_area zswap_areas[MAX_SWAPFILES];
+static LIST_HEAD(zswap_lru);
+static unsigned long zswap_pool_bytes;
+static DEFINE_SPINLOCK(zswap_lock);
+static int zswap_ready;
+
+struct zswap_cpu {
+	struct z_stream_s comp;
+	struct z_stream_s decomp;
+	unsigned char *buffer;
+};
+
+static DEFINE_PER_CPU(struct zswap_cpu, zswap_cpu);
+
+static void zswap_writeback_work(void *unused);
+static DECLARE_WORK(zswap_writeback, zswap_writeback_work, NULL);
+
+static inline unsigned long zswap_pool_pages(void)
+{
+	return zswap_pool_bytes >> PAGE_SHIFT;
+}
+
+static inline unsigned long zswap_pool_limit(void)
+{
+	return totalram_pages / 100 * zswap_max_pool_percent;
+}
+
+static void zswap_free_entry(struct zswap_entry *entry)
+{
+	struct zswap_area *area = &zswap_areas[entry->type];
+
+	radix_tree_delete(&area->tree, entry->offset);
+	list_del(&entry->lru);
+	area->stored--;
+	area->stored_bytes -= entry->length;
+	zswap_pool_bytes -= ksize(entry);
+	kfree(entry);
+}
+
+/* Entries in the pool, for one pass over the LRU */
+static unsigned long zswap_nr_stored(void)
+{
+	unsigned long nr = 0;
+	int type;
+
+	for (type = 0; type < MAX_SWAPFILES; type++)
+		nr += zswap_areas[type].stored;
+	return nr;
+}
+
+static int zswap_compress(struct zswap_cpu *z, struct page *page,
+				unsigned int *length)
+{
+	struct z_stream_s *stream = &z->comp;
+	void *src;
+	int ret;
+
+	if (zlib_deflateReset(stream) != Z_OK)
+		return -EINVAL;
+
+	src = kmap_atomic(page, KM_USER0);
+	stream->next_in = src;
+	stream->avail_in = PAGE_SIZE;
+	stream->next_out = z->buffer;
+	stream->avail_out = ZSWAP_MAX_STORED;
+	ret = zlib_deflate(stream, Z_FINISH);
+	kunmap_atomic(src, KM_USER0);
+
+	if (ret != Z_STREAM_END)
+		return -E2BIG;
+	*length = stream->total_out;
+	return 0;
+}
+
+static int zswap_decompress(struct zswap_cpu *z, struct zswap_entry *entry,
+				struct page *page)
+{
+	struct z_stream_s *stream = &z->decomp;
+	void *dst;
+	int ret;
+
+	if (zlib_inflateReset(stream) != Z_OK)
+		return -EINVAL;
+
+	dst = kmap_atomic(page, KM_USER0);
+	stream->next_in = entry->data;
+	stream->avail_in = entry->length;
+	stream->next_out = dst;
+	stream->avail_out = PAGE_SIZE;
+	ret = zlib_inflate(stream, Z_SYNC_FLUSH);
+	/*
+	 * zlib sometimes wants to taste an extra byte in raw deflate mode,
+	 * see crypto/deflate.c.
+	 */
+	if (ret == Z_OK && !stream->avail_in && stream->avail_out) {
+		u8 zerostuff = 0;
+		stream->next_in = &zerostuff;
+		stream->avail_in = 1;
+		ret = zlib_inflate(stream, Z_FINISH);
+	}
+	kunmap_atomic(dst, KM_USER0);
+
+	if (ret != Z_STREAM_END || stream->total_out != PAGE_SIZE)
+		return -EIO;
+	return 0;
+}
+
+/*
+ * Called by swap_writepage() with the page locked in the swap cache.
+ * Returns 0 if the page is now held in the pool and need not be written.
+ */
+int zswap_store(struct page *page)
+{
+	swp_entry_t swp = { .val = page_private(page), };
+	struct zswap_area *area = &zswap_areas[swp_type(swp)];
+	struct zswap_entry *entry, *old;
+	unsigned int length;
+	unsigned long limit;
+	int ret;
+
+	if (!zswap_ready || !zswap_max_pool_percent)
+		return -ENODEV;
+
+	limit = zswap_pool_limit();
+	if (zswap_pool_pages() >= limit - limit / 8)
+		schedule_work(&zswap_writeback);
+	if (zswap_pool_pages() >= limit) {
+		area->pool_full++;
+		return -ENOSPC;
+	}
+
+	/* This also disables preemption for the per-cpu buffers below */
+	if (radix_tree_preload(GFP_NOIO))
+		return -ENOMEM;
+
+	ret = zswap_compress(&__get_cpu_var(zswap_cpu), page, &length);
+	if (ret) {
+		area->poor_compression++;
+		goto out;
+	}
+
+	ret = -ENOMEM;
+	entry = kmalloc(sizeof(*entry) + length, ZSWAP_GFP);
+	if (!entry)
+		goto out;
+	entry->type = swp_type(swp);
+	entry->offset = swp_offset(swp);
+	entry->length = length;
+	memcpy(entry->data, __get_cpu_var(zswap_cpu).buffer, length);
+
+	spin_lock(&zswap_lock);
+	old = radix_tree_lookup(&area->tree, entry->offset);
+	if (old)
+		zswap_free_entry(old);
+	ret = radix_tree_insert(&area->tree, entry->offset, entry);
+	if (ret) {
+		spin_unlock(&zswap_lock);
+		kfree(entry);
+		goto out;
+	}
+	list_add_tail(&entry->lru, &zswap_lru);
+	area->stored++;
+	area->stored_bytes += length;
+	area->stores++;
+	zswap_pool_bytes += ksize(entry);
+	spin_unlock(&zswap_lock);
+out:
+	radix_tree_preload_end();
+	return ret;
+}
+
+/*
+ * Called by swap_readpage() with the page locked in the swap cache.
+ * Returns -ENOENT if the page is not in the pool and must be read from
+ * the device.
+ */
+int zswap_load(struct page *page)
+{
+	swp_entry_t swp = { .val = page_private(page), };
+	struct zswap_area *area = &zswap_areas[swp_type(swp)];
+	struct zswap_entry *entry;
+	int ret;
+
+	if (!area->stored)
+		return -ENOENT;
+
+	spin_lock(&zswap_lock);
+	entry = radix_tree_lookup(&area->tree, swp_offset(swp));
+	if (!entry) {
+		spin_unlock(&zswap_lock);
+		return -ENOENT;
+	}
+	/* Take it out of the pool: the page in the swap cache replaces it */
+	radix_tree_delete(&area->tree, entry->offset);
+	list_del(&entry->lru);
+	area->stored--;
+	area->stored_bytes -= entry->length;
+	area->loads++;
+	zswap_pool_bytes -= ksize(entry);
+	spin_unlock(&zswap_lock);
+
+	ret = zswap_decompress(&get_cpu_var(zswap_cpu), entry, page);
+	put_cpu_var(zswap_cpu);
+	if (ret)
+		printk(KERN_ERR "zswap: corrupt entry %u:%lu\n",
+				entry->type, (unsigned long)entry->offset);
+	else
+		SetPageDirty(page);
+	kfree(entry);
+	return ret;
+}
+
+/*
+ * The swap slot has been freed: drop its copy.  Called under the swap
+ * area's sdev_lock.
+ */
+void zswap_invalidate(unsigned type, pgoff_t offset)
+{
+	struct zswap_area *area = &zswap_areas[type];
+	struct zswap_entry *entry;
+
+	if (!area->stored)
+		return;
+
+	spin_lock(&zswap_lock);
+	entry = radix_tree_lookup(&area->tree, offset);
+	if (entry)
+		zswap_free_entry(entry);
+	spin_unlock(&zswap_lock);
+}
+
+/*
+ * swapoff: try_to_unuse() has brought everything back, but leave
+ * nothing behind for the next user of the area, and reset its counters.
+ */
+void zswap_invalidate_area(unsigned type)
+{
+	struct zswap_area *area = &zswap_areas[type];
+	struct zswap_entry *entry, *next;
+
+	spin_lock(&zswap_lock);
+	list_for_each_entry_safe(entry, next, &zswap_lru, lru)
+		if (entry->type == type)
+			zswap_free_entry(entry);
+	area->stores = 0;
+	area->loads = 0;
+	area->poor_compression = 0;
+	area->pool_full = 0;
+	area->written_back = 0;
+	spin_unlock(&zswap_lock);
+}
+
+/*
+ * Age out one entry: read it back into the swap cache, which takes it
+ * out of the pool, and write the page to its slot on the device.  If
+ * the page was in the swap cache already it may be clean, the pool
+ * holding its only copy: drop that and write the page all the same.
+ */
+static int zswap_writeback_entry(unsigned type, pgoff_t offset)
+{
+	swp_entry_t swp = swp_entry(type, offset);
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+	struct page *page;
+
+	page = read_swap_cache_async(swp, NULL, 0);
+	if (!page)
+		return -ENOMEM;
+
+	lock_page(page);
+	if (PageSwapCache(page) && page_private(page) == swp.val &&
+	    !PageWriteback(page)) {
+		zswap_invalidate(type, offset);
+		SetPageDirty(page);
+		clear_page_dirty_for_io(page);
+		/* __swap_writepage unlocks the page */
+		__swap_writepage(page, &wbc);
+		zswap_areas[type].written_back++;
+	} else
+		unlock_page(page);
+	page_cache_release(page);
+	return 0;
+}
+
+static void zswap_writeback_work(void *unused)
+{
+	struct zswap_entry *entry;
+	unsigned long target, nr;
+	unsigned type;
+	pgoff_t offset;
+
+	/* At most one pass: entries that could not go are retried later */
+	target = zswap_pool_limit() / 4 * 3;
+	spin_lock(&zswap_lock);
+	nr = zswap_nr_stored();
+	spin_unlock(&zswap_lock);
+	while (nr-- && zswap_pool_pages() > target) {
+		spin_lock(&zswap_lock);
+		if (list_empty(&zswap_lru)) {
+			spin_unlock(&zswap_lock);
+			break;
+		}
+		entry = list_entry(zswap_lru.next, struct zswap_entry, lru);
+		type = entry->type;
+		offset = entry->offset;
+		/* Don't come back to it at once if the writeback fails */
+		list_move_tail(&entry->lru, &zswap_lru);
+		spin_unlock(&zswap_lock);
+
+		if (zswap_writeback_entry(type, offset))
+			break;
+		cond_resched();
+	}
+}
+
+#ifdef CONFIG_PROC_FS
+static int zswap_show(struct seq_file *m, void *v)
+{
+	struct swap_info_struct *p;
+	struct zswap_area *area;
+	unsigned type;
+
+	seq_printf(m, "Pool: %lu kB of %lu kB\n",
+			zswap_pool_bytes >> 10,
+			zswap_pool_limit() << (PAGE_SHIFT - 10));
+	seq_printf(m, "Filename\t\t\t\tStored\tBytes\tStores\tLoads\t"
+			"Poor\tFull\tWritten\n");
+
+	swap_list_lock();
+	for (type = 0; type < nr_swapfiles; type++) {
+		p = swap_info + type;
+		area = zswap_areas + type;
+		if (!(p->flags & SWP_USED) || !p->swap_file)
+			continue;
+		seq_path(m, p->swap_file->f_vfsmnt, p->swap_file->f_dentry,
+				" \t\n\\");
+		seq_printf(m, "\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n",
+				area->stored, area->stored_bytes,
+				area->stores, area->loads,
+				area->poor_compression, area->pool_full,
+				area->written_back);
+	}
+	swap_list_unlock();
+	return 0;
+}
+
+static int zswap_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zswap_show, NULL);
+}
+
+static struct file_operations proc_zswap_operations = {
+	.open		= zswap_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif
+
+static int __init zswap_init_cpu(struct zswap_cpu *z)
+{
+	z->buffer = kmalloc(ZSWAP_MAX_STORED, GFP_KERNEL);
+	z->comp.workspace = vmalloc(zlib_deflate_workspacesize());
+	z->decomp.workspace = vmalloc(zlib_inflate_workspacesize());
+	if (!z->buffer || !z->comp.workspace || !z->decomp.workspace)
+		return -ENOMEM;
+	memset(z->comp.workspace, 0, zlib_deflate_workspacesize());
+	memset(z->decomp.workspace, 0, zlib_inflate_workspacesize());
+
+	if (zlib_deflateInit2(&z->comp, ZSWAP_LEVEL, Z_DEFLATED,
+			-ZSWAP_WINBITS, ZSWAP_MEMLEVEL,
+			Z_DEFAULT_STRATEGY) != Z_OK)
+		return -EINVAL;
+	if (zlib_inflateInit2(&z->decomp, -ZSWAP_WINBITS) != Z_OK)
+		return -EINVAL;
+	return 0;
+}
+
+static int __init zswap_init(void)
+{
+	int type, cpu;
+
+	for (type = 0; type < MAX_SWAPFILES; type++)
+		INIT_RADIX_TREE(&zswap_areas[type].tree, GFP_ATOMIC);
+
+	for_each_cpu(cpu) {
+		if (zswap_init_cpu(&per_cpu(zswap_cpu, cpu))) {
+			printk(KERN_WARNING "zswap: no memory for cpu %d "
+					"buffers, disabled\n", cpu);
+			return 0;
+		}
+	}
+	zswap_ready = 1;
+
+#ifdef CONFIG_PROC_FS
+	{
+		struct proc_dir_entry *entry;
+
+		entry = create_proc_entry("zswap", 0, NULL);
+		if (entry)
+			entry->proc_fops = &proc_zswap_operations;
+	}
+#endif
+	return 0;
+}
+__initcall(zswap_init);